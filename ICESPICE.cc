@@ -67,8 +67,8 @@ int main(int argc,char** argv) {
   G4VisManager* visManager = new G4VisExecutive;
   visManager->Initialize();
 
-  //Initialize G4 kernel
-  runManager->Initialize();
+  //The G4 kernel is initialized by /run/initialize in the macro, so that
+  //the /ICESPICE/Detector/ commands before it apply to the geometry and field
 
   // get the pointer to the User Interface manager
   G4UImanager* UImanager = G4UImanager::GetUIpointer();
@@ -39,6 +39,7 @@
 
 class BuiltInReader;
 class CADMeshTemplate;
+class FastReader;
 class Mesh;
 class STLReader;
 class ASSIMPReader;
@@ -100,14 +101,22 @@ namespace CADMesh {
 
 typedef std::vector<G4ThreeVector> Points;
 typedef std::vector<G4TriangularFacet *> Triangles;
+typedef std::vector<size_t> Indices;
 
 class Mesh {
 public:
   Mesh(Points points, Triangles triangles, G4String name = "");
 
+  // An indexed mesh: three indices into points per triangle. Its triangles
+  // are only made when GetTriangles is called.
+  Mesh(Points points, Indices indices, G4String name = "");
+
   static std::shared_ptr<Mesh> New(Points points, Triangles triangles,
                                    G4String name = "");
 
+  static std::shared_ptr<Mesh> New(Points points, Indices indices,
+                                   G4String name = "");
+
   static std::shared_ptr<Mesh> New(Triangles triangles, G4String name = "");
 
   static std::shared_ptr<Mesh> New(std::shared_ptr<Mesh> mesh,
@@ -118,13 +127,24 @@ public:
   Points GetPoints();
   Triangles GetTriangles();
 
+  // Empty unless the mesh is indexed
+  const Indices &GetIndices();
+  G4bool IsIndexed();
+  size_t GetNumberOfTriangles();
+
+  // Checked once and remembered. SetValidForNavigation records the result
+  // of an earlier check, such as one stored in a mesh cache.
   G4bool IsValidForNavigation();
+  void SetValidForNavigation(G4bool valid);
 
 private:
   G4String name_ = "";
 
   Points points_;
   Triangles triangles_;
+  Indices indices_;
+
+  G4int valid_for_navigation_ = -1; // not checked yet
 };
 
 typedef std::vector<std::shared_ptr<Mesh>> Meshes;
@@ -353,9 +373,21 @@ std::shared_ptr<BuiltInReader> BuiltIn();
 #endif
 
 #include "G4AssemblyVolume.hh"
+#include "G4Box.hh"
+#include "G4DisplacedSolid.hh"
+#include "G4ExtrudedSolid.hh"
 #include "G4LogicalVolume.hh"
 #include "G4Material.hh"
+#include "G4SystemOfUnits.hh"
 #include "G4TessellatedSolid.hh"
+#include "G4Tubs.hh"
+
+#include <array>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <unordered_map>
 #include "G4Tet.hh"
 #include "G4UIcommand.hh"
 
@@ -454,6 +486,9 @@ void ReaderCantReadError(G4String origin, File::Type file_type,
 
 void MeshNotFound(G4String origin, size_t index);
 void MeshNotFound(G4String origin, G4String name);
+
+void MeshNotValid(G4String origin, G4String filepath, G4String name);
+void CacheNotWritten(G4String origin, G4String filepath);
 }
 }
 
@@ -466,6 +501,7 @@ public:
   G4VSolid *GetSolid();
   G4VSolid *GetSolid(G4int index);
   G4VSolid *GetSolid(G4String name, G4bool exact = true);
+  G4VSolid *GetSolid(std::shared_ptr<Mesh> mesh);
 
   std::vector<G4VSolid *> GetSolids();
 
@@ -474,6 +510,23 @@ public:
   G4TessellatedSolid *GetTessellatedSolid(G4String name, G4bool exact = true);
   G4TessellatedSolid *GetTessellatedSolid(std::shared_ptr<Mesh> mesh);
 
+  // A G4Box, G4Tubs or G4ExtrudedSolid for a mesh that is a box, a
+  // cylinder or a prism within the primitive tolerance, or nullptr. It is
+  // placed in a G4DisplacedSolid if its axes are not those of the file.
+  G4VSolid *GetPrimitiveSolid(std::shared_ptr<Mesh> mesh);
+
+  // The mesh with repeated points welded, then decimated by edge collapses
+  // while its surface stays within tolerance (in the units of the solid)
+  // of the original. Collapses of least quadric error go first, so points
+  // inside flat regions and along their straight edges, which cost
+  // nothing, are merged away before any curved surface is coarsened. The
+  // distance is checked both ways, from points a quarter of an edge apart
+  // on each original facet to the new surface and from points an eighth
+  // of an edge apart on each new facet to the original. GetSimplification
+  // then gives the facet counts and the largest distance found.
+  std::shared_ptr<Mesh> SimplifyMesh(std::shared_ptr<Mesh> mesh,
+                                     G4double tolerance);
+
   G4AssemblyVolume *GetAssembly();
 
 public:
@@ -481,8 +534,50 @@ public:
 
   G4bool GetReverse() { return this->reverse_; };
 
+  // GetSolid, GetSolids and GetAssembly return primitive solids where
+  // there are any, unless this is turned off
+  void SetPrimitives(G4bool primitives) { this->primitives_ = primitives; };
+
+  G4bool GetPrimitives() { return this->primitives_; };
+
+  // Largest distance allowed between the facets and the primitive surface
+  void SetPrimitiveTolerance(G4double tolerance) {
+    this->primitive_tolerance_ = tolerance;
+  };
+
+  G4double GetPrimitiveTolerance() { return this->primitive_tolerance_; };
+
+  // Tessellated solids are made from meshes simplified to this tolerance
+  // by SimplifyMesh. 0, the default, leaves the meshes as read.
+  void SetSimplifyTolerance(G4double tolerance) {
+    this->simplify_tolerance_ = tolerance;
+  };
+
+  G4double GetSimplifyTolerance() { return this->simplify_tolerance_; };
+
+  struct Simplification {
+    size_t facets_before = 0;
+    size_t facets_after = 0;
+    G4double max_deviation = 0;
+  };
+
+  // Of the last mesh simplified
+  Simplification GetSimplification() { return this->simplification_; };
+
 private:
+  G4VSolid *GetPrismSolid(G4String name, const Points &points,
+                          const Indices &indices, G4ThreeVector axis);
+
+  // The points of the facets of mesh once each, placed as in
+  // GetTessellatedSolid if place is set, and three indices per facet
+  void WeldMesh(std::shared_ptr<Mesh> mesh, G4bool place, Points &points,
+                Indices &indices);
+
   G4bool reverse_;
+  G4bool primitives_ = true;
+  G4double primitive_tolerance_ = 0.01 * mm;
+  G4double simplify_tolerance_ = 0;
+  Simplification simplification_;
 };
 }
 
@@ -570,6 +665,14 @@ inline std::shared_ptr<Mesh> Mesh::New(Points points, Triangles triangles,
   return std::make_shared<Mesh>(points, triangles, name);
 }
 
+inline Mesh::Mesh(Points points, Indices indices, G4String name)
+    : name_(name), points_(std::move(points)), indices_(std::move(indices)) {}
+
+inline std::shared_ptr<Mesh> Mesh::New(Points points, Indices indices,
+                                       G4String name) {
+  return std::make_shared<Mesh>(std::move(points), std::move(indices), name);
+}
+
 inline std::shared_ptr<Mesh> Mesh::New(Triangles triangles, G4String name) {
   Points points;
 
@@ -578,6 +681,10 @@ inline std::shared_ptr<Mesh> Mesh::New(Triangles triangles, G4String name) {
 
 inline std::shared_ptr<Mesh> Mesh::New(std::shared_ptr<Mesh> mesh,
                                        G4String name) {
+  if (mesh->IsIndexed()) {
+    return New(mesh->GetPoints(), mesh->GetIndices(), name);
+  }
+
   return New(mesh->GetPoints(), mesh->GetTriangles(), name);
 }
 
@@ -585,9 +692,35 @@ inline G4String Mesh::GetName() { return name_; }
 
 inline Points Mesh::GetPoints() { return points_; }
 
-inline Triangles Mesh::GetTriangles() { return triangles_; }
+inline Triangles Mesh::GetTriangles() {
+  if (triangles_.empty()) {
+    for (size_t i = 0; i + 2 < indices_.size(); i += 3) {
+      triangles_.push_back(new G4TriangularFacet(
+          points_[indices_[i]], points_[indices_[i + 1]],
+          points_[indices_[i + 2]], ABSOLUTE));
+    }
+  }
+
+  return triangles_;
+}
+
+inline const Indices &Mesh::GetIndices() { return indices_; }
+
+inline G4bool Mesh::IsIndexed() { return !indices_.empty(); }
+
+inline size_t Mesh::GetNumberOfTriangles() {
+  return IsIndexed() ? indices_.size() / 3 : triangles_.size();
+}
+
+inline void Mesh::SetValidForNavigation(G4bool valid) {
+  valid_for_navigation_ = valid;
+}
 
 inline G4bool Mesh::IsValidForNavigation() {
+  if (valid_for_navigation_ >= 0) {
+    return valid_for_navigation_;
+  }
+
   std::map<G4ThreeVector, size_t> point_index;
 
   size_t index = 0;
@@ -599,12 +732,23 @@ inline G4bool Mesh::IsValidForNavigation() {
   typedef std::pair<size_t, size_t> Edge;
   std::map<Edge, G4int> edge_use_count;
 
-  for (size_t i = 0; i < triangles_.size(); i++) {
-    auto triangle = triangles_[i];
+  for (size_t i = 0; i < GetNumberOfTriangles(); i++) {
+    size_t a, b, c;
+
+    // Points repeated in an indexed mesh count as one
+    if (IsIndexed()) {
+      a = point_index[points_[indices_[3 * i]]];
+      b = point_index[points_[indices_[3 * i + 1]]];
+      c = point_index[points_[indices_[3 * i + 2]]];
+    }
+
+    else {
+      auto triangle = triangles_[i];
 
-    size_t a = point_index[triangle->GetVertex(0)];
-    size_t b = point_index[triangle->GetVertex(1)];
-    size_t c = point_index[triangle->GetVertex(2)];
+      a = point_index[triangle->GetVertex(0)];
+      b = point_index[triangle->GetVertex(1)];
+      c = point_index[triangle->GetVertex(2)];
+    }
 
     if (a < b) {
       edge_use_count[Edge(a, b)] += 1;
@@ -631,13 +775,15 @@ inline G4bool Mesh::IsValidForNavigation() {
     }
   }
 
+  valid_for_navigation_ = true;
+
   for (auto count : edge_use_count) {
     if (count.second != 2) {
-      return false;
+      valid_for_navigation_ = false;
     }
   }
 
-  return true;
+  return valid_for_navigation_;
 }
 }
 
@@ -1261,6 +1407,21 @@ inline void MeshNotFound(G4String origin, G4String name) {
       ("CADMesh in " + origin).c_str(), "MeshNotFound", FatalException,
       ("\nThe mesh with name '" + name + "' could not be found.").c_str());
 }
+
+inline void MeshNotValid(G4String origin, G4String filepath, G4String name) {
+  G4Exception(("CADMesh in " + origin).c_str(), "MeshNotValid", JustWarning,
+              ("\nThe mesh '" + name + "' in the file:\n\t" + filepath +
+               "\nis not closed; navigation in it may fail.")
+                  .c_str());
+}
+
+inline void CacheNotWritten(G4String origin, G4String filepath) {
+  G4Exception(("CADMesh in " + origin).c_str(), "CacheNotWritten", JustWarning,
+              ("\nThe mesh cache:\n\t" + filepath +
+               "\ncould not be written; the file will be read again on the "
+               "next run.")
+                  .c_str());
+}
 }
 }
 
@@ -1268,23 +1429,31 @@ inline void MeshNotFound(G4String origin, G4String name) {
 
 namespace CADMesh {
 
-inline G4VSolid *TessellatedMesh::GetSolid() {
-  return (G4VSolid *)GetTessellatedSolid();
-}
+inline G4VSolid *TessellatedMesh::GetSolid() { return GetSolid(0); }
 
 inline G4VSolid *TessellatedMesh::GetSolid(G4int index) {
-  return (G4VSolid *)GetTessellatedSolid(index);
+  return GetSolid(reader_->GetMesh(index));
 }
 
 inline G4VSolid *TessellatedMesh::GetSolid(G4String name, G4bool exact) {
-  return (G4VSolid *)GetTessellatedSolid(name, exact);
+  return GetSolid(reader_->GetMesh(name, exact));
+}
+
+inline G4VSolid *TessellatedMesh::GetSolid(std::shared_ptr<Mesh> mesh) {
+  if (primitives_) {
+    if (auto solid = GetPrimitiveSolid(mesh)) {
+      return solid;
+    }
+  }
+
+  return (G4VSolid *)GetTessellatedSolid(mesh);
 }
 
 inline std::vector<G4VSolid *> TessellatedMesh::GetSolids() {
   std::vector<G4VSolid *> solids;
 
   for (auto mesh : reader_->GetMeshes()) {
-    solids.push_back(GetTessellatedSolid(mesh));
+    solids.push_back(GetSolid(mesh));
   }
 
   return solids;
@@ -1296,7 +1465,7 @@ inline G4AssemblyVolume *TessellatedMesh::GetAssembly() {
   }
 
   for (auto mesh : reader_->GetMeshes()) {
-    auto solid = GetTessellatedSolid(mesh);
+    auto solid = GetSolid(mesh);
 
     G4Material *material = nullptr;
 
@@ -1327,21 +1496,50 @@ inline G4TessellatedSolid *TessellatedMesh::GetTessellatedSolid(G4String name,
 
 inline G4TessellatedSolid *
 TessellatedMesh::GetTessellatedSolid(std::shared_ptr<Mesh> mesh) {
+  if (simplify_tolerance_ > 0) {
+    mesh = SimplifyMesh(mesh, simplify_tolerance_);
+  }
+
   auto volume_solid = new G4TessellatedSolid(mesh->GetName());
 
-  for (auto triangle : mesh->GetTriangles()) {
-    auto a = triangle->GetVertex(0) * scale_ + offset_;
-    auto b = triangle->GetVertex(1) * scale_ + offset_;
-    auto c = triangle->GetVertex(2) * scale_ + offset_;
+  // Indexed meshes are placed once per point, and each triangle made once
+  if (mesh->IsIndexed()) {
+    auto points = mesh->GetPoints();
+    for (auto &point : points) {
+      point = point * scale_ + offset_;
+    }
+
+    auto &indices = mesh->GetIndices();
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      auto &a = points[indices[i]];
+      auto &b = points[indices[i + 1]];
+      auto &c = points[indices[i + 2]];
 
-    auto t = new G4TriangularFacet(a, b, c, ABSOLUTE);
+      if (reverse_) {
+        volume_solid->AddFacet(new G4TriangularFacet(a, c, b, ABSOLUTE));
+      }
 
-    if (reverse_) {
-      volume_solid->AddFacet((G4VFacet *)t->GetFlippedFacet());
+      else {
+        volume_solid->AddFacet(new G4TriangularFacet(a, b, c, ABSOLUTE));
+      }
     }
+  }
 
-    else {
-      volume_solid->AddFacet((G4VFacet *)t);
+  else {
+    for (auto triangle : mesh->GetTriangles()) {
+      auto a = triangle->GetVertex(0) * scale_ + offset_;
+      auto b = triangle->GetVertex(1) * scale_ + offset_;
+      auto c = triangle->GetVertex(2) * scale_ + offset_;
+
+      auto t = new G4TriangularFacet(a, b, c, ABSOLUTE);
+
+      if (reverse_) {
+        volume_solid->AddFacet((G4VFacet *)t->GetFlippedFacet());
+      }
+
+      else {
+        volume_solid->AddFacet((G4VFacet *)t);
+      }
     }
   }
 
@@ -1354,1246 +1552,3134 @@ TessellatedMesh::GetTessellatedSolid(std::shared_ptr<Mesh> mesh) {
   }
   return volume_solid;
 }
-}
 
-#ifdef USE_CADMESH_TETGEN
+inline G4VSolid *
+TessellatedMesh::GetPrimitiveSolid(std::shared_ptr<Mesh> mesh) {
+  if (!mesh->IsValidForNavigation()) {
+    return nullptr;
+  }
 
-namespace CADMesh {
+  Points points;
+  Indices indices;
+  WeldMesh(mesh, true, points, indices);
+
+  auto normal = [&](size_t t) {
+    auto &a = points[indices[3 * t]];
+    return (points[indices[3 * t + 1]] - a)
+        .cross(points[indices[3 * t + 2]] - a);
+  };
+
+  // The sides of a prism are parallel to its axis and its caps normal to
+  // it, so the axis is the normal of the largest facet, of the largest
+  // facet not parallel to that one, or normal to both
+  size_t largest = 0;
+  for (size_t t = 1; t < indices.size() / 3; t++) {
+    if (normal(t).mag2() > normal(largest).mag2()) {
+      largest = t;
+    }
+  }
 
-inline TetrahedralMesh::TetrahedralMesh() {}
+  auto first = normal(largest).unit();
+  G4ThreeVector second;
+  G4double second_area = 0;
 
-inline TetrahedralMesh::~TetrahedralMesh() {}
+  for (size_t t = 0; t < indices.size() / 3; t++) {
+    auto n = normal(t);
 
-inline G4VSolid *TetrahedralMesh::GetSolid() { return GetSolid(0); }
+    if (n.mag() > second_area && n.unit().cross(first).mag() > 1e-6) {
+      second = n.unit();
+      second_area = n.mag();
+    }
+  }
 
-inline G4VSolid *TetrahedralMesh::GetSolid(G4int /*index*/) { return nullptr; }
+  std::vector<G4ThreeVector> axes = {first};
+  if (second_area > 0) {
+    axes.push_back(second);
+    axes.push_back(first.cross(second).unit());
+  }
 
-inline G4VSolid *TetrahedralMesh::GetSolid(G4String /*name*/,
-                                           G4bool /*exact*/) {
+  for (auto axis : axes) {
+    if (auto solid = GetPrismSolid(mesh->GetName(), points, indices, axis)) {
+      return solid;
+    }
+  }
 
   return nullptr;
 }
 
-inline std::vector<G4VSolid *> TetrahedralMesh::GetSolids() {
+inline G4VSolid *TessellatedMesh::GetPrismSolid(G4String name,
+                                                const Points &points,
+                                                const Indices &indices,
+                                                G4ThreeVector w) {
+  const G4double tolerance = primitive_tolerance_;
 
-  return std::vector<G4VSolid *>();
-}
+  // Axes of the file where they fit, so that the solid needs no rotation
+  const G4ThreeVector coordinates[3] = {G4ThreeVector(1, 0, 0),
+                                        G4ThreeVector(0, 1, 0),
+                                        G4ThreeVector(0, 0, 1)};
 
-inline G4AssemblyVolume *TetrahedralMesh::GetAssembly() {
-  if (assembly_) {
-    return assembly_;
+  size_t nearest = 0, farthest = 0;
+  for (size_t i = 1; i < 3; i++) {
+    if (std::abs(w[i]) > std::abs(w[nearest]))
+      nearest = i;
+    if (std::abs(w[i]) < std::abs(w[farthest]))
+      farthest = i;
   }
 
-  assembly_ = new G4AssemblyVolume();
-
-  in_ = std::make_shared<tetgenio>();
-  out_ = std::make_shared<tetgenio>();
-
-  char *fn = (char *)file_name_.c_str();
+  if (w[nearest] < 0) {
+    w = -w;
+  }
 
-  G4bool do_tet = true;
+  G4ThreeVector u, v;
 
-  if (file_type_ == File::STL) {
-    in_->load_stl(fn);
+  if (1 - w[nearest] < 1e-12) {
+    w = coordinates[nearest];
+    u = coordinates[(nearest + 1) % 3];
+    v = coordinates[(nearest + 2) % 3];
   }
 
-  else if (file_type_ == File::PLY) {
-    in_->load_ply(fn);
+  else {
+    u = coordinates[farthest].cross(w).unit();
+    v = w.cross(u);
   }
 
-  else if (file_type_ == File::TET) {
-    out_->load_tetmesh(fn, 0);
-    do_tet = false;
-  }
+  // Every point is on one of the two caps
+  G4double low = std::numeric_limits<G4double>::max();
+  G4double high = -low;
 
-  else if (file_type_ == File::OFF) {
-    out_->load_off(fn);
-    do_tet = false;
+  for (auto &point : points) {
+    low = std::min(low, w.dot(point));
+    high = std::max(high, w.dot(point));
   }
 
-  if (do_tet) {
-    tetgenbehavior *behavior = new tetgenbehavior();
-    behavior->nobisect = 1;
-    behavior->plc = 1;
-    behavior->quality = quality_;
-
-    tetrahedralize(behavior, in_.get(), out_.get());
+  G4double height = high - low;
+  if (height <= tolerance) {
+    return nullptr;
   }
 
-  G4RotationMatrix *element_rotation = new G4RotationMatrix();
-  G4ThreeVector element_position = G4ThreeVector();
-  G4Transform3D assembly_transform = G4Translate3D();
+  std::vector<G4int> level(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    G4double h = w.dot(points[i]);
 
-  for (int i = 0; i < out_->numberoftetrahedra; i++) {
-    int index_offset = i * 4;
+    if (h - low <= tolerance) {
+      level[i] = 0;
+    }
 
-    G4ThreeVector p1 = GetTetPoint(index_offset);
-    G4ThreeVector p2 = GetTetPoint(index_offset + 1);
-    G4ThreeVector p3 = GetTetPoint(index_offset + 2);
-    G4ThreeVector p4 = GetTetPoint(index_offset + 3);
+    else if (high - h <= tolerance) {
+      level[i] = 1;
+    }
 
-    G4String tet_name =
-        file_name_ + G4String("_tet_") + G4UIcommand::ConvertToString(i);
+    else {
+      return nullptr;
+    }
+  }
 
-    auto tet_solid =
-        new G4Tet(tet_name + G4String("_solid"), p1, p2, p3, p4, 0);
+  // Cap facets lie on one cap, and seen along the axis the side facets
+  // have no area
+  typedef std::pair<size_t, size_t> Edge;
+  std::map<Edge, G4int> cap_edges[2];
+  G4double volume = 0;
+
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    size_t corner[3] = {indices[i], indices[i + 1], indices[i + 2]};
+    auto &a = points[corner[0]];
+    auto &b = points[corner[1]];
+    auto &c = points[corner[2]];
+
+    volume += a.dot(b.cross(c));
+
+    if (level[corner[0]] == level[corner[1]] &&
+        level[corner[1]] == level[corner[2]]) {
+      for (G4int k = 0; k < 3; k++) {
+        size_t p = corner[k], q = corner[(k + 1) % 3];
+        cap_edges[level[p]][Edge(std::min(p, q), std::max(p, q))] += 1;
+      }
+    }
 
-    auto tet_logical = new G4LogicalVolume(
-        tet_solid, material_, tet_name + G4String("_logical"), 0, 0, 0);
+    else {
+      G4double longest =
+          std::max({(b - a).mag(), (c - b).mag(), (a - c).mag()});
 
-    assembly_->AddPlacedVolume(tet_logical, element_position, element_rotation);
+      if (std::abs(w.dot((b - a).cross(c - a))) > tolerance * longest) {
+        return nullptr;
+      }
+    }
   }
 
-  return assembly_;
-}
+  volume = std::abs(volume) / 6;
 
-inline G4ThreeVector TetrahedralMesh::GetTetPoint(G4int index_offset) {
-  return G4ThreeVector(
-      out_->pointlist[out_->tetrahedronlist[index_offset] * 3] * scale_ -
-          offset_.x(),
-      out_->pointlist[out_->tetrahedronlist[index_offset] * 3 + 1] * scale_ -
-          offset_.y(),
-      out_->pointlist[out_->tetrahedronlist[index_offset] * 3 + 2] * scale_ -
-          offset_.z());
-}
-}
-#endif
+  // The edges of each cap used only once form a single loop, its outline
+  std::vector<G4TwoVector> outlines[2];
 
-#define CADMeshLexerToken(name)                                                \
-  static Token name##Token { #name }
+  for (G4int cap = 0; cap < 2; cap++) {
+    std::map<size_t, std::vector<size_t>> neighbours;
 
-#define CADMeshLexerStateDefinition(name)                                      \
-  struct name##State : public State {                                          \
-    State *operator()(Lexer *lexer) const;                                     \
-  }
+    for (auto &edge : cap_edges[cap]) {
+      if (edge.second == 1) {
+        neighbours[edge.first.first].push_back(edge.first.second);
+        neighbours[edge.first.second].push_back(edge.first.first);
+      }
+    }
 
-#define CADMeshLexerState(name) name##State::operator()(Lexer *lexer) const
+    if (neighbours.size() < 3 || neighbours.size() > 4096) {
+      return nullptr;
+    }
 
-#define ThisIsA(name) lexer->ThisIsA(name##Token)
-#define StartOfA(name) lexer->StartOfA(name##Token)
-#define EndOfA(name) lexer->EndOfA(name##Token)
-#define MaybeEndOfA(name) lexer->MaybeEndOfA(name##Token)
+    for (auto &point : neighbours) {
+      if (point.second.size() != 2) {
+        return nullptr;
+      }
+    }
 
-#define Skip() lexer->Skip()
+    std::vector<G4TwoVector> loop;
+    size_t start = neighbours.begin()->first;
+    size_t previous = start, current = start;
 
-#define Next() lexer->Peek()
-#define PrintNext() std::cout << lexer->Peek() << std::endl;
+    do {
+      loop.push_back(G4TwoVector(u.dot(points[current]),
+                                 v.dot(points[current])));
 
-#define OneOf(possibles) lexer->OneOf(possibles)
-#define NotOneOf(possibles) !OneOf(possibles)
+      auto &next = neighbours[current];
+      size_t following = next[0] == previous ? next[1] : next[0];
+      previous = current;
+      current = following;
+    } while (current != start && loop.size() <= neighbours.size());
 
-#define ManyOf(possibles) lexer->ManyOf(possibles)
-#define NotManyOf(possibles) !ManyOf(possibles)
+    if (loop.size() != neighbours.size()) {
+      return nullptr;
+    }
 
-#define Until(match) lexer->Until(match)
+    // Points on a straight edge between two others are dropped
+    auto &outline = outlines[cap];
 
-#define RestOfLine()                                                           \
-  if (Until("\n\r"))                                                           \
-  lexer->Backup()
+    for (size_t i = 0; i < loop.size(); i++) {
+      auto &before = outline.empty() ? loop.back() : outline.back();
+      auto &after = loop[(i + 1) % loop.size()];
+      auto along = (after - before).unit();
+      auto off = loop[i] - before;
 
-#define MatchExactly(match) lexer->MatchExactly(match)
-#define DoesNotMatchExactly(match) !MatchExactly(match)
+      if (std::abs(off.x() * along.y() - off.y() * along.x()) >
+          1e-3 * tolerance) {
+        outline.push_back(loop[i]);
+      }
+    }
+  }
 
-#define OneDigit() lexer->OneDigit()
-#define NotOneDigit() !OneDigit()
+  // Both caps have the same outline
+  if (outlines[0].size() != outlines[1].size() || outlines[0].size() < 3) {
+    return nullptr;
+  }
 
-#define ManyDigits() lexer->ManyDigits()
-#define NotManyDigits() !ManyDigits()
+  for (auto &corner : outlines[0]) {
+    G4bool matched = false;
 
-#define OneLetter() lexer->OneLetter()
-#define NotOneLetter() !OneLetter()
+    for (auto &other : outlines[1]) {
+      if ((corner - other).mag() <= tolerance) {
+        matched = true;
+        break;
+      }
+    }
 
-#define ManyLetters() lexer->ManyLetters()
-#define NotManyLetters() !ManyLetters()
+    if (!matched) {
+      return nullptr;
+    }
+  }
 
-#define ManyCharacters() lexer->ManyCharacters()
-#define NotManyCharacters() !ManyCharacters()
+  auto &outline = outlines[0];
+  size_t n = outline.size();
 
-#define Integer() lexer->Integer()
-#define NotAnInteger() !Integer()
+  G4double area = 0, perimeter = 0;
+  G4TwoVector centroid;
 
-#define Float() lexer->Float()
-#define NotAFloat() !Float()
+  for (size_t i = 0; i < n; i++) {
+    auto &p = outline[i];
+    auto &q = outline[(i + 1) % n];
+    G4double cross = p.x() * q.y() - q.x() * p.y();
 
-#define Number() lexer->Number()
-#define NotANumber() !Number()
+    area += cross / 2;
+    centroid += (p + q) * (cross / 6);
+    perimeter += (q - p).mag();
+  }
 
-#define SkipWhiteSpace() lexer->SkipWhiteSpace()
-#define DidNotSkipWhiteSpace() !SkipWhiteSpace()
+  centroid = centroid / area;
 
-#define SkipLineBreak() lexer->SkipLineBreak()
-#define DidNotSkipLineBreak() !SkipLineBreak()
+  // The caps and sides enclose nothing else
+  if (std::abs(volume - std::abs(area) * height) >
+      tolerance * (perimeter * height + 2 * std::abs(area))) {
+    return nullptr;
+  }
 
-#define SkipLineBreaks() lexer->SkipLineBreaks()
-#define DidNotSkipLineBreaks() !SkipLineBreaks()
+  auto place = [&](G4VSolid *solid, const G4ThreeVector &x,
+                   const G4ThreeVector &y, const G4ThreeVector &z,
+                   const G4ThreeVector &centre) -> G4VSolid * {
+    G4RotationMatrix rotation(x, y, z);
 
-#define SkipLine() lexer->SkipLine()
-#define DidNotSkipLine() !SkipLine()
+    if (rotation.isIdentity() && centre.mag2() == 0) {
+      return solid;
+    }
 
-#define AtEndOfLine() Next() == "\n" || Next() == "\r"
+    return new G4DisplacedSolid(name, solid, G4Transform3D(rotation, centre));
+  };
+
+  auto centre = u * centroid.x() + v * centroid.y() + w * ((low + high) / 2);
+
+  // A box, if the outline is a rectangle
+  if (n == 4) {
+    auto e0 = outline[1] - outline[0];
+    auto e1 = outline[2] - outline[1];
+    auto e2 = outline[3] - outline[2];
+    auto e3 = outline[0] - outline[3];
+
+    if ((e0 + e2).mag() <= tolerance && (e1 + e3).mag() <= tolerance &&
+        std::abs(e0.dot(e1)) <= tolerance * e0.mag()) {
+      auto along = e0.unit();
+      auto x = u * along.x() + v * along.y();
+      auto y = w.cross(x);
+      G4double half[3] = {e0.mag() / 2, e1.mag() / 2, height / 2};
+      G4ThreeVector box_axes[3] = {x, y, w};
+
+      // Along the axes of the file, the box needs no rotation
+      G4double aligned[3];
+      size_t found = 0;
+
+      for (size_t i = 0; i < 3; i++) {
+        for (size_t k = 0; k < 3; k++) {
+          if (std::abs(box_axes[k].dot(coordinates[i])) > 1 - 1e-12) {
+            aligned[i] = half[k];
+            found++;
+          }
+        }
+      }
 
-#define Error(message)                                                         \
-  {                                                                            \
-    lexer->Error(message);                                                     \
-    return nullptr;                                                            \
+      if (found == 3) {
+        return place(new G4Box(name, aligned[0], aligned[1], aligned[2]),
+                     coordinates[0], coordinates[1], coordinates[2], centre);
+      }
+
+      return place(new G4Box(name, half[0], half[1], half[2]), x, y, w,
+                   centre);
+    }
   }
 
-#define NextState(next) return new next##State()
-#define TestState(next) lexer->TestState(new next##State())
-#define TryState(next)                                                         \
-  if (TestState(next))                                                         \
-  NextState(next)
-#define FinalState() return new __FinalState();
+  // A cylinder, if the outline is within the tolerance of a circle
+  G4double radius = 0;
+  for (auto &p : outline) {
+    radius += (p - centroid).mag() / n;
+  }
 
-#define RunLexer(filepath, start) Lexer(filepath, new start##State).GetItems()
+  G4double deviation = 0;
+  for (size_t i = 0; i < n; i++) {
+    auto &p = outline[i];
+    auto &q = outline[(i + 1) % n];
+    auto edge = q - p;
+    G4double t = std::min(1., std::max(0., (centroid - p).dot(edge) /
+                                                edge.mag2()));
 
-namespace CADMesh {
+    deviation = std::max({deviation, std::abs((p - centroid).mag() - radius),
+                          radius - (p + edge * t - centroid).mag()});
+  }
 
-namespace File {
+  if (deviation <= tolerance) {
+    return place(new G4Tubs(name, 0, radius, height / 2, 0, CLHEP::twopi), u,
+                 v, w, centre);
+  }
 
-class STLReader : public Reader {
-public:
-  STLReader() : Reader("STLReader"){};
+  // Otherwise the prism itself, its outline clockwise
+  std::vector<G4TwoVector> polygon(outline.begin(), outline.end());
+  if (area > 0) {
+    std::reverse(polygon.begin(), polygon.end());
+  }
 
-  G4bool Read(G4String filepath);
-  G4bool CanRead(Type file_type);
+  std::vector<G4ExtrudedSolid::ZSection> sections = {
+      G4ExtrudedSolid::ZSection(low, G4TwoVector(), 1),
+      G4ExtrudedSolid::ZSection(high, G4TwoVector(), 1)};
 
-protected:
-  CADMeshLexerStateDefinition(StartSolid);
-  CADMeshLexerStateDefinition(EndSolid);
+  return place(new G4ExtrudedSolid(name, polygon, sections), u, v, w,
+               G4ThreeVector());
+}
 
-  CADMeshLexerStateDefinition(StartFacet);
-  CADMeshLexerStateDefinition(EndFacet);
+inline void TessellatedMesh::WeldMesh(std::shared_ptr<Mesh> mesh, G4bool place,
+                                      Points &points, Indices &indices) {
+  std::map<G4ThreeVector, size_t> point_index;
 
-  CADMeshLexerStateDefinition(StartVertices);
-  CADMeshLexerStateDefinition(EndVertices);
+  auto add = [&](const G4ThreeVector &point) {
+    auto placed = place ? point * scale_ + offset_ : point;
+    auto found = point_index.emplace(placed, points.size());
 
-  CADMeshLexerStateDefinition(Vertex);
+    if (found.second) {
+      points.push_back(placed);
+    }
 
-  CADMeshLexerStateDefinition(ThreeVector);
+    indices.push_back(found.first->second);
+  };
 
-  std::shared_ptr<Mesh> ParseMesh(Items items);
-  G4TriangularFacet *ParseFacet(Items items);
-  G4TriangularFacet *ParseVertices(Items items);
-  G4ThreeVector ParseThreeVector(Items items);
-};
-}
+  if (mesh->IsIndexed()) {
+    auto mesh_points = mesh->GetPoints();
+
+    for (auto index : mesh->GetIndices()) {
+      add(mesh_points[index]);
+    }
+  }
+
+  else {
+    for (auto triangle : mesh->GetTriangles()) {
+      for (G4int i = 0; i < 3; i++) {
+        add(triangle->GetVertex(i));
+      }
+    }
+  }
 }
 
-namespace CADMesh {
+inline std::shared_ptr<Mesh>
+TessellatedMesh::SimplifyMesh(std::shared_ptr<Mesh> mesh, G4double tolerance) {
+  typedef std::array<size_t, 3> Triangle;
+  typedef std::array<G4double, 10> Quadric;
 
-namespace File {
+  simplification_ = Simplification();
+  simplification_.facets_before = mesh->GetNumberOfTriangles();
 
-class OBJReader : public Reader {
-public:
-  OBJReader() : Reader("OBJReader"){};
+  // Points and distances are in the units of the file
+  tolerance /= scale_;
 
-  G4bool Read(G4String filepath);
-  G4bool CanRead(Type file_type);
+  Points points;
+  Indices indices;
+  WeldMesh(mesh, false, points, indices);
 
-protected:
-  CADMeshLexerStateDefinition(StartSolid);
-  CADMeshLexerStateDefinition(EndSolid);
+  // Facets left with two corners at one point by the welding are dropped
+  std::vector<Triangle> triangles;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    Triangle t = {indices[i], indices[i + 1], indices[i + 2]};
 
-  CADMeshLexerStateDefinition(Ignore);
-  CADMeshLexerStateDefinition(Vertex);
-  CADMeshLexerStateDefinition(Facet);
-  CADMeshLexerStateDefinition(Object);
+    if (t[0] != t[1] && t[1] != t[2] && t[2] != t[0]) {
+      triangles.push_back(t);
+    }
+  }
 
-  std::shared_ptr<Mesh> ParseMesh(Items items);
-  G4ThreeVector ParseVertex(Items items);
-  G4TriangularFacet *ParseFacet(Items items, G4bool quad);
+  const std::vector<Triangle> original = triangles;
+
+  auto corner = [&](const Triangle &t, G4int k) -> const G4ThreeVector & {
+    return points[t[k]];
+  };
+
+  auto normal = [&](const Triangle &t) {
+    return (corner(t, 1) - corner(t, 0)).cross(corner(t, 2) - corner(t, 0));
+  };
+
+  auto segment_distance = [](const G4ThreeVector &p, const G4ThreeVector &a,
+                             const G4ThreeVector &b) {
+    auto ab = b - a;
+    auto t = ab.mag2() > 0 ? (p - a).dot(ab) / ab.mag2() : 0.;
+    return (p - (a + ab * std::min(1., std::max(0., t)))).mag();
+  };
+
+  // Distance from p to the closest point of the facet t
+  auto distance = [&](const G4ThreeVector &p, const Triangle &t) {
+    auto &a = corner(t, 0);
+    auto &b = corner(t, 1);
+    auto &c = corner(t, 2);
+
+    auto n = normal(t);
+    if (n.mag2() <= 0) {
+      return std::min({segment_distance(p, a, b), segment_distance(p, b, c),
+                       segment_distance(p, c, a)});
+    }
 
-private:
-  Points vertices_;
-};
-}
-}
+    // Inside the facet when p projects onto the inner side of every edge
+    auto inside = (b - a).cross(p - a).dot(n) >= 0 &&
+                  (c - b).cross(p - b).dot(n) >= 0 &&
+                  (a - c).cross(p - c).dot(n) >= 0;
 
-namespace CADMesh {
+    if (inside) {
+      return std::abs((p - a).dot(n)) / n.mag();
+    }
 
-namespace File {
+    return std::min({segment_distance(p, a, b), segment_distance(p, b, c),
+                     segment_distance(p, c, a)});
+  };
 
-CADMeshLexerToken(Header);
-CADMeshLexerToken(Element);
-CADMeshLexerToken(Property);
+  // Facets are measured at the points of a grid an nth of an edge apart
+  auto samples = [&](const Triangle &t, G4int n) {
+    std::vector<G4ThreeVector> s;
 
-class PLYReader : public Reader {
-public:
-  PLYReader() : Reader("PLYReader"){};
+    for (G4int i = 0; i <= n; i++) {
+      for (G4int j = 0; i + j <= n; j++) {
+        G4int k = n - i - j;
+        s.push_back((corner(t, 0) * i + corner(t, 1) * j + corner(t, 2) * k) /
+                    n);
+      }
+    }
 
-  G4bool Read(G4String filepath);
-  G4bool CanRead(Type file_type);
+    return s;
+  };
 
-protected:
-  CADMeshLexerStateDefinition(StartHeader);
-  CADMeshLexerStateDefinition(EndHeader);
+  // The new facets an eighth of an edge apart, and the original ones a
+  // quarter. Each point of an original has a witness, a facet within
+  // tolerance of it, and is measured again only when its witness changes.
+  const size_t kSamples = 15;
+  std::vector<std::array<G4ThreeVector, kSamples>> original_samples;
+  std::vector<std::array<size_t, kSamples>> witness;
 
-  CADMeshLexerStateDefinition(Element);
-  CADMeshLexerStateDefinition(Property);
-  CADMeshLexerStateDefinition(Ignore);
+  for (size_t i = 0; i < original.size(); i++) {
+    auto s = samples(original[i], 4);
+    std::array<G4ThreeVector, kSamples> points_of_original;
+    std::copy(s.begin(), s.end(), points_of_original.begin());
 
-  CADMeshLexerStateDefinition(Vertex);
-  CADMeshLexerStateDefinition(Facet);
+    original_samples.push_back(points_of_original);
+    witness.emplace_back();
+    witness.back().fill(i);
+  }
 
-  void ParseHeader(Items items);
+  // The original facets by the cells of a grid their bounding boxes touch,
+  // so that those within tolerance of a point are found in at most eight
+  // cells. The cells are no smaller than twice the tolerance, the mean
+  // edge, or 1/256 of the size of the mesh.
+  const G4double huge = std::numeric_limits<G4double>::max();
+  G4ThreeVector lowest(huge, huge, huge);
+  G4ThreeVector highest = -lowest;
+  G4double edges = 0;
+
+  for (auto &t : original) {
+    for (G4int k = 0; k < 3; k++) {
+      for (G4int a = 0; a < 3; a++) {
+        lowest[a] = std::min(lowest[a], corner(t, k)[a]);
+        highest[a] = std::max(highest[a], corner(t, k)[a]);
+      }
 
-  std::shared_ptr<Mesh> ParseMesh(Items vertex_items, Items face_items);
-  G4ThreeVector ParseVertex(Items items);
-  G4TriangularFacet *ParseFacet(Items items, Points vertices);
+      edges += (corner(t, (k + 1) % 3) - corner(t, k)).mag();
+    }
+  }
 
-  size_t vertex_count_ = 0;
-  size_t facet_count_ = 0;
+  const G4double cell_size =
+      std::max({2 * tolerance, edges / std::max<size_t>(3 * original.size(), 1),
+                (highest - lowest).mag() / 256});
 
-  size_t x_index_ = 0;
-  size_t y_index_ = 0;
-  size_t z_index_ = 0;
+  auto cell = [&](G4double x, G4int a) {
+    return (G4int)std::floor((x - lowest[a]) / cell_size);
+  };
 
-  size_t facet_index_ = 0;
-};
-}
-}
+  auto key = [](G4int i, G4int j, G4int k) {
+    return ((uint64_t)(uint32_t)i << 42) ^ ((uint64_t)(uint32_t)j << 21) ^
+           (uint64_t)(uint32_t)k;
+  };
 
-namespace CADMesh {
+  std::unordered_map<uint64_t, std::vector<size_t>> grid;
 
-namespace File {
+  for (size_t o = 0; o < original.size(); o++) {
+    G4int low[3], high[3];
 
-inline State *STLReader::CADMeshLexerState(StartSolid) {
-  if (DoesNotMatchExactly("solid"))
-    Error("STL files start with 'solid'. Make sure you are using an ASCII STL "
-          "file.");
+    for (G4int a = 0; a < 3; a++) {
+      auto x = {corner(original[o], 0)[a], corner(original[o], 1)[a],
+                corner(original[o], 2)[a]};
+      low[a] = cell(std::min(x), a);
+      high[a] = cell(std::max(x), a);
+    }
 
-  SkipWhiteSpace();
+    for (G4int i = low[0]; i <= high[0]; i++) {
+      for (G4int j = low[1]; j <= high[1]; j++) {
+        for (G4int k = low[2]; k <= high[2]; k++) {
+          grid[key(i, j, k)].push_back(o);
+        }
+      }
+    }
+  }
 
-  RestOfLine();
+  // Facets around each point, and the points on an edge that is not shared
+  // by exactly two facets, which stay where they are
+  std::vector<std::vector<size_t>> around(points.size());
+  std::map<std::pair<size_t, size_t>, G4int> edge_use_count;
 
-  StartOfA(Solid);
+  for (size_t i = 0; i < triangles.size(); i++) {
+    for (G4int k = 0; k < 3; k++) {
+      around[triangles[i][k]].push_back(i);
 
-  SkipLineBreak();
-  NextState(StartFacet);
-}
+      auto a = triangles[i][k];
+      auto b = triangles[i][(k + 1) % 3];
+      edge_use_count[std::make_pair(std::min(a, b), std::max(a, b))]++;
+    }
+  }
 
-inline State *STLReader::CADMeshLexerState(EndSolid) {
-  SkipWhiteSpace();
-  SkipLineBreaks();
-  SkipWhiteSpace();
+  std::vector<G4bool> fixed(points.size(), false);
+  for (auto &count : edge_use_count) {
+    if (count.second != 2) {
+      fixed[count.first.first] = true;
+      fixed[count.first.second] = true;
+    }
+  }
 
-  if (DoesNotMatchExactly("endsolid"))
-    Error("STL files end with 'endsolid'.");
+  // Quadric error of each point: the squared distances to the planes of
+  // its facets, weighted by their area
+  std::vector<Quadric> quadrics(points.size(), Quadric());
 
-  Skip();
-  EndOfA(Solid);
+  for (auto &t : triangles) {
+    auto n = normal(t);
+    auto w = n.mag() / 2;
 
-  FinalState();
-}
+    if (w <= 0) {
+      continue;
+    }
 
-inline State *STLReader::CADMeshLexerState(StartFacet) {
-  SkipWhiteSpace();
-  SkipLineBreaks();
-  SkipWhiteSpace();
+    n = n.unit();
+    auto d = -n.dot(corner(t, 0));
+    Quadric q = {n.x() * n.x(), n.x() * n.y(), n.x() * n.z(), n.x() * d,
+                 n.y() * n.y(), n.y() * n.z(), n.y() * d,     n.z() * n.z(),
+                 n.z() * d,     d * d};
 
-  if (DoesNotMatchExactly("facet normal"))
-    Error("Facets are indicated by the tag 'facet normal'.");
+    for (G4int k = 0; k < 3; k++) {
+      for (G4int i = 0; i < 10; i++) {
+        quadrics[t[k]][i] += w * q[i];
+      }
+    }
+  }
 
-  SkipWhiteSpace();
+  auto error = [&](size_t from, size_t to) {
+    auto &a = quadrics[from];
+    auto &b = quadrics[to];
+    auto &p = points[to];
+    G4double q[10];
 
-  StartOfA(Facet);
+    for (G4int i = 0; i < 10; i++) {
+      q[i] = a[i] + b[i];
+    }
 
-  SkipLine();
+    auto x = p.x();
+    auto y = p.y();
+    auto z = p.z();
 
-  NextState(StartVertices);
-}
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+           q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y + q[7] * z * z +
+           2 * q[8] * z + q[9];
+  };
 
-inline State *STLReader::CADMeshLexerState(EndFacet) {
-  SkipWhiteSpace();
-  SkipLineBreaks();
-  SkipWhiteSpace();
+  // The originals with a point witnessed by each facet
+  std::vector<std::vector<size_t>> witnessed(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++) {
+    witnessed[i].push_back(i);
+  }
 
-  if (DoesNotMatchExactly("endfacet"))
-    Error("The end of a facets is indicated by the tag 'endfacet'.");
+  std::vector<G4bool> alive(triangles.size(), true);
+  std::vector<G4double> facet_deviation(triangles.size(), 0);
 
-  SkipWhiteSpace();
-  SkipLineBreak();
+  auto neighbours = [&](size_t point) {
+    std::vector<size_t> ring;
 
-  EndOfA(Facet);
+    for (auto i : around[point]) {
+      for (auto p : triangles[i]) {
+        if (p != point) {
+          ring.push_back(p);
+        }
+      }
+    }
 
-  TryState(StartFacet);
+    std::sort(ring.begin(), ring.end());
+    ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+    return ring;
+  };
 
-  NextState(EndSolid);
-}
+  // Moves the point from onto the point to, if the surface stays closed,
+  // no facet turns over and the new facets stay within tolerance
+  auto collapse = [&](size_t from, size_t to) {
+    std::vector<size_t> removed, changed;
 
-inline State *STLReader::CADMeshLexerState(StartVertices) {
-  SkipWhiteSpace();
-  SkipLineBreaks();
-  SkipWhiteSpace();
+    for (auto i : around[from]) {
+      auto &t = triangles[i];
 
-  if (DoesNotMatchExactly("outer loop"))
-    Error("The start of the vertices is indicated by the tag 'outer loop'.");
+      if (t[0] == to || t[1] == to || t[2] == to) {
+        removed.push_back(i);
+      }
 
-  SkipWhiteSpace();
-  SkipLineBreak();
+      else {
+        changed.push_back(i);
+      }
+    }
 
-  StartOfA(Vertices);
+    if (removed.size() != 2) {
+      return false;
+    }
 
-  NextState(Vertex);
-}
+    // The only points next to both are the far corners of the two facets
+    // on the edge, or the collapse would pinch the surface
+    auto from_ring = neighbours(from);
+    auto to_ring = neighbours(to);
+    std::vector<size_t> common;
+    std::set_intersection(from_ring.begin(), from_ring.end(), to_ring.begin(),
+                          to_ring.end(), std::back_inserter(common));
 
-inline State *STLReader::CADMeshLexerState(EndVertices) {
-  SkipWhiteSpace();
-  SkipLineBreaks();
-  SkipWhiteSpace();
+    if (common.size() != 2) {
+      return false;
+    }
 
-  if (DoesNotMatchExactly("endloop"))
-    Error("The end of the vertices is indicated by the tag 'endloop'.");
+    std::vector<Triangle> made;
+    for (auto i : changed) {
+      auto t = triangles[i];
+      auto before = normal(t);
 
-  SkipWhiteSpace();
-  SkipLineBreak();
+      for (auto &p : t) {
+        if (p == from) {
+          p = to;
+        }
+      }
 
-  EndOfA(Vertices);
+      auto after = normal(t);
+      auto longest = std::max({(corner(t, 1) - corner(t, 0)).mag2(),
+                               (corner(t, 2) - corner(t, 1)).mag2(),
+                               (corner(t, 0) - corner(t, 2)).mag2()});
 
-  NextState(EndFacet);
-}
+      if (after.dot(before) <= 0 || after.mag() <= 1e-6 * longest) {
+        return false;
+      }
 
-inline State *STLReader::CADMeshLexerState(Vertex) {
-  SkipWhiteSpace();
-  SkipLineBreaks();
-  SkipWhiteSpace();
+      // A facet that already exists, the other way round, as when a
+      // tetrahedron would flatten
+      for (auto j : around[to]) {
+        auto a = t;
+        auto b = triangles[j];
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
 
-  if (DoesNotMatchExactly("vertex"))
-    Error("A vertex is indicated by the tag 'vertex'.");
+        if (a == b) {
+          return false;
+        }
+      }
 
-  SkipWhiteSpace();
+      made.push_back(t);
+    }
 
-  NextState(ThreeVector);
-}
+    // The facets around to that are left, which with the new ones can
+    // witness the points of the originals whose witness goes
+    std::vector<size_t> kept;
+    for (auto j : around[to]) {
+      if (std::find(removed.begin(), removed.end(), j) == removed.end()) {
+        kept.push_back(j);
+      }
+    }
 
-inline State *STLReader::CADMeshLexerState(ThreeVector) {
-  SkipWhiteSpace();
+    auto going = [&](size_t facet) {
+      return std::find(around[from].begin(), around[from].end(), facet) !=
+             around[from].end();
+    };
 
-  StartOfA(ThreeVector);
+    std::vector<size_t> pool;
+    for (auto i : around[from]) {
+      pool.insert(pool.end(), witnessed[i].begin(), witnessed[i].end());
+    }
 
-  if (NotANumber())
-    Error("First number in three vector not found.");
+    std::sort(pool.begin(), pool.end());
+    pool.erase(std::unique(pool.begin(), pool.end()), pool.end());
 
-  ThisIsA(Number);
-  SkipWhiteSpace();
+    // The new witness of each point that needs one, as its place in made
+    // and then kept
+    std::vector<std::array<size_t, kSamples>> new_witness;
+    for (auto o : pool) {
+      std::array<size_t, kSamples> w;
+      w.fill(made.size() + kept.size());
 
-  if (NotANumber())
-    Error("Second number in three vector not found.");
+      for (size_t k = 0; k < kSamples; k++) {
+        if (!going(witness[o][k])) {
+          continue;
+        }
 
-  ThisIsA(Number);
-  SkipWhiteSpace();
+        G4double best = std::numeric_limits<G4double>::infinity();
 
-  if (NotANumber())
-    Error("Third number in three vector not found.");
+        for (size_t r = 0; r < made.size() + kept.size(); r++) {
+          auto &t =
+              r < made.size() ? made[r] : triangles[kept[r - made.size()]];
+          auto d = distance(original_samples[o][k], t);
 
-  ThisIsA(Number);
-  EndOfA(ThreeVector);
+          if (d < best) {
+            best = d;
+            w[k] = r;
+          }
+        }
 
-  SkipWhiteSpace();
+        if (best > tolerance) {
+          return false;
+        }
+      }
 
-  if (DidNotSkipLineBreak())
-    Error("Expecting a new line at the end of a three vector.");
+      new_witness.push_back(w);
+    }
 
-  TryState(StartVertices);
+    // Every new facet close to the original surface
+    std::vector<G4double> made_deviation;
+    for (auto &t : made) {
+      G4double worst = 0;
 
-  TryState(Vertex);
+      for (auto &p : samples(t, 8)) {
+        G4double closest = std::numeric_limits<G4double>::infinity();
+        G4int low[3], high[3];
 
-  NextState(EndVertices);
-}
+        for (G4int a = 0; a < 3; a++) {
+          low[a] = cell(p[a] - tolerance, a);
+          high[a] = cell(p[a] + tolerance, a);
+        }
 
-inline G4bool STLReader::Read(G4String filepath) {
-  auto items = RunLexer(filepath, StartSolid);
+        for (G4int i = low[0]; i <= high[0] && closest > worst; i++) {
+          for (G4int j = low[1]; j <= high[1] && closest > worst; j++) {
+            for (G4int k = low[2]; k <= high[2] && closest > worst; k++) {
+              auto found = grid.find(key(i, j, k));
 
-  if (items.size() == 0) {
-    Exceptions::ParserError("STLReader::Read",
-                            "The STL file appears to be empty.");
-  }
+              if (found == grid.end()) {
+                continue;
+              }
 
-  for (auto item : items) {
-    if (item.children.size() == 0) {
-      std::stringstream error;
-      error << "The mesh appears to be empty."
-            << "Error around line " << item.line << ".";
+              for (auto o : found->second) {
+                closest = std::min(closest, distance(p, original[o]));
 
-      Exceptions::ParserError("STLReader::Read", error.str());
+                if (closest <= worst) {
+                  break;
+                }
+              }
+            }
+          }
+        }
+
+        worst = std::max(worst, closest);
+        if (worst > tolerance) {
+          return false;
+        }
+      }
+
+      made_deviation.push_back(worst);
     }
 
-    auto mesh = ParseMesh(item.children);
+    // Accepted
+    for (auto i : removed) {
+      alive[i] = false;
 
-    auto name = G4String(item.value);
-    AddMesh(Mesh::New(mesh, name));
-  }
-
-  return true;
-}
-
-inline G4bool STLReader::CanRead(Type file_type) { return (file_type == STL); }
+      for (auto p : triangles[i]) {
+        auto &facets = around[p];
+        facets.erase(std::remove(facets.begin(), facets.end(), i),
+                     facets.end());
+      }
+    }
 
-inline std::shared_ptr<Mesh> STLReader::ParseMesh(Items items) {
-  Triangles triangles;
+    for (size_t m = 0; m < changed.size(); m++) {
+      triangles[changed[m]] = made[m];
+      facet_deviation[changed[m]] = made_deviation[m];
+      around[to].push_back(changed[m]);
+    }
 
-  for (auto item : items) {
-    if (item.children.size() == 0) {
-      std::stringstream error;
-      error << "The facet appears to be empty."
-            << "Error around line " << item.line << ".";
+    for (auto i : around[from]) {
+      witnessed[i].clear();
+    }
 
-      Exceptions::ParserError("STLReader::Mesh", error.str());
+    for (auto i : removed) {
+      witnessed[i].clear();
     }
 
-    triangles.push_back(ParseFacet(item.children));
-  }
+    for (size_t n = 0; n < pool.size(); n++) {
+      auto o = pool[n];
 
-  return Mesh::New(triangles);
-}
+      for (size_t k = 0; k < kSamples; k++) {
+        auto r = new_witness[n][k];
 
-inline G4TriangularFacet *STLReader::ParseFacet(Items items) {
-  Triangles triangles;
+        if (r == changed.size() + kept.size()) {
+          continue;
+        }
 
-  for (auto item : items) {
-    if (item.children.size() == 0) {
-      std::stringstream error;
-      error << "The vertex appears to be empty."
-            << "Error around line " << item.line << ".";
+        auto facet = r < changed.size() ? changed[r] : kept[r - changed.size()];
+        witness[o][k] = facet;
 
-      Exceptions::ParserError("STLReader::ParseFacet", error.str());
+        auto &list = witnessed[facet];
+        if (list.empty() || list.back() != o) {
+          list.push_back(o);
+        }
+      }
     }
 
-    triangles.push_back(ParseVertices(item.children));
-  }
-
-  if (triangles.size() != 1) {
-    std::stringstream error;
-    error << "STL files expect exactly 1 triangle per facet.";
+    around[from].clear();
 
-    if (items.size() != 0) {
-      error << "Error around line " << items[0].line << ".";
+    for (G4int i = 0; i < 10; i++) {
+      quadrics[to][i] += quadrics[from][i];
     }
 
-    Exceptions::ParserError("STLReader::ParseFacet", error.str());
-  }
+    return true;
+  };
 
-  return triangles[0];
-}
+  // Collapses of least error first, skipping any queued before one of its
+  // points last changed
+  struct Candidate {
+    G4double error;
+    size_t from, to;
+    size_t from_version, to_version;
 
-inline G4TriangularFacet *STLReader::ParseVertices(Items items) {
-  std::vector<G4ThreeVector> vertices;
+    bool operator>(const Candidate &other) const {
+      return error > other.error;
+    }
+  };
 
-  for (auto item : items) {
-    if (item.children.size() == 0) {
-      std::stringstream error;
-      error << "The vertex appears to be empty."
-            << "Error around line " << item.line << ".";
+  std::priority_queue<Candidate, std::vector<Candidate>,
+                      std::greater<Candidate>>
+      queue;
+  std::vector<size_t> version(points.size(), 0);
 
-      Exceptions::ParserError("STLReader::ParseVertices", error.str());
+  auto push = [&](size_t from, size_t to) {
+    if (!fixed[from]) {
+      queue.push({error(from, to), from, to, version[from], version[to]});
     }
+  };
 
-    vertices.push_back(ParseThreeVector(item.children));
+  for (size_t p = 0; p < points.size(); p++) {
+    for (auto q : neighbours(p)) {
+      push(p, q);
+    }
   }
 
-  if (vertices.size() != 3) {
-    std::stringstream error;
-    error << "STL files expect exactly 3 vertices for a triangular facet. ";
+  while (!queue.empty()) {
+    auto c = queue.top();
+    queue.pop();
 
-    if (items.size() != 0) {
-      error << "Error around line " << items[0].line << ".";
+    if (c.from_version != version[c.from] || c.to_version != version[c.to] ||
+        !collapse(c.from, c.to)) {
+      continue;
     }
 
-    Exceptions::ParserError("STLReader::ParseVertices", error.str());
-  }
+    auto changed = neighbours(c.to);
+    changed.push_back(c.to);
+    std::sort(changed.begin(), changed.end());
 
-  return new G4TriangularFacet(vertices[0], vertices[1], vertices[2], ABSOLUTE);
-}
+    for (auto p : changed) {
+      version[p]++;
+    }
 
-inline G4ThreeVector STLReader::ParseThreeVector(Items items) {
-  std::vector<double> numbers;
+    for (auto p : changed) {
+      for (auto q : neighbours(p)) {
+        push(p, q);
 
-  for (auto item : items) {
-    numbers.push_back((double)atof(item.value.c_str()));
+        if (!std::binary_search(changed.begin(), changed.end(), q)) {
+          push(q, p);
+        }
+      }
+    }
   }
 
-  if (numbers.size() != 3) {
-    std::stringstream error;
-    error << "Three vectors in STL files require exactly 3 numbers";
+  // The points still used, numbered again
+  std::vector<size_t> renumbered(points.size(), points.size());
+  Points simplified_points;
+  Indices simplified_indices;
 
-    if (items.size() != 0) {
-      error << "Error around line " << items[0].line << ".";
+  for (size_t i = 0; i < triangles.size(); i++) {
+    if (!alive[i]) {
+      continue;
     }
 
-    Exceptions::ParserError("STLReader::ParseThreeVector", error.str());
+    for (auto p : triangles[i]) {
+      if (renumbered[p] == points.size()) {
+        renumbered[p] = simplified_points.size();
+        simplified_points.push_back(points[p]);
+      }
+
+      simplified_indices.push_back(renumbered[p]);
+    }
+
+    simplification_.max_deviation =
+        std::max(simplification_.max_deviation, facet_deviation[i] * scale_);
   }
 
-  return G4ThreeVector(numbers[0], numbers[1], numbers[2]);
-}
+  for (size_t o = 0; o < original.size(); o++) {
+    for (size_t k = 0; k < kSamples; k++) {
+      simplification_.max_deviation = std::max(
+          simplification_.max_deviation,
+          distance(original_samples[o][k], triangles[witness[o][k]]) * scale_);
+    }
+  }
+
+  simplification_.facets_after = simplified_indices.size() / 3;
+
+  return Mesh::New(std::move(simplified_points), std::move(simplified_indices),
+                   mesh->GetName());
 }
 }
 
+#ifdef USE_CADMESH_TETGEN
+
 namespace CADMesh {
 
-namespace File {
+inline TetrahedralMesh::TetrahedralMesh() {}
 
-inline State *OBJReader::CADMeshLexerState(StartSolid) {
-  StartOfA(Solid);
+inline TetrahedralMesh::~TetrahedralMesh() {}
 
-  TryState(Object);
-  TryState(Vertex);
-  TryState(Ignore);
+inline G4VSolid *TetrahedralMesh::GetSolid() { return GetSolid(0); }
 
-  Error("Invalid element tag.");
-}
+inline G4VSolid *TetrahedralMesh::GetSolid(G4int /*index*/) { return nullptr; }
 
-inline State *OBJReader::CADMeshLexerState(EndSolid) {
-  if (Next() != "")
-    lexer->LastError();
+inline G4VSolid *TetrahedralMesh::GetSolid(G4String /*name*/,
+                                           G4bool /*exact*/) {
 
-  EndOfA(Solid);
-  FinalState();
+  return nullptr;
 }
 
-inline State *OBJReader::CADMeshLexerState(Ignore) {
-  if (DidNotSkipLine())
-    NextState(EndSolid);
-
-  TryState(Object);
-  TryState(Vertex);
-  TryState(Facet);
-  TryState(Ignore);
+inline std::vector<G4VSolid *> TetrahedralMesh::GetSolids() {
 
-  NextState(EndSolid);
+  return std::vector<G4VSolid *>();
 }
 
-inline State *OBJReader::CADMeshLexerState(Vertex) {
-  SkipLineBreaks();
-
-  if (DoesNotMatchExactly("v "))
-    Error("A vertex is indicated by the tag 'v'.");
+inline G4AssemblyVolume *TetrahedralMesh::GetAssembly() {
+  if (assembly_) {
+    return assembly_;
+  }
 
-  SkipWhiteSpace();
-  StartOfA(Vertex);
+  assembly_ = new G4AssemblyVolume();
 
-  if (NotANumber())
-    Error("First number in three vector not found.");
+  in_ = std::make_shared<tetgenio>();
+  out_ = std::make_shared<tetgenio>();
 
-  ThisIsA(Number);
-  SkipWhiteSpace();
+  char *fn = (char *)file_name_.c_str();
 
-  if (NotANumber())
-    Error("Second number in three vector not found.");
+  G4bool do_tet = true;
 
-  ThisIsA(Number);
-  SkipWhiteSpace();
+  if (file_type_ == File::STL) {
+    in_->load_stl(fn);
+  }
 
-  if (NotANumber())
-    Error("Third number in three vector not found.");
+  else if (file_type_ == File::PLY) {
+    in_->load_ply(fn);
+  }
 
-  ThisIsA(Number);
+  else if (file_type_ == File::TET) {
+    out_->load_tetmesh(fn, 0);
+    do_tet = false;
+  }
 
-  EndOfA(Vertex);
+  else if (file_type_ == File::OFF) {
+    out_->load_off(fn);
+    do_tet = false;
+  }
 
-  SkipLine();
+  if (do_tet) {
+    tetgenbehavior *behavior = new tetgenbehavior();
+    behavior->nobisect = 1;
+    behavior->plc = 1;
+    behavior->quality = quality_;
 
-  TryState(Vertex);
-  TryState(Object);
-  TryState(Facet);
-  TryState(Ignore);
+    tetrahedralize(behavior, in_.get(), out_.get());
+  }
 
-  NextState(EndSolid);
-}
+  G4RotationMatrix *element_rotation = new G4RotationMatrix();
+  G4ThreeVector element_position = G4ThreeVector();
+  G4Transform3D assembly_transform = G4Translate3D();
 
-inline State *OBJReader::CADMeshLexerState(Facet) {
-  SkipLineBreaks();
+  for (int i = 0; i < out_->numberoftetrahedra; i++) {
+    int index_offset = i * 4;
 
-  if (DoesNotMatchExactly("f "))
-    Error("A facet is indicated by the tag 'f'.");
+    G4ThreeVector p1 = GetTetPoint(index_offset);
+    G4ThreeVector p2 = GetTetPoint(index_offset + 1);
+    G4ThreeVector p3 = GetTetPoint(index_offset + 2);
+    G4ThreeVector p4 = GetTetPoint(index_offset + 3);
 
-  SkipWhiteSpace();
-  StartOfA(Facet);
+    G4String tet_name =
+        file_name_ + G4String("_tet_") + G4UIcommand::ConvertToString(i);
 
-  if (NotANumber())
-    Error("First number in three vector not found.");
+    auto tet_solid =
+        new G4Tet(tet_name + G4String("_solid"), p1, p2, p3, p4, 0);
 
-  ThisIsA(Number);
+    auto tet_logical = new G4LogicalVolume(
+        tet_solid, material_, tet_name + G4String("_logical"), 0, 0, 0);
 
-  OneOf("/");
-  Number();
-  OneOf("/");
-  Number();
-  SkipWhiteSpace();
+    assembly_->AddPlacedVolume(tet_logical, element_position, element_rotation);
+  }
 
-  if (NotANumber())
-    Error("Second number in three vector not found.");
+  return assembly_;
+}
 
-  ThisIsA(Number);
+inline G4ThreeVector TetrahedralMesh::GetTetPoint(G4int index_offset) {
+  return G4ThreeVector(
+      out_->pointlist[out_->tetrahedronlist[index_offset] * 3] * scale_ -
+          offset_.x(),
+      out_->pointlist[out_->tetrahedronlist[index_offset] * 3 + 1] * scale_ -
+          offset_.y(),
+      out_->pointlist[out_->tetrahedronlist[index_offset] * 3 + 2] * scale_ -
+          offset_.z());
+}
+}
+#endif
 
-  OneOf("/");
-  Number();
-  OneOf("/");
-  Number();
-  SkipWhiteSpace();
+#define CADMeshLexerToken(name)                                                \
+  static Token name##Token { #name }
 
-  if (NotANumber())
-    Error("Third number in three vector not found.");
+#define CADMeshLexerStateDefinition(name)                                      \
+  struct name##State : public State {                                          \
+    State *operator()(Lexer *lexer) const;                                     \
+  }
 
-  ThisIsA(Number);
+#define CADMeshLexerState(name) name##State::operator()(Lexer *lexer) const
 
-  OneOf("/");
-  Number();
-  OneOf("/");
-  Number();
-  SkipWhiteSpace();
+#define ThisIsA(name) lexer->ThisIsA(name##Token)
+#define StartOfA(name) lexer->StartOfA(name##Token)
+#define EndOfA(name) lexer->EndOfA(name##Token)
+#define MaybeEndOfA(name) lexer->MaybeEndOfA(name##Token)
 
-  if (Number())
-    ThisIsA(Number);
+#define Skip() lexer->Skip()
+
+#define Next() lexer->Peek()
+#define PrintNext() std::cout << lexer->Peek() << std::endl;
+
+#define OneOf(possibles) lexer->OneOf(possibles)
+#define NotOneOf(possibles) !OneOf(possibles)
+
+#define ManyOf(possibles) lexer->ManyOf(possibles)
+#define NotManyOf(possibles) !ManyOf(possibles)
+
+#define Until(match) lexer->Until(match)
+
+#define RestOfLine()                                                           \
+  if (Until("\n\r"))                                                           \
+  lexer->Backup()
+
+#define MatchExactly(match) lexer->MatchExactly(match)
+#define DoesNotMatchExactly(match) !MatchExactly(match)
+
+#define OneDigit() lexer->OneDigit()
+#define NotOneDigit() !OneDigit()
+
+#define ManyDigits() lexer->ManyDigits()
+#define NotManyDigits() !ManyDigits()
+
+#define OneLetter() lexer->OneLetter()
+#define NotOneLetter() !OneLetter()
+
+#define ManyLetters() lexer->ManyLetters()
+#define NotManyLetters() !ManyLetters()
+
+#define ManyCharacters() lexer->ManyCharacters()
+#define NotManyCharacters() !ManyCharacters()
+
+#define Integer() lexer->Integer()
+#define NotAnInteger() !Integer()
+
+#define Float() lexer->Float()
+#define NotAFloat() !Float()
+
+#define Number() lexer->Number()
+#define NotANumber() !Number()
+
+#define SkipWhiteSpace() lexer->SkipWhiteSpace()
+#define DidNotSkipWhiteSpace() !SkipWhiteSpace()
+
+#define SkipLineBreak() lexer->SkipLineBreak()
+#define DidNotSkipLineBreak() !SkipLineBreak()
+
+#define SkipLineBreaks() lexer->SkipLineBreaks()
+#define DidNotSkipLineBreaks() !SkipLineBreaks()
+
+#define SkipLine() lexer->SkipLine()
+#define DidNotSkipLine() !SkipLine()
+
+#define AtEndOfLine() Next() == "\n" || Next() == "\r"
+
+#define Error(message)                                                         \
+  {                                                                            \
+    lexer->Error(message);                                                     \
+    return nullptr;                                                            \
+  }
+
+#define NextState(next) return new next##State()
+#define TestState(next) lexer->TestState(new next##State())
+#define TryState(next)                                                         \
+  if (TestState(next))                                                         \
+  NextState(next)
+#define FinalState() return new __FinalState();
+
+#define RunLexer(filepath, start) Lexer(filepath, new start##State).GetItems()
+
+namespace CADMesh {
+
+namespace File {
+
+class STLReader : public Reader {
+public:
+  STLReader() : Reader("STLReader"){};
+
+  G4bool Read(G4String filepath);
+  G4bool CanRead(Type file_type);
+
+protected:
+  CADMeshLexerStateDefinition(StartSolid);
+  CADMeshLexerStateDefinition(EndSolid);
+
+  CADMeshLexerStateDefinition(StartFacet);
+  CADMeshLexerStateDefinition(EndFacet);
+
+  CADMeshLexerStateDefinition(StartVertices);
+  CADMeshLexerStateDefinition(EndVertices);
+
+  CADMeshLexerStateDefinition(Vertex);
+
+  CADMeshLexerStateDefinition(ThreeVector);
+
+  std::shared_ptr<Mesh> ParseMesh(Items items);
+  G4TriangularFacet *ParseFacet(Items items);
+  G4TriangularFacet *ParseVertices(Items items);
+  G4ThreeVector ParseThreeVector(Items items);
+};
+}
+}
+
+namespace CADMesh {
+
+namespace File {
+
+class OBJReader : public Reader {
+public:
+  OBJReader() : Reader("OBJReader"){};
+
+  G4bool Read(G4String filepath);
+  G4bool CanRead(Type file_type);
+
+protected:
+  CADMeshLexerStateDefinition(StartSolid);
+  CADMeshLexerStateDefinition(EndSolid);
+
+  CADMeshLexerStateDefinition(Ignore);
+  CADMeshLexerStateDefinition(Vertex);
+  CADMeshLexerStateDefinition(Facet);
+  CADMeshLexerStateDefinition(Object);
+
+  std::shared_ptr<Mesh> ParseMesh(Items items);
+  G4ThreeVector ParseVertex(Items items);
+  G4TriangularFacet *ParseFacet(Items items, G4bool quad);
+
+private:
+  Points vertices_;
+};
+}
+}
+
+namespace CADMesh {
+
+namespace File {
+
+CADMeshLexerToken(Header);
+CADMeshLexerToken(Element);
+CADMeshLexerToken(Property);
+
+class PLYReader : public Reader {
+public:
+  PLYReader() : Reader("PLYReader"){};
+
+  G4bool Read(G4String filepath);
+  G4bool CanRead(Type file_type);
+
+protected:
+  CADMeshLexerStateDefinition(StartHeader);
+  CADMeshLexerStateDefinition(EndHeader);
+
+  CADMeshLexerStateDefinition(Element);
+  CADMeshLexerStateDefinition(Property);
+  CADMeshLexerStateDefinition(Ignore);
+
+  CADMeshLexerStateDefinition(Vertex);
+  CADMeshLexerStateDefinition(Facet);
+
+  void ParseHeader(Items items);
+
+  std::shared_ptr<Mesh> ParseMesh(Items vertex_items, Items face_items);
+  G4ThreeVector ParseVertex(Items items);
+  G4TriangularFacet *ParseFacet(Items items, Points vertices);
+
+  size_t vertex_count_ = 0;
+  size_t facet_count_ = 0;
+
+  size_t x_index_ = 0;
+  size_t y_index_ = 0;
+  size_t z_index_ = 0;
+
+  size_t facet_index_ = 0;
+};
+}
+}
+
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+namespace CADMesh {
+
+namespace File {
+
+// Reads PLY and STL files straight into the points and indices of an
+// indexed Mesh. The file is read into one buffer and numbers are parsed in
+// place with std::from_chars, instead of the Lexer's token and string per
+// character; each triangle is made only once, for the solid.
+//
+// ASCII and binary files of both formats are read, whichever the extension
+// says: PLY files start with 'ply' and give their format in the header, and
+// a file is taken as a binary STL if its size is 84 bytes plus 50 per
+// facet counted in its header. Binary STL headers may start with 'solid'
+// (SOLIDWORKS writes them that way), so that word alone proves nothing.
+class FastReader : public Reader {
+public:
+  FastReader() : Reader("FastReader"){};
+
+  G4bool Read(G4String filepath);
+  G4bool CanRead(Type file_type);
+
+protected:
+  // Scalar types of binary PLY properties
+  enum Scalar { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+  struct Property {
+    G4String name;
+    G4String type;
+    G4String count_type; // type of the length of a list
+    G4bool list;
+
+    Scalar scalar;
+    Scalar count_scalar;
+  };
+
+  struct Element {
+    G4String name;
+    size_t count;
+    std::vector<Property> properties;
+  };
+
+  void ReadPLY();
+  void ReadSTL();
+  void ReadBinarySTL();
+  G4bool IsBinarySTL();
+
+  void SkipSpace();
+  void SkipToNextLine();
+  G4bool Keyword(const char *word);
+  void Expect(const char *word);
+  G4String Word();
+  G4bool ParseNumber(G4double &value);
+  G4bool ParseIndex(size_t &value);
+  void Fail(G4String message);
+
+  // Values of PLY elements, in text or binary as the header says
+  G4bool ReadValue(Scalar scalar, G4double &value);
+  G4bool ReadIndex(Scalar scalar, size_t &value);
+  void SkipValue(Scalar scalar);
+
+  Scalar ScalarFromName(G4String name);
+  size_t ScalarSize(Scalar scalar);
+  G4double BinaryValue(Scalar scalar);
+  static G4bool LittleEndianMachine();
+
+  G4String filepath_;
+  std::string buffer_;
+
+  const char *position_ = nullptr;
+  const char *end_ = nullptr;
+
+  G4bool binary_ = false;
+  G4bool swap_ = false; // the file's byte order is not the machine's
+};
+
+std::shared_ptr<FastReader> Fast();
+
+// Keeps the meshes read by another reader in a binary cache next to the
+// file (<file>.cache), keyed by a hash of the file's content. The points
+// of each mesh are welded and the mesh checked for navigation before it is
+// cached, so a later read of the same content skips the parsing, welding
+// and checking. A cache that does not match the file is rebuilt.
+class CachedReader : public Reader {
+public:
+  CachedReader(std::shared_ptr<Reader> reader)
+      : Reader("CachedReader"), reader_(reader){};
+
+  G4bool Read(G4String filepath);
+  G4bool CanRead(Type file_type);
+
+  static uint64_t Hash(const char *data, size_t size);
+
+protected:
+  G4bool ReadCache(G4String cache, uint64_t hash, uint64_t size);
+  void WriteCache(G4String cache, uint64_t hash, uint64_t size);
+
+  // Indexed copy of the mesh with each distinct point kept once
+  static std::shared_ptr<Mesh> Weld(std::shared_ptr<Mesh> mesh);
+
+  std::shared_ptr<Reader> reader_;
+};
+
+std::shared_ptr<CachedReader> Cached(std::shared_ptr<Reader> reader);
+}
+}
+
+namespace CADMesh {
+
+namespace File {
+
+inline State *STLReader::CADMeshLexerState(StartSolid) {
+  if (DoesNotMatchExactly("solid"))
+    Error("STL files start with 'solid'. Make sure you are using an ASCII STL "
+          "file.");
+
+  SkipWhiteSpace();
+
+  RestOfLine();
+
+  StartOfA(Solid);
+
+  SkipLineBreak();
+  NextState(StartFacet);
+}
+
+inline State *STLReader::CADMeshLexerState(EndSolid) {
+  SkipWhiteSpace();
+  SkipLineBreaks();
+  SkipWhiteSpace();
+
+  if (DoesNotMatchExactly("endsolid"))
+    Error("STL files end with 'endsolid'.");
+
+  Skip();
+  EndOfA(Solid);
+
+  FinalState();
+}
+
+inline State *STLReader::CADMeshLexerState(StartFacet) {
+  SkipWhiteSpace();
+  SkipLineBreaks();
+  SkipWhiteSpace();
+
+  if (DoesNotMatchExactly("facet normal"))
+    Error("Facets are indicated by the tag 'facet normal'.");
+
+  SkipWhiteSpace();
+
+  StartOfA(Facet);
+
+  SkipLine();
+
+  NextState(StartVertices);
+}
+
+inline State *STLReader::CADMeshLexerState(EndFacet) {
+  SkipWhiteSpace();
+  SkipLineBreaks();
+  SkipWhiteSpace();
+
+  if (DoesNotMatchExactly("endfacet"))
+    Error("The end of a facets is indicated by the tag 'endfacet'.");
+
+  SkipWhiteSpace();
+  SkipLineBreak();
+
+  EndOfA(Facet);
+
+  TryState(StartFacet);
+
+  NextState(EndSolid);
+}
+
+inline State *STLReader::CADMeshLexerState(StartVertices) {
+  SkipWhiteSpace();
+  SkipLineBreaks();
+  SkipWhiteSpace();
+
+  if (DoesNotMatchExactly("outer loop"))
+    Error("The start of the vertices is indicated by the tag 'outer loop'.");
+
+  SkipWhiteSpace();
+  SkipLineBreak();
+
+  StartOfA(Vertices);
+
+  NextState(Vertex);
+}
+
+inline State *STLReader::CADMeshLexerState(EndVertices) {
+  SkipWhiteSpace();
+  SkipLineBreaks();
+  SkipWhiteSpace();
+
+  if (DoesNotMatchExactly("endloop"))
+    Error("The end of the vertices is indicated by the tag 'endloop'.");
+
+  SkipWhiteSpace();
+  SkipLineBreak();
+
+  EndOfA(Vertices);
+
+  NextState(EndFacet);
+}
+
+inline State *STLReader::CADMeshLexerState(Vertex) {
+  SkipWhiteSpace();
+  SkipLineBreaks();
+  SkipWhiteSpace();
+
+  if (DoesNotMatchExactly("vertex"))
+    Error("A vertex is indicated by the tag 'vertex'.");
+
+  SkipWhiteSpace();
+
+  NextState(ThreeVector);
+}
+
+inline State *STLReader::CADMeshLexerState(ThreeVector) {
+  SkipWhiteSpace();
+
+  StartOfA(ThreeVector);
+
+  if (NotANumber())
+    Error("First number in three vector not found.");
+
+  ThisIsA(Number);
+  SkipWhiteSpace();
+
+  if (NotANumber())
+    Error("Second number in three vector not found.");
+
+  ThisIsA(Number);
+  SkipWhiteSpace();
+
+  if (NotANumber())
+    Error("Third number in three vector not found.");
+
+  ThisIsA(Number);
+  EndOfA(ThreeVector);
+
+  SkipWhiteSpace();
+
+  if (DidNotSkipLineBreak())
+    Error("Expecting a new line at the end of a three vector.");
+
+  TryState(StartVertices);
+
+  TryState(Vertex);
+
+  NextState(EndVertices);
+}
+
+inline G4bool STLReader::Read(G4String filepath) {
+  auto items = RunLexer(filepath, StartSolid);
+
+  if (items.size() == 0) {
+    Exceptions::ParserError("STLReader::Read",
+                            "The STL file appears to be empty.");
+  }
+
+  for (auto item : items) {
+    if (item.children.size() == 0) {
+      std::stringstream error;
+      error << "The mesh appears to be empty."
+            << "Error around line " << item.line << ".";
+
+      Exceptions::ParserError("STLReader::Read", error.str());
+    }
+
+    auto mesh = ParseMesh(item.children);
+
+    auto name = G4String(item.value);
+    AddMesh(Mesh::New(mesh, name));
+  }
+
+  return true;
+}
+
+inline G4bool STLReader::CanRead(Type file_type) { return (file_type == STL); }
+
+inline std::shared_ptr<Mesh> STLReader::ParseMesh(Items items) {
+  Triangles triangles;
+
+  for (auto item : items) {
+    if (item.children.size() == 0) {
+      std::stringstream error;
+      error << "The facet appears to be empty."
+            << "Error around line " << item.line << ".";
+
+      Exceptions::ParserError("STLReader::Mesh", error.str());
+    }
+
+    triangles.push_back(ParseFacet(item.children));
+  }
+
+  return Mesh::New(triangles);
+}
+
+inline G4TriangularFacet *STLReader::ParseFacet(Items items) {
+  Triangles triangles;
+
+  for (auto item : items) {
+    if (item.children.size() == 0) {
+      std::stringstream error;
+      error << "The vertex appears to be empty."
+            << "Error around line " << item.line << ".";
+
+      Exceptions::ParserError("STLReader::ParseFacet", error.str());
+    }
+
+    triangles.push_back(ParseVertices(item.children));
+  }
+
+  if (triangles.size() != 1) {
+    std::stringstream error;
+    error << "STL files expect exactly 1 triangle per facet.";
+
+    if (items.size() != 0) {
+      error << "Error around line " << items[0].line << ".";
+    }
+
+    Exceptions::ParserError("STLReader::ParseFacet", error.str());
+  }
+
+  return triangles[0];
+}
+
+inline G4TriangularFacet *STLReader::ParseVertices(Items items) {
+  std::vector<G4ThreeVector> vertices;
+
+  for (auto item : items) {
+    if (item.children.size() == 0) {
+      std::stringstream error;
+      error << "The vertex appears to be empty."
+            << "Error around line " << item.line << ".";
+
+      Exceptions::ParserError("STLReader::ParseVertices", error.str());
+    }
+
+    vertices.push_back(ParseThreeVector(item.children));
+  }
+
+  if (vertices.size() != 3) {
+    std::stringstream error;
+    error << "STL files expect exactly 3 vertices for a triangular facet. ";
+
+    if (items.size() != 0) {
+      error << "Error around line " << items[0].line << ".";
+    }
+
+    Exceptions::ParserError("STLReader::ParseVertices", error.str());
+  }
+
+  return new G4TriangularFacet(vertices[0], vertices[1], vertices[2], ABSOLUTE);
+}
+
+inline G4ThreeVector STLReader::ParseThreeVector(Items items) {
+  std::vector<double> numbers;
+
+  for (auto item : items) {
+    numbers.push_back((double)atof(item.value.c_str()));
+  }
+
+  if (numbers.size() != 3) {
+    std::stringstream error;
+    error << "Three vectors in STL files require exactly 3 numbers";
+
+    if (items.size() != 0) {
+      error << "Error around line " << items[0].line << ".";
+    }
+
+    Exceptions::ParserError("STLReader::ParseThreeVector", error.str());
+  }
+
+  return G4ThreeVector(numbers[0], numbers[1], numbers[2]);
+}
+}
+}
+
+namespace CADMesh {
+
+namespace File {
+
+inline State *OBJReader::CADMeshLexerState(StartSolid) {
+  StartOfA(Solid);
+
+  TryState(Object);
+  TryState(Vertex);
+  TryState(Ignore);
+
+  Error("Invalid element tag.");
+}
+
+inline State *OBJReader::CADMeshLexerState(EndSolid) {
+  if (Next() != "")
+    lexer->LastError();
+
+  EndOfA(Solid);
+  FinalState();
+}
+
+inline State *OBJReader::CADMeshLexerState(Ignore) {
+  if (DidNotSkipLine())
+    NextState(EndSolid);
+
+  TryState(Object);
+  TryState(Vertex);
+  TryState(Facet);
+  TryState(Ignore);
+
+  NextState(EndSolid);
+}
+
+inline State *OBJReader::CADMeshLexerState(Vertex) {
+  SkipLineBreaks();
+
+  if (DoesNotMatchExactly("v "))
+    Error("A vertex is indicated by the tag 'v'.");
+
+  SkipWhiteSpace();
+  StartOfA(Vertex);
+
+  if (NotANumber())
+    Error("First number in three vector not found.");
+
+  ThisIsA(Number);
+  SkipWhiteSpace();
+
+  if (NotANumber())
+    Error("Second number in three vector not found.");
+
+  ThisIsA(Number);
+  SkipWhiteSpace();
+
+  if (NotANumber())
+    Error("Third number in three vector not found.");
+
+  ThisIsA(Number);
+
+  EndOfA(Vertex);
+
+  SkipLine();
+
+  TryState(Vertex);
+  TryState(Object);
+  TryState(Facet);
+  TryState(Ignore);
+
+  NextState(EndSolid);
+}
+
+inline State *OBJReader::CADMeshLexerState(Facet) {
+  SkipLineBreaks();
+
+  if (DoesNotMatchExactly("f "))
+    Error("A facet is indicated by the tag 'f'.");
+
+  SkipWhiteSpace();
+  StartOfA(Facet);
+
+  if (NotANumber())
+    Error("First number in three vector not found.");
+
+  ThisIsA(Number);
+
+  OneOf("/");
+  Number();
+  OneOf("/");
+  Number();
+  SkipWhiteSpace();
+
+  if (NotANumber())
+    Error("Second number in three vector not found.");
+
+  ThisIsA(Number);
+
+  OneOf("/");
+  Number();
+  OneOf("/");
+  Number();
+  SkipWhiteSpace();
+
+  if (NotANumber())
+    Error("Third number in three vector not found.");
+
+  ThisIsA(Number);
+
+  OneOf("/");
+  Number();
+  OneOf("/");
+  Number();
+  SkipWhiteSpace();
+
+  if (Number())
+    ThisIsA(Number);
 
   EndOfA(Facet);
 
   SkipLine();
 
-  TryState(Facet);
-  TryState(Vertex);
-  TryState(Object);
+  TryState(Facet);
+  TryState(Vertex);
+  TryState(Object);
+  TryState(Ignore);
+
+  NextState(EndSolid);
+}
+
+inline State *OBJReader::CADMeshLexerState(Object) {
+  SkipLineBreaks();
+
+  if (DoesNotMatchExactly("o "))
+    Error("An object is indicated by the tag 'o'.");
+
+  EndOfA(Solid);
+
+  SkipWhiteSpace();
+  StartOfA(Solid);
+
+  ManyCharacters();
+  ThisIsA(Word);
+  SkipWhiteSpace();
+
+  TryState(Vertex);
+  TryState(Facet);
+  TryState(Object);
+  TryState(Ignore);
+
+  NextState(EndSolid);
+}
+
+inline G4bool OBJReader::Read(G4String filepath) {
+  auto items = RunLexer(filepath, StartSolid);
+
+  if (items.size() == 0) {
+    Exceptions::ParserError("OBJReader::Read",
+                            "The OBJ file appears to be empty.");
+  }
+
+  for (auto item : items) {
+    if (item.children.size() == 0) {
+      continue;
+    }
+
+    auto mesh = ParseMesh(item.children);
+
+    if (mesh->GetTriangles().size() == 0) {
+      continue;
+    }
+
+    G4String name;
+
+    if (item.children[0].token == WordToken) {
+      name = item.children[0].value;
+    }
+
+    AddMesh(Mesh::New(mesh, name));
+  }
+
+  return true;
+}
+
+inline G4bool OBJReader::CanRead(Type file_type) { return (file_type == OBJ); }
+
+inline std::shared_ptr<Mesh> OBJReader::ParseMesh(Items items) {
+  Triangles facets;
+
+  for (auto item : items) {
+    if (item.token != VertexToken) {
+      continue;
+    }
+
+    if (item.children.size() == 0) {
+      std::stringstream error;
+      error << "The vertex appears to be empty."
+            << "Error around line " << item.line << ".";
+
+      Exceptions::ParserError("OBJReader::Mesh", error.str());
+    }
+
+    vertices_.push_back(ParseVertex(item.children));
+  }
+
+  for (auto item : items) {
+    if (item.token != FacetToken) {
+      continue;
+    }
+
+    if (item.children.size() == 0) {
+      std::stringstream error;
+      error << "The facet appears to be empty."
+            << "Error around line " << item.line << ".";
+
+      Exceptions::ParserError("OBJReader::Mesh", error.str());
+    }
+
+    facets.push_back(ParseFacet(item.children, false));
+
+    if (item.children.size() == 4) {
+      facets.push_back(ParseFacet(item.children, true));
+    }
+  }
+
+  return Mesh::New(facets);
+}
+
+inline G4ThreeVector OBJReader::ParseVertex(Items items) {
+  std::vector<double> numbers;
+
+  for (auto item : items) {
+    numbers.push_back((double)atof(item.value.c_str()));
+  }
+
+  if (numbers.size() != 3) {
+    std::stringstream error;
+    error << "Three vectors in OBJ files require exactly 3 numbers";
+
+    if (items.size() != 0) {
+      error << "Error around line " << items[0].line << ".";
+    }
+
+    Exceptions::ParserError("OBJReader::ParseThreeVector", error.str());
+  }
+
+  return G4ThreeVector(numbers[0], numbers[1], numbers[2]);
+}
+
+inline G4TriangularFacet *OBJReader::ParseFacet(Items items, G4bool quad) {
+  std::vector<int> indices;
+
+  for (auto item : items) {
+    indices.push_back((int)atoi(item.value.c_str()));
+  }
+
+  if (indices.size() < 3) {
+    std::stringstream error;
+    error << "Facets in OBJ files require at least 3 indicies";
+
+    if (items.size() != 0) {
+      error << "Error around line " << items[0].line << ".";
+    }
+
+    Exceptions::ParserError("OBJReader::ParseFacet", error.str());
+  }
+
+  if (quad && indices.size() != 4) {
+    std::stringstream error;
+    error << "Trying to triangle-ify a facet that isn't a quad";
+
+    if (items.size() != 0) {
+      error << "Error around line " << items[0].line << ".";
+    }
+
+    Exceptions::ParserError("OBJReader::ParseFacet", error.str());
+  }
+
+  if (quad) {
+    return new G4TriangularFacet(vertices_[indices[0] - 1],
+                                 vertices_[indices[2] - 1],
+                                 vertices_[indices[3] - 1], ABSOLUTE);
+  }
+
+  else {
+    return new G4TriangularFacet(vertices_[indices[0] - 1],
+                                 vertices_[indices[1] - 1],
+                                 vertices_[indices[2] - 1], ABSOLUTE);
+  }
+}
+}
+}
+
+namespace CADMesh {
+
+namespace File {
+
+inline State *PLYReader::CADMeshLexerState(StartHeader) {
+  if (DoesNotMatchExactly("ply"))
+    Error("PLY files start with 'ply'.");
+
+  StartOfA(Header);
+
+  SkipLine();
+
+  TryState(Element);
+  TryState(Ignore);
+
+  Error("Invalid header tag.");
+}
+
+inline State *PLYReader::CADMeshLexerState(EndHeader) {
+  if (DoesNotMatchExactly("end_header"))
+    Error("PLY file headers end with 'end_header'.");
+
+  MaybeEndOfA(Element);
+
+  EndOfA(Header);
+  FinalState();
+}
+
+inline State *PLYReader::CADMeshLexerState(Element) {
+  if (DoesNotMatchExactly("element "))
+    Error("An element is indicated by the tag 'element'.");
+
+  MaybeEndOfA(Element);
+
+  SkipWhiteSpace();
+  StartOfA(Element);
+
+  if (NotManyCharacters())
+    Error("Element type not found.");
+
+  ThisIsA(Word);
+  SkipWhiteSpace();
+
+  if (NotANumber())
+    Error("Element count not found.");
+
+  ThisIsA(Number);
+  SkipLine();
+
+  TryState(Property);
   TryState(Ignore);
 
-  NextState(EndSolid);
+  NextState(EndHeader);
 }
 
-inline State *OBJReader::CADMeshLexerState(Object) {
-  SkipLineBreaks();
+inline State *PLYReader::CADMeshLexerState(Property) {
+  if (DoesNotMatchExactly("property "))
+    Error("An property is indicated by the tag 'property'.");
 
-  if (DoesNotMatchExactly("o "))
-    Error("An object is indicated by the tag 'o'.");
+  SkipWhiteSpace();
+  StartOfA(Property);
 
-  EndOfA(Solid);
+  if (NotManyCharacters())
+    Error("Element type not found.");
 
+  ThisIsA(Word);
   SkipWhiteSpace();
-  StartOfA(Solid);
 
-  ManyCharacters();
+  RestOfLine();
   ThisIsA(Word);
+
+  EndOfA(Property);
+
+  SkipLineBreak();
+
+  TryState(Property);
+  TryState(Element);
+  TryState(EndHeader);
+  TryState(Ignore);
+
+  NextState(EndHeader);
+}
+
+inline State *PLYReader::CADMeshLexerState(Ignore) {
+  if (DidNotSkipLine())
+    NextState(EndHeader);
+
+  TryState(Element);
+  TryState(Property);
+  TryState(EndHeader);
+
+  NextState(Ignore);
+}
+
+inline State *PLYReader::CADMeshLexerState(Vertex) {
+  SkipLineBreaks();
   SkipWhiteSpace();
+  SkipLineBreaks();
+
+  StartOfA(Vertex);
+
+  size_t i = 0;
+
+  while (i < 32) {
+    if (AtEndOfLine())
+      break;
+
+    SkipWhiteSpace();
+
+    if (NotANumber())
+      Error("Expecting only numbers in the vertex specification.");
+
+    ThisIsA(Number);
+    SkipWhiteSpace();
+
+    i++;
+  }
+
+  EndOfA(Vertex);
+
+  SkipLine();
 
   TryState(Vertex);
+
+  FinalState();
+}
+
+inline State *PLYReader::CADMeshLexerState(Facet) {
+  SkipLineBreaks();
+  SkipWhiteSpace();
+  SkipLineBreaks();
+
+  StartOfA(Facet);
+
+  size_t i = 0;
+
+  while (i < 32) {
+    if (AtEndOfLine())
+      break;
+
+    SkipWhiteSpace();
+
+    if (NotANumber())
+      Error("Expecting only numbers in the facet specification.");
+
+    ThisIsA(Number);
+    SkipWhiteSpace();
+
+    i++;
+  }
+
+  EndOfA(Facet);
+
+  SkipLine();
+
   TryState(Facet);
-  TryState(Object);
-  TryState(Ignore);
 
-  NextState(EndSolid);
+  FinalState();
 }
 
-inline G4bool OBJReader::Read(G4String filepath) {
-  auto items = RunLexer(filepath, StartSolid);
+inline G4bool PLYReader::Read(G4String filepath) {
+  auto lexer = Lexer(filepath, new StartHeaderState);
+  auto items = lexer.GetItems();
 
   if (items.size() == 0) {
-    Exceptions::ParserError("OBJReader::Read",
-                            "The OBJ file appears to be empty.");
+    std::stringstream error;
+    error << "The header appears to be empty.";
+
+    Exceptions::ParserError("PLYReader::Read", error.str());
   }
 
-  for (auto item : items) {
-    if (item.children.size() == 0) {
-      continue;
-    }
+  ParseHeader(items);
 
-    auto mesh = ParseMesh(item.children);
+  lexer.Run(new VertexState, vertex_count_);
+  auto vertex_items = lexer.GetItems();
 
-    if (mesh->GetTriangles().size() == 0) {
-      continue;
-    }
+  if (vertex_items.size() == 0) {
+    Exceptions::ParserError("PLYReader::Read",
+                            "The PLY file appears to have no vertices.");
+  }
 
-    G4String name;
+  if (vertex_items.size() != vertex_count_) {
+    Exceptions::ParserError("PLYReader::Read",
+                            "The PLY file appears to be missing vertices.");
+  }
 
-    if (item.children[0].token == WordToken) {
-      name = item.children[0].value;
-    }
+  lexer.Run(new FacetState, facet_count_);
+  auto face_items = lexer.GetItems();
 
-    AddMesh(Mesh::New(mesh, name));
+  if (face_items.size() == 0) {
+    Exceptions::ParserError("PLYReader::Read",
+                            "The PLY file appears to have no facets.");
+  }
+
+  if (face_items.size() != facet_count_) {
+    Exceptions::ParserError("PLYReader::Read",
+                            "The PLY file appears to be missing facets");
   }
 
+  auto mesh = ParseMesh(vertex_items, face_items);
+  AddMesh(Mesh::New(mesh));
+
   return true;
 }
 
-inline G4bool OBJReader::CanRead(Type file_type) { return (file_type == OBJ); }
+inline G4bool PLYReader::CanRead(Type file_type) { return (file_type == PLY); }
 
-inline std::shared_ptr<Mesh> OBJReader::ParseMesh(Items items) {
-  Triangles facets;
+inline void PLYReader::ParseHeader(Items items) {
+  if (items.size() != 1) {
+    std::stringstream error;
+    error << "The header appears to be invalid or missing."
+          << "Error around line 1.";
 
-  for (auto item : items) {
-    if (item.token != VertexToken) {
-      continue;
+    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+  }
+
+  for (auto item : items[0].children) {
+    if (item.token == ElementToken) {
+      if (item.children.size() < 2) {
+        std::stringstream error;
+        error << "Invalid element information in header. Expecting 'vertex' or "
+                 "'face' and a number."
+              << "Error around line " << item.line << ".";
+
+        Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+      }
+
+      if (item.children[0].token == WordToken &&
+          item.children[1].token == NumberToken) {
+        if (item.children[0].value == "vertex") {
+          vertex_count_ = atoi(item.children[1].value.c_str());
+
+          for (size_t i = 2; i < item.children.size(); i++) {
+            auto property = item.children[i];
+
+            if (property.children.size() > 1) {
+              if (property.children[1].token == WordToken) {
+                if (property.children[1].value == "x") {
+                  x_index_ = i - 2;
+                }
+
+                if (property.children[1].value == "y") {
+                  y_index_ = i - 2;
+                }
+
+                if (property.children[1].value == "z") {
+                  z_index_ = i - 2;
+                }
+              }
+            }
+          }
+        }
+
+        else if (item.children[0].value == "face") {
+          facet_count_ = atoi(item.children[1].value.c_str());
+
+          for (size_t i = 2; i < item.children.size(); i++) {
+            auto property = item.children[i];
+
+            if (property.children.size() > 1) {
+              if (property.children[1].token == WordToken) {
+                if (property.children[1].value == "uchar int vertex_indices") {
+                  facet_index_ = i - 2;
+                }
+              }
+            }
+          }
+        }
+      }
     }
+  }
+
+  if (vertex_count_ == 0) {
+    std::stringstream error;
+    error << "The number of vertices was not found in the header.";
+
+    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+  }
+
+  if (facet_count_ == 0) {
+    std::stringstream error;
+    error << "The number of faces was not found in the header.";
+
+    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+  }
+
+  if ((x_index_ == y_index_) || (y_index_ == z_index_) ||
+      (x_index_ == z_index_)) {
+    std::stringstream error;
+    error << "The vertex x, y, z indices were not found in the header.";
+
+    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+  }
+}
+
+inline std::shared_ptr<Mesh> PLYReader::ParseMesh(Items vertex_items,
+                                                  Items face_items) {
+  Points vertices;
+  Triangles facets;
 
+  for (auto item : vertex_items) {
     if (item.children.size() == 0) {
       std::stringstream error;
       error << "The vertex appears to be empty."
             << "Error around line " << item.line << ".";
 
-      Exceptions::ParserError("OBJReader::Mesh", error.str());
+      Exceptions::ParserError("PLYReader::ParseMesh", error.str());
     }
 
-    vertices_.push_back(ParseVertex(item.children));
-  }
-
-  for (auto item : items) {
-    if (item.token != FacetToken) {
-      continue;
+    if (item.token == VertexToken) {
+      vertices.push_back(ParseVertex(item.children));
     }
+  }
 
+  for (auto item : face_items) {
     if (item.children.size() == 0) {
       std::stringstream error;
       error << "The facet appears to be empty."
             << "Error around line " << item.line << ".";
 
-      Exceptions::ParserError("OBJReader::Mesh", error.str());
+      Exceptions::ParserError("PLYReader::Mesh", error.str());
     }
 
-    facets.push_back(ParseFacet(item.children, false));
-
-    if (item.children.size() == 4) {
-      facets.push_back(ParseFacet(item.children, true));
+    if (item.token == FacetToken) {
+      facets.push_back(ParseFacet(item.children, vertices));
     }
   }
 
   return Mesh::New(facets);
 }
 
-inline G4ThreeVector OBJReader::ParseVertex(Items items) {
+inline G4ThreeVector PLYReader::ParseVertex(Items items) {
   std::vector<double> numbers;
 
   for (auto item : items) {
     numbers.push_back((double)atof(item.value.c_str()));
   }
 
-  if (numbers.size() != 3) {
+  if (numbers.size() < 3) {
     std::stringstream error;
-    error << "Three vectors in OBJ files require exactly 3 numbers";
+    error << "Vertices in PLY files require atleast 3 numbers. ";
 
     if (items.size() != 0) {
       error << "Error around line " << items[0].line << ".";
     }
 
-    Exceptions::ParserError("OBJReader::ParseThreeVector", error.str());
+    Exceptions::ParserError("PLYReader::ParseVertex", error.str());
   }
 
-  return G4ThreeVector(numbers[0], numbers[1], numbers[2]);
+  return G4ThreeVector(numbers[x_index_], numbers[y_index_], numbers[z_index_]);
 }
 
-inline G4TriangularFacet *OBJReader::ParseFacet(Items items, G4bool quad) {
+inline G4TriangularFacet *PLYReader::ParseFacet(Items items, Points vertices) {
   std::vector<int> indices;
 
   for (auto item : items) {
     indices.push_back((int)atoi(item.value.c_str()));
   }
 
-  if (indices.size() < 3) {
+  if (indices.size() < 4) {
     std::stringstream error;
-    error << "Facets in OBJ files require at least 3 indicies";
+    error << "Facets in PLY files require 3 indicies";
 
     if (items.size() != 0) {
       error << "Error around line " << items[0].line << ".";
     }
 
-    Exceptions::ParserError("OBJReader::ParseFacet", error.str());
+    Exceptions::ParserError("PLYReader::ParseFacet", error.str());
   }
 
-  if (quad && indices.size() != 4) {
-    std::stringstream error;
-    error << "Trying to triangle-ify a facet that isn't a quad";
+  return new G4TriangularFacet(vertices[indices[1 + facet_index_]],
+                               vertices[indices[2 + facet_index_]],
+                               vertices[indices[3 + facet_index_]], ABSOLUTE);
+}
+}
+}
 
-    if (items.size() != 0) {
-      error << "Error around line " << items[0].line << ".";
-    }
+namespace CADMesh {
 
-    Exceptions::ParserError("OBJReader::ParseFacet", error.str());
+namespace File {
+
+inline G4bool FastReader::Read(G4String filepath) {
+  std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+
+  if (!file) {
+    Exceptions::FileNotFound("FastReader::Read", filepath);
+    return false;
   }
 
-  if (quad) {
-    return new G4TriangularFacet(vertices_[indices[0] - 1],
-                                 vertices_[indices[2] - 1],
-                                 vertices_[indices[3] - 1], ABSOLUTE);
+  filepath_ = filepath;
+  buffer_.resize(file.tellg());
+  file.seekg(0);
+  file.read(&buffer_[0], buffer_.size());
+
+  position_ = buffer_.data();
+  end_ = position_ + buffer_.size();
+
+  if (Keyword("ply")) {
+    ReadPLY();
+  }
+
+  else if (IsBinarySTL()) {
+    ReadBinarySTL();
   }
 
   else {
-    return new G4TriangularFacet(vertices_[indices[0] - 1],
-                                 vertices_[indices[1] - 1],
-                                 vertices_[indices[2] - 1], ABSOLUTE);
+    ReadSTL();
   }
+
+  return true;
 }
-}
+
+inline G4bool FastReader::CanRead(Type file_type) {
+  return file_type == PLY || file_type == STL;
 }
 
-namespace CADMesh {
+inline void FastReader::ReadPLY() {
+  std::vector<Element> elements;
+  G4String format;
 
-namespace File {
+  while (!Keyword("end_header")) {
+    if (position_ == end_) {
+      Fail("PLY file headers end with 'end_header'.");
+    }
 
-inline State *PLYReader::CADMeshLexerState(StartHeader) {
-  if (DoesNotMatchExactly("ply"))
-    Error("PLY files start with 'ply'.");
+    if (Keyword("format")) {
+      format = Word();
 
-  StartOfA(Header);
+      if (format != "ascii" && format != "binary_little_endian" &&
+          format != "binary_big_endian") {
+        Fail("Unknown PLY format '" + format + "'.");
+      }
+    }
 
-  SkipLine();
+    else if (Keyword("element")) {
+      Element element;
+      element.name = Word();
 
-  TryState(Element);
-  TryState(Ignore);
+      if (!ParseIndex(element.count)) {
+        Fail("Element count not found.");
+      }
 
-  Error("Invalid header tag.");
-}
+      elements.push_back(element);
+    }
 
-inline State *PLYReader::CADMeshLexerState(EndHeader) {
-  if (DoesNotMatchExactly("end_header"))
-    Error("PLY file headers end with 'end_header'.");
+    else if (Keyword("property")) {
+      if (elements.empty()) {
+        Fail("A property before any element.");
+      }
 
-  MaybeEndOfA(Element);
+      Property property;
+      property.type = Word();
+      property.list = property.type == "list";
 
-  EndOfA(Header);
-  FinalState();
+      if (property.list) {
+        property.count_type = Word();
+        property.type = Word();
+      }
+
+      property.name = Word();
+      property.scalar = ScalarFromName(property.type);
+      property.count_scalar =
+          property.list ? ScalarFromName(property.count_type) : UInt8;
+      elements.back().properties.push_back(property);
+    }
+
+    SkipToNextLine();
+  }
+
+  // The data starts right after the newline that ends the header
+  SkipToNextLine();
+
+  if (format.empty()) {
+    Fail("The PLY header has no format.");
+  }
+
+  binary_ = format != "ascii";
+  swap_ = binary_ &&
+          (format == "binary_little_endian") != LittleEndianMachine();
+
+  Points points;
+  Indices indices;
+  std::vector<size_t> polygon;
+
+  for (auto &element : elements) {
+    size_t x_index = element.properties.size();
+    size_t y_index = x_index, z_index = x_index, list_index = x_index;
+
+    for (size_t i = 0; i < element.properties.size(); i++) {
+      auto &name = element.properties[i].name;
+
+      if (name == "x")
+        x_index = i;
+      if (name == "y")
+        y_index = i;
+      if (name == "z")
+        z_index = i;
+      if (element.properties[i].list &&
+          (name == "vertex_indices" || name == "vertex_index"))
+        list_index = i;
+    }
+
+    G4bool is_vertex = element.name == "vertex";
+    G4bool is_face = element.name == "face";
+
+    if (is_vertex && (x_index == element.properties.size() ||
+                      y_index == element.properties.size() ||
+                      z_index == element.properties.size())) {
+      Fail("The vertex x, y, z properties were not found in the header.");
+    }
+
+    if (is_face && list_index == element.properties.size()) {
+      Fail("The face vertex_indices property was not found in the header.");
+    }
+
+    if (is_vertex) {
+      points.reserve(element.count);
+    }
+
+    if (is_face) {
+      indices.reserve(3 * element.count);
+    }
+
+    for (size_t n = 0; n < element.count; n++) {
+      G4double xyz[3] = {0, 0, 0};
+
+      for (size_t i = 0; i < element.properties.size(); i++) {
+        auto &property = element.properties[i];
+
+        if (is_face && i == list_index) {
+          size_t count = 0;
+
+          if (!ReadIndex(property.count_scalar, count) || count < 3) {
+            Fail("Faces need at least 3 vertex indices.");
+          }
+
+          polygon.resize(count);
+
+          for (auto &index : polygon) {
+            if (!ReadIndex(property.scalar, index) || index >= points.size()) {
+              Fail("Invalid vertex index in a face.");
+            }
+          }
+
+          // Polygons are split into a fan of triangles
+          for (size_t k = 1; k + 1 < count; k++) {
+            indices.push_back(polygon[0]);
+            indices.push_back(polygon[k]);
+            indices.push_back(polygon[k + 1]);
+          }
+        }
+
+        else if (property.list) {
+          size_t count = 0;
+
+          if (!ReadIndex(property.count_scalar, count)) {
+            Fail("Expecting the length of a list.");
+          }
+
+          for (size_t k = 0; k < count; k++) {
+            SkipValue(property.scalar);
+          }
+        }
+
+        else if (is_vertex && (i == x_index || i == y_index || i == z_index)) {
+          size_t axis = i == x_index ? 0 : i == y_index ? 1 : 2;
+
+          if (!ReadValue(property.scalar, xyz[axis])) {
+            Fail("Expecting only numbers in the vertex specification.");
+          }
+        }
+
+        else {
+          SkipValue(property.scalar);
+        }
+      }
+
+      if (is_vertex) {
+        points.push_back(G4ThreeVector(xyz[0], xyz[1], xyz[2]));
+      }
+    }
+  }
+
+  if (points.empty()) {
+    Fail("The PLY file appears to have no vertices.");
+  }
+
+  if (indices.empty()) {
+    Fail("The PLY file appears to have no facets.");
+  }
+
+  AddMesh(Mesh::New(std::move(points), std::move(indices)));
 }
 
-inline State *PLYReader::CADMeshLexerState(Element) {
-  if (DoesNotMatchExactly("element "))
-    Error("An element is indicated by the tag 'element'.");
+inline void FastReader::ReadSTL() {
+  if (!Keyword("solid")) {
+    Fail("STL files start with 'solid'.");
+  }
 
-  MaybeEndOfA(Element);
+  // Each solid of the file is a mesh of its own
+  while (true) {
+    while (position_ < end_ && (*position_ == ' ' || *position_ == '\t')) {
+      position_++;
+    }
 
-  SkipWhiteSpace();
-  StartOfA(Element);
+    auto name_end = position_;
+    while (name_end < end_ && *name_end != '\n' && *name_end != '\r') {
+      name_end++;
+    }
 
-  if (NotManyCharacters())
-    Error("Element type not found.");
+    G4String name(position_, name_end);
+    SkipToNextLine();
 
-  ThisIsA(Word);
-  SkipWhiteSpace();
+    Points points;
+    Indices indices;
+    G4double value;
 
-  if (NotANumber())
-    Error("Element count not found.");
+    while (Keyword("facet")) {
+      Expect("normal");
 
-  ThisIsA(Number);
-  SkipLine();
+      for (int i = 0; i < 3; i++) {
+        if (!ParseNumber(value)) {
+          Fail("Facet normals need three numbers.");
+        }
+      }
 
-  TryState(Property);
-  TryState(Ignore);
+      Expect("outer");
+      Expect("loop");
 
-  NextState(EndHeader);
+      for (int vertex = 0; vertex < 3; vertex++) {
+        G4double xyz[3];
+        Expect("vertex");
+
+        for (auto &coordinate : xyz) {
+          if (!ParseNumber(coordinate)) {
+            Fail("Vertices need three numbers.");
+          }
+        }
+
+        indices.push_back(points.size());
+        points.push_back(G4ThreeVector(xyz[0], xyz[1], xyz[2]));
+      }
+
+      Expect("endloop");
+      Expect("endfacet");
+    }
+
+    Expect("endsolid");
+    SkipToNextLine();
+
+    if (indices.empty()) {
+      Fail("The mesh appears to be empty.");
+    }
+
+    AddMesh(Mesh::New(std::move(points), std::move(indices), name));
+
+    SkipSpace();
+    if (position_ == end_) {
+      break;
+    }
+
+    Expect("solid");
+  }
 }
 
-inline State *PLYReader::CADMeshLexerState(Property) {
-  if (DoesNotMatchExactly("property "))
-    Error("An property is indicated by the tag 'property'.");
+inline G4bool FastReader::IsBinarySTL() {
+  if (buffer_.size() < 84) {
+    return false;
+  }
 
-  SkipWhiteSpace();
-  StartOfA(Property);
+  auto count = reinterpret_cast<const unsigned char *>(buffer_.data() + 80);
+  size_t facets = size_t(count[0]) | size_t(count[1]) << 8 |
+                  size_t(count[2]) << 16 | size_t(count[3]) << 24;
 
-  if (NotManyCharacters())
-    Error("Element type not found.");
+  return buffer_.size() == 84 + 50 * facets;
+}
 
-  ThisIsA(Word);
-  SkipWhiteSpace();
+inline void FastReader::ReadBinarySTL() {
+  // An 80 byte header, the facet count and then per facet the normal, the
+  // three vertices as little endian floats and two bytes of attributes
+  size_t facets = (buffer_.size() - 84) / 50;
 
-  RestOfLine();
-  ThisIsA(Word);
+  if (facets == 0) {
+    position_ = end_;
+    Fail("The mesh appears to be empty.");
+  }
 
-  EndOfA(Property);
+  binary_ = true;
+  swap_ = !LittleEndianMachine();
 
-  SkipLineBreak();
+  Points points;
+  Indices indices;
 
-  TryState(Property);
-  TryState(Element);
-  TryState(EndHeader);
-  TryState(Ignore);
+  points.reserve(3 * facets);
+  indices.reserve(3 * facets);
 
-  NextState(EndHeader);
+  for (size_t n = 0; n < facets; n++) {
+    position_ = buffer_.data() + 84 + 50 * n + 12;
+
+    for (int vertex = 0; vertex < 3; vertex++) {
+      G4double x = BinaryValue(Float32);
+      G4double y = BinaryValue(Float32);
+      G4double z = BinaryValue(Float32);
+
+      indices.push_back(points.size());
+      points.push_back(G4ThreeVector(x, y, z));
+    }
+  }
+
+  AddMesh(Mesh::New(std::move(points), std::move(indices)));
 }
 
-inline State *PLYReader::CADMeshLexerState(Ignore) {
-  if (DidNotSkipLine())
-    NextState(EndHeader);
+inline void FastReader::SkipSpace() {
+  while (position_ < end_ && std::isspace(static_cast<unsigned char>(*position_))) {
+    position_++;
+  }
+}
 
-  TryState(Element);
-  TryState(Property);
-  TryState(EndHeader);
+inline void FastReader::SkipToNextLine() {
+  auto newline = static_cast<const char *>(
+      std::memchr(position_, '\n', end_ - position_));
 
-  NextState(Ignore);
+  position_ = newline ? newline + 1 : end_;
 }
 
-inline State *PLYReader::CADMeshLexerState(Vertex) {
-  SkipLineBreaks();
-  SkipWhiteSpace();
-  SkipLineBreaks();
+inline G4bool FastReader::Keyword(const char *word) {
+  SkipSpace();
 
-  StartOfA(Vertex);
+  size_t length = std::strlen(word);
 
-  size_t i = 0;
+  if (size_t(end_ - position_) < length ||
+      std::memcmp(position_, word, length) != 0) {
+    return false;
+  }
 
-  while (i < 32) {
-    if (AtEndOfLine())
-      break;
+  if (position_ + length < end_ &&
+      !std::isspace(static_cast<unsigned char>(position_[length]))) {
+    return false;
+  }
 
-    SkipWhiteSpace();
+  position_ += length;
+  return true;
+}
 
-    if (NotANumber())
-      Error("Expecting only numbers in the vertex specification.");
+inline void FastReader::Expect(const char *word) {
+  if (!Keyword(word)) {
+    Fail(G4String("Expecting '") + word + "'.");
+  }
+}
 
-    ThisIsA(Number);
-    SkipWhiteSpace();
+inline G4String FastReader::Word() {
+  while (position_ < end_ && (*position_ == ' ' || *position_ == '\t')) {
+    position_++;
+  }
+
+  auto start = position_;
+  while (position_ < end_ &&
+         !std::isspace(static_cast<unsigned char>(*position_))) {
+    position_++;
+  }
+
+  return G4String(start, position_);
+}
+
+inline G4bool FastReader::ParseNumber(G4double &value) {
+  SkipSpace();
+
+  if (position_ < end_ && *position_ == '+') {
+    position_++;
+  }
 
-    i++;
+  auto result = std::from_chars(position_, end_, value);
+  if (result.ec != std::errc()) {
+    return false;
   }
 
-  EndOfA(Vertex);
+  position_ = result.ptr;
+  return true;
+}
 
-  SkipLine();
+inline G4bool FastReader::ParseIndex(size_t &value) {
+  SkipSpace();
 
-  TryState(Vertex);
+  auto result = std::from_chars(position_, end_, value);
+  if (result.ec != std::errc()) {
+    return false;
+  }
 
-  FinalState();
+  position_ = result.ptr;
+  return true;
 }
 
-inline State *PLYReader::CADMeshLexerState(Facet) {
-  SkipLineBreaks();
-  SkipWhiteSpace();
-  SkipLineBreaks();
+inline G4bool FastReader::ReadValue(Scalar scalar, G4double &value) {
+  if (!binary_) {
+    return ParseNumber(value);
+  }
 
-  StartOfA(Facet);
+  value = BinaryValue(scalar);
+  return true;
+}
 
-  size_t i = 0;
+inline G4bool FastReader::ReadIndex(Scalar scalar, size_t &value) {
+  if (!binary_) {
+    return ParseIndex(value);
+  }
 
-  while (i < 32) {
-    if (AtEndOfLine())
-      break;
+  if (scalar == Float32 || scalar == Float64) {
+    return false;
+  }
 
-    SkipWhiteSpace();
+  G4double number = BinaryValue(scalar);
+  if (number < 0) {
+    return false;
+  }
 
-    if (NotANumber())
-      Error("Expecting only numbers in the facet specification.");
+  value = size_t(number);
+  return true;
+}
 
-    ThisIsA(Number);
-    SkipWhiteSpace();
+inline void FastReader::SkipValue(Scalar scalar) {
+  if (binary_) {
+    if (size_t(end_ - position_) < ScalarSize(scalar)) {
+      Fail("Unexpected end of file.");
+    }
 
-    i++;
+    position_ += ScalarSize(scalar);
+    return;
   }
 
-  EndOfA(Facet);
-
-  SkipLine();
+  SkipSpace();
 
-  TryState(Facet);
+  if (position_ == end_) {
+    Fail("Unexpected end of file.");
+  }
 
-  FinalState();
+  while (position_ < end_ &&
+         !std::isspace(static_cast<unsigned char>(*position_))) {
+    position_++;
+  }
 }
 
-inline G4bool PLYReader::Read(G4String filepath) {
-  auto lexer = Lexer(filepath, new StartHeaderState);
-  auto items = lexer.GetItems();
+inline G4bool FastReader::LittleEndianMachine() {
+  const uint16_t one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+
+  return first == 1;
+}
+
+inline FastReader::Scalar FastReader::ScalarFromName(G4String name) {
+  if (name == "char" || name == "int8")
+    return Int8;
+  if (name == "uchar" || name == "uint8")
+    return UInt8;
+  if (name == "short" || name == "int16")
+    return Int16;
+  if (name == "ushort" || name == "uint16")
+    return UInt16;
+  if (name == "int" || name == "int32")
+    return Int32;
+  if (name == "uint" || name == "uint32")
+    return UInt32;
+  if (name == "float" || name == "float32")
+    return Float32;
+  if (name == "double" || name == "float64")
+    return Float64;
+
+  Fail("Unknown PLY property type '" + name + "'.");
+  return Float64;
+}
+
+inline size_t FastReader::ScalarSize(Scalar scalar) {
+  switch (scalar) {
+  case Int8:
+  case UInt8:
+    return 1;
+  case Int16:
+  case UInt16:
+    return 2;
+  case Int32:
+  case UInt32:
+  case Float32:
+    return 4;
+  default:
+    return 8;
+  }
+}
 
-  if (items.size() == 0) {
-    std::stringstream error;
-    error << "The header appears to be empty.";
+inline G4double FastReader::BinaryValue(Scalar scalar) {
+  size_t size = ScalarSize(scalar);
 
-    Exceptions::ParserError("PLYReader::Read", error.str());
+  if (size_t(end_ - position_) < size) {
+    Fail("Unexpected end of file.");
   }
 
-  ParseHeader(items);
-
-  lexer.Run(new VertexState, vertex_count_);
-  auto vertex_items = lexer.GetItems();
+  unsigned char bytes[8];
+  std::memcpy(bytes, position_, size);
+  position_ += size;
 
-  if (vertex_items.size() == 0) {
-    Exceptions::ParserError("PLYReader::Read",
-                            "The PLY file appears to have no vertices.");
+  if (swap_) {
+    std::reverse(bytes, bytes + size);
   }
 
-  if (vertex_items.size() != vertex_count_) {
-    Exceptions::ParserError("PLYReader::Read",
-                            "The PLY file appears to be missing vertices.");
+  switch (scalar) {
+  case Int8: {
+    int8_t value;
+    std::memcpy(&value, bytes, size);
+    return value;
   }
+  case UInt8:
+    return bytes[0];
+  case Int16: {
+    int16_t value;
+    std::memcpy(&value, bytes, size);
+    return value;
+  }
+  case UInt16: {
+    uint16_t value;
+    std::memcpy(&value, bytes, size);
+    return value;
+  }
+  case Int32: {
+    int32_t value;
+    std::memcpy(&value, bytes, size);
+    return value;
+  }
+  case UInt32: {
+    uint32_t value;
+    std::memcpy(&value, bytes, size);
+    return value;
+  }
+  case Float32: {
+    float value;
+    std::memcpy(&value, bytes, size);
+    return value;
+  }
+  default: {
+    double value;
+    std::memcpy(&value, bytes, size);
+    return value;
+  }
+  }
+}
 
-  lexer.Run(new FacetState, facet_count_);
-  auto face_items = lexer.GetItems();
+inline void FastReader::Fail(G4String message) {
+  std::stringstream error;
+  error << filepath_ << ": " << message;
 
-  if (face_items.size() == 0) {
-    Exceptions::ParserError("PLYReader::Read",
-                            "The PLY file appears to have no facets.");
+  if (binary_) {
+    error << " Error around byte " << position_ - buffer_.data() << ".";
   }
 
-  if (face_items.size() != facet_count_) {
-    Exceptions::ParserError("PLYReader::Read",
-                            "The PLY file appears to be missing facets");
+  else {
+    error << " Error around line "
+          << std::count(static_cast<const char *>(buffer_.data()), position_,
+                        '\n') + 1
+          << ".";
   }
 
-  auto mesh = ParseMesh(vertex_items, face_items);
-  AddMesh(Mesh::New(mesh));
-
-  return true;
+  Exceptions::ParserError("FastReader::Read", error.str());
 }
 
-inline G4bool PLYReader::CanRead(Type file_type) { return (file_type == PLY); }
+inline std::shared_ptr<FastReader> Fast() {
+  return std::make_shared<FastReader>();
+}
 
-inline void PLYReader::ParseHeader(Items items) {
-  if (items.size() != 1) {
-    std::stringstream error;
-    error << "The header appears to be invalid or missing."
-          << "Error around line 1.";
+inline G4bool CachedReader::Read(G4String filepath) {
+  std::ifstream file(filepath, std::ios::binary | std::ios::ate);
 
-    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+  if (!file) {
+    Exceptions::FileNotFound("CachedReader::Read", filepath);
+    return false;
   }
 
-  for (auto item : items[0].children) {
-    if (item.token == ElementToken) {
-      if (item.children.size() < 2) {
-        std::stringstream error;
-        error << "Invalid element information in header. Expecting 'vertex' or "
-                 "'face' and a number."
-              << "Error around line " << item.line << ".";
+  std::string content(size_t(file.tellg()), '\0');
+  file.seekg(0);
+  file.read(&content[0], content.size());
 
-        Exceptions::ParserError("PLYReader::ParseHeader", error.str());
-      }
+  auto hash = Hash(content.data(), content.size());
+  auto cache = filepath + ".cache";
 
-      if (item.children[0].token == WordToken &&
-          item.children[1].token == NumberToken) {
-        if (item.children[0].value == "vertex") {
-          vertex_count_ = atoi(item.children[1].value.c_str());
+  if (!ReadCache(cache, hash, content.size())) {
+    if (!reader_->Read(filepath)) {
+      return false;
+    }
 
-          for (size_t i = 2; i < item.children.size(); i++) {
-            auto property = item.children[i];
+    for (auto mesh : reader_->GetMeshes()) {
+      auto welded = Weld(mesh);
+      welded->IsValidForNavigation();
+      AddMesh(welded);
+    }
 
-            if (property.children.size() > 1) {
-              if (property.children[1].token == WordToken) {
-                if (property.children[1].value == "x") {
-                  x_index_ = i - 2;
-                }
+    WriteCache(cache, hash, content.size());
+  }
 
-                if (property.children[1].value == "y") {
-                  y_index_ = i - 2;
-                }
+  for (auto mesh : GetMeshes()) {
+    if (!mesh->IsValidForNavigation()) {
+      Exceptions::MeshNotValid("CachedReader::Read", filepath,
+                               mesh->GetName());
+    }
+  }
 
-                if (property.children[1].value == "z") {
-                  z_index_ = i - 2;
-                }
-              }
-            }
-          }
-        }
+  return true;
+}
 
-        else if (item.children[0].value == "face") {
-          facet_count_ = atoi(item.children[1].value.c_str());
+inline G4bool CachedReader::CanRead(Type file_type) {
+  return reader_->CanRead(file_type);
+}
 
-          for (size_t i = 2; i < item.children.size(); i++) {
-            auto property = item.children[i];
+inline uint64_t CachedReader::Hash(const char *data, size_t size) {
+  // FNV-1a over 8 byte words, then over the bytes left
+  uint64_t hash = 14695981039346656037ULL ^ size;
+  size_t i = 0;
 
-            if (property.children.size() > 1) {
-              if (property.children[1].token == WordToken) {
-                if (property.children[1].value == "uchar int vertex_indices") {
-                  facet_index_ = i - 2;
-                }
-              }
-            }
-          }
-        }
-      }
-    }
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    hash = (hash ^ word) * 1099511628211ULL;
   }
 
-  if (vertex_count_ == 0) {
-    std::stringstream error;
-    error << "The number of vertices was not found in the header.";
-
-    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+  for (; i < size; i++) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
   }
 
-  if (facet_count_ == 0) {
-    std::stringstream error;
-    error << "The number of faces was not found in the header.";
+  return hash ^ (hash >> 32);
+}
 
-    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+// A cache file is a header, then per mesh its name, whether it is valid
+// for navigation, its points as three doubles and its triangles as three
+// 32 bit indices. Numbers are in the byte order of the machine.
+static const char CADMESH_CACHE_MAGIC[8] = {'C', 'A', 'D', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t CADMESH_CACHE_VERSION = 1;
+
+inline G4bool CachedReader::ReadCache(G4String cache, uint64_t hash,
+                                      uint64_t size) {
+  std::ifstream file(cache, std::ios::binary | std::ios::ate);
+
+  if (!file) {
+    return false;
   }
 
-  if ((x_index_ == y_index_) || (y_index_ == z_index_) ||
-      (x_index_ == z_index_)) {
-    std::stringstream error;
-    error << "The vertex x, y, z indices were not found in the header.";
+  std::string buffer(size_t(file.tellg()), '\0');
+  file.seekg(0);
+  file.read(&buffer[0], buffer.size());
 
-    Exceptions::ParserError("PLYReader::ParseHeader", error.str());
+  size_t position = 0;
+  auto take = [&](void *value, size_t bytes) {
+    if (!file || buffer.size() - position < bytes) {
+      return false;
+    }
+
+    std::memcpy(value, buffer.data() + position, bytes);
+    position += bytes;
+    return true;
+  };
+
+  char magic[8];
+  uint32_t version, mesh_count;
+  uint64_t stored_size, stored_hash;
+
+  if (!take(magic, 8) || std::memcmp(magic, CADMESH_CACHE_MAGIC, 8) != 0 ||
+      !take(&version, 4) || version != CADMESH_CACHE_VERSION ||
+      !take(&mesh_count, 4) || !take(&stored_size, 8) ||
+      !take(&stored_hash, 8) || stored_size != size || stored_hash != hash) {
+    return false;
   }
-}
 
-inline std::shared_ptr<Mesh> PLYReader::ParseMesh(Items vertex_items,
-                                                  Items face_items) {
-  Points vertices;
-  Triangles facets;
+  Meshes meshes;
 
-  for (auto item : vertex_items) {
-    if (item.children.size() == 0) {
-      std::stringstream error;
-      error << "The vertex appears to be empty."
-            << "Error around line " << item.line << ".";
+  for (uint32_t m = 0; m < mesh_count; m++) {
+    uint32_t name_length, valid;
+    uint64_t point_count, index_count;
 
-      Exceptions::ParserError("PLYReader::ParseMesh", error.str());
+    if (!take(&name_length, 4) || buffer.size() - position < name_length) {
+      return false;
     }
 
-    if (item.token == VertexToken) {
-      vertices.push_back(ParseVertex(item.children));
-    }
-  }
+    G4String name(buffer.data() + position, name_length);
+    position += name_length;
 
-  for (auto item : face_items) {
-    if (item.children.size() == 0) {
-      std::stringstream error;
-      error << "The facet appears to be empty."
-            << "Error around line " << item.line << ".";
+    if (!take(&valid, 4) || !take(&point_count, 8) || !take(&index_count, 8) ||
+        (buffer.size() - position) / 24 < point_count ||
+        (buffer.size() - position - 24 * point_count) / 4 < index_count) {
+      return false;
+    }
 
-      Exceptions::ParserError("PLYReader::Mesh", error.str());
+    Points points(point_count);
+    for (auto &point : points) {
+      G4double xyz[3];
+      take(xyz, sizeof(xyz));
+      point.set(xyz[0], xyz[1], xyz[2]);
     }
 
-    if (item.token == FacetToken) {
-      facets.push_back(ParseFacet(item.children, vertices));
+    std::vector<uint32_t> stored_indices(index_count);
+    take(stored_indices.data(), 4 * index_count);
+
+    Indices indices(stored_indices.begin(), stored_indices.end());
+    for (auto index : indices) {
+      if (index >= point_count) {
+        return false;
+      }
     }
+
+    auto mesh = Mesh::New(std::move(points), std::move(indices), name);
+    mesh->SetValidForNavigation(valid);
+    meshes.push_back(mesh);
   }
 
-  return Mesh::New(facets);
+  if (position != buffer.size() || meshes.empty()) {
+    return false;
+  }
+
+  SetMeshes(meshes);
+  return true;
 }
 
-inline G4ThreeVector PLYReader::ParseVertex(Items items) {
-  std::vector<double> numbers;
+inline void CachedReader::WriteCache(G4String cache, uint64_t hash,
+                                     uint64_t size) {
+  // Written under another name and renamed, so that runs starting together
+  // never read a partial cache
+  std::stringstream temporary;
+  temporary << cache << ".tmp" << std::random_device()();
 
-  for (auto item : items) {
-    numbers.push_back((double)atof(item.value.c_str()));
-  }
+  std::ofstream file(temporary.str(), std::ios::binary | std::ios::trunc);
 
-  if (numbers.size() < 3) {
-    std::stringstream error;
-    error << "Vertices in PLY files require atleast 3 numbers. ";
+  auto put = [&](const void *value, size_t bytes) {
+    file.write(static_cast<const char *>(value), bytes);
+  };
 
-    if (items.size() != 0) {
-      error << "Error around line " << items[0].line << ".";
+  auto meshes = GetMeshes();
+  uint32_t mesh_count = meshes.size();
+
+  put(CADMESH_CACHE_MAGIC, 8);
+  put(&CADMESH_CACHE_VERSION, 4);
+  put(&mesh_count, 4);
+  put(&size, 8);
+  put(&hash, 8);
+
+  G4bool fits = true;
+
+  for (auto mesh : meshes) {
+    auto name = mesh->GetName();
+    auto points = mesh->GetPoints();
+    auto &indices = mesh->GetIndices();
+
+    uint32_t name_length = name.size();
+    uint32_t valid = mesh->IsValidForNavigation();
+    uint64_t point_count = points.size();
+    uint64_t index_count = indices.size();
+
+    fits = fits && point_count <= UINT32_MAX;
+
+    put(&name_length, 4);
+    put(name.data(), name_length);
+    put(&valid, 4);
+    put(&point_count, 8);
+    put(&index_count, 8);
+
+    for (auto &point : points) {
+      G4double xyz[3] = {point.x(), point.y(), point.z()};
+      put(xyz, sizeof(xyz));
     }
 
-    Exceptions::ParserError("PLYReader::ParseVertex", error.str());
+    std::vector<uint32_t> stored_indices(indices.begin(), indices.end());
+    put(stored_indices.data(), 4 * index_count);
   }
 
-  return G4ThreeVector(numbers[x_index_], numbers[y_index_], numbers[z_index_]);
+  file.close();
+
+  if (!fits || !file ||
+      std::rename(temporary.str().c_str(), cache.c_str()) != 0) {
+    std::remove(temporary.str().c_str());
+    Exceptions::CacheNotWritten("CachedReader::Read", cache);
+  }
 }
 
-inline G4TriangularFacet *PLYReader::ParseFacet(Items items, Points vertices) {
-  std::vector<int> indices;
+inline std::shared_ptr<Mesh> CachedReader::Weld(std::shared_ptr<Mesh> mesh) {
+  std::map<G4ThreeVector, size_t> point_index;
+  Points points;
+  Indices indices;
 
-  for (auto item : items) {
-    indices.push_back((int)atoi(item.value.c_str()));
-  }
+  auto add = [&](const G4ThreeVector &point) {
+    auto found = point_index.emplace(point, points.size());
 
-  if (indices.size() < 4) {
-    std::stringstream error;
-    error << "Facets in PLY files require 3 indicies";
+    if (found.second) {
+      points.push_back(point);
+    }
 
-    if (items.size() != 0) {
-      error << "Error around line " << items[0].line << ".";
+    indices.push_back(found.first->second);
+  };
+
+  if (mesh->IsIndexed()) {
+    auto mesh_points = mesh->GetPoints();
+
+    for (auto index : mesh->GetIndices()) {
+      add(mesh_points[index]);
     }
+  }
 
-    Exceptions::ParserError("PLYReader::ParseFacet", error.str());
+  else {
+    for (auto triangle : mesh->GetTriangles()) {
+      for (G4int i = 0; i < 3; i++) {
+        add(triangle->GetVertex(i));
+      }
+    }
   }
 
-  return new G4TriangularFacet(vertices[indices[1 + facet_index_]],
-                               vertices[indices[2 + facet_index_]],
-                               vertices[indices[3 + facet_index_]], ABSOLUTE);
+  return Mesh::New(std::move(points), std::move(indices), mesh->GetName());
+}
+
+inline std::shared_ptr<CachedReader> Cached(std::shared_ptr<Reader> reader) {
+  return std::make_shared<CachedReader>(reader);
 }
 }
 }
@@ -2669,18 +4755,14 @@ inline G4bool BuiltInReader::Read(G4String filepath) {
 
   auto type = TypeFromName(filepath);
 
-  if (type == STL) {
-    reader = new File::STLReader();
+  if (type == STL || type == PLY) {
+    reader = new File::CachedReader(Fast());
   }
 
   else if (type == OBJ) {
     reader = new File::OBJReader();
   }
 
-  else if (type == PLY) {
-    reader = new File::PLYReader();
-  }
-
   else {
     Exceptions::ReaderCantReadError("BuildInReader::Read", type, filepath);
   }
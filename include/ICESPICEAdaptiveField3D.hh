@@ -0,0 +1,69 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEAdaptiveField3D.hh      *
+//    *                                   *
+//    *************************************
+//
+
+#ifndef ICESPICEAdaptiveField3D_h
+#define ICESPICEAdaptiveField3D_h 1
+
+#include "globals.hh"
+#include "G4MagneticField.hh"
+#include "G4ios.hh"
+#include "G4ThreeVector.hh"
+
+#include "ICESPICEAdaptiveFieldMap.hh"
+
+#include <memory>
+
+// Per-thread view over a shared ICESPICEAdaptiveFieldMap, the counterpart
+// of ICESPICETabulatedField3D for adaptive maps.
+
+class ICESPICEAdaptiveField3D
+#ifndef STANDALONE
+ : public G4MagneticField
+#endif
+{
+  std::shared_ptr<const ICESPICEAdaptiveFieldMap> fFieldMap;
+  double fZoffset;
+
+public:
+  ICESPICEAdaptiveField3D(const char* filename, double zOffset );
+  void  GetFieldValue( const  double Point[4],
+		       double *Bfield          ) const;
+
+  // Box, in world coordinates, outside of which the field is zero.
+  // Returns false if the field is zero everywhere.
+  G4bool GetActiveBox(G4ThreeVector& lower, G4ThreeVector& upper) const;
+};
+
+#endif
@@ -0,0 +1,158 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEAdaptiveFieldMap.hh     *
+//    *                                   *
+//    *************************************
+//
+// Field grid whose resolution follows the field. The grid of a Cartesian
+// ICESPICEFieldMap is cut into blocks of B x B x B cells, and each block
+// keeps the nodes of its own sub-grid, every s-th source node along each
+// axis with s = B, B/2, ..., 1. The coarsest s whose trilinear
+// interpolation reproduces every source node of the block within a
+// tolerance is chosen. Blocks with no field hold no nodes at all.
+//
+// Both interpolants are trilinear within each source cell, so their
+// difference anywhere is bounded by its value at the source nodes: the
+// adaptive map is within the tolerance of the source everywhere, not only
+// at the nodes.
+//
+
+#ifndef ICESPICEAdaptiveFieldMap_h
+#define ICESPICEAdaptiveFieldMap_h 1
+
+#include "globals.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class ICESPICEFieldMap;
+
+class ICESPICEAdaptiveFieldMap
+{
+public:
+  // Layout of the binary adaptive map. The header is followed, at
+  // blockOffset, by one Block per block (x slowest, z fastest), and at
+  // valueOffset by the float values Bx, By, Bz of the block nodes. The
+  // nodes of a block with stride s form a (B/s+1)^3 grid, again x slowest.
+  // Coordinates are in lengthUnit and values in fieldUnit.
+  struct BinaryHeader
+  {
+    char          magic[8];      // "ICEAMAP" followed by a NUL
+    std::uint32_t version;
+    std::uint32_t blockCells;    // B, a power of two
+    std::uint32_t nx, ny, nz;    // nodes of the source grid
+    std::uint32_t blocks[3];     // blocks along x, y, z
+    double        first[3];      // x,y,z of the first node of the source
+    double        last[3];       // x,y,z of the last node of the source
+    double        lengthUnit;
+    double        fieldUnit;
+    double        tolerance;     // in fieldUnit
+    std::uint64_t blockOffset;
+    std::uint64_t valueOffset;
+    std::uint64_t valueCount;    // 3 per node
+    std::uint64_t checksum;      // ICESPICEFieldMap::Checksum from blockOffset on
+  };
+
+  struct Block
+  {
+    std::uint32_t offset;        // first node of the block
+    std::uint32_t stride;        // source cells between nodes, 0 if no field
+  };
+
+  static const char          kBinaryMagic[8];
+  static const std::uint32_t kBinaryVersion = 1;
+
+  // Returns the map read from filename, reading it on the first call.
+  // Safe to call from any thread, like ICESPICEFieldMap::Get.
+  static std::shared_ptr<const ICESPICEAdaptiveFieldMap> Get(const G4String& filename);
+
+  // Reads a binary adaptive map. It is memory mapped read-only, so its
+  // pages are shared by every process on the node that uses the file.
+  explicit ICESPICEAdaptiveFieldMap(const char* filename);
+
+  // Builds the map from a Cartesian source. tolerance is the largest
+  // deviation |dB| allowed at a source node and blockCells is B.
+  ICESPICEAdaptiveFieldMap(const ICESPICEFieldMap& source, double tolerance,
+			   int blockCells = 8);
+  ~ICESPICEAdaptiveFieldMap();
+
+  ICESPICEAdaptiveFieldMap(const ICESPICEAdaptiveFieldMap&) = delete;
+  ICESPICEAdaptiveFieldMap& operator=(const ICESPICEAdaptiveFieldMap&) = delete;
+
+  // Trilinear field at (x,y,z) in the frame of the table. Points outside
+  // the blocks that hold a field get a zero field.
+  void GetFieldValue(double x, double y, double z, double* Bfield) const;
+
+  // Box, in the frame of the table, holding every block with field.
+  // Returns false if there is none.
+  bool GetActiveBox(double* lower, double* upper) const;
+
+  // Largest |dB| from the source at any of its nodes
+  double GetMaxDeviation(const ICESPICEFieldMap& source) const;
+
+  double GetTolerance() const { return fTolerance; }
+  int GetBlockCells() const { return fBlockCells; }
+  // Blocks held at a stride of 2^level source cells, level 0 to
+  // log2(B), or with no field for level -1
+  std::size_t GetBlockCount(int level) const;
+  // Bytes held by the block table and the field values
+  std::size_t GetValueBytes() const;
+
+  void WriteBinary(const char* filename) const;
+
+private:
+  void ReadBinary(const char* filename);
+  void PrepareLookup();
+  void PrintSummary() const;
+
+  // Point into the owned tables or into the mapped file
+  const Block* fBlocks;
+  const float* fValues;  // in units of tesla
+  std::size_t  fBlockCount;
+  std::size_t  fValueCount;
+  std::vector<Block> fBlockTable;  // owned when built, not when read
+  std::vector<float> fValueTable;
+  void*        fMapping;
+  std::size_t  fMappingSize;
+  double       fTolerance;
+  int          fBlockCells;
+  int          fBlockShift;   // log2(fBlockCells)
+  int          nbx, nby, nbz;
+  int          nx, ny, nz;
+  double       minx, maxx, miny, maxy, minz, maxz;
+  double       invdx, invdy, invdz;
+  // Blocks with field, in the frame of the table, empty if there is none
+  double       fActiveMin[3], fActiveMax[3];
+};
+
+#endif
@@ -0,0 +1,82 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICECombinedField.hh        *
+//    *                                   *
+//    *************************************
+//
+// Field of the selected model scaled by a factor, plus a second field
+// map scaled by its own factor and a uniform field. ICESPICEFieldSetup
+// hands it to the field manager in place of the model when any of these
+// differs from the plain model, so the field can be changed between runs
+// without reading a map again or rebuilding the geometry.
+//
+
+#ifndef ICESPICECombinedField_h
+#define ICESPICECombinedField_h 1
+
+#include "globals.hh"
+#include "G4MagneticField.hh"
+#include "G4ThreeVector.hh"
+
+class ICESPICECombinedField : public G4MagneticField
+{
+public:
+  ICESPICECombinedField();
+
+  void GetFieldValue(const G4double Point[4], G4double* Bfield) const override;
+
+  // The fields are not owned; extra may be null
+  void SetField(const G4MagneticField* field) { fField = field; }
+  void SetScale(G4double val) { fScale = val; }
+  void SetExtraField(const G4MagneticField* extra, G4double scale)
+  {
+    fExtra = extra;
+    fExtraScale = scale;
+  }
+  void SetUniformField(const G4ThreeVector& val) { fUniform = val; }
+
+  G4double GetScale() const { return fScale; }
+  const G4ThreeVector& GetUniformField() const { return fUniform; }
+
+  // True if the field is the model field itself
+  G4bool IsPlain() const
+  {
+    return fScale == 1. && fExtra == nullptr && fUniform == G4ThreeVector();
+  }
+
+private:
+  const G4MagneticField* fField;
+  const G4MagneticField* fExtra;
+  G4double      fScale, fExtraScale;
+  G4ThreeVector fUniform;
+};
+
+#endif
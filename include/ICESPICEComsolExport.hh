@@ -0,0 +1,66 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEComsolExport.hh         *
+//    *                                   *
+//    *************************************
+//
+// Reader of the field exported by COMSOL on a regular grid (Export >
+// Data, spreadsheet format): '%' comment lines, then one line per node
+// with x, y, z, Bx, By, Bz and any further columns, separated by commas
+// or blanks. The order of the axes, the grid and the units are taken from
+// the file itself, and nodes outside the COMSOL geometry (NaN) get a zero
+// field, as comsol_to_geant_table.py did.
+//
+// The export is streamed through a fixed buffer and every node is written
+// straight to its place in a binary field map, so a gigabyte export is
+// converted without holding it, or the grid, in memory.
+//
+
+#ifndef ICESPICEComsolExport_h
+#define ICESPICEComsolExport_h 1
+
+#include "globals.hh"
+#include "ICESPICEFieldMap.hh"
+
+class ICESPICEComsolExport
+{
+public:
+  // True if the first line of filename is a '%' comment, as in every
+  // COMSOL export and in no field table or binary map
+  static bool IsExport(const char* filename);
+
+  // Converts the export in filename into the binary field map output,
+  // with values held as double or float
+  static void Convert(const char* filename, const char* output,
+		      ICESPICEFieldMap::Storage storage = ICESPICEFieldMap::Storage::Double);
+};
+
+#endif
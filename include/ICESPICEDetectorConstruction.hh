@@ -44,7 +44,8 @@
 #include "G4ThreeVector.hh"
 #include "G4RotationMatrix.hh"
 #include "G4Cache.hh"
-#include "G4MagneticField.hh"
+
+#include <memory>
 
 #include "G4Tubs.hh"  // Ensure this header is included for cylindrical volumes
 
@@ -54,10 +55,12 @@ class G4LogicalVolume;
 class G4VPhysicalVolume;
 class G4Material;
 class G4UniformMagField;
-class ICESPICETabulatedField3D;
+class ICESPICEFieldSetup;
 
 class G4GenericMessenger;
 
+namespace CADMesh { class TessellatedMesh; }
+
 class G4Tubs; 
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
@@ -94,6 +97,10 @@ public:
   void SetDetectorPosition(G4double val); 
   G4double GetDetectorPosition() const {return DetectorPosition;}; 
 
+  // Check field maps and table caches in full when they are read, see
+  // ICESPICEFieldMap::SetVerifyChecksums
+  void SetVerifyFieldMaps(G4bool val);
+
   const G4VPhysicalVolume* GetWorld() const          {return physiWorld;};           
   const G4VPhysicalVolume* GetMeasureVolume() const { return physiDetector; } 
   const G4VPhysicalVolume* GetSiliconPV() const { return physiDetector; } 
@@ -106,6 +113,9 @@ private:
 
   G4double           SSD;
   G4double           zOffset;
+  G4String           FieldModel;  // "grid", "adaptive" or "magnets", before /run/initialize
+  G4bool             MeshPrimitives;  // CAD boxes, cylinders and prisms as native solids
+  G4double           MeshTolerance;   // decimate the other CAD meshes to this, 0 for none
   
   G4double           WorldSizeXY;
   G4double           WorldSizeZ;
@@ -141,7 +151,7 @@ private:
   G4LogicalVolume*   logicTransmissionDetector;
   G4Tubs*          solidTransmissionDetector;
 
-  G4Cache<G4MagneticField*> fField;  //pointer to the thread-local fields
+  G4Cache<ICESPICEFieldSetup*> fField;  //pointer to the thread-local field setups
 
   G4GenericMessenger* fMessenger;  // Messenger for dynamic configuration
 
@@ -149,6 +159,7 @@ private:
 
   void DefineMaterials();
   void DefineCommands();
+  G4VSolid* MeshSolid(std::shared_ptr<CADMesh::TessellatedMesh> mesh);
   G4VPhysicalVolume* ConstructCalorimeter();     
 };
 
@@ -0,0 +1,82 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldManager.hh         *
+//    *                                   *
+//    *************************************
+//
+// Field manager that switches the field off for tracks which are outside
+// the region where the field is non-zero and heading away from
+// it. G4Transportation asks the field manager to configure itself before
+// every step, so those steps are taken as straight lines instead of being
+// integrated through a zero field. Set up by ICESPICEFieldSetup.
+//
+
+#ifndef ICESPICEFieldManager_h
+#define ICESPICEFieldManager_h 1
+
+#include "G4FieldManager.hh"
+#include "G4ThreeVector.hh"
+#include "globals.hh"
+
+class G4Track;
+class G4MagneticField;
+
+class ICESPICEFieldManager : public G4FieldManager
+{
+public:
+  // The field is zero outside the box from lower to upper, and everywhere
+  // if hasField is false
+  ICESPICEFieldManager(G4MagneticField* field, G4bool hasField,
+		       const G4ThreeVector& lower, const G4ThreeVector& upper);
+
+  // Replaces the field and its box
+  void SetField(G4MagneticField* field, G4bool hasField,
+		const G4ThreeVector& lower, const G4ThreeVector& upper);
+
+  void ConfigureForTrack(const G4Track* track) override;
+
+  void SetStraightLineOutsideField(G4bool val) { fStraightLine = val; }
+  G4bool GetStraightLineOutsideField() const { return fStraightLine; }
+
+private:
+  // True if the ray from position along direction enters the active box
+  G4bool ReachesField(const G4ThreeVector& position,
+		      const G4ThreeVector& direction) const;
+
+  G4MagneticField* fField;
+  G4bool        fHasField;      // false if the field is zero everywhere
+  G4ThreeVector fLower, fUpper; // active box of the field, world frame
+  G4bool        fFieldOn;       // whether the field is currently set
+  G4bool        fStraightLine;
+};
+
+#endif
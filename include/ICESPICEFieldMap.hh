@@ -0,0 +1,329 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldMap.hh             *
+//    *                                   *
+//    *************************************
+//
+// Read-only magnetic field grid. The grid is read once per file and the
+// same instance is handed to every ICESPICETabulatedField3D, so worker
+// threads share one copy of the table instead of holding their own.
+//
+
+#ifndef ICESPICEFieldMap_h
+#define ICESPICEFieldMap_h 1
+
+#include "globals.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class ICESPICEFieldMap
+{
+public:
+  // How the field values are held. Interpolation is always done in double;
+  // the narrower types trade a little precision for a smaller footprint.
+  enum class Storage { Double, Float, Half, BFloat16 };
+
+  // Cartesian maps tabulate Bx, By, Bz on an (x, y, z) grid. Sector maps
+  // use the symmetry of the mini-orange: they tabulate Br, Bphi, Bz on an
+  // (r, phi, z) grid covering one 2pi/N sector, and every query is rotated
+  // into that sector and the field rotated back out.
+  enum class Geometry { Cartesian, Sector };
+
+  // Layout of the binary field map. The header is followed, at dataOffset,
+  // by nx*ny*nz nodes of three interleaved values Bx, By, Bz, stored in the
+  // same order as ICESPICE3D.TABLE (x slowest, z fastest). Only maps of
+  // kBinaryVersion are read; others are regenerated with ICESPICEFieldConvert.
+  // Coordinates are in lengthUnit and field values in fieldUnit, both
+  // expressed in Geant4 internal units. For sector maps the axes are
+  // (r, phi, z), with phi in radians.
+  struct BinaryHeader
+  {
+    char          magic[8];      // "ICEFMAP" followed by a NUL
+    std::uint32_t version;
+    std::uint32_t valueSize;     // 2, 4 (float) or 8 (double)
+    std::uint32_t nx, ny, nz;
+    std::uint32_t encoding;      // 0: IEEE 754 of valueSize bytes, 1: bfloat16
+    double        first[3];      // x,y,z of the first point of the table
+    double        last[3];       // x,y,z of the last point of the table
+    double        lengthUnit;
+    double        fieldUnit;
+    std::uint64_t dataOffset;
+    std::uint64_t checksum;      // Checksum() of the data block
+    std::uint32_t geometry;      // 0: Cartesian, 1: sector
+    std::uint32_t symmetry;      // N of a sector map
+    // Index range, per axis, of the nodes with |B| above zeroField, so that
+    // reading the map needs no scan of its values; activeLast is -1 if no
+    // node is above it.
+    double        zeroField;
+    std::int32_t  activeFirst[3];
+    std::int32_t  activeLast[3];
+  };
+
+  static const char          kBinaryMagic[8];
+  static const std::uint32_t kBinaryVersion = 4;
+
+  // A text table read through Get is parsed once and then cached next to
+  // it, as a binary map of doubles in CacheName(table). The cache holds
+  // this key between its header and its values, and is only used while
+  // the key matches the table: same path, size and modification time, and
+  // same content when maps are verified (SetVerifyChecksums).
+  struct CacheKey
+  {
+    char          magic[8];      // "ICEFKEY" followed by a NUL
+    std::uint64_t size;          // bytes of the table
+    std::int64_t  mtime;         // modification time of the table, in s
+    std::uint64_t hash;          // Checksum() of the whole table
+    char          path[4096];    // absolute path of the table
+  };
+
+  static const char kCacheMagic[8];
+  static G4String CacheName(const G4String& filename) { return filename + ".cache"; }
+
+  // Returns the map read from filename, reading it on the first call and
+  // caching it if it is a text table. Safe to call from any thread; later
+  // callers wait for the first read to finish and then share its result.
+  static std::shared_ptr<const ICESPICEFieldMap> Get(const G4String& filename);
+
+  // Reads either a text table (ICESPICE3D.TABLE) or a binary field map,
+  // chosen from the first bytes of the file. Binary maps are memory
+  // mapped read-only, so their pages are shared by every process on the
+  // node that uses the same file. A text table is read from its cache
+  // when that is up to date, and otherwise parsed, and cached only if
+  // writeCache is set. The tools leave it unset, so that opening a table
+  // writes nothing next to it.
+  explicit ICESPICEFieldMap(const char* filename, bool writeCache = false);
+  ~ICESPICEFieldMap();
+
+  // Copy of source with its values held as storage
+  ICESPICEFieldMap(const ICESPICEFieldMap& source, Storage storage);
+
+  // Copy of source holding only every stride-th node along each axis,
+  // starting from the lower limits. Sector maps need a stride
+  // that divides the number of phi intervals.
+  ICESPICEFieldMap(const ICESPICEFieldMap& source, int stride);
+
+  // Sector map of N-fold symmetry resampled from a Cartesian source, with
+  // nodes every pitch in r and z and at most pitch apart along phi. Each
+  // node averages the N symmetric copies of the source field. The sector
+  // covers the disc inscribed in the source's x-y extent.
+  ICESPICEFieldMap(const ICESPICEFieldMap& source, int symmetry, double pitch);
+
+  ICESPICEFieldMap(const ICESPICEFieldMap&) = delete;
+  ICESPICEFieldMap& operator=(const ICESPICEFieldMap&) = delete;
+
+  // Linear interpolates between the eight nodes around a point. Cubic
+  // uses Catmull-Rom splines through the 4x4x4 surrounding nodes: the
+  // field and its first derivatives are continuous, and the error falls
+  // with the cube of the grid spacing, so a coarser grid gives the same
+  // accuracy. At the faces of the table the missing nodes are
+  // extrapolated linearly; across the phi edges of a sector map the
+  // neighbouring sector is used.
+  enum class Interpolation { Linear, Cubic };
+
+  // Field at (x,y,z) in the frame of the table.
+  // Points outside the table get a zero field, and so do points outside
+  // the active box, which is rejected before any table lookup.
+  void GetFieldValue(double x, double y, double z, double* Bfield,
+		     Interpolation interpolation = Interpolation::Linear) const;
+
+  // Corners of the cell of the last linear lookup, kept by the caller, so
+  // that the next lookup in the same cell reuses them instead of reading
+  // the table: the stepper evaluates the field several times per step,
+  // usually within one cell. A cache belongs to one thread, and is
+  // refilled when used with another map than the one it was filled from.
+  struct CellCache
+  {
+    std::uint64_t map = 0;      // GetId() of the map of the corners
+    std::size_t cell = static_cast<std::size_t>(-1);  // lower corner node
+    double      corners[8][3];  // x slowest, z fastest, in Geant4 units
+    G4long      hits = 0;       // lookups that reused the corners
+    G4long      misses = 0;     // lookups that read them from the table
+  };
+
+  // Linear interpolation through cache. Sector maps do not use the cache.
+  void GetFieldValue(double x, double y, double z, double* Bfield,
+		     CellCache& cache) const;
+
+  // Linear field at n points, for callers that evaluate several stepper
+  // stages together: points holds x, y, z and Bfield receives Bx, By, Bz
+  // per point. On Cartesian maps the cells of a block of points are found
+  // and their corners prefetched before any of them is blended, so the
+  // cache misses of the block overlap. Sector maps look each point up in
+  // turn.
+  void GetFieldValues(std::size_t n, const double* points, double* Bfield) const;
+
+  // Instruction set of the interpolation kernel. The widest one the CPU
+  // supports is used by default. SetKernel selects another one for all
+  // maps, limited to what the CPU supports, and returns the kernel set;
+  // it is meant for benchmarks, not for use while other threads track.
+  enum class Kernel { Scalar, AVX2, AVX512 };
+  static Kernel GetKernel();
+  static Kernel SetKernel(Kernel kernel);
+  static const char* KernelName(Kernel kernel);
+
+  // Field magnitude below which a node counts as field free
+  static const double kZeroField;
+
+  // Box, in the Cartesian frame of the table, outside of which every
+  // interpolated value is zero: it holds all cells that touch a node with
+  // |B| above kZeroField. Returns false if there is no such node.
+  bool GetActiveBox(double* lower, double* upper) const;
+
+  // Number of this map, never reused by another map of the process
+  std::uint64_t GetId() const { return fId; }
+
+  Geometry GetGeometry() const { return fGeometry; }
+  int GetSymmetry() const { return fSymmetry; }
+
+  // Grid dimensions and limits. The axes always run towards increasing
+  // coordinates: tables stored the other way are reordered when read.
+  // For sector maps x, y, z stand for r, phi, z.
+  int GetNx() const { return nx; }
+  int GetNy() const { return ny; }
+  int GetNz() const { return nz; }
+  double GetMinX() const { return minx; }
+  double GetMaxX() const { return maxx; }
+  double GetMinY() const { return miny; }
+  double GetMaxY() const { return maxy; }
+  double GetMinZ() const { return minz; }
+  double GetMaxZ() const { return maxz; }
+
+  // Field at a tabulated node, indices counted from the lower limits
+  void GetNodeValue(int ix, int iy, int iz, double* Bfield) const;
+
+  // Bytes held by the field values
+  std::size_t GetValueBytes() const { return 3 * fNodes * ValueSize(fStorage); }
+  Storage GetStorage() const { return fStorage; }
+
+  // Writes the map in the binary format with the given value type
+  void WriteBinary(const char* filename, Storage storage) const;
+
+  // A checksum of several parts passes the result of each part as hash of
+  // the next; every part but the last must be a multiple of 8 bytes.
+  static std::uint64_t Checksum(const void* data, std::size_t size,
+				std::uint64_t hash = 0xcbf29ce484222325ULL);
+  // Whether binary maps are checked against their checksum, and caches
+  // against the content of their table, when read. Off by default, since
+  // that reads every page of the files. The tools turn it on.
+  static bool GetVerifyChecksums();
+  static void SetVerifyChecksums(bool verify);
+  static std::size_t ValueSize(Storage storage);
+  static const char* StorageName(Storage storage);
+
+private:
+  void ReadTable(const char* filename);
+  // Returns false on failure if the map is not required, else it is fatal
+  bool ReadBinary(const char* filename, bool required = true);
+  // Reads the cache of a text table if it matches the table
+  bool ReadCache(const char* filename);
+  // Writes the cache of a text table, replacing any previous one in a
+  // single rename, so that concurrent runs never see half a file
+  void WriteCache(const char* filename) const;
+  // Key of a text table as it is now, its content hashed only if hash is
+  // set; false if it cannot be read
+  static bool MakeCacheKey(const char* filename, CacheKey& key, bool hash);
+  // WriteBinary, with extra bytes between the header and the values
+  bool WriteBinary(const char* filename, Storage storage,
+		   const void* extra, std::size_t extraSize) const;
+  void FinishReading();
+  // Reverses the node order along the axes whose coordinates decrease in
+  // the file, so that every axis runs from its minimum to its maximum
+  void NormalizeAxes(bool invertX, bool invertY, bool invertZ);
+  // Extents, inverse spacings and active box, once the grid is complete
+  void PrepareLookup();
+  // Finds the active box of the grid once the values are in place,
+  // scanning them unless the binary header gave the active nodes
+  void FindActiveRegion();
+
+  // Interpolation in the coordinates of the grid axes
+  void GetGridValue(double x, double y, double z, double* Bfield,
+		    Interpolation interpolation) const;
+
+  // Value i of the 3*nx*ny*nz held values, in units of fFieldUnit
+  double ValueAt(std::size_t i) const;
+  // Unit the values are held in when stored as storage
+  double StorageUnit(Storage storage) const;
+  // Writes values begin to end of the 3*nx*ny*nz, divided by unit, to out
+  // as storage
+  void EncodeValues(Storage storage, double unit, std::size_t begin,
+		    std::size_t end, void* out) const;
+
+  // GetFieldValues on a Cartesian map
+  template <typename T>
+  void GetGridValues(const T* values, std::size_t n, const double* points,
+		     double* Bfield) const;
+
+  template <typename T>
+  void Interpolate(const T* values, int xindex, int yindex, int zindex,
+                   double xlocal, double ylocal, double zlocal,
+                   Interpolation interpolation, double* Bfield) const;
+  // Reads the eight corners from node on into corners, in Geant4 units
+  template <typename T>
+  void GatherCell(const T* values, std::size_t node, double (*corners)[3]) const;
+  template <typename T>
+  void InterpolateCubic(const T* values, int xindex, int yindex, int zindex,
+			double xlocal, double ylocal, double zlocal,
+			double* Bfield) const;
+
+  // Field values, Bx, By, Bz interleaved per node so that the eight corners
+  // of a cell are read from a few cache lines. They point either into fTable
+  // or into the mapped binary file, and are held as fStorage in units of
+  // fFieldUnit.
+  const void* fValues;
+  Storage     fStorage;
+  double      fFieldUnit;
+  std::vector<double> fTable;  // owned values; double only for alignment
+  Geometry    fGeometry;
+  int         fSymmetry;
+  double      fSectorAngle;
+  void*       fMapping;
+  std::size_t fMappingSize;
+  // The dimensions of the table
+  int nx,ny,nz;
+  std::size_t fNodes;
+  // The physical limits of the defined region
+  double minx, maxx, miny, maxy, minz, maxz;
+  // The physical extent of the defined region
+  double dx, dy, dz;
+  // Cells per unit length, (n-1)/extent, so the lookup needs no division
+  double invdx, invdy, invdz;
+  // Index range of the nodes above kZeroField, last -1 if there are none
+  int  fActiveFirst[3], fActiveLast[3];
+  bool fActiveKnown;  // set once the range is found or read
+  // The active box in grid coordinates, empty if the field is zero
+  double fActiveMin[3], fActiveMax[3];
+  std::uint64_t fId;
+};
+
+#endif
@@ -0,0 +1,149 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldSetup.hh           *
+//    *                                   *
+//    *************************************
+//
+// Per-thread field, field manager and integration parameters. The field
+// is interpolated from the grid or from the adaptive grid
+// (ICESPICEAdaptiveFieldMap), or computed from the analytic model of the
+// magnets (ICESPICEMagnetField). The model field can be scaled, and a
+// second field map and a uniform field added to it (ICESPICECombinedField).
+// These, the model, the stepper and the accuracy of the propagation in
+// field can be changed between runs with the /ICESPICE/Field/ commands,
+// which exist once the worker threads are initialised (after
+// /run/initialize).
+//
+
+#ifndef ICESPICEFieldSetup_h
+#define ICESPICEFieldSetup_h 1
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+class G4ChordFinder;
+class G4EquationOfMotion;
+class G4MagIntegratorStepper;
+class G4MagneticField;
+class G4GenericMessenger;
+class ICESPICETabulatedField3D;
+class ICESPICEAdaptiveField3D;
+class ICESPICEMagnetField;
+class ICESPICEFieldManager;
+class ICESPICECombinedField;
+
+class ICESPICEFieldSetup
+{
+public:
+  // gridFile is the field map, adaptiveFile the adaptive map and
+  // magnetFile the parameters of the magnet model; only the selected
+  // model is read until another is selected.
+  ICESPICEFieldSetup(const char* gridFile, const char* adaptiveFile,
+		     const char* magnetFile, G4double zOffset,
+		     const G4String& model = "grid");
+  ~ICESPICEFieldSetup();
+
+  // The field handed to the field manager
+  G4MagneticField* GetField() const;
+  ICESPICEFieldManager* GetFieldManager() const { return fFieldManager; }
+
+  // "grid", "adaptive" or "magnets"
+  void SetModel(const G4String& name);
+
+  // Factor on the field of the model
+  void SetScale(G4double val);
+  // Field map added to the model, read once per process like the grid;
+  // "none" removes it
+  void SetExtraGrid(const G4String& filename);
+  // Factor on the added field map
+  void SetExtraScale(G4double val);
+  // Uniform field added everywhere
+  void SetUniformField(G4ThreeVector val);
+
+  // Any of ICESPICEStepperFactory::Names(). Default is what Geant4 builds
+  // when no stepper is given; the T variants are the templated steppers,
+  // which call the field directly.
+  void SetStepper(const G4String& name);
+  void SetMinStep(G4double val);
+  void SetDeltaChord(G4double val);
+  void SetDeltaOneStep(G4double val);
+  void SetDeltaIntersection(G4double val);
+  void SetEpsilonMin(G4double val);
+  void SetEpsilonMax(G4double val);
+
+  // "linear" or "cubic", see ICESPICEFieldMap::Interpolation
+  void SetInterpolation(const G4String& name);
+  void SetStraightLineOutsideField(G4bool val);
+  // Reuse the corners of the last grid cell, see ICESPICETabulatedField3D
+  void SetCellCache(G4bool val);
+
+  void Print() const;
+
+private:
+  // Field of the selected model
+  G4MagneticField* GetModelField() const;
+  // Hands the model, or the combined field when it is scaled or has
+  // anything added, to the field manager with the box holding the field,
+  // and rebuilds the chord finder around it
+  void UpdateField();
+  // Builds the chord finder for the current stepper and minimum step and
+  // hands it to the field manager, replacing the previous one. Returns
+  // false, keeping the previous one, if the stepper is unknown.
+  G4bool UpdateChordFinder();
+  void DefineCommands();
+
+  G4String fGridFile, fAdaptiveFile, fMagnetFile;
+  G4double fZoffset;
+  G4String fModel;
+  G4String fInterpolation;
+  G4bool   fCellCache;
+  G4String fExtraFile;
+  G4double fScale, fExtraScale;
+  G4ThreeVector fUniform;
+
+  ICESPICETabulatedField3D* fGridField;    // null until the grid is used
+  ICESPICEAdaptiveField3D*  fAdaptiveField;  // null until the adaptive grid is used
+  ICESPICEMagnetField*      fMagnetField;  // null until the model is used
+  ICESPICETabulatedField3D* fExtraField;   // null unless a map is added
+  ICESPICECombinedField*    fCombinedField;
+  ICESPICEFieldManager*     fFieldManager;
+  G4ChordFinder*            fChordFinder;
+  G4EquationOfMotion*       fEquation;  // null when the chord finder owns it
+  G4MagIntegratorStepper*   fStepper;   // null when the chord finder owns it
+
+  G4String fStepperName;
+  G4double fMinStep;
+  G4double fDeltaChord;
+
+  G4GenericMessenger* fMessenger;
+};
+
+#endif
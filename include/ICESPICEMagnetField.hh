@@ -0,0 +1,114 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//    *************************************
+//    *                                   *
+//    *    ICESPICEMagnetField.hh          *
+//    *                                   *
+//    *************************************
+//
+// Analytic field of the five magnets of the mini-orange, each a uniformly
+// magnetized box. It needs no field map: a few parameters, fitted to the
+// COMSOL grid with ICESPICEMagnetFit, describe the whole field. Like
+// ICESPICETabulatedField3D it works in the frame of the field table, and
+// is zero outside a box (the active box of the grid it was fitted to).
+//
+
+#ifndef ICESPICEMagnetField_h
+#define ICESPICEMagnetField_h 1
+
+#include "globals.hh"
+#include "G4MagneticField.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+
+class ICESPICEMagnetField
+#ifndef STANDALONE
+ : public G4MagneticField
+#endif
+{
+public:
+  // Reads the parameters written by ICESPICEMagnetFit from filename. If
+  // the file cannot be read, the magnets placed by
+  // ICESPICEDetectorConstruction are used with the remanence of N42
+  // magnetized through the plates.
+  ICESPICEMagnetField(const char* filename, double zOffset);
+
+  void GetFieldValue(const double Point[4], double* Bfield) const;
+
+  // Box, in world coordinates, outside of which the field is zero.
+  // Returns false if the field is zero everywhere.
+  G4bool GetActiveBox(G4ThreeVector& lower, G4ThreeVector& upper) const;
+
+  // Remanence (mu0 M) of every magnet, in the frame of the magnet: x
+  // through the plate, y radially outwards, z along the axis
+  void SetRemanence(const G4ThreeVector& val);
+  const G4ThreeVector& GetRemanence() const { return fRemanence; }
+
+  // Distance of the inner corner of each magnet from the axis
+  void SetPlacementRadius(double val);
+  double GetPlacementRadius() const { return fRadius; }
+
+  // Region of the model, in the frame of the table
+  void SetBox(const double* lower, const double* upper);
+
+  // Whether point, in the frame of the table, is within margin of a magnet
+  bool IsNearMagnet(const double* point, double margin) const;
+
+  // Writes the parameters in the format read by the constructor
+  void Write(const char* filename, const char* comment) const;
+
+private:
+  void Read(const char* filename);
+  // Centre and axes of each magnet, from the number of magnets, radius
+  // and size
+  void Place();
+
+  // Field at p, relative to the centre of a box of half sizes half and
+  // remanence Br along its axes, in the frame of the box
+  static void BoxField(const double* p, const double* half, const double* Br,
+		       double* Bfield);
+
+  struct Magnet
+  {
+    double centre[3];
+    double axes[3][3];  // unit axes of the box, table frame
+  };
+
+  int    fMagnets;
+  double fRadius;
+  double fHalfSize[3];         // through the plate, and the two sides
+  G4ThreeVector fRemanence;
+  double fBoxRemanence[3];     // fRemanence along the box axes
+  double fLower[3], fUpper[3];
+  double fZoffset;
+  std::vector<Magnet> fPlaced;
+};
+
+#endif
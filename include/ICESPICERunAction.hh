@@ -38,6 +38,8 @@
 #define ICESPICERunAction_h 1
 
 #include "G4UserRunAction.hh"
+#include "G4Accumulable.hh"
+#include "G4Timer.hh"
 #include "globals.hh"
 #include <iostream>
 
@@ -58,9 +60,27 @@ public:
   void  SetRndmFreq(G4int   val)  {saveRndm = val;}
   G4int GetRndmFreq()             {return saveRndm;}
 
+  // Steps of finished tracks, for the transport rate printed at end of run
+  void  AddSteps(G4long steps)    {fSteps += steps;}
+
 
 private:
+#ifdef ICESPICE_FIELD_STATS
+  // Field evaluation statistics of all threads, see ICESPICETabulatedField3D
+  void PrintFieldStatistics(G4double seconds);
+#endif
+
   G4int saveRndm;
+  G4Accumulable<G4long> fSteps;
+  G4Timer fTimer;
+#ifdef ICESPICE_FIELD_STATS
+  G4Accumulable<G4long>   fFieldCalls;
+  G4Accumulable<G4long>   fFieldInside;
+  G4Accumulable<G4long>   fFieldTimed;
+  G4Accumulable<G4double> fFieldNanoseconds;
+  G4Accumulable<G4long>   fFieldCellHits;
+  G4Accumulable<G4long>   fFieldCellMisses;
+#endif
 };
 
 #endif
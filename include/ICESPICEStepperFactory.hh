@@ -0,0 +1,158 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//    *************************************
+//    *                                   *
+//    *    ICESPICEStepperFactory.hh       *
+//    *                                   *
+//    *************************************
+//
+// Chord finders for the steppers that can be chosen by name, around any
+// magnetic field type. Used by ICESPICEFieldSetup and by the stepper
+// benchmark, which wraps the field to count its evaluations.
+//
+
+#ifndef ICESPICEStepperFactory_h
+#define ICESPICEStepperFactory_h 1
+
+#include "globals.hh"
+#include "G4ChordFinder.hh"
+#include "G4MagIntegratorDriver.hh"
+#include "G4IntegrationDriver.hh"
+#include "G4Mag_UsualEqRhs.hh"
+#include "G4TMagFieldEquation.hh"
+
+#include "G4ExplicitEuler.hh"
+#include "G4ImplicitEuler.hh"
+#include "G4SimpleRunge.hh"
+#include "G4SimpleHeum.hh"
+#include "G4ClassicalRK4.hh"
+#include "G4CashKarpRKF45.hh"
+#include "G4HelixExplicitEuler.hh"
+#include "G4HelixImplicitEuler.hh"
+#include "G4HelixSimpleRunge.hh"
+#include "G4RKG3_Stepper.hh"
+#include "G4DormandPrince745.hh"
+#include "G4BogackiShampine23.hh"
+#include "G4BogackiShampine45.hh"
+#include "G4TsitourasRK45.hh"
+#include "G4TDormandPrince45.hh"
+#include "G4TCashKarpRKF45.hh"
+#include "G4TClassicalRK4.hh"
+
+class ICESPICEStepperFactory
+{
+public:
+  // Space separated stepper names, as UI command candidates
+  static const char* Names()
+  {
+    return "Default DormandPrince745 TDormandPrince45 BogackiShampine23 BogackiShampine45"
+      " TsitourasRK45 CashKarpRKF45 TCashKarpRKF45 ClassicalRK4 TClassicalRK4"
+      " SimpleHeum SimpleRunge ExplicitEuler ImplicitEuler"
+      " HelixExplicitEuler HelixImplicitEuler HelixSimpleRunge RKG3_Stepper";
+  }
+
+  // Chord finder for the stepper called name, whose driver takes steps of
+  // at least minStep. The equation and the stepper are returned to be
+  // deleted by the caller after the chord finder; both are null for
+  // Default, what Geant4 builds when no stepper is given, whose chord
+  // finder owns them. Returns null if the name is unknown.
+  template <class Field>
+  static G4ChordFinder* Create(const G4String& name, Field* field, G4double minStep,
+			       G4EquationOfMotion*& equation,
+			       G4MagIntegratorStepper*& stepper);
+
+private:
+  // The templated steppers are driven by a driver of their own type, so
+  // that the field and the stepper stages are called without virtual calls
+  template <class Stepper, class Equation>
+  static G4ChordFinder* Templated(Equation* equation, G4double minStep,
+				  G4MagIntegratorStepper*& stepper)
+  {
+    Stepper* templated = new Stepper(equation);
+    stepper = templated;
+    return new G4ChordFinder(new G4IntegrationDriver<Stepper>(minStep, templated,
+					    templated->GetNumberOfVariables()));
+  }
+};
+
+template <class Field>
+G4ChordFinder* ICESPICEStepperFactory::Create(const G4String& name, Field* field,
+					      G4double minStep,
+					      G4EquationOfMotion*& equation,
+					      G4MagIntegratorStepper*& stepper)
+{
+  equation = nullptr;
+  stepper = nullptr;
+  G4ChordFinder* chordFinder = nullptr;
+
+  if (name == "Default") {
+    chordFinder = new G4ChordFinder(field, minStep);
+  }
+  else if (name[0] == 'T' && name != "TsitourasRK45") {
+    typedef G4TMagFieldEquation<Field> Equation;
+    Equation* templatedEquation = new Equation(field);
+    equation = templatedEquation;
+    if (name == "TDormandPrince45")
+      chordFinder = Templated<G4TDormandPrince45<Equation>>(templatedEquation, minStep, stepper);
+    else if (name == "TCashKarpRKF45")
+      chordFinder = Templated<G4TCashKarpRKF45<Equation>>(templatedEquation, minStep, stepper);
+    else if (name == "TClassicalRK4")
+      chordFinder = Templated<G4TClassicalRK4<Equation>>(templatedEquation, minStep, stepper);
+  }
+  else {
+    G4Mag_UsualEqRhs* usualEquation = new G4Mag_UsualEqRhs(field);
+    equation = usualEquation;
+    if (name == "DormandPrince745")        stepper = new G4DormandPrince745(usualEquation);
+    else if (name == "BogackiShampine23")  stepper = new G4BogackiShampine23(usualEquation);
+    else if (name == "BogackiShampine45")  stepper = new G4BogackiShampine45(usualEquation);
+    else if (name == "TsitourasRK45")      stepper = new G4TsitourasRK45(usualEquation);
+    else if (name == "CashKarpRKF45")      stepper = new G4CashKarpRKF45(usualEquation);
+    else if (name == "ClassicalRK4")       stepper = new G4ClassicalRK4(usualEquation);
+    else if (name == "SimpleHeum")         stepper = new G4SimpleHeum(usualEquation);
+    else if (name == "SimpleRunge")        stepper = new G4SimpleRunge(usualEquation);
+    else if (name == "ExplicitEuler")      stepper = new G4ExplicitEuler(usualEquation);
+    else if (name == "ImplicitEuler")      stepper = new G4ImplicitEuler(usualEquation);
+    else if (name == "HelixExplicitEuler") stepper = new G4HelixExplicitEuler(usualEquation);
+    else if (name == "HelixImplicitEuler") stepper = new G4HelixImplicitEuler(usualEquation);
+    else if (name == "HelixSimpleRunge")   stepper = new G4HelixSimpleRunge(usualEquation);
+    else if (name == "RKG3_Stepper")       stepper = new G4RKG3_Stepper(usualEquation);
+    if (stepper != nullptr) {
+      chordFinder = new G4ChordFinder(new G4MagInt_Driver(minStep, stepper,
+					      stepper->GetNumberOfVariables()));
+    }
+  }
+
+  if (chordFinder == nullptr) {
+    delete equation;
+    equation = nullptr;
+  }
+  return chordFinder;
+}
+
+#endif
@@ -34,13 +34,20 @@
 //
 //
 
+#ifndef ICESPICETabulatedField3D_h
+#define ICESPICETabulatedField3D_h 1
+
 #include "globals.hh"
 #include "G4MagneticField.hh"
 #include "G4ios.hh"
+#include "G4ThreeVector.hh"
+
+#include "ICESPICEFieldMap.hh"
+
+#include <memory>
 
-#include <fstream>
-#include <vector>
-#include <cmath>
+// Thin per-thread view over a shared ICESPICEFieldMap. Constructing one
+// per worker is cheap: only the first construction reads the table.
 
 class ICESPICETabulatedField3D
 #ifndef STANDALONE
@@ -48,22 +55,54 @@ class ICESPICETabulatedField3D
 #endif
 {
   
-  // Storage space for the table
-  std::vector< std::vector< std::vector< double > > > xField;
-  std::vector< std::vector< std::vector< double > > > yField;
-  std::vector< std::vector< std::vector< double > > > zField;
-  // The dimensions of the table
-  int nx,ny,nz; 
-  // The physical limits of the defined region
-  double minx, maxx, miny, maxy, minz, maxz;
-  // The physical extent of the defined region
-  double dx, dy, dz;
+  // The shared, read-only table
+  std::shared_ptr<const ICESPICEFieldMap> fFieldMap;
   double fZoffset;
-  bool invertX, invertY, invertZ;
+  ICESPICEFieldMap::Interpolation fInterpolation;
+  G4bool fUseCellCache;
+  // Corners of the last cell looked up; the field is per thread
+  mutable ICESPICEFieldMap::CellCache fCellCache;
 
 public:
   ICESPICETabulatedField3D(const char* filename, double zOffset );
   void  GetFieldValue( const  double Point[4],
 		       double *Bfield          ) const;
+
+  // Box, in world coordinates, outside of which the field is zero.
+  // Returns false if the field is zero everywhere.
+  G4bool GetActiveBox(G4ThreeVector& lower, G4ThreeVector& upper) const;
+
+  // Trilinear by default; cubic is smoother and suits coarser grids
+  void SetInterpolation(ICESPICEFieldMap::Interpolation val) { fInterpolation = val; }
+  ICESPICEFieldMap::Interpolation GetInterpolation() const { return fInterpolation; }
+
+  // Reuse the corners of the last cell when the next linear lookup falls
+  // in it (ICESPICEFieldMap::CellCache). Off by default.
+  void SetCellCache(G4bool val) { fUseCellCache = val; }
+  G4bool GetCellCache() const { return fUseCellCache; }
+  const ICESPICEFieldMap::CellCache& GetCellCacheState() const { return fCellCache; }
+
+#ifdef ICESPICE_FIELD_STATS
+  // Evaluations made by the calling thread since ResetStatistics, over all
+  // fields. One call in kTimingInterval is timed.
+  struct Statistics
+  {
+    G4long   calls;
+    G4long   inside;       // calls inside the active box; the rest get zero
+    G4long   timed;
+    G4double nanoseconds;  // spent in the timed calls
+    G4long   cellHits;     // calls that reused the cached cell
+    G4long   cellMisses;   // calls through the cell cache that did not
+  };
+  static const G4long kTimingInterval = 64;
+  static const Statistics& GetStatistics() { return fStatistics; }
+  static void ResetStatistics() { fStatistics = Statistics(); }
+
+private:
+  static G4ThreadLocal Statistics fStatistics;
+  G4ThreeVector fLower, fUpper;  // active box, world frame
+  G4bool fHasField;
+#endif
 };
 
+#endif
@@ -39,6 +39,7 @@
 
 #include "G4UserTrackingAction.hh"
 
+class ICESPICERunAction;
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 
@@ -46,11 +47,14 @@ class ICESPICETrackingAction : public G4UserTrackingAction
 {
 
   public:  
-    ICESPICETrackingAction();
+    ICESPICETrackingAction(ICESPICERunAction* runAction = nullptr);
    ~ICESPICETrackingAction() {};
    
     void PostUserTrackingAction(const G4Track*);
 
+  private:
+    ICESPICERunAction* fRunAction;
+
 };
 
 #endif
@@ -172,12 +172,43 @@ def plot_transmission_summary(detector, f, g_values):
     plt.savefig(f'./analysis/plots/{detector}_f{f}mm_summary.png', dpi=900)
 
     # plt.show()
+
+def compare_esil_histograms(reference_file, test_file):
+    # Compare two Esil histograms from runs that differ only in the field map,
+    # e.g. the double grid against a float or half precision binary map.
+    # The difference is reported in units of its statistical uncertainty.
+
+    def read_counts(file_path):
+        df = pd.read_csv(file_path, skiprows=7, names=['counts', 'Sw', 'Sw2', 'Sxw0', 'Sx2w0'])
+        return df['counts'].to_numpy(dtype=float)
+
+    reference = read_counts(reference_file)
+    test = read_counts(test_file)
+
+    # counts[0] is underflow and counts[1] the first bin (no energy deposited)
+    for name, select in [('Total', slice(None)), ('Transmission', slice(2, None))]:
+        n_ref = reference[select].sum()
+        n_test = test[select].sum()
+        sigma = np.sqrt(n_ref + n_test)
+        print(f'{name} counts: {n_ref:.0f} -> {n_test:.0f} '
+              f'({(n_test - n_ref) / sigma if sigma > 0 else 0:+.2f} sigma)')
+
+    # Bin by bin chi2 over the bins that have entries in either histogram
+    filled = (reference + test) > 0
+    chi2 = ((test[filled] - reference[filled])**2 / (test[filled] + reference[filled])).sum()
+    ndf = filled.sum()
+    print(f'chi2/ndf: {chi2:.1f}/{ndf} = {chi2 / ndf if ndf else 0:.3f}')
+
+    return chi2, ndf
     
 # Usage examples:
 
 # plot the histogram for a single file
 # transmission_histogram('./analysis/data/ICESPICE_PIPS1000_f50mm_g20mm_1000_h1_Esil.csv')
 
+# compare the spectra from the double and a reduced precision field map
+# compare_esil_histograms('./ICESPICE_double_h1_Esil.csv', './ICESPICE_half_h1_Esil.csv')
+
 # # plot the transmission probability for a detector, f value, and g value
 # pips1000_f50_g30_files = get_file_paths(detector='PIPS1000', f='50', g='30')
 # transmission_probability(pips1000_f50_g30_files, title='PIPS1000 | f=50mm | g=30mm')
@@ -54,9 +54,10 @@ void ICESPICEActionInitializer::Build() const
   SetUserAction(new ICESPICEPrimaryGeneratorAction());
 
   //Optional user classes
-  SetUserAction(new ICESPICERunAction());
+  auto runAction = new ICESPICERunAction();
+  SetUserAction(runAction);
   SetUserAction(new ICESPICEEventAction());
-  SetUserAction(new ICESPICETrackingAction()); 
+  SetUserAction(new ICESPICETrackingAction(runAction)); 
 
   auto eventAction = new ICESPICEEventAction;
   SetUserAction(eventAction);
@@ -0,0 +1,61 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEAdaptiveField3D.cc      *
+//    *                                   *
+//    *************************************
+//
+
+#include "ICESPICEAdaptiveField3D.hh"
+#include "G4SystemOfUnits.hh"
+
+ICESPICEAdaptiveField3D::ICESPICEAdaptiveField3D(const char* filename,
+						 double zOffset )
+  :fFieldMap(ICESPICEAdaptiveFieldMap::Get(filename)),fZoffset(zOffset)
+{
+  G4cout << " ---> Using adaptive field grid " << filename
+	 << ", offset by " << zOffset/cm << " cm " << G4endl;
+}
+
+void ICESPICEAdaptiveField3D::GetFieldValue(const double point[4],
+					    double *Bfield ) const
+{
+  fFieldMap->GetFieldValue(point[0], point[1], point[2] + fZoffset, Bfield);
+}
+
+G4bool ICESPICEAdaptiveField3D::GetActiveBox(G4ThreeVector& lower,
+					     G4ThreeVector& upper) const
+{
+  double lo[3], hi[3];
+  if (!fFieldMap->GetActiveBox(lo, hi)) return false;
+  lower.set(lo[0], lo[1], lo[2] - fZoffset);
+  upper.set(hi[0], hi[1], hi[2] - fZoffset);
+  return true;
+}
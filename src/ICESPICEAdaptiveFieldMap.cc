@@ -0,0 +1,539 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEAdaptiveFieldMap.cc     *
+//    *                                   *
+//    *************************************
+//
+//
+
+#include "ICESPICEAdaptiveFieldMap.hh"
+#include "ICESPICEFieldMap.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4AutoLock.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace{
+  G4Mutex myICESPICEAdaptiveFieldMapLock = G4MUTEX_INITIALIZER;
+
+  // One entry per file name, never released, as for ICESPICEFieldMap
+  std::map<G4String, std::shared_ptr<const ICESPICEAdaptiveFieldMap> >& AdaptiveFieldMaps()
+  {
+    static std::map<G4String, std::shared_ptr<const ICESPICEAdaptiveFieldMap> > maps;
+    return maps;
+  }
+
+  // Trilinear interpolation of Bx, By, Bz between the eight nodes from c000,
+  // whose neighbours along z, y and x are 3, ystride and xstride values on
+  template <typename T>
+  inline void Trilinear(const T* c000, std::size_t ystride, std::size_t xstride,
+			double xlocal, double ylocal, double zlocal, double* B)
+  {
+    const double wxy[4] = { (1-xlocal) * (1-ylocal), (1-xlocal) * ylocal,
+			       xlocal  * (1-ylocal),    xlocal  * ylocal };
+    const T* column[4] = { c000, c000 + ystride, c000 + xstride, c000 + xstride + ystride };
+    for (int component = 0; component < 3; ++component) {
+      double value = 0.;
+      for (int corner = 0; corner < 4; ++corner) {
+	const T* c = column[corner] + component;
+	value += wxy[corner] * ((1-zlocal) * c[0] + zlocal * c[3]);
+      }
+      B[component] = value;
+    }
+  }
+}
+
+const char ICESPICEAdaptiveFieldMap::kBinaryMagic[8] = {'I','C','E','A','M','A','P','\0'};
+
+std::shared_ptr<const ICESPICEAdaptiveFieldMap>
+ICESPICEAdaptiveFieldMap::Get(const G4String& filename)
+{
+  G4AutoLock lock(&myICESPICEAdaptiveFieldMapLock);
+
+  std::shared_ptr<const ICESPICEAdaptiveFieldMap>& fieldMap = AdaptiveFieldMaps()[filename];
+  if (!fieldMap) {
+    fieldMap = std::make_shared<const ICESPICEAdaptiveFieldMap>(filename.c_str());
+  }
+  return fieldMap;
+}
+
+ICESPICEAdaptiveFieldMap::ICESPICEAdaptiveFieldMap(const char* filename)
+  :fBlocks(nullptr),fValues(nullptr),fBlockCount(0),fValueCount(0),
+   fMapping(nullptr),fMappingSize(0),fTolerance(0.),fBlockCells(1),fBlockShift(0)
+{
+  G4cout << "\n-----------------------------------------------------------"
+	 << "\n      Magnetic field"
+	 << "\n-----------------------------------------------------------";
+
+  G4cout << "\n ---> " "Reading the adaptive field grid from " << filename << " ... " << G4endl;
+
+  ReadBinary(filename);
+  PrepareLookup();
+  PrintSummary();
+}
+
+ICESPICEAdaptiveFieldMap::ICESPICEAdaptiveFieldMap(const ICESPICEFieldMap& source,
+						   double tolerance, int blockCells)
+  :fBlocks(nullptr),fValues(nullptr),fBlockCount(0),fValueCount(0),
+   fMapping(nullptr),fMappingSize(0),fTolerance(tolerance),fBlockCells(blockCells),
+   fBlockShift(0)
+{
+  if (source.GetGeometry() != ICESPICEFieldMap::Geometry::Cartesian
+      || blockCells < 1 || blockCells > 64 || (blockCells & (blockCells - 1)) != 0
+      || tolerance < 0.) {
+    G4ExceptionDescription ed;
+    ed << "An adaptive map needs a Cartesian source, a block size that is a "
+       << "power of two up to 64 and a tolerance >= 0" << std::endl;
+    G4Exception("ICESPICEAdaptiveFieldMap::ICESPICEAdaptiveFieldMap",
+		"pugmag012",FatalException,ed);
+    return;
+  }
+  while ((1 << fBlockShift) < fBlockCells) ++fBlockShift;
+
+  nx = source.GetNx();
+  ny = source.GetNy();
+  nz = source.GetNz();
+  minx = source.GetMinX();
+  maxx = source.GetMaxX();
+  miny = source.GetMinY();
+  maxy = source.GetMaxY();
+  minz = source.GetMinZ();
+  maxz = source.GetMaxZ();
+  // Enough blocks to cover the n-1 cells of each axis
+  nbx = (nx - 2) / fBlockCells + 1;
+  nby = (ny - 2) / fBlockCells + 1;
+  nbz = (nz - 2) / fBlockCells + 1;
+  fBlockCount = static_cast<std::size_t>(nbx) * nby * nbz;
+  fBlockTable.resize(fBlockCount);
+
+  // Source nodes of one block, B+1 along each axis. Blocks at the upper
+  // faces of the table reach past its last node; there the last node is
+  // repeated, and only the nodes within the table are checked.
+  const int B = fBlockCells;
+  const int n = B + 1;
+  std::vector<double> fine(3 * n * n * n);
+  std::vector<float> coarse;
+  const double zero2 = ICESPICEFieldMap::kZeroField * ICESPICEFieldMap::kZeroField;
+  const double tolerance2 = tolerance * tolerance;
+
+  std::size_t block = 0;
+  for (int bx = 0; bx < nbx; ++bx) {
+    for (int by = 0; by < nby; ++by) {
+      for (int bz = 0; bz < nbz; ++bz, ++block) {
+	const int last[3] = { std::min(B, nx - 1 - bx * B),
+			      std::min(B, ny - 1 - by * B),
+			      std::min(B, nz - 1 - bz * B) };
+	double largest2 = 0.;
+	for (int a = 0; a < n; ++a) {
+	  for (int b = 0; b < n; ++b) {
+	    for (int c = 0; c < n; ++c) {
+	      double* value = &fine[3 * ((a * n + b) * n + c)];
+	      source.GetNodeValue(std::min(bx * B + a, nx - 1),
+				  std::min(by * B + b, ny - 1),
+				  std::min(bz * B + c, nz - 1), value);
+	      largest2 = std::max(largest2, value[0] * value[0]
+				  + value[1] * value[1] + value[2] * value[2]);
+	    }
+	  }
+	}
+	Block& entry = fBlockTable[block];
+	if (largest2 <= zero2) {
+	  entry.offset = 0;
+	  entry.stride = 0;
+	  continue;
+	}
+
+	// Coarsest stride that holds the tolerance; a stride of one keeps
+	// every source node and always does
+	for (int stride = B; stride >= 1; stride /= 2) {
+	  const int cells = B / stride;
+	  const int m = cells + 1;
+	  coarse.resize(3 * m * m * m);
+	  for (int i = 0; i < m; ++i) {
+	    for (int j = 0; j < m; ++j) {
+	      for (int k = 0; k < m; ++k) {
+		const double* value = &fine[3 * ((i * stride * n + j * stride) * n + k * stride)];
+		for (int component = 0; component < 3; ++component) {
+		  coarse[3 * ((i * m + j) * m + k) + component]
+		    = static_cast<float>(value[component] / tesla);
+		}
+	      }
+	    }
+	  }
+
+	  bool accepted = stride == 1;
+	  if (!accepted) {
+	    accepted = true;
+	    for (int a = 0; a <= last[0] && accepted; ++a) {
+	      const int i = std::min(a / stride, cells - 1);
+	      for (int b = 0; b <= last[1] && accepted; ++b) {
+		const int j = std::min(b / stride, cells - 1);
+		for (int c = 0; c <= last[2]; ++c) {
+		  const int k = std::min(c / stride, cells - 1);
+		  double interpolated[3];
+		  Trilinear(&coarse[3 * ((i * m + j) * m + k)], 3 * m, 3 * m * m,
+			    double(a - i * stride) / stride, double(b - j * stride) / stride,
+			    double(c - k * stride) / stride, interpolated);
+		  const double* value = &fine[3 * ((a * n + b) * n + c)];
+		  double deviation2 = 0.;
+		  for (int component = 0; component < 3; ++component) {
+		    const double d = interpolated[component] * tesla - value[component];
+		    deviation2 += d * d;
+		  }
+		  if (deviation2 > tolerance2) {
+		    accepted = false;
+		    break;
+		  }
+		}
+	      }
+	    }
+	  }
+	  if (accepted) {
+	    entry.offset = static_cast<std::uint32_t>(fValueTable.size() / 3);
+	    entry.stride = stride;
+	    fValueTable.insert(fValueTable.end(), coarse.begin(), coarse.end());
+	    break;
+	  }
+	}
+      }
+    }
+  }
+
+  fValueCount = fValueTable.size();
+  fBlocks = fBlockTable.data();
+  fValues = fValueTable.data();
+  PrepareLookup();
+  PrintSummary();
+}
+
+ICESPICEAdaptiveFieldMap::~ICESPICEAdaptiveFieldMap()
+{
+  if (fMapping) munmap(fMapping, fMappingSize);
+}
+
+void ICESPICEAdaptiveFieldMap::ReadBinary(const char* filename)
+{
+  int fd = open(filename, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    G4ExceptionDescription ed;
+    ed << "Could not open adaptive field map " << filename << std::endl;
+    G4Exception("ICESPICEAdaptiveFieldMap::ReadBinary","pugmag013",FatalException,ed);
+    return;
+  }
+  fMappingSize = static_cast<std::size_t>(info.st_size);
+  void* mapping = mmap(nullptr, fMappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    G4ExceptionDescription ed;
+    ed << "Could not map adaptive field map " << filename << std::endl;
+    G4Exception("ICESPICEAdaptiveFieldMap::ReadBinary","pugmag013",FatalException,ed);
+    return;
+  }
+  fMapping = mapping;
+
+  BinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  const char* bytes = static_cast<const char*>(fMapping);
+  bool valid = fMappingSize >= sizeof(header);
+  if (valid) {
+    std::memcpy(&header, bytes, sizeof(header));
+    const std::uint32_t B = header.blockCells;
+    valid = std::memcmp(header.magic, kBinaryMagic, sizeof(kBinaryMagic)) == 0
+      && header.version == kBinaryVersion
+      && B >= 1 && B <= 64 && (B & (B - 1)) == 0
+      && header.nx > 1 && header.ny > 1 && header.nz > 1
+      && header.blocks[0] == (header.nx - 2) / B + 1
+      && header.blocks[1] == (header.ny - 2) / B + 1
+      && header.blocks[2] == (header.nz - 2) / B + 1
+      && header.valueCount % 3 == 0
+      && header.blockOffset >= sizeof(header);
+    if (valid) {
+      fBlockCount = static_cast<std::size_t>(header.blocks[0]) * header.blocks[1] * header.blocks[2];
+      fValueCount = header.valueCount;
+      valid = header.valueOffset == header.blockOffset + fBlockCount * sizeof(Block)
+	&& header.valueOffset + fValueCount * sizeof(float) <= fMappingSize;
+    }
+  }
+  if (valid && ICESPICEFieldMap::GetVerifyChecksums()) {
+    const std::size_t payload = header.valueOffset - header.blockOffset
+      + fValueCount * sizeof(float);
+    valid = ICESPICEFieldMap::Checksum(bytes + header.blockOffset, payload) == header.checksum;
+  }
+  if (valid) {
+    // Every block must lie within the values, so lookups need no checks
+    fBlocks = reinterpret_cast<const Block*>(bytes + header.blockOffset);
+    for (std::size_t i = 0; i < fBlockCount && valid; ++i) {
+      const std::uint32_t stride = fBlocks[i].stride;
+      if (stride == 0) continue;
+      const std::size_t m = header.blockCells / stride + 1;
+      valid = stride <= header.blockCells && (stride & (stride - 1)) == 0
+	&& 3 * (fBlocks[i].offset + m * m * m) <= fValueCount;
+    }
+  }
+  if (!valid) {
+    G4ExceptionDescription ed;
+    ed << filename << " is not a valid adaptive field map (version "
+       << kBinaryVersion << " expected), or it is truncated or corrupt" << std::endl;
+    G4Exception("ICESPICEAdaptiveFieldMap::ReadBinary","pugmag014",FatalException,ed);
+    return;
+  }
+
+  fValues = reinterpret_cast<const float*>(bytes + header.valueOffset);
+  fBlockCells = header.blockCells;
+  while ((1 << fBlockShift) < fBlockCells) ++fBlockShift;
+  fTolerance = header.tolerance * header.fieldUnit;
+  nx = header.nx;
+  ny = header.ny;
+  nz = header.nz;
+  nbx = header.blocks[0];
+  nby = header.blocks[1];
+  nbz = header.blocks[2];
+  minx = header.first[0] * header.lengthUnit;
+  miny = header.first[1] * header.lengthUnit;
+  minz = header.first[2] * header.lengthUnit;
+  maxx = header.last[0] * header.lengthUnit;
+  maxy = header.last[1] * header.lengthUnit;
+  maxz = header.last[2] * header.lengthUnit;
+}
+
+void ICESPICEAdaptiveFieldMap::PrepareLookup()
+{
+  invdx = (nx - 1) / (maxx - minx);
+  invdy = (ny - 1) / (maxy - miny);
+  invdz = (nz - 1) / (maxz - minz);
+
+  // Index range, per axis, of the blocks with field
+  int first[3] = {nbx, nby, nbz};
+  int last[3]  = {-1, -1, -1};
+  std::size_t block = 0;
+  for (int bx = 0; bx < nbx; ++bx) {
+    for (int by = 0; by < nby; ++by) {
+      for (int bz = 0; bz < nbz; ++bz, ++block) {
+	if (fBlocks[block].stride == 0) continue;
+	const int index[3] = {bx, by, bz};
+	for (int axis = 0; axis < 3; ++axis) {
+	  first[axis] = std::min(first[axis], index[axis]);
+	  last[axis]  = std::max(last[axis], index[axis]);
+	}
+      }
+    }
+  }
+
+  const int n[3] = {nx, ny, nz};
+  const double lower[3] = {minx, miny, minz};
+  const double upper[3] = {maxx, maxy, maxz};
+  for (int axis = 0; axis < 3; ++axis) {
+    if (last[axis] < 0) {
+      fActiveMin[axis] = HUGE_VAL;
+      fActiveMax[axis] = -HUGE_VAL;
+      continue;
+    }
+    const int lo = first[axis] * fBlockCells;
+    const int hi = std::min((last[axis] + 1) * fBlockCells, n[axis] - 1);
+    auto coordinate = [&](int i) {
+      if (i == n[axis] - 1) return upper[axis];
+      return lower[axis] + (upper[axis] - lower[axis]) * i / (n[axis] - 1);
+    };
+    fActiveMin[axis] = coordinate(lo);
+    fActiveMax[axis] = coordinate(hi);
+  }
+}
+
+void ICESPICEAdaptiveFieldMap::PrintSummary() const
+{
+  G4cout << "  [ Source nodes x,y,z: " << nx << " " << ny << " " << nz << " ] "
+	 << "\n  [ " << fBlockCount << " blocks of " << fBlockCells << "^3 cells,"
+	 << " tolerance " << fTolerance/gauss << " G ]"
+	 << "\n  [ Blocks per node spacing:";
+  for (int level = 0; (1 << level) <= fBlockCells; ++level) {
+    G4cout << " " << (1 << level) << ": " << GetBlockCount(level);
+  }
+  G4cout << ", no field: " << GetBlockCount(-1) << " ]"
+	 << "\n  [ " << GetValueBytes() / 1024 << " kB ]" << G4endl;
+
+  double boxLower[3], boxUpper[3];
+  if (GetActiveBox(boxLower, boxUpper)) {
+    G4cout << " ---> Blocks with field inside x,y,z: "
+	   << boxLower[0]/cm << " .. " << boxUpper[0]/cm << ", "
+	   << boxLower[1]/cm << " .. " << boxUpper[1]/cm << ", "
+	   << boxLower[2]/cm << " .. " << boxUpper[2]/cm << " cm" << G4endl;
+  } else {
+    G4cout << " ---> The field is below " << ICESPICEFieldMap::kZeroField/tesla
+	   << " T everywhere" << G4endl;
+  }
+}
+
+bool ICESPICEAdaptiveFieldMap::GetActiveBox(double* lower, double* upper) const
+{
+  if (fActiveMin[0] > fActiveMax[0]) return false;
+  for (int axis = 0; axis < 3; ++axis) {
+    lower[axis] = fActiveMin[axis];
+    upper[axis] = fActiveMax[axis];
+  }
+  return true;
+}
+
+std::size_t ICESPICEAdaptiveFieldMap::GetBlockCount(int level) const
+{
+  const std::uint32_t stride = level < 0 ? 0 : 1u << level;
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < fBlockCount; ++i) {
+    if (fBlocks[i].stride == stride) ++count;
+  }
+  return count;
+}
+
+std::size_t ICESPICEAdaptiveFieldMap::GetValueBytes() const
+{
+  return fBlockCount * sizeof(Block) + fValueCount * sizeof(float);
+}
+
+double ICESPICEAdaptiveFieldMap::GetMaxDeviation(const ICESPICEFieldMap& source) const
+{
+  auto coordinate = [](double lower, double upper, int i, int n) {
+    return i == n - 1 ? upper : lower + (upper - lower) * i / (n - 1);
+  };
+  double largest2 = 0.;
+  for (int ix = 0; ix < source.GetNx(); ++ix) {
+    const double x = coordinate(source.GetMinX(), source.GetMaxX(), ix, source.GetNx());
+    for (int iy = 0; iy < source.GetNy(); ++iy) {
+      const double y = coordinate(source.GetMinY(), source.GetMaxY(), iy, source.GetNy());
+      for (int iz = 0; iz < source.GetNz(); ++iz) {
+	const double z = coordinate(source.GetMinZ(), source.GetMaxZ(), iz, source.GetNz());
+	double B[3], reference[3];
+	GetFieldValue(x, y, z, B);
+	source.GetNodeValue(ix, iy, iz, reference);
+	double deviation2 = 0.;
+	for (int component = 0; component < 3; ++component) {
+	  const double d = B[component] - reference[component];
+	  deviation2 += d * d;
+	}
+	largest2 = std::max(largest2, deviation2);
+      }
+    }
+  }
+  return std::sqrt(largest2);
+}
+
+void ICESPICEAdaptiveFieldMap::WriteBinary(const char* filename) const
+{
+  BinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kBinaryMagic, sizeof(kBinaryMagic));
+  header.version = kBinaryVersion;
+  header.blockCells = fBlockCells;
+  header.nx = nx;
+  header.ny = ny;
+  header.nz = nz;
+  header.blocks[0] = nbx;
+  header.blocks[1] = nby;
+  header.blocks[2] = nbz;
+  header.first[0] = minx / meter;
+  header.first[1] = miny / meter;
+  header.first[2] = minz / meter;
+  header.last[0]  = maxx / meter;
+  header.last[1]  = maxy / meter;
+  header.last[2]  = maxz / meter;
+  header.lengthUnit = meter;
+  header.fieldUnit = tesla;
+  header.tolerance = fTolerance / tesla;
+  header.blockOffset = sizeof(header);
+  header.valueOffset = header.blockOffset + fBlockCount * sizeof(Block);
+  header.valueCount = fValueCount;
+
+  // The checksum covers the block table and the values together
+  std::vector<char> data(fBlockCount * sizeof(Block) + fValueCount * sizeof(float));
+  std::memcpy(data.data(), fBlocks, fBlockCount * sizeof(Block));
+  std::memcpy(data.data() + fBlockCount * sizeof(Block), fValues, fValueCount * sizeof(float));
+  header.checksum = ICESPICEFieldMap::Checksum(data.data(), data.size());
+
+  std::ofstream file( filename, std::ios::binary | std::ios::trunc );
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(data.data(), data.size());
+  file.close();
+  if (!file) {
+    G4ExceptionDescription ed;
+    ed << "Could not write adaptive field map " << filename << std::endl;
+    G4Exception("ICESPICEAdaptiveFieldMap::WriteBinary","pugmag015",FatalException,ed);
+  }
+}
+
+void ICESPICEAdaptiveFieldMap::GetFieldValue(double x, double y, double z,
+					     double* Bfield) const
+{
+  if ( x>=fActiveMin[0] && x<=fActiveMax[0] &&
+       y>=fActiveMin[1] && y<=fActiveMax[1] &&
+       z>=fActiveMin[2] && z<=fActiveMax[2] ) {
+
+    // Source cell of the point, as in ICESPICEFieldMap, and its block
+    const double xcell = (x - minx) * invdx;
+    const double ycell = (y - miny) * invdy;
+    const double zcell = (z - minz) * invdz;
+    const int xblock = std::min(static_cast<int>(xcell), nx - 2) >> fBlockShift;
+    const int yblock = std::min(static_cast<int>(ycell), ny - 2) >> fBlockShift;
+    const int zblock = std::min(static_cast<int>(zcell), nz - 2) >> fBlockShift;
+    const Block& block = fBlocks[(static_cast<std::size_t>(xblock) * nby + yblock) * nbz + zblock];
+
+    if (block.stride != 0) {
+      // Position in the cells of the block's own grid
+      const double scale = 1. / block.stride;
+      const int cells = fBlockCells / block.stride;
+      const double xs = (xcell - (xblock << fBlockShift)) * scale;
+      const double ys = (ycell - (yblock << fBlockShift)) * scale;
+      const double zs = (zcell - (zblock << fBlockShift)) * scale;
+      const int xindex = std::min(static_cast<int>(xs), cells - 1);
+      const int yindex = std::min(static_cast<int>(ys), cells - 1);
+      const int zindex = std::min(static_cast<int>(zs), cells - 1);
+
+      const std::size_t m = cells + 1;
+      const float* c000 = fValues
+	+ 3 * (block.offset + (xindex * m + yindex) * m + zindex);
+      Trilinear(c000, 3 * m, 3 * m * m, xs - xindex, ys - yindex, zs - zindex, Bfield);
+      Bfield[0] *= tesla;
+      Bfield[1] *= tesla;
+      Bfield[2] *= tesla;
+      return;
+    }
+  }
+  Bfield[0] = 0.0;
+  Bfield[1] = 0.0;
+  Bfield[2] = 0.0;
+}
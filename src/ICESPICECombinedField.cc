@@ -0,0 +1,57 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//    *************************************
+//    *                                   *
+//    *    ICESPICECombinedField.cc        *
+//    *                                   *
+//    *************************************
+//
+//
+
+#include "ICESPICECombinedField.hh"
+
+ICESPICECombinedField::ICESPICECombinedField()
+  :fField(nullptr),fExtra(nullptr),fScale(1.),fExtraScale(1.)
+{
+}
+
+void ICESPICECombinedField::GetFieldValue(const G4double Point[4],
+					  G4double* Bfield) const
+{
+  fField->GetFieldValue(Point, Bfield);
+  Bfield[0] = fScale*Bfield[0] + fUniform.x();
+  Bfield[1] = fScale*Bfield[1] + fUniform.y();
+  Bfield[2] = fScale*Bfield[2] + fUniform.z();
+  if (fExtra) {
+    G4double extra[3];
+    fExtra->GetFieldValue(Point, extra);
+    Bfield[0] += fExtraScale*extra[0];
+    Bfield[1] += fExtraScale*extra[1];
+    Bfield[2] += fExtraScale*extra[2];
+  }
+}
@@ -0,0 +1,514 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//    *************************************
+//    *                                   *
+//    *    ICESPICEComsolExport.cc         *
+//    *                                   *
+//    *************************************
+//
+//
+
+#include "ICESPICEComsolExport.hh"
+#include "G4SystemOfUnits.hh"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+  // Bytes read from the export at a time; also the longest line allowed
+  const std::size_t kBufferSize = 1 << 24;
+
+  // x, y, z, Bx, By, Bz of a line
+  typedef std::array<double, 6> Node;
+
+  // Lines of a file, read through a buffer of fixed size
+  class LineReader
+  {
+  public:
+    explicit LineReader(std::FILE* file)
+      :fFile(file),fBuffer(kBufferSize),fBegin(0),fEnd(0),fBytes(0),fLine(0),fTooLong(false)
+    {}
+
+    // Next line, without its end of line; false at the end of the file
+    // or if a line does not fit in the buffer
+    bool Next(const char*& line, const char*& lineEnd)
+    {
+      const void* newline = std::memchr(fBuffer.data() + fBegin, '\n', fEnd - fBegin);
+      if (newline == nullptr) {
+	// Keep the incomplete line and fill the rest of the buffer
+	std::memmove(fBuffer.data(), fBuffer.data() + fBegin, fEnd - fBegin);
+	fEnd -= fBegin;
+	fBegin = 0;
+	fEnd += std::fread(fBuffer.data() + fEnd, 1, fBuffer.size() - fEnd, fFile);
+	newline = std::memchr(fBuffer.data(), '\n', fEnd);
+	if (newline == nullptr) {
+	  if (fEnd == fBuffer.size()) fTooLong = true;
+	  if (fEnd == 0 || fTooLong) return false;
+	  newline = fBuffer.data() + fEnd;  // last line, without end of line
+	}
+      }
+      line = fBuffer.data() + fBegin;
+      lineEnd = static_cast<const char*>(newline);
+      const std::size_t next = std::min(fEnd, static_cast<std::size_t>(lineEnd - fBuffer.data()) + 1);
+      fBytes += next - fBegin;
+      fBegin = next;
+      ++fLine;
+      if (lineEnd > line && lineEnd[-1] == '\r') --lineEnd;
+      return true;
+    }
+
+    std::size_t GetBytes() const { return fBytes; }
+    std::size_t GetLine() const { return fLine; }
+    bool TooLong() const { return fTooLong; }
+
+  private:
+    std::FILE*        fFile;
+    std::vector<char> fBuffer;
+    std::size_t       fBegin, fEnd;  // unread part of the buffer
+    std::size_t       fBytes;        // bytes of the lines returned
+    std::size_t       fLine;         // lines returned
+    bool              fTooLong;
+  };
+
+  inline bool IsSeparator(char c)
+  {
+    return c == ' ' || c == '\t' || c == ',' || c == ';';
+  }
+
+  inline const char* SkipBlanks(const char* p, const char* end)
+  {
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    return p;
+  }
+
+  // Reads x, y, z, Bx, By, Bz; further columns are ignored
+  bool ParseNode(const char* p, const char* end, Node& node)
+  {
+    for (double& value : node) {
+      while (p < end && IsSeparator(*p)) ++p;
+      if (p < end && *p == '+') ++p;  // from_chars takes no plus sign
+      const std::from_chars_result result = std::from_chars(p, end, value);
+      if (result.ec != std::errc()) return false;
+      p = result.ptr;
+    }
+    return true;
+  }
+
+  double LengthUnit(const std::string& name)
+  {
+    if (name == "m")  return meter;
+    if (name == "cm") return cm;
+    if (name == "mm") return mm;
+    if (name == "um" || name == "\xC2\xB5m") return micrometer;
+    return 0.;
+  }
+
+  double FieldUnit(const std::string& name)
+  {
+    if (name == "T")  return tesla;
+    if (name == "mT") return 1.e-3*tesla;
+    if (name == "G")  return gauss;
+    if (name == "kG") return kilogauss;
+    return 0.;
+  }
+
+  // Unit of the first field column of the line naming the columns, as in
+  // "% x  y  z  mf.Bx (T)  mf.By (T)  mf.Bz (T)"; 0 if there is none
+  double ColumnFieldUnit(const std::string& columns)
+  {
+    for (std::size_t open = columns.find('('); open != std::string::npos;
+	 open = columns.find('(', open + 1)) {
+      const std::size_t close = columns.find(')', open);
+      if (close == std::string::npos) break;
+      const double unit = FieldUnit(columns.substr(open + 1, close - open - 1));
+      if (unit > 0.) return unit;
+    }
+    return 0.;
+  }
+
+  // Value of a "% Name: value" comment line, trimmed, if text is one
+  bool CommentValue(const std::string& text, const char* name, std::string& value)
+  {
+    const std::size_t length = std::strlen(name);
+    if (text.compare(0, length, name) != 0) return false;
+    const std::size_t begin = text.find_first_not_of(" \t", length);
+    const std::size_t end = text.find_last_not_of(" \t");
+    value = begin == std::string::npos ? std::string() : text.substr(begin, end + 1 - begin);
+    return true;
+  }
+
+  inline bool IsDataLine(const char* line, const char* lineEnd)
+  {
+    const char* p = SkipBlanks(line, lineEnd);
+    return p < lineEnd && *p != '%';
+  }
+
+  inline bool Differs(double a, double b)
+  {
+    return std::fabs(a - b) > 1.e-9 * (std::fabs(a) + std::fabs(b));
+  }
+}
+
+bool ICESPICEComsolExport::IsExport(const char* filename)
+{
+  std::FILE* file = std::fopen(filename, "rb");
+  if (file == nullptr) return false;
+  int c;
+  do c = std::fgetc(file); while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+  std::fclose(file);
+  return c == '%';
+}
+
+void ICESPICEComsolExport::Convert(const char* filename, const char* output,
+				   ICESPICEFieldMap::Storage storage)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  const G4String temporary = G4String(output) + ".tmp" + std::to_string(getpid());
+  std::FILE* in = std::fopen(filename, "rb");
+  int fd = -1;
+  void* mapping = nullptr;
+  std::size_t mappingSize = 0;
+
+  auto fail = [&](const G4String& message) {
+    if (mapping) munmap(mapping, mappingSize);
+    if (fd >= 0) {
+      close(fd);
+      unlink(temporary.c_str());
+    }
+    if (in) std::fclose(in);
+    G4ExceptionDescription ed;
+    ed << filename << ": " << message << std::endl;
+    G4Exception("ICESPICEComsolExport::Convert","pugmag017",FatalException,ed);
+  };
+
+  struct stat info;
+  if (in == nullptr || fstat(fileno(in), &info) != 0) {
+    fail("could not open the export");
+    return;
+  }
+  if (storage != ICESPICEFieldMap::Storage::Double
+      && storage != ICESPICEFieldMap::Storage::Float) {
+    fail("only double and float values can be written from an export");
+    return;
+  }
+  const std::size_t size = static_cast<std::size_t>(info.st_size);
+  LineReader reader(in);
+
+  // Comment lines: the number of nodes, the length unit, and last the
+  // names of the columns with the units of the field
+  std::size_t announced = 0;
+  double lengthUnit = mm;  // the default of COMSOL
+  std::string columns;
+  const char* line = nullptr;
+  const char* lineEnd = nullptr;
+  bool more;
+  while ((more = reader.Next(line, lineEnd))) {
+    const char* p = SkipBlanks(line, lineEnd);
+    if (p == lineEnd) continue;
+    if (*p != '%') break;
+    const std::string text(SkipBlanks(p + 1, lineEnd), lineEnd);
+    std::string value;
+    if (CommentValue(text, "Nodes:", value)) {
+      announced = std::strtoul(value.c_str(), nullptr, 10);
+    }
+    else if (CommentValue(text, "Length unit:", value)) {
+      lengthUnit = LengthUnit(value);
+      if (lengthUnit == 0.) {
+	fail("unknown length unit " + value);
+	return;
+      }
+    }
+    columns = text;
+  }
+  double fieldUnit = ColumnFieldUnit(columns);
+  if (fieldUnit == 0.) {
+    G4cout << "No unit found for the field columns of " << filename
+	   << ", taking tesla" << G4endl;
+    fieldUnit = tesla;
+  }
+
+  // Without the number of nodes in the header, the lines are counted first
+  if (announced == 0 && more) {
+    std::FILE* counted = std::fopen(filename, "rb");
+    if (counted) {
+      LineReader counter(counted);
+      const char* l;
+      const char* lEnd;
+      while (counter.Next(l, lEnd))
+	if (IsDataLine(l, lEnd)) ++announced;
+      std::fclose(counted);
+    }
+  }
+
+  // The grid is learned from the first plane of nodes, which is held
+  // until the fastest and the second fastest axes have both wrapped
+  // around. Every node after that goes straight to its place in the map.
+  std::vector<Node> plane;
+  int fastAxis = -1, middleAxis = -1, slowAxis = -1;
+  std::size_t nFast = 0;
+  double first[3], step[3];
+  long n[3] = {0, 0, 0};
+  bool gridKnown = false;
+
+  ICESPICEFieldMap::BinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  const std::size_t valueSize = ICESPICEFieldMap::ValueSize(storage);
+  char* data = nullptr;
+  std::size_t nodes = 0, stored = 0, empty = 0;
+  std::vector<bool> written;  // one bit per node
+
+  auto where = [&]() {
+    std::ostringstream message;
+    message << "line " << reader.GetLine() << ": ";
+    return message.str();
+  };
+
+  // Creates the map once the grid is known
+  auto createMap = [&]() {
+    nodes = static_cast<std::size_t>(n[0]) * n[1] * n[2];
+    std::memcpy(header.magic, ICESPICEFieldMap::kBinaryMagic, sizeof(header.magic));
+    header.version = ICESPICEFieldMap::kBinaryVersion;
+    header.valueSize = static_cast<std::uint32_t>(valueSize);
+    header.nx = n[0];
+    header.ny = n[1];
+    header.nz = n[2];
+    for (int axis = 0; axis < 3; ++axis) {
+      const double end = first[axis] + step[axis] * (n[axis] - 1);
+      header.first[axis] = std::min(first[axis], end);
+      header.last[axis]  = std::max(first[axis], end);
+    }
+    header.lengthUnit = lengthUnit;
+    header.fieldUnit = fieldUnit;
+    header.dataOffset = sizeof(header);
+    header.zeroField = ICESPICEFieldMap::kZeroField;
+    for (int axis = 0; axis < 3; ++axis) {
+      header.activeFirst[axis] = static_cast<std::int32_t>(n[axis]);
+      header.activeLast[axis] = -1;
+    }
+
+    mappingSize = header.dataOffset + 3 * nodes * valueSize;
+    fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(mappingSize)) != 0) return false;
+    mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      mapping = nullptr;
+      return false;
+    }
+    data = static_cast<char*>(mapping) + header.dataOffset;
+    written.assign(nodes, false);
+    return true;
+  };
+
+  const double zero2 = ICESPICEFieldMap::kZeroField * ICESPICEFieldMap::kZeroField;
+
+  // Writes a node at its place in the map, x slowest and z fastest with
+  // every axis increasing
+  auto store = [&](const Node& node) {
+    std::size_t index[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      const double t = (node[axis] - first[axis]) / step[axis];
+      const long i = std::lround(t);
+      if (std::fabs(t - i) > 1.e-3 || i < 0 || i >= n[axis]) {
+	std::ostringstream message;
+	message << where() << "coordinate " << "xyz"[axis] << " = " << node[axis]
+		<< " is not on the grid of the first plane";
+	fail(message.str());
+	return false;
+      }
+      index[axis] = step[axis] > 0. ? i : n[axis] - 1 - i;
+    }
+    const std::size_t k = (index[0] * n[1] + index[1]) * n[2] + index[2];
+    if (written[k]) {
+      fail(where() + "the node is already in the export");
+      return false;
+    }
+    written[k] = true;
+    ++stored;
+    // Active nodes go in the header, so reading the map needs no scan
+    const double B2 = node[3] * node[3] + node[4] * node[4] + node[5] * node[5];
+    if (B2 * fieldUnit * fieldUnit > zero2) {
+      for (int axis = 0; axis < 3; ++axis) {
+	const std::int32_t i = static_cast<std::int32_t>(index[axis]);
+	header.activeFirst[axis] = std::min(header.activeFirst[axis], i);
+	header.activeLast[axis] = std::max(header.activeLast[axis], i);
+      }
+    }
+    if (storage == ICESPICEFieldMap::Storage::Double) {
+      std::memcpy(data + 3 * k * sizeof(double), &node[3], 3 * sizeof(double));
+    } else {
+      const float values[3] = { static_cast<float>(node[3]), static_cast<float>(node[4]),
+				static_cast<float>(node[5]) };
+      std::memcpy(data + 3 * k * sizeof(float), values, sizeof(values));
+    }
+    return true;
+  };
+
+  // Learns the grid from the nodes held so far; returns false on failure
+  auto learnGrid = [&]() {
+    const Node& p0 = plane.front();
+    const Node& last = plane.back();
+    const std::size_t k = plane.size() - 1;
+    bool differs[3];
+    for (int axis = 0; axis < 3; ++axis) differs[axis] = Differs(last[axis], p0[axis]);
+
+    if (fastAxis < 0) {
+      if (differs[0] + differs[1] + differs[2] != 1) {
+	fail(where() + "the first two nodes differ in more than one coordinate");
+	return false;
+      }
+      fastAxis = differs[0] ? 0 : differs[1] ? 1 : 2;
+      return true;
+    }
+    // The node where the next axis steps starts over along the faster ones
+    if (middleAxis < 0) {
+      const int a = (fastAxis + 1) % 3, b = (fastAxis + 2) % 3;
+      if (!differs[a] && !differs[b]) return true;
+      if (differs[fastAxis] || (differs[a] && differs[b])) {
+	fail(where() + "the fastest axis does not start over when the next one steps");
+	return false;
+      }
+      middleAxis = differs[a] ? a : b;
+      slowAxis = 3 - fastAxis - middleAxis;
+      nFast = k;
+      return true;
+    }
+    if (!differs[slowAxis]) return true;
+    if (differs[fastAxis] || differs[middleAxis] || k % nFast != 0) {
+      fail(where() + "the first plane of nodes is not a regular grid");
+      return false;
+    }
+
+    n[fastAxis] = static_cast<long>(nFast);
+    n[middleAxis] = static_cast<long>(k / nFast);
+    n[slowAxis] = static_cast<long>(announced / k);
+    if (n[middleAxis] < 2 || n[slowAxis] < 2 || announced % k != 0) {
+      std::ostringstream message;
+      message << announced << " nodes do not make a grid of " << n[fastAxis] << " x "
+	      << n[middleAxis] << " nodes per plane and at least 2 planes";
+      fail(message.str());
+      return false;
+    }
+    for (int axis = 0; axis < 3; ++axis) first[axis] = p0[axis];
+    step[fastAxis] = plane[1][fastAxis] - p0[fastAxis];
+    step[middleAxis] = plane[nFast][middleAxis] - p0[middleAxis];
+    step[slowAxis] = last[slowAxis] - p0[slowAxis];
+
+    if (!createMap()) {
+      fail(G4String("could not create ") + temporary);
+      return false;
+    }
+    gridKnown = true;
+    for (const Node& node : plane)
+      if (!store(node)) return false;
+    std::vector<Node>().swap(plane);
+    return true;
+  };
+
+  // The data lines, starting with the one after the comments
+  int percentComplete = 0;
+  for (; more; more = reader.Next(line, lineEnd)) {
+    if (!IsDataLine(line, lineEnd)) continue;
+    Node node;
+    if (!ParseNode(line, lineEnd, node)) {
+      fail(where() + "could not read x, y, z, Bx, By, Bz");
+      return;
+    }
+    if (!std::isfinite(node[0]) || !std::isfinite(node[1]) || !std::isfinite(node[2])) {
+      fail(where() + "the coordinates are not finite");
+      return;
+    }
+    // COMSOL has no field outside its geometry, inside the magnets
+    if (std::isnan(node[3]) || std::isnan(node[4]) || std::isnan(node[5])) {
+      node[3] = node[4] = node[5] = 0.;
+      ++empty;
+    }
+
+    if (gridKnown) {
+      if (!store(node)) return;
+    } else {
+      plane.push_back(node);
+      if (plane.size() > 1 && !learnGrid()) return;
+    }
+
+    const int newPercentComplete = static_cast<int>(10 * reader.GetBytes() / size) * 10;
+    if (newPercentComplete > percentComplete) {
+      percentComplete = newPercentComplete;
+      G4cout << "Reading progress: " << percentComplete << "% complete" << G4endl;
+    }
+  }
+  if (reader.TooLong()) {
+    fail(where() + "line longer than the read buffer");
+    return;
+  }
+  if (!gridKnown) {
+    fail("the export does not hold a 3D grid with at least two nodes along every axis");
+    return;
+  }
+  if (stored != nodes) {
+    const std::size_t k = std::find(written.begin(), written.end(), false) - written.begin();
+    std::ostringstream message;
+    message << "only " << stored << " of the " << nodes << " nodes are in the export;"
+	    << " the first one missing is ix=" << k / (n[1] * n[2])
+	    << ", iy=" << k / n[2] % n[1] << ", iz=" << k % n[2];
+    fail(message.str());
+    return;
+  }
+
+  header.checksum = ICESPICEFieldMap::Checksum(data, 3 * nodes * valueSize);
+  std::memcpy(mapping, &header, sizeof(header));
+  const bool synced = msync(mapping, mappingSize, MS_SYNC) == 0;
+  munmap(mapping, mappingSize);
+  mapping = nullptr;
+  if (!synced || close(fd) != 0 || std::rename(temporary.c_str(), output) != 0) {
+    fail(G4String("could not write ") + output);
+    return;
+  }
+  fd = -1;
+  std::fclose(in);
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  G4cout << "Converted " << filename << ": " << n[0] << " x " << n[1] << " x " << n[2]
+	 << " nodes, " << "xyz"[fastAxis] << " fastest and " << "xyz"[slowAxis] << " slowest, "
+	 << empty << " without field set to zero, " << size / (1024*1024) << " MB in "
+	 << seconds << " s (" << size / (1024.*1024.) / seconds << " MB/s)" << G4endl;
+}
@@ -34,7 +34,9 @@
 //
 //
 #include "ICESPICEDetectorConstruction.hh"
-#include "ICESPICETabulatedField3D.hh"
+#include "ICESPICEFieldSetup.hh"
+#include "ICESPICEFieldManager.hh"
+#include "ICESPICEFieldMap.hh"
 #include "globals.hh"
 #include "G4PhysicalConstants.hh"
 #include "G4SystemOfUnits.hh"
@@ -47,23 +49,7 @@
 #include "G4PVPlacement.hh"
 #include "G4PVReplica.hh"
 #include "G4PVParameterised.hh"
-#include "G4Mag_UsualEqRhs.hh"
-#include "G4FieldManager.hh"
 #include "G4TransportationManager.hh"
-#include "G4EqMagElectricField.hh"
-
-#include "G4ChordFinder.hh"
-#include "G4UniformMagField.hh"
-#include "G4ExplicitEuler.hh"
-#include "G4ImplicitEuler.hh"
-#include "G4SimpleRunge.hh"
-#include "G4SimpleHeum.hh"
-#include "G4ClassicalRK4.hh"
-#include "G4HelixExplicitEuler.hh"
-#include "G4HelixImplicitEuler.hh"
-#include "G4HelixSimpleRunge.hh"
-#include "G4CashKarpRKF45.hh"
-#include "G4RKG3_Stepper.hh"
 #include "G4NistManager.hh"
 
 #include "G4VisAttributes.hh"
@@ -75,8 +61,12 @@
 
 #include "G4GenericMessenger.hh"
 #include "G4RunManager.hh"
+#include "G4AutoDelete.hh"
 
 #include "CADMesh.hh"
+#include "G4DisplacedSolid.hh"
+
+#include <fstream>
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 // Possibility to turn off (0) magnetic field and measurement volume. 
@@ -103,6 +93,9 @@ ICESPICEDetectorConstruction::ICESPICEDetectorConstruction()
     fMessenger(0)  
 {
   fField.Put(0);
+  FieldModel="grid";
+  MeshPrimitives=true;
+  MeshTolerance=0.;
   WorldSizeXY=WorldSizeZ=0;
   DetectorPosition=-30.*mm; // AC
   DefineCommands();
@@ -291,7 +284,7 @@ void ICESPICEDetectorConstruction::ICESPICE()
   // Add the attenuator at the origin
   #if ATTENUATOR
     auto attenuator = CADMesh::TessellatedMesh::FromPLY("./cad_files/tantalum_5_slot_attenuator.PLY");
-    solidAttenuator = attenuator->GetSolid();
+    solidAttenuator = MeshSolid(attenuator);
     logicAttenuator = new G4LogicalVolume(solidAttenuator, AttenuatorMaterial, "Attenuator");
     // rotate 180 degrees to match the CAD file
     G4RotationMatrix* rot = new G4RotationMatrix();
@@ -315,7 +308,7 @@ void ICESPICEDetectorConstruction::ICESPICE()
   // Add the magnets around the origin with the same offset as in solidworks
   #if MAGNETS
     auto magnet = CADMesh::TessellatedMesh::FromPLY("./cad_files/1x1x1_8in_square_magnet.PLY");
-    auto solidMagnet = magnet->GetSolid();
+    auto solidMagnet = MeshSolid(magnet);
     auto logicMagnet = new G4LogicalVolume(solidMagnet, MagnetMaterial, "Magnet");
 
     // Calculate the placement and rotation for each magnet
@@ -346,8 +339,8 @@ void ICESPICEDetectorConstruction::ICESPICE()
   #endif
 
   #if MAGNETHOLDER
-      auto magnetHolder = CADMesh::TessellatedMesh::FromPLY("./cad_files/5N42_1x1x1_8in_magnets_mount.stl");
-      auto solidMagnetHolder = magnetHolder->GetSolid();
+      auto magnetHolder = CADMesh::TessellatedMesh::FromSTL("./cad_files/5N42_1x1x1_8in_magnets_mount.stl");
+      auto solidMagnetHolder = MeshSolid(magnetHolder);
       auto logicMagnetHolder = new G4LogicalVolume(solidMagnetHolder, DetectorHousingMaterial, "MagnetHolder");
 
       // Place the magnet holder at the origin
@@ -375,19 +368,31 @@ void ICESPICEDetectorConstruction::ConstructSDandField()
   
   if (fField.Get() == 0)
     {
-      //Field grid in A9.TABLE. File must be in accessible from run urn directory. 
-      G4MagneticField* ICESPICEField= new ICESPICETabulatedField3D("ICESPICE3D.TABLE", zOffset);
-      fField.Put(ICESPICEField);
-      
-      //This is thread-local
-      G4FieldManager* pFieldMgr = 
-	G4TransportationManager::GetTransportationManager()->GetFieldManager();
-           
-      G4cout<< "DeltaStep "<<pFieldMgr->GetDeltaOneStep()/mm <<"mm" <<G4endl;
-      //G4ChordFinder *pChordFinder = new G4ChordFinder(ICESPICEField);
-
-      pFieldMgr->SetDetectorField(fField.Get());
-      pFieldMgr->CreateChordFinder(fField.Get());
+      //Field grid in ICESPICE3D.TABLE. File must be in accessible from run urn directory. 
+      //The binary map ICESPICE3D.bin (see ICESPICEFieldConvert) is used instead
+      //when it is present, since it is mapped rather than parsed.
+      //The grid is read once and shared by all threads (ICESPICEFieldMap);
+      //only this thin view is created per thread.
+      const char* fieldFile = "ICESPICE3D.TABLE";
+      if (std::ifstream("ICESPICE3D.bin").good()) fieldFile = "ICESPICE3D.bin";
+
+      //The adaptive grid (/ICESPICE/Detector/FieldModel adaptive) is read
+      //from ICESPICE3D.amap, written by ICESPICEFieldConvert --adaptive.
+      //The analytic model of the magnets (/ICESPICE/Detector/FieldModel)
+      //takes its parameters from ICESPICEMagnetFit, in ICESPICEMagnets.dat.
+      //This is thread-local: the field, its stepper and the accuracy
+      //parameters, all set with the /ICESPICE/Field/ commands. The field
+      //manager lets tracks that stay clear of the region with field
+      //(source and detector ends of the world) move in straight lines.
+      //It is attached to the world volume, so every daughter inherits it.
+      ICESPICEFieldSetup* fieldSetup =
+        new ICESPICEFieldSetup(fieldFile, "ICESPICE3D.amap", "ICESPICEMagnets.dat",
+                               zOffset, FieldModel);
+      G4AutoDelete::Register(fieldSetup);
+      fField.Put(fieldSetup);
+      logicWorld->SetFieldManager(fieldSetup->GetFieldManager(), true);
+
+      fieldSetup->Print();
       
     }
 #endif
@@ -408,6 +413,60 @@ void ICESPICEDetectorConstruction::DefineCommands() {
     detectorPosition.SetRange("position>-100. && position<=0.");
     detectorPosition.SetDefaultValue("-30.");
 
+    // Field model built at /run/initialize, which the macro runs after this
+    // command, so that the grid is not read when the magnet model is
+    // wanted; /ICESPICE/Field/Model switches later
+    G4GenericMessenger::Command& fieldModel
+      = fMessenger->DeclareProperty("FieldModel", FieldModel,
+                                    "Field from the grid, the adaptive grid or the analytic model of the magnets");
+    fieldModel.SetParameterName("model", false);
+    fieldModel.SetCandidates("grid adaptive magnets");
+
+    // Off by default: verifying reads every page of the map and the table
+    G4GenericMessenger::Command& verifyFieldMaps
+      = fMessenger->DeclareMethod("VerifyFieldMaps",
+                                  &ICESPICEDetectorConstruction::SetVerifyFieldMaps,
+                                  "Check field maps against their checksum and caches against their table when read");
+    verifyFieldMaps.SetParameterName("verify", true);
+    verifyFieldMaps.SetDefaultValue("true");
+
+    // Read when the CAD files are loaded, at /run/initialize
+    G4GenericMessenger::Command& meshPrimitives
+      = fMessenger->DeclareProperty("MeshPrimitives", MeshPrimitives,
+                                    "Build CAD meshes that are boxes, cylinders or prisms as G4Box, G4Tubs or G4ExtrudedSolid");
+    meshPrimitives.SetParameterName("primitives", true);
+    meshPrimitives.SetDefaultValue("true");
+
+    G4GenericMessenger::Command& meshTolerance
+      = fMessenger->DeclarePropertyWithUnit("MeshTolerance", "mm", MeshTolerance,
+                                            "Simplify tessellated CAD meshes to within this distance of the file, 0 to keep them as read");
+    meshTolerance.SetParameterName("tolerance", true);
+    meshTolerance.SetRange("tolerance>=0.");
+    meshTolerance.SetDefaultValue("0.");
+
+}
+
+G4VSolid* ICESPICEDetectorConstruction::MeshSolid(std::shared_ptr<CADMesh::TessellatedMesh> mesh) {
+    // Boxes, cylinders and prisms within 0.01 mm become native solids,
+    // which navigation handles far faster than a tessellated solid
+    mesh->SetPrimitives(MeshPrimitives);
+    // The rest may be decimated, within MeshTolerance of the file
+    mesh->SetSimplifyTolerance(MeshTolerance);
+    G4VSolid* solid = mesh->GetSolid();
+
+    G4VSolid* shape = solid;
+    if (auto displaced = dynamic_cast<G4DisplacedSolid*>(solid)) {
+      shape = displaced->GetConstituentMovedSolid();
+    }
+    G4cout << " ---> " << mesh->GetFileName() << " as " << shape->GetEntityType();
+    if (MeshTolerance > 0. && dynamic_cast<G4TessellatedSolid*>(solid)) {
+      auto simplification = mesh->GetSimplification();
+      G4cout << ", " << simplification.facets_before << " -> "
+             << simplification.facets_after << " facets, deviation "
+             << G4BestUnit(simplification.max_deviation, "Length");
+    }
+    G4cout << G4endl;
+    return solid;
 }
 
 void ICESPICEDetectorConstruction::SetDetectorPosition(G4double val) {
@@ -418,11 +477,15 @@ void ICESPICEDetectorConstruction::SetDetectorPosition(G4double val) {
     G4RunManager::GetRunManager()->ReinitializeGeometry();
 }
 
+void ICESPICEDetectorConstruction::SetVerifyFieldMaps(G4bool val) {
+    ICESPICEFieldMap::SetVerifyChecksums(val);
+}
+
 void ICESPICEDetectorConstruction::PIPS1000Detector() {
     // Assuming that the detector window and housing are positioned relative to the detector's dimensions.
     auto detector = CADMesh::TessellatedMesh::FromPLY("./cad_files/pips1000/active_area.PLY");
 
-    solidDetector = detector->GetSolid();
+    solidDetector = MeshSolid(detector);
     logicDetector = new G4LogicalVolume(solidDetector,
                                           DetectorMaterial,
                                           "Detector");
@@ -456,7 +519,7 @@ void ICESPICEDetectorConstruction::PIPS1000Detector() {
 
     // Create the outer housing for the detector
     auto detectorHousing = CADMesh::TessellatedMesh::FromPLY("./cad_files/pips1000/detector_housing.PLY");
-    solidDetectorHousing = detectorHousing->GetSolid();
+    solidDetectorHousing = MeshSolid(detectorHousing);
     logicDetectorHousing = new G4LogicalVolume(solidDetectorHousing,
                                               AttenuatorMaterial,
                                               "DetectorHousing");
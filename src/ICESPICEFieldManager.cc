@@ -0,0 +1,101 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldManager.cc         *
+//    *                                   *
+//    *************************************
+//
+//
+
+#include "ICESPICEFieldManager.hh"
+#include "G4MagneticField.hh"
+#include "G4Track.hh"
+
+#include <algorithm>
+#include <cfloat>
+
+ICESPICEFieldManager::ICESPICEFieldManager(G4MagneticField* field, G4bool hasField,
+					   const G4ThreeVector& lower,
+					   const G4ThreeVector& upper)
+  :G4FieldManager(field, nullptr, false),fField(field),fHasField(hasField),
+   fLower(lower),fUpper(upper),fFieldOn(true),fStraightLine(true)
+{
+}
+
+void ICESPICEFieldManager::SetField(G4MagneticField* field, G4bool hasField,
+				    const G4ThreeVector& lower,
+				    const G4ThreeVector& upper)
+{
+  fField = field;
+  fHasField = hasField;
+  fLower = lower;
+  fUpper = upper;
+  SetDetectorField(field);
+  fFieldOn = true;
+}
+
+void ICESPICEFieldManager::ConfigureForTrack(const G4Track* track)
+{
+  // Without field the step is a straight line up to the next boundary, and
+  // the next step is configured again, so dropping the field is exact as
+  // long as the straight ray misses the active box entirely.
+  G4bool fieldOn = true;
+  if (fStraightLine) {
+    fieldOn = fHasField
+      && ReachesField(track->GetPosition(), track->GetMomentumDirection());
+  }
+  if (fieldOn != fFieldOn) {
+    SetDetectorField(fieldOn ? fField : nullptr);
+    fFieldOn = fieldOn;
+  }
+}
+
+G4bool ICESPICEFieldManager::ReachesField(const G4ThreeVector& position,
+					  const G4ThreeVector& direction) const
+{
+  // Slab test: the ray enters the box if its entry distances through the
+  // three pairs of planes overlap ahead of the track.
+  G4double tnear = 0.;
+  G4double tfar = DBL_MAX;
+  for (G4int axis = 0; axis < 3; ++axis) {
+    if (direction[axis] == 0.) {
+      if (position[axis] < fLower[axis] || position[axis] > fUpper[axis]) return false;
+      continue;
+    }
+    G4double t1 = (fLower[axis] - position[axis]) / direction[axis];
+    G4double t2 = (fUpper[axis] - position[axis]) / direction[axis];
+    if (t1 > t2) std::swap(t1, t2);
+    tnear = std::max(tnear, t1);
+    tfar  = std::min(tfar, t2);
+    if (tnear > tfar) return false;
+  }
+  return true;
+}
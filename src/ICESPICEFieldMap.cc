@@ -0,0 +1,1668 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  S.Larsson and J. Generowicz.
+//  Modified by: Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldMap.cc             *
+//    *                                   *
+//    *************************************
+//
+//
+
+#include "ICESPICEFieldMap.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4AutoLock.hh"
+
+#include <fstream>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include <cstddef>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The vector kernels are compiled for their instruction set regardless of
+// the build flags and only called when the CPU supports it.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ICESPICE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace{
+  G4Mutex myICESPICEFieldMapLock = G4MUTEX_INITIALIZER;
+
+  // 16-bit value types. Conversions follow F. Giesen's branch-light
+  // float/half routines and round to nearest even.
+  struct Half     { std::uint16_t bits; };
+  struct BFloat16 { std::uint16_t bits; };
+
+  inline std::uint32_t FloatBits(float f)
+  { std::uint32_t u; std::memcpy(&u, &f, sizeof(u)); return u; }
+  inline float BitsFloat(std::uint32_t u)
+  { float f; std::memcpy(&f, &u, sizeof(f)); return f; }
+
+  inline double ToDouble(double value)   { return value; }
+  inline double ToDouble(float value)    { return value; }
+  inline double ToDouble(BFloat16 value) { return BitsFloat(std::uint32_t(value.bits) << 16); }
+  inline double ToDouble(Half value)
+  {
+    const std::uint32_t shiftedExp = 0x7c00u << 13;
+    std::uint32_t bits = (value.bits & 0x7fffu) << 13;
+    const std::uint32_t exp = shiftedExp & bits;
+    bits += (127u - 15u) << 23;
+    if (exp == shiftedExp) {
+      bits += (128u - 16u) << 23;                       // Inf/NaN
+    } else if (exp == 0) {
+      bits += 1u << 23;                                 // zero/subnormal
+      bits = FloatBits(BitsFloat(bits) - BitsFloat(113u << 23));
+    }
+    bits |= std::uint32_t(value.bits & 0x8000u) << 16;
+    return BitsFloat(bits);
+  }
+
+  inline Half ToHalf(float value)
+  {
+    std::uint32_t bits = FloatBits(value);
+    const std::uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    std::uint16_t half;
+    if (bits >= (127u + 16u) << 23) {
+      half = (bits > 255u << 23) ? 0x7e00 : 0x7c00;     // NaN or overflow
+    } else if (bits < 113u << 23) {
+      const std::uint32_t denormMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+      half = static_cast<std::uint16_t>(FloatBits(BitsFloat(bits) + BitsFloat(denormMagic)) - denormMagic);
+    } else {
+      const std::uint32_t mantOdd = (bits >> 13) & 1u;
+      bits += (std::uint32_t(15 - 127) << 23) + 0xfffu + mantOdd;
+      half = static_cast<std::uint16_t>(bits >> 13);
+    }
+    return Half{ static_cast<std::uint16_t>(half | (sign >> 16)) };
+  }
+
+  inline BFloat16 ToBFloat16(float value)
+  {
+    const std::uint32_t bits = FloatBits(value);
+    if ((bits & 0x7fffffffu) > 0x7f800000u) {
+      return BFloat16{ static_cast<std::uint16_t>((bits >> 16) | 0x40u) };  // quiet NaN
+    }
+    return BFloat16{ static_cast<std::uint16_t>((bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16) };
+  }
+
+  // Trilinear kernels. c000 is the first corner of the cell; its z
+  // neighbour follows three values later, and ystride and xstride (in
+  // values) lead to the y and x neighbours. wxy holds the x-y weights of
+  // the corner columns 00, 01, 10, 11 and wz the weights of the lower and
+  // upper z corners. The sum is returned in the units of the values.
+  template <typename T>
+  inline void TrilinearScalar(const T* c000, std::size_t ystride, std::size_t xstride,
+			      const double* wxy, const double* wz, double* B)
+  {
+    const T* c010 = c000 + ystride;
+    const T* c100 = c000 + xstride;
+    const T* c110 = c100 + ystride;
+    for (int component = 0; component < 3; ++component) {
+      // Blend along z first, then weight the four columns
+      B[component] =
+	wxy[0] * (ToDouble(c000[component]) * wz[0] + ToDouble(c000[component + 3]) * wz[1]) +
+	wxy[1] * (ToDouble(c010[component]) * wz[0] + ToDouble(c010[component + 3]) * wz[1]) +
+	wxy[2] * (ToDouble(c100[component]) * wz[0] + ToDouble(c100[component + 3]) * wz[1]) +
+	wxy[3] * (ToDouble(c110[component]) * wz[0] + ToDouble(c110[component + 3]) * wz[1]);
+    }
+  }
+
+#ifdef ICESPICE_X86_KERNELS
+  // One corner per 256-bit register: Bx, By, Bz and a masked lane. Masked
+  // lanes are not read, so the last node of a mapped file is safe.
+  __attribute__((target("avx2,fma")))
+  void TrilinearAVX2(const double* c000, std::size_t ystride, std::size_t xstride,
+		     const double* wxy, const double* wz, double* B)
+  {
+    const __m256i mask = _mm256_setr_epi64x(-1, -1, -1, 0);
+    const double* corners[8] = { c000,           c000 + 3,
+				 c000 + ystride, c000 + ystride + 3,
+				 c000 + xstride, c000 + xstride + 3,
+				 c000 + xstride + ystride, c000 + xstride + ystride + 3 };
+    __m256d sum = _mm256_setzero_pd();
+    for (int corner = 0; corner < 8; ++corner) {
+      const __m256d w = _mm256_set1_pd(wxy[corner >> 1] * wz[corner & 1]);
+      sum = _mm256_fmadd_pd(_mm256_maskload_pd(corners[corner], mask), w, sum);
+    }
+    alignas(32) double out[4];
+    _mm256_store_pd(out, sum);
+    B[0] = out[0];
+    B[1] = out[1];
+    B[2] = out[2];
+  }
+
+  __attribute__((target("avx2,fma")))
+  void TrilinearAVX2(const float* c000, std::size_t ystride, std::size_t xstride,
+		     const double* wxy, const double* wz, double* B)
+  {
+    const __m128i mask = _mm_setr_epi32(-1, -1, -1, 0);
+    const float* corners[8] = { c000,           c000 + 3,
+				c000 + ystride, c000 + ystride + 3,
+				c000 + xstride, c000 + xstride + 3,
+				c000 + xstride + ystride, c000 + xstride + ystride + 3 };
+    __m256d sum = _mm256_setzero_pd();
+    for (int corner = 0; corner < 8; ++corner) {
+      const __m256d value = _mm256_cvtps_pd(_mm_maskload_ps(corners[corner], mask));
+      const __m256d w = _mm256_set1_pd(wxy[corner >> 1] * wz[corner & 1]);
+      sum = _mm256_fmadd_pd(value, w, sum);
+    }
+    alignas(32) double out[4];
+    _mm256_store_pd(out, sum);
+    B[0] = out[0];
+    B[1] = out[1];
+    B[2] = out[2];
+  }
+
+  // Two corners per 512-bit register: a node and its z neighbour are six
+  // consecutive values, so four masked loads cover the cell. The z weights
+  // are applied once at the end and the two halves are then added.
+  __attribute__((target("avx512f")))
+  void TrilinearAVX512(const __m512d* rows, const double* wxy, const double* wz, double* B)
+  {
+    __m512d sum = _mm512_mul_pd(rows[0], _mm512_set1_pd(wxy[0]));
+    sum = _mm512_fmadd_pd(rows[1], _mm512_set1_pd(wxy[1]), sum);
+    sum = _mm512_fmadd_pd(rows[2], _mm512_set1_pd(wxy[2]), sum);
+    sum = _mm512_fmadd_pd(rows[3], _mm512_set1_pd(wxy[3]), sum);
+    sum = _mm512_mul_pd(sum, _mm512_setr_pd(wz[0], wz[0], wz[0], wz[1], wz[1], wz[1], 0., 0.));
+    const __m512d upper = _mm512_maskz_permutexvar_pd(0x07, _mm512_setr_epi64(3, 4, 5, 0, 0, 0, 0, 0), sum);
+    _mm512_mask_storeu_pd(B, 0x07, _mm512_add_pd(sum, upper));
+  }
+
+  __attribute__((target("avx512f")))
+  void TrilinearAVX512(const double* c000, std::size_t ystride, std::size_t xstride,
+		       const double* wxy, const double* wz, double* B)
+  {
+    const __mmask8 six = 0x3f;
+    const __m512d rows[4] = { _mm512_maskz_loadu_pd(six, c000),
+			      _mm512_maskz_loadu_pd(six, c000 + ystride),
+			      _mm512_maskz_loadu_pd(six, c000 + xstride),
+			      _mm512_maskz_loadu_pd(six, c000 + xstride + ystride) };
+    TrilinearAVX512(rows, wxy, wz, B);
+  }
+
+  __attribute__((target("avx512f")))
+  void TrilinearAVX512(const float* c000, std::size_t ystride, std::size_t xstride,
+		       const double* wxy, const double* wz, double* B)
+  {
+    const __m256i six = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+    const float* starts[4] = { c000, c000 + ystride, c000 + xstride, c000 + xstride + ystride };
+    __m512d rows[4];
+    for (int row = 0; row < 4; ++row) {
+      rows[row] = _mm512_maskz_cvtps_pd(0x3f, _mm256_maskload_ps(starts[row], six));
+    }
+    TrilinearAVX512(rows, wxy, wz, B);
+  }
+#endif
+
+  ICESPICEFieldMap::Kernel DetectKernel()
+  {
+#ifdef ICESPICE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return ICESPICEFieldMap::Kernel::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      return ICESPICEFieldMap::Kernel::AVX2;
+#endif
+    return ICESPICEFieldMap::Kernel::Scalar;
+  }
+
+  const ICESPICEFieldMap::Kernel kBestKernel = DetectKernel();
+  std::atomic<ICESPICEFieldMap::Kernel> gKernel(kBestKernel);
+  std::atomic<bool> gVerifyChecksums(false);
+  std::atomic<std::uint64_t> gMapCount(0);  // maps created, for GetId
+
+  // Double and float values go through the selected kernel; the 16-bit
+  // types need a conversion per value and stay scalar.
+  template <typename T>
+  inline void Trilinear(const T* c000, std::size_t ystride, std::size_t xstride,
+			const double* wxy, const double* wz, double* B)
+  {
+    TrilinearScalar(c000, ystride, xstride, wxy, wz, B);
+  }
+
+  template <typename T>
+  inline void TrilinearVector(const T* c000, std::size_t ystride, std::size_t xstride,
+			      const double* wxy, const double* wz, double* B)
+  {
+#ifdef ICESPICE_X86_KERNELS
+    switch (gKernel.load(std::memory_order_relaxed)) {
+    case ICESPICEFieldMap::Kernel::AVX512:
+      TrilinearAVX512(c000, ystride, xstride, wxy, wz, B);
+      return;
+    case ICESPICEFieldMap::Kernel::AVX2:
+      TrilinearAVX2(c000, ystride, xstride, wxy, wz, B);
+      return;
+    default:
+      break;
+    }
+#endif
+    TrilinearScalar(c000, ystride, xstride, wxy, wz, B);
+  }
+
+  template <>
+  inline void Trilinear(const double* c000, std::size_t ystride, std::size_t xstride,
+			const double* wxy, const double* wz, double* B)
+  {
+    TrilinearVector(c000, ystride, xstride, wxy, wz, B);
+  }
+
+  template <>
+  inline void Trilinear(const float* c000, std::size_t ystride, std::size_t xstride,
+			const double* wxy, const double* wz, double* B)
+  {
+    TrilinearVector(c000, ystride, xstride, wxy, wz, B);
+  }
+
+  // Asks for the cache line holding p, without waiting for it
+  inline void Prefetch(const void* p)
+  {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+  }
+
+  // Start of the line after the one holding p, or end
+  inline const char* NextLine(const char* p, const char* end)
+  {
+    const void* newline = std::memchr(p, '\n', end - p);
+    return newline ? static_cast<const char*>(newline) + 1 : end;
+  }
+
+  // Start of the line before the one starting at p, or begin
+  inline const char* PreviousLine(const char* p, const char* begin)
+  {
+    if (p > begin) --p;  // the newline ending the previous line
+    while (p > begin && p[-1] != '\n') --p;
+    return p;
+  }
+
+  inline bool IsBlank(const char* p, const char* end)
+  {
+    for (; p < end; ++p) {
+      if (!std::isspace(static_cast<unsigned char>(*p))) return false;
+    }
+    return true;
+  }
+
+  // Reads x, y, z, Bx, By, Bz from the start of a line of a field table.
+  // Further columns (the permeability) are ignored.
+  bool ParseNode(const char* p, const char* end, double* values)
+  {
+    for (int i = 0; i < 6; ++i) {
+      while (p < end && (*p == ' ' || *p == '\t')) ++p;
+      if (p < end && *p == '+') ++p;  // from_chars takes no plus sign
+      const std::from_chars_result result = std::from_chars(p, end, values[i]);
+      if (result.ec != std::errc()) return false;
+      p = result.ptr;
+    }
+    return true;
+  }
+
+  // One entry per file name. The entries are never released, so a map
+  // survives geometry re-initialisation between runs.
+  std::map<G4String, std::shared_ptr<const ICESPICEFieldMap> >& FieldMaps()
+  {
+    static std::map<G4String, std::shared_ptr<const ICESPICEFieldMap> > maps;
+    return maps;
+  }
+}
+
+using namespace std;
+
+const char ICESPICEFieldMap::kBinaryMagic[8] = {'I','C','E','F','M','A','P','\0'};
+const char ICESPICEFieldMap::kCacheMagic[8]  = {'I','C','E','F','K','E','Y','\0'};
+
+// 0.01 G: a 100 keV electron would curl on a radius of about a kilometre
+const double ICESPICEFieldMap::kZeroField = 1.e-6*tesla;
+
+std::shared_ptr<const ICESPICEFieldMap>
+ICESPICEFieldMap::Get(const G4String& filename)
+{
+  // The lock is held while reading, so threads asking for the same file
+  // wait for the first read and then share it instead of reading it again.
+  G4AutoLock lock(&myICESPICEFieldMapLock);
+
+  std::shared_ptr<const ICESPICEFieldMap>& fieldMap = FieldMaps()[filename];
+  if (!fieldMap) {
+    fieldMap = std::make_shared<const ICESPICEFieldMap>(filename.c_str(), true);
+  }
+  return fieldMap;
+}
+
+ICESPICEFieldMap::ICESPICEFieldMap(const char* filename, bool writeCache)
+  :fValues(nullptr),fStorage(Storage::Double),fFieldUnit(1.),
+   fGeometry(Geometry::Cartesian),fSymmetry(1),fSectorAngle(twopi),
+   fMapping(nullptr),fMappingSize(0),fActiveKnown(false),
+   fId(++gMapCount)
+{    
+  G4cout << "\n-----------------------------------------------------------"
+	 << "\n      Magnetic field"
+	 << "\n-----------------------------------------------------------";
+    
+  G4cout << "\n ---> " "Reading the field grid from " << filename << " ... " << G4endl; 
+
+  ifstream file( filename, ios::binary ); // Open the file for reading.
+  
+  if (!file.is_open())
+    {
+      G4ExceptionDescription ed;
+      ed << "Could not open input file " << filename << std::endl;
+      G4Exception("ICESPICEFieldMap::ICESPICEFieldMap",
+		  "pugmag001",FatalException,ed);
+    }
+
+  // Binary maps start with kBinaryMagic, anything else is read as text.
+  char magic[sizeof(kBinaryMagic)] = {0};
+  file.read(magic, sizeof(magic));
+  file.close();
+
+  bool parsed = false;
+  if (std::memcmp(magic, kBinaryMagic, sizeof(kBinaryMagic)) == 0) {
+    ReadBinary(filename);
+  } else if (!ReadCache(filename)) {
+    ReadTable(filename);
+    parsed = true;
+  }
+  FinishReading();
+  if (parsed && writeCache) WriteCache(filename);
+}
+
+ICESPICEFieldMap::ICESPICEFieldMap(const ICESPICEFieldMap& source,
+				   Storage storage)
+  :fValues(nullptr),fStorage(storage),fFieldUnit(source.StorageUnit(storage)),
+   fGeometry(source.fGeometry),fSymmetry(source.fSymmetry),fSectorAngle(source.fSectorAngle),
+   fMapping(nullptr),fMappingSize(0),
+   nx(source.nx),ny(source.ny),nz(source.nz),fNodes(source.fNodes),
+   minx(source.minx),maxx(source.maxx),miny(source.miny),maxy(source.maxy),
+   minz(source.minz),maxz(source.maxz),fActiveKnown(false),
+   fId(++gMapCount)
+{
+  const std::size_t bytes = 3 * fNodes * ValueSize(storage);
+  fTable.resize((bytes + sizeof(double) - 1) / sizeof(double));
+  source.EncodeValues(storage, fFieldUnit, 0, 3 * fNodes, fTable.data());
+  fValues = fTable.data();
+  PrepareLookup();
+}
+
+ICESPICEFieldMap::ICESPICEFieldMap(const ICESPICEFieldMap& source, int stride)
+  :fValues(nullptr),fStorage(Storage::Double),fFieldUnit(1.),
+   fGeometry(source.fGeometry),fSymmetry(source.fSymmetry),fSectorAngle(source.fSectorAngle),
+   fMapping(nullptr),fMappingSize(0),fActiveKnown(false),
+   fId(++gMapCount)
+{
+  if (stride < 1 || (fGeometry == Geometry::Sector && (source.ny - 1) % stride != 0)) {
+    G4ExceptionDescription ed;
+    ed << "Cannot keep every " << stride << "th node of a map with "
+       << source.ny - 1 << " intervals along the second axis" << std::endl;
+    G4Exception("ICESPICEFieldMap::ICESPICEFieldMap","pugmag008",FatalException,ed);
+    return;
+  }
+
+  nx = (source.nx - 1) / stride + 1;
+  ny = (source.ny - 1) / stride + 1;
+  nz = (source.nz - 1) / stride + 1;
+  fNodes = static_cast<std::size_t>(nx) * ny * nz;
+
+  // The kept nodes start at the lower limit of each axis
+  minx = source.minx;
+  miny = source.miny;
+  minz = source.minz;
+  maxx = minx + (source.maxx - minx) * (nx - 1) * stride / (source.nx - 1);
+  maxy = miny + (source.maxy - miny) * (ny - 1) * stride / (source.ny - 1);
+  maxz = minz + (source.maxz - minz) * (nz - 1) * stride / (source.nz - 1);
+
+  fTable.resize(3 * fNodes);
+  std::size_t node = 0;
+  for (int ix = 0; ix < nx; ++ix) {
+    for (int iy = 0; iy < ny; ++iy) {
+      for (int iz = 0; iz < nz; ++iz, ++node) {
+	source.GetNodeValue(ix * stride, iy * stride, iz * stride, &fTable[3*node]);
+      }
+    }
+  }
+  fValues = fTable.data();
+  PrepareLookup();
+}
+
+ICESPICEFieldMap::ICESPICEFieldMap(const ICESPICEFieldMap& source,
+				   int symmetry, double pitch)
+  :fValues(nullptr),fStorage(Storage::Double),fFieldUnit(1.),
+   fGeometry(Geometry::Sector),fSymmetry(symmetry),fSectorAngle(twopi/symmetry),
+   fMapping(nullptr),fMappingSize(0),fActiveKnown(false),
+   fId(++gMapCount)
+{
+  // Largest disc around the z axis that the source covers
+  const double rmax = std::min(std::min(source.maxx, -source.minx),
+			       std::min(source.maxy, -source.miny));
+  if (source.fGeometry != Geometry::Cartesian || symmetry < 1 || rmax <= 0.
+      || pitch <= 0.) {
+    G4ExceptionDescription ed;
+    ed << "A sector map needs a Cartesian source around the z axis, "
+       << "a symmetry order >= 1 and a positive pitch" << std::endl;
+    G4Exception("ICESPICEFieldMap::ICESPICEFieldMap","pugmag007",FatalException,ed);
+    return;
+  }
+
+  nx = static_cast<int>(std::ceil(rmax / pitch)) + 1;
+  ny = static_cast<int>(std::ceil(rmax * fSectorAngle / pitch)) + 1;
+  nz = static_cast<int>(std::ceil((source.maxz - source.minz) / pitch)) + 1;
+  fNodes = static_cast<std::size_t>(nx) * ny * nz;
+  minx = 0.;          maxx = rmax;
+  miny = 0.;          maxy = fSectorAngle;
+  minz = source.minz; maxz = source.maxz;
+  dx = maxx - minx;
+  dy = maxy - miny;
+  dz = maxz - minz;
+
+  G4cout << "\n ---> Building a " << symmetry << "-fold sector map: "
+	 << nx << " x " << ny << " x " << nz << " (r, phi, z) nodes, "
+	 << 3 * fNodes * sizeof(double) / (1024*1024) << " MB" << G4endl;
+
+  fTable.resize(3 * fNodes);
+  std::size_t node = 0;
+  for (int ix = 0; ix < nx; ++ix) {
+    const double r = dx * ix / (nx - 1);
+    for (int iy = 0; iy < ny; ++iy) {
+      const double phi = dy * iy / (ny - 1);
+      for (int iz = 0; iz < nz; ++iz, ++node) {
+	const double z = minz + dz * iz / (nz - 1);
+	double sum[3] = {0., 0., 0.};
+	for (int k = 0; k < symmetry; ++k) {
+	  const double c = std::cos(phi + k * fSectorAngle);
+	  const double s = std::sin(phi + k * fSectorAngle);
+	  double B[3];
+	  source.GetFieldValue(r * c, r * s, z, B);
+	  sum[0] +=  B[0] * c + B[1] * s;   // Br
+	  sum[1] += -B[0] * s + B[1] * c;   // Bphi
+	  sum[2] +=  B[2];
+	}
+	for (int component = 0; component < 3; ++component) {
+	  fTable[3*node + component] = sum[component] / symmetry;
+	}
+      }
+    }
+  }
+  fValues = fTable.data();
+  PrepareLookup();
+}
+
+ICESPICEFieldMap::~ICESPICEFieldMap()
+{
+  if (fMapping) munmap(fMapping, fMappingSize);
+}
+
+void ICESPICEFieldMap::ReadTable(const char* filename)
+{
+  const double lenUnit= meter;
+  const double fieldUnit= tesla; 
+
+  const auto start = std::chrono::steady_clock::now();
+
+  // The text is mapped rather than read, so the threads below parse it
+  // straight from the page cache.
+  int fd = open(filename, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+    if (fd >= 0) close(fd);
+    G4ExceptionDescription ed;
+    ed << "Could not open input file " << filename << std::endl;
+    G4Exception("ICESPICEFieldMap::ReadTable","pugmag001",FatalException,ed);
+    return;
+  }
+  const std::size_t size = static_cast<std::size_t>(info.st_size);
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    G4ExceptionDescription ed;
+    ed << "Could not map input file " << filename << std::endl;
+    G4Exception("ICESPICEFieldMap::ReadTable","pugmag001",FatalException,ed);
+    return;
+  }
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  const char* text = static_cast<const char*>(mapping);
+  const char* const textEnd = text + size;
+
+  auto fail = [&](const G4String& message) {
+    munmap(mapping, size);
+    G4ExceptionDescription ed;
+    ed << filename << ": " << message << std::endl;
+    G4Exception("ICESPICEFieldMap::ReadTable","pugmag006",FatalException,ed);
+  };
+
+  // Ignore first blank line, then read the table dimensions
+  const char* p = NextLine(text, textEnd);
+  long dimensions[3];
+  for (long& n : dimensions) {
+    while (p < textEnd && std::isspace(static_cast<unsigned char>(*p))) ++p;
+    const std::from_chars_result result = std::from_chars(p, textEnd, n);
+    if (result.ec != std::errc() || n < 2) {
+      fail("the second line must hold the three table dimensions, each at least 2");
+      return;
+    }
+    p = result.ptr;
+  }
+  nx = static_cast<int>(dimensions[0]);  // Note dodgy order
+  ny = static_cast<int>(dimensions[1]);
+  nz = static_cast<int>(dimensions[2]);
+
+  G4cout << "  [ Number of values x,y,z: " 
+	 << nx << " " << ny << " " << nz << " ] "
+	 << G4endl;
+
+  // Ignore other header information    
+  // The first line whose second character is '0' is considered to
+  // be the last line of the header.
+  p = NextLine(p, textEnd);
+  const char* line = p;
+  while (line < textEnd) {
+    p = NextLine(line, textEnd);
+    if (p - line > 1 && line[1] == '0') break;
+    line = p;
+  }
+  if (line >= textEnd) {
+    fail("no end of the header (a line with '0' as second character)");
+    return;
+  }
+  const char* const data = p;
+
+  // Set up storage space for table
+  fNodes = static_cast<std::size_t>(nx) * ny * nz;
+  fTable.resize(3 * fNodes);
+  fValues = fTable.data();
+  fStorage = Storage::Double;
+  fFieldUnit = 1.;  // the values are stored in Geant4 units already
+
+  // The first and the last line give the grid, against which every line
+  // is checked as it is read: x slowest, z fastest, evenly spaced.
+  double first[6], last[6];
+  const char* lastLine = textEnd;
+  while (lastLine > data && IsBlank(PreviousLine(lastLine, data), lastLine))
+    lastLine = PreviousLine(lastLine, data);
+  lastLine = PreviousLine(lastLine, data);
+  if (!ParseNode(data, textEnd, first) || !ParseNode(lastLine, textEnd, last)) {
+    fail("the first or the last line of data does not hold x, y, z, Bx, By, Bz");
+    return;
+  }
+  minx = first[0] * lenUnit;
+  miny = first[1] * lenUnit;
+  minz = first[2] * lenUnit;
+  maxx = last[0] * lenUnit;
+  maxy = last[1] * lenUnit;
+  maxz = last[2] * lenUnit;
+  const int n[3] = {nx, ny, nz};
+  double step[3], slack[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    step[axis] = (last[axis] - first[axis]) / (n[axis] - 1);
+    slack[axis] = 1.e-3 * std::fabs(step[axis]);  // far above the rounding of the text
+  }
+
+  // Split the data into about equal byte ranges, one per thread, each
+  // starting at the beginning of a line. Ranges of less than a megabyte
+  // are not worth a thread.
+  const std::size_t bytes = textEnd - data;
+  std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::max<std::size_t>(1, std::min(threads, bytes >> 20));
+  struct Chunk
+  {
+    const char* begin;
+    const char* end;
+    std::size_t lines;    // lines of data in the chunk
+    std::size_t node;     // node of its first line
+    std::size_t badNode;  // first line that failed, or fNodes if none
+    G4String    error;
+  };
+  std::vector<Chunk> chunks(threads);
+  for (std::size_t i = 0; i < threads; ++i) {
+    chunks[i].begin = i == 0 ? data : chunks[i-1].end;
+    chunks[i].end = i + 1 == threads ? textEnd
+      : std::max(chunks[i].begin, NextLine(data + bytes * (i + 1) / threads - 1, textEnd));
+    chunks[i].badNode = fNodes;
+  }
+
+  // Runs fn(chunk) on every chunk, the first one on this thread
+  auto forEachChunk = [&](auto fn) {
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < threads; ++i) workers.emplace_back(fn, std::ref(chunks[i]));
+    fn(chunks[0]);
+    for (std::thread& worker : workers) worker.join();
+  };
+
+  // Count the lines of each chunk first, so each knows its first node
+  forEachChunk([](Chunk& chunk) {
+    chunk.lines = 0;
+    for (const char* q = chunk.begin; q < chunk.end; ) {
+      const char* next = NextLine(q, chunk.end);
+      if (!IsBlank(q, next)) ++chunk.lines;
+      q = next;
+    }
+  });
+  std::size_t lines = 0;
+  for (Chunk& chunk : chunks) {
+    chunk.node = lines;
+    lines += chunk.lines;
+  }
+  if (lines != fNodes) {
+    std::ostringstream message;
+    message << "the header announces " << fNodes << " nodes but there are "
+	    << lines << " lines of data";
+    fail(message.str());
+    return;
+  }
+
+  // Parse. Progress is reported from the first chunk, which is as long
+  // as the others.
+  forEachChunk([&](Chunk& chunk) {
+    const bool report = chunk.begin == data;
+    int percentComplete = 0;
+    std::size_t node = chunk.node;
+    double values[6];
+    for (const char* q = chunk.begin; q < chunk.end; ) {
+      const char* next = NextLine(q, chunk.end);
+      if (IsBlank(q, next)) { q = next; continue; }
+      if (!ParseNode(q, next, values)) {
+	chunk.badNode = node;
+	chunk.error = "could not read x, y, z, Bx, By, Bz";
+	return;
+      }
+      const std::size_t index[3] = { node / (static_cast<std::size_t>(ny) * nz),
+				     node / nz % ny, node % nz };
+      for (int axis = 0; axis < 3; ++axis) {
+	const double expected = first[axis] + step[axis] * index[axis];
+	if (std::fabs(values[axis] - expected) > slack[axis]) {
+	  std::ostringstream message;
+	  message << "coordinate " << "xyz"[axis] << " = " << values[axis]
+		  << " where the grid has " << expected
+		  << " (x must vary slowest and z fastest, evenly spaced)";
+	  chunk.badNode = node;
+	  chunk.error = message.str();
+	  return;
+	}
+      }
+      fTable[3*node  ] = values[3] * fieldUnit;
+      fTable[3*node+1] = values[4] * fieldUnit;
+      fTable[3*node+2] = values[5] * fieldUnit;
+      ++node;
+      q = next;
+
+      if (report) {
+	const int newPercentComplete = static_cast<int>(10 * (node - chunk.node) / chunk.lines) * 10;
+	if (newPercentComplete > percentComplete) {
+	  percentComplete = newPercentComplete;
+	  G4cout << "Reading progress: " << percentComplete << "% complete" << G4endl;
+	}
+      }
+    }
+  });
+
+  for (const Chunk& chunk : chunks) {
+    if (chunk.badNode == fNodes) continue;
+    const std::size_t node = chunk.badNode;
+    std::ostringstream message;
+    message << "line of data " << node + 1 << " (ix=" << node / (static_cast<std::size_t>(ny) * nz)
+	    << ", iy=" << node / nz % ny << ", iz=" << node % nz << "): " << chunk.error;
+    fail(message.str());
+    return;
+  }
+
+  munmap(mapping, size);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  G4cout << "Reading complete: " << size / (1024*1024) << " MB in " << seconds << " s ("
+	 << size / (1024.*1024.) / seconds << " MB/s, " << threads << " threads)" << G4endl;
+}
+
+bool ICESPICEFieldMap::ReadBinary(const char* filename, bool required)
+{
+  // Failures are fatal unless the map is optional, as a cache is
+  auto reject = [&](const char* code, const G4String& message) {
+    if (fMapping) munmap(fMapping, fMappingSize);
+    fMapping = nullptr;
+    fMappingSize = 0;
+    if (!required) return false;
+    G4ExceptionDescription ed;
+    ed << message << std::endl;
+    G4Exception("ICESPICEFieldMap::ReadBinary",code,FatalException,ed);
+    return false;
+  };
+
+  int fd = open(filename, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    if (fd >= 0) close(fd);
+    return reject("pugmag002", G4String("Could not open binary field map ") + filename);
+  }
+  fMappingSize = static_cast<std::size_t>(info.st_size);
+  void* mapping = mmap(nullptr, fMappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // the mapping stays valid after the descriptor is closed
+  if (mapping == MAP_FAILED) {
+    return reject("pugmag002", G4String("Could not map binary field map ") + filename);
+  }
+  fMapping = mapping;
+
+  BinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  const char* bytes = static_cast<const char*>(fMapping);
+  bool valid = fMappingSize >= sizeof(header);
+  if (valid) std::memcpy(&header, bytes, sizeof(header));
+  if (valid && std::memcmp(header.magic, kBinaryMagic, sizeof(kBinaryMagic)) == 0
+      && header.version != kBinaryVersion) {
+    std::ostringstream message;
+    message << filename << " is a version " << header.version << " binary field map,"
+	    << " but only version " << kBinaryVersion << " is read;"
+	    << " regenerate it with ICESPICEFieldConvert";
+    return reject("pugmag003", message.str());
+  }
+  if (valid) {
+    fNodes = static_cast<std::size_t>(header.nx) * header.ny * header.nz;
+    valid = std::memcmp(header.magic, kBinaryMagic, sizeof(kBinaryMagic)) == 0
+      && ((header.valueSize == sizeof(float) && header.encoding == 0)
+          || (header.valueSize == sizeof(double) && header.encoding == 0)
+          || (header.valueSize == 2 && (header.encoding == 0 || header.encoding == 1)))
+      && header.nx > 1 && header.ny > 1 && header.nz > 1
+      && (header.geometry == 0 || (header.geometry == 1 && header.symmetry >= 1))
+      && header.dataOffset >= sizeof(header)
+      && header.dataOffset + 3 * fNodes * header.valueSize <= fMappingSize;
+    const std::int32_t n[3] = {static_cast<std::int32_t>(header.nx),
+			       static_cast<std::int32_t>(header.ny),
+			       static_cast<std::int32_t>(header.nz)};
+    for (int axis = 0; axis < 3 && valid; ++axis) {
+      valid = header.activeLast[axis] < 0
+	|| (header.activeFirst[axis] >= 0 && header.activeFirst[axis] <= header.activeLast[axis]
+	    && header.activeLast[axis] < n[axis]);
+    }
+  }
+  if (!valid) {
+    std::ostringstream message;
+    message << filename << " is not a valid binary field map; regenerate it with"
+	    << " ICESPICEFieldConvert";
+    return reject("pugmag003", message.str());
+  }
+
+  fValues = bytes + header.dataOffset;
+  if (header.valueSize == 2) {
+    fStorage = header.encoding == 1 ? Storage::BFloat16 : Storage::Half;
+  } else {
+    fStorage = header.valueSize == sizeof(float) ? Storage::Float : Storage::Double;
+  }
+  // Checking reads every page of the map, so it is done only on request
+  if (GetVerifyChecksums()
+      && Checksum(fValues, GetValueBytes()) != header.checksum) {
+    return reject("pugmag004", G4String("Checksum mismatch in binary field map ") + filename
+		  + ", the file is truncated or corrupt");
+  }
+
+  nx = header.nx;
+  ny = header.ny;
+  nz = header.nz;
+  fFieldUnit = header.fieldUnit;
+  // A range found with another threshold is found again
+  if (header.zeroField == kZeroField) {
+    for (int axis = 0; axis < 3; ++axis) {
+      fActiveFirst[axis] = header.activeFirst[axis];
+      fActiveLast[axis] = header.activeLast[axis];
+    }
+    fActiveKnown = true;
+  }
+  if (header.geometry == 1) {
+    fGeometry = Geometry::Sector;
+    fSymmetry = header.symmetry;
+    fSectorAngle = twopi / fSymmetry;
+  }
+  // phi of a sector map is in radians already
+  const double yUnit = fGeometry == Geometry::Sector ? 1. : header.lengthUnit;
+  minx = header.first[0] * header.lengthUnit;
+  miny = header.first[1] * yUnit;
+  minz = header.first[2] * header.lengthUnit;
+  maxx = header.last[0] * header.lengthUnit;
+  maxy = header.last[1] * yUnit;
+  maxz = header.last[2] * header.lengthUnit;
+
+  G4cout << "  [ Number of values x,y,z: " 
+	 << nx << " " << ny << " " << nz << " ] "
+	 << "\n  [ " << StorageName(fStorage)
+	 << " values, " << GetValueBytes() / (1024*1024) << " MB ]"
+	 << G4endl;
+  return true;
+}
+
+void ICESPICEFieldMap::FinishReading()
+{
+  G4cout << "\n ---> ... done reading " << G4endl;
+
+  if (fGeometry == Geometry::Sector) {
+    G4cout << " ---> " << fSymmetry << "-fold sector map: r, phi, z, Br, Bphi, Bz "
+	   << "\n ---> r up to " << maxx/cm << " cm, phi from " << miny/deg
+	   << " to " << maxy/deg << " deg, z from " << minz/cm << " to " << maxz/cm << " cm"
+	   << "\n-----------------------------------------------------------" << G4endl;
+    PrepareLookup();
+    return;
+  }
+
+  G4cout << " ---> assumed the order:  x, y, z, Bx, By, Bz "
+	 << "\n ---> Min values x,y,z: " 
+	 << minx/cm << " " << miny/cm << " " << minz/cm << " cm "
+	 << "\n ---> Max values x,y,z: " 
+	 << maxx/cm << " " << maxy/cm << " " << maxz/cm << " cm " << G4endl;
+
+  // Tables running towards decreasing coordinates are reordered here, so
+  // the lookup only ever sees increasing ones.
+  bool invertX = false, invertY = false, invertZ = false;
+  if (maxx < minx) {swap(maxx,minx); invertX = true;} 
+  if (maxy < miny) {swap(maxy,miny); invertY = true;} 
+  if (maxz < minz) {swap(maxz,minz); invertZ = true;} 
+  NormalizeAxes(invertX, invertY, invertZ);
+  G4cout << "\nAfter reordering if neccesary"  
+	 << "\n ---> Min values x,y,z: " 
+	 << minx/cm << " " << miny/cm << " " << minz/cm << " cm "
+	 << " \n ---> Max values x,y,z: " 
+	 << maxx/cm << " " << maxy/cm << " " << maxz/cm << " cm ";
+
+  G4cout << "\n ---> Dif values x,y,z (range): " 
+	 << (maxx-minx)/cm << " " << (maxy-miny)/cm << " " << (maxz-minz)/cm << " cm in z "
+	 << "\n-----------------------------------------------------------" << G4endl;
+  PrepareLookup();
+}
+
+void ICESPICEFieldMap::NormalizeAxes(bool invertX, bool invertY, bool invertZ)
+{
+  if (!invertX && !invertY && !invertZ) return;
+
+  // A mapped file cannot be reordered in place, so the values are copied
+  // into memory. Writing the map out again stores it in increasing order.
+  G4cout << "  [ Reordering the table to increasing coordinates ]" << G4endl;
+  const std::size_t nodeBytes = 3 * ValueSize(fStorage);
+  std::vector<double> table((fNodes * nodeBytes + sizeof(double) - 1) / sizeof(double));
+  const char* from = static_cast<const char*>(fValues);
+  char* to = reinterpret_cast<char*>(table.data());
+  std::size_t node = 0;
+  for (int ix = 0; ix < nx; ++ix) {
+    const std::size_t jx = invertX ? nx - 1 - ix : ix;
+    for (int iy = 0; iy < ny; ++iy) {
+      const std::size_t jy = invertY ? ny - 1 - iy : iy;
+      for (int iz = 0; iz < nz; ++iz, ++node) {
+	const std::size_t jz = invertZ ? nz - 1 - iz : iz;
+	std::memcpy(to + ((jx * ny + jy) * nz + jz) * nodeBytes,
+		    from + node * nodeBytes, nodeBytes);
+      }
+    }
+  }
+  fTable.swap(table);
+  fValues = fTable.data();
+  if (fMapping) {
+    munmap(fMapping, fMappingSize);
+    fMapping = nullptr;
+    fMappingSize = 0;
+  }
+
+  if (!fActiveKnown) return;
+  const bool invert[3] = {invertX, invertY, invertZ};
+  const int n[3] = {nx, ny, nz};
+  for (int axis = 0; axis < 3; ++axis) {
+    if (!invert[axis] || fActiveLast[axis] < 0) continue;
+    const int first = fActiveFirst[axis];
+    fActiveFirst[axis] = n[axis] - 1 - fActiveLast[axis];
+    fActiveLast[axis] = n[axis] - 1 - first;
+  }
+}
+
+void ICESPICEFieldMap::PrepareLookup()
+{
+  dx = maxx - minx;
+  dy = maxy - miny;
+  dz = maxz - minz;
+  invdx = (nx - 1) / dx;
+  invdy = (ny - 1) / dy;
+  invdz = (nz - 1) / dz;
+  FindActiveRegion();
+}
+
+void ICESPICEFieldMap::FindActiveRegion()
+{
+  // Index range, per table axis, of the nodes whose field is not negligible
+  int* first = fActiveFirst;
+  int* last = fActiveLast;
+  if (!fActiveKnown) {
+    first[0] = nx;  first[1] = ny;  first[2] = nz;
+    last[0] = last[1] = last[2] = -1;
+    const double threshold2 = kZeroField * kZeroField;
+    std::size_t node = 0;
+    for (int ix = 0; ix < nx; ++ix) {
+      for (int iy = 0; iy < ny; ++iy) {
+	for (int iz = 0; iz < nz; ++iz, ++node) {
+	  double B2 = 0.;
+	  for (std::size_t component = 0; component < 3; ++component) {
+	    const double B = fFieldUnit * ValueAt(3*node + component);
+	    B2 += B * B;
+	  }
+	  if (B2 <= threshold2) continue;
+	  const int index[3] = {ix, iy, iz};
+	  for (int axis = 0; axis < 3; ++axis) {
+	    first[axis] = std::min(first[axis], index[axis]);
+	    last[axis]  = std::max(last[axis], index[axis]);
+	  }
+	}
+      }
+    }
+    fActiveKnown = true;
+  }
+
+  const int n[3] = {nx, ny, nz};
+  const double lower[3] = {minx, miny, minz};
+  const double upper[3] = {maxx, maxy, maxz};
+  for (int axis = 0; axis < 3; ++axis) {
+    if (last[axis] < 0) {
+      fActiveMin[axis] = HUGE_VAL;
+      fActiveMax[axis] = -HUGE_VAL;
+      continue;
+    }
+    // Widen by two cells, the reach of the cubic interpolation stencil
+    const int lo = std::max(first[axis] - 2, 0);
+    const int hi = std::min(last[axis] + 2, n[axis] - 1);
+    auto coordinate = [&](int i) {
+      if (i == n[axis] - 1) return upper[axis];
+      return lower[axis] + (upper[axis] - lower[axis]) * i / (n[axis] - 1);
+    };
+    fActiveMin[axis] = std::min(coordinate(lo), coordinate(hi));
+    fActiveMax[axis] = std::max(coordinate(lo), coordinate(hi));
+  }
+
+  double boxLower[3], boxUpper[3];
+  if (GetActiveBox(boxLower, boxUpper)) {
+    G4cout << " ---> Field above " << kZeroField/tesla << " T inside x,y,z: "
+	   << boxLower[0]/cm << " .. " << boxUpper[0]/cm << ", "
+	   << boxLower[1]/cm << " .. " << boxUpper[1]/cm << ", "
+	   << boxLower[2]/cm << " .. " << boxUpper[2]/cm << " cm" << G4endl;
+  } else {
+    G4cout << " ---> The field is below " << kZeroField/tesla
+	   << " T everywhere" << G4endl;
+  }
+}
+
+bool ICESPICEFieldMap::GetActiveBox(double* lower, double* upper) const
+{
+  if (fActiveMin[0] > fActiveMax[0]) return false;
+  if (fGeometry == Geometry::Sector) {
+    // Any azimuth, out to the largest active radius
+    lower[0] = lower[1] = -fActiveMax[0];
+    upper[0] = upper[1] =  fActiveMax[0];
+  } else {
+    lower[0] = fActiveMin[0];
+    lower[1] = fActiveMin[1];
+    upper[0] = fActiveMax[0];
+    upper[1] = fActiveMax[1];
+  }
+  lower[2] = fActiveMin[2];
+  upper[2] = fActiveMax[2];
+  return true;
+}
+
+void ICESPICEFieldMap::WriteBinary(const char* filename,
+				   Storage storage) const
+{
+  if (!WriteBinary(filename, storage, nullptr, 0)) {
+    G4ExceptionDescription ed;
+    ed << "Could not write binary field map " << filename << std::endl;
+    G4Exception("ICESPICEFieldMap::WriteBinary","pugmag005",FatalException,ed);
+  }
+}
+
+bool ICESPICEFieldMap::WriteBinary(const char* filename, Storage storage,
+				   const void* extra, std::size_t extraSize) const
+{
+  BinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kBinaryMagic, sizeof(kBinaryMagic));
+  header.version = kBinaryVersion;
+  header.valueSize = static_cast<std::uint32_t>(ValueSize(storage));
+  header.encoding = storage == Storage::BFloat16 ? 1 : 0;
+  header.nx = nx;
+  header.ny = ny;
+  header.nz = nz;
+  const double yUnit = fGeometry == Geometry::Sector ? 1. : meter;
+  header.first[0] = minx / meter;
+  header.first[1] = miny / yUnit;
+  header.first[2] = minz / meter;
+  header.last[0]  = maxx / meter;
+  header.last[1]  = maxy / yUnit;
+  header.last[2]  = maxz / meter;
+  header.lengthUnit = meter;
+  header.geometry = fGeometry == Geometry::Sector ? 1 : 0;
+  header.symmetry = fSymmetry;
+  header.fieldUnit = StorageUnit(storage);
+  header.dataOffset = sizeof(header) + extraSize;
+  header.zeroField = kZeroField;
+  for (int axis = 0; axis < 3; ++axis) {
+    header.activeFirst[axis] = fActiveFirst[axis];
+    header.activeLast[axis] = fActiveLast[axis];
+  }
+
+  // The values are encoded and written a chunk at a time, so that writing
+  // needs no second copy of the map; the header, with the checksum, last.
+  ofstream file( filename, ios::binary | ios::trunc );
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (extraSize > 0) file.write(static_cast<const char*>(extra), extraSize);
+  const std::size_t chunk = 3 * (std::size_t(1) << 16);  // values, a multiple of 8
+  std::vector<char> data(chunk * header.valueSize);
+  header.checksum = Checksum(nullptr, 0);
+  for (std::size_t begin = 0; begin < 3 * fNodes && file; begin += chunk) {
+    const std::size_t end = std::min(begin + chunk, 3 * fNodes);
+    const std::size_t bytes = (end - begin) * header.valueSize;
+    EncodeValues(storage, header.fieldUnit, begin, end, data.data());
+    header.checksum = Checksum(data.data(), bytes, header.checksum);
+    file.write(data.data(), bytes);
+  }
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.close();
+  return static_cast<bool>(file);
+}
+
+bool ICESPICEFieldMap::MakeCacheKey(const char* filename, CacheKey& key, bool hash)
+{
+  std::memset(&key, 0, sizeof(key));
+  std::memcpy(key.magic, kCacheMagic, sizeof(kCacheMagic));
+  char path[PATH_MAX];
+  if (realpath(filename, path) == nullptr || std::strlen(path) >= sizeof(key.path)) return false;
+  std::strcpy(key.path, path);
+
+  int fd = open(filename, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  key.size = static_cast<std::uint64_t>(info.st_size);
+  key.mtime = static_cast<std::int64_t>(info.st_mtime);
+  if (!hash) {
+    close(fd);
+    return true;
+  }
+  void* mapping = mmap(nullptr, key.size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+  madvise(mapping, key.size, MADV_SEQUENTIAL);
+  key.hash = Checksum(mapping, key.size);
+  munmap(mapping, key.size);
+  return true;
+}
+
+bool ICESPICEFieldMap::ReadCache(const char* filename)
+{
+  const G4String cache = CacheName(filename);
+  ifstream file( cache, ios::binary );
+  if (!file.is_open()) return false;
+
+  // The key follows the header
+  BinaryHeader header;
+  CacheKey stored, key;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+  if (!file || header.dataOffset < sizeof(header) + sizeof(stored)
+      || std::memcmp(stored.magic, kCacheMagic, sizeof(kCacheMagic)) != 0) return false;
+  file.close();
+
+  // Hashing the table reads all of it, so its content is only compared
+  // when maps are verified (SetVerifyChecksums)
+  const bool verify = GetVerifyChecksums();
+  const bool current = MakeCacheKey(filename, key, verify)
+    && key.size == stored.size && key.mtime == stored.mtime
+    && std::strncmp(key.path, stored.path, sizeof(stored.path)) == 0
+    && (!verify || key.hash == stored.hash);
+  if (!current) {
+    G4cout << "  [ " << cache << " is out of date, parsing the table again ]" << G4endl;
+    return false;
+  }
+
+  G4cout << "  [ Reading the cache " << cache << " ]" << G4endl;
+  if (ReadBinary(cache.c_str(), false)) return true;
+  G4cout << "  [ " << cache << " is corrupt, parsing the table again ]" << G4endl;
+  return false;
+}
+
+void ICESPICEFieldMap::WriteCache(const char* filename) const
+{
+  const G4String cache = CacheName(filename);
+  std::ostringstream temporary;
+  temporary << cache << ".tmp" << getpid();
+
+  CacheKey key;
+  const bool written = MakeCacheKey(filename, key, true)
+    && WriteBinary(temporary.str().c_str(), Storage::Double, &key, sizeof(key))
+    && std::rename(temporary.str().c_str(), cache.c_str()) == 0;
+  if (!written) {
+    std::remove(temporary.str().c_str());
+    G4ExceptionDescription ed;
+    ed << "Could not write the field cache " << cache
+       << "; the table will be parsed again on the next run." << std::endl;
+    G4Exception("ICESPICEFieldMap::WriteCache","pugmag016",JustWarning,ed);
+    return;
+  }
+  G4cout << " ---> Cached the table in " << cache << G4endl;
+}
+
+double ICESPICEFieldMap::StorageUnit(Storage storage) const
+{
+  if (storage != Storage::Half) return tesla;
+
+  // Half floats only reach 65504 and lose precision below 6e-5, so pick a
+  // power of two that puts the largest component near 2^14.
+  double largest = 0.;
+  for (std::size_t i = 0; i < 3 * fNodes; ++i) {
+    largest = std::max(largest, std::fabs(ValueAt(i) * fFieldUnit));
+  }
+  if (largest == 0.) return tesla;
+  return std::ldexp(1., std::ilogb(largest) - 14);
+}
+
+void ICESPICEFieldMap::EncodeValues(Storage storage, double unit,
+				    std::size_t begin, std::size_t end,
+				    void* out) const
+{
+  const double scale = fFieldUnit / unit;
+  for (std::size_t i = begin; i < end; ++i) {
+    const double value = ValueAt(i) * scale;
+    const std::size_t k = i - begin;
+    switch (storage) {
+    case Storage::Double:
+      static_cast<double*>(out)[k] = value;
+      break;
+    case Storage::Float:
+      static_cast<float*>(out)[k] = static_cast<float>(value);
+      break;
+    case Storage::Half:
+      static_cast<Half*>(out)[k] = ToHalf(static_cast<float>(value));
+      break;
+    case Storage::BFloat16:
+      static_cast<BFloat16*>(out)[k] = ToBFloat16(static_cast<float>(value));
+      break;
+    }
+  }
+}
+
+double ICESPICEFieldMap::ValueAt(std::size_t i) const
+{
+  switch (fStorage) {
+  case Storage::Float:    return ToDouble(static_cast<const float*>(fValues)[i]);
+  case Storage::Half:     return ToDouble(static_cast<const Half*>(fValues)[i]);
+  case Storage::BFloat16: return ToDouble(static_cast<const BFloat16*>(fValues)[i]);
+  default:                return static_cast<const double*>(fValues)[i];
+  }
+}
+
+std::size_t ICESPICEFieldMap::ValueSize(Storage storage)
+{
+  switch (storage) {
+  case Storage::Float:    return sizeof(float);
+  case Storage::Half:
+  case Storage::BFloat16: return sizeof(std::uint16_t);
+  default:                return sizeof(double);
+  }
+}
+
+const char* ICESPICEFieldMap::StorageName(Storage storage)
+{
+  switch (storage) {
+  case Storage::Float:    return "float";
+  case Storage::Half:     return "half";
+  case Storage::BFloat16: return "bfloat16";
+  default:                return "double";
+  }
+}
+
+std::uint64_t ICESPICEFieldMap::Checksum(const void* data, std::size_t size,
+					 std::uint64_t hash)
+{
+  // FNV-1a over 64-bit words; memory bound, so checking a mapped file of
+  // a gigabyte costs a fraction of a second.
+  const std::uint64_t prime = 0x100000001b3ULL;
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  std::size_t i = 0;
+  for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+  }
+  for (; i < size; ++i) hash = (hash ^ bytes[i]) * prime;
+  return hash;
+}
+
+void ICESPICEFieldMap::GetFieldValue(double x, double y, double z,
+				     double *Bfield,
+				     Interpolation interpolation) const
+{
+  if (fGeometry == Geometry::Cartesian) {
+    GetGridValue(x, y, z, Bfield, interpolation);
+    return;
+  }
+
+  // Reject points outside the active cylinder before any trigonometry
+  const double r2 = x*x + y*y;
+  if (z < fActiveMin[2] || z > fActiveMax[2] || r2 > fActiveMax[0] * fActiveMax[0]) {
+    Bfield[0] = 0.0;
+    Bfield[1] = 0.0;
+    Bfield[2] = 0.0;
+    return;
+  }
+
+  // Fold the azimuth into the tabulated sector. Br and Bphi do not change
+  // under the symmetry rotation, so only the final rotation back to x, y
+  // depends on the true azimuth, which x/r and y/r give directly.
+  const double r = std::sqrt(r2);
+  double phi = std::atan2(y, x);
+  phi -= std::floor(phi / fSectorAngle) * fSectorAngle;
+  if (phi >= fSectorAngle) phi -= fSectorAngle;
+
+  double Bcyl[3];
+  GetGridValue(r, phi, z, Bcyl, interpolation);
+
+  const double c = r > 0. ? x / r : 1.;
+  const double s = r > 0. ? y / r : 0.;
+  Bfield[0] = Bcyl[0] * c - Bcyl[1] * s;
+  Bfield[1] = Bcyl[0] * s + Bcyl[1] * c;
+  Bfield[2] = Bcyl[2];
+}
+
+void ICESPICEFieldMap::GetGridValue(double x, double y, double z,
+				    double *Bfield,
+				    Interpolation interpolation) const
+{
+  // Check that the point is within the active part of the defined region.
+  // The active box lies inside the table, and outside it every node is
+  // below kZeroField, so the lookup is skipped there.
+  if ( x>=fActiveMin[0] && x<=fActiveMax[0] &&
+       y>=fActiveMin[1] && y<=fActiveMax[1] && 
+       z>=fActiveMin[2] && z<=fActiveMax[2] ) {
+    
+    // Position of the point in cells from the lower corner of the table.
+    // The point is not below the table, so truncation gives the cell
+    // index. A point on an upper face belongs to the last cell, with a
+    // local coordinate of 1, so the cell never reaches past the table.
+    const double xcell = (x - minx) * invdx;
+    const double ycell = (y - miny) * invdy;
+    const double zcell = (z - minz) * invdz;
+    const int xindex = std::min(static_cast<int>(xcell), nx - 2);
+    const int yindex = std::min(static_cast<int>(ycell), ny - 2);
+    const int zindex = std::min(static_cast<int>(zcell), nz - 2);
+
+    // Position of the point within the cuboid defined by the
+    // nearest surrounding tabulated points
+    const double xlocal = xcell - xindex;
+    const double ylocal = ycell - yindex;
+    const double zlocal = zcell - zindex;
+
+#ifdef DEBUG_INTERPOLATING_FIELD
+    G4cout << "Local x,y,z: " << xlocal << " " << ylocal << " " << zlocal << G4endl;
+    G4cout << "Index x,y,z: " << xindex << " " << yindex << " " << zindex << G4endl;
+#endif
+
+    switch (fStorage) {
+    case Storage::Float:
+      Interpolate(static_cast<const float*>(fValues), xindex, yindex, zindex,
+		  xlocal, ylocal, zlocal, interpolation, Bfield);
+      break;
+    case Storage::Half:
+      Interpolate(static_cast<const Half*>(fValues), xindex, yindex, zindex,
+		  xlocal, ylocal, zlocal, interpolation, Bfield);
+      break;
+    case Storage::BFloat16:
+      Interpolate(static_cast<const BFloat16*>(fValues), xindex, yindex, zindex,
+		  xlocal, ylocal, zlocal, interpolation, Bfield);
+      break;
+    default:
+      Interpolate(static_cast<const double*>(fValues), xindex, yindex, zindex,
+		  xlocal, ylocal, zlocal, interpolation, Bfield);
+    }
+
+  } else {
+    Bfield[0] = 0.0;
+    Bfield[1] = 0.0;
+    Bfield[2] = 0.0;
+  }
+}
+
+void ICESPICEFieldMap::GetNodeValue(int ix, int iy, int iz,
+				    double* Bfield) const
+{
+  const std::size_t node = (static_cast<std::size_t>(ix) * ny + iy) * nz + iz;
+  for (std::size_t component = 0; component < 3; ++component) {
+    Bfield[component] = fFieldUnit * ValueAt(3*node + component);
+  }
+}
+
+template <typename T>
+void ICESPICEFieldMap::Interpolate(const T* values,
+				   int xindex, int yindex, int zindex,
+				   double xlocal, double ylocal, double zlocal,
+				   Interpolation interpolation,
+				   double* Bfield) const
+{
+  if (interpolation == Interpolation::Cubic) {
+    InterpolateCubic(values, xindex, yindex, zindex, xlocal, ylocal, zlocal, Bfield);
+    return;
+  }
+
+  // Offsets of the corners of the cell; each node holds Bx, By, Bz
+  const std::size_t ystride = 3 * static_cast<std::size_t>(nz);
+  const std::size_t xstride = ystride * ny;
+  const T* c000 = values + xindex * xstride + yindex * ystride + 3 * zindex;
+
+  // Weights of the four x-y corner columns and of the two z corners,
+  // computed once for all three components
+  const double wxy[4] = { (1-xlocal) * (1-ylocal), (1-xlocal) * ylocal,
+			     xlocal  * (1-ylocal),    xlocal  * ylocal };
+  const double wz[2]  = { 1-zlocal, zlocal };
+
+  Trilinear(c000, ystride, xstride, wxy, wz, Bfield);
+  Bfield[0] *= fFieldUnit;
+  Bfield[1] *= fFieldUnit;
+  Bfield[2] *= fFieldUnit;
+}
+
+template <typename T>
+void ICESPICEFieldMap::InterpolateCubic(const T* values,
+					int xindex, int yindex, int zindex,
+					double xlocal, double ylocal, double zlocal,
+					double* Bfield) const
+{
+  // Catmull-Rom weights and node indices of the four nodes along one axis
+  // around a point at local position t in cell index
+  auto stencil = [](int index, int n, double t, bool periodic, double* w, int* node) {
+    const double t2 = t * t, t3 = t2 * t;
+    w[0] = 0.5 * (-t3 + 2*t2 - t);
+    w[1] = 0.5 * (3*t3 - 5*t2 + 2);
+    w[2] = 0.5 * (-3*t3 + 4*t2 + t);
+    w[3] = 0.5 * (t3 - t2);
+    for (int k = 0; k < 4; ++k) node[k] = index - 1 + k;
+    if (periodic) {
+      // The last phi node is the first one of the next sector
+      for (int k = 0; k < 4; ++k) {
+	if (node[k] < 0)      node[k] += n - 1;
+	if (node[k] > n - 1)  node[k] -= n - 1;
+      }
+      return;
+    }
+    // Outside the table, continue the field linearly from the last two
+    // nodes: p[-1] = 2 p[0] - p[1], and likewise at the upper face
+    if (node[0] < 0) {
+      w[1] += 2 * w[0];
+      w[2] -= w[0];
+      w[0] = 0.;
+    }
+    if (node[3] > n - 1) {
+      w[2] += 2 * w[3];
+      w[1] -= w[3];
+      w[3] = 0.;
+    }
+    for (int k = 0; k < 4; ++k) node[k] = std::min(std::max(node[k], 0), n - 1);
+  };
+
+  double wx[4], wy[4], wz[4];
+  int ix[4], iy[4], iz[4];
+  stencil(xindex, nx, xlocal, false, wx, ix);
+  stencil(yindex, ny, ylocal, fGeometry == Geometry::Sector, wy, iy);
+  stencil(zindex, nz, zlocal, false, wz, iz);
+
+  const std::size_t ystride = 3 * static_cast<std::size_t>(nz);
+  const std::size_t xstride = ystride * ny;
+  double sum[3] = {0., 0., 0.};
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      const double wxy = wx[i] * wy[j];
+      if (wxy == 0.) continue;
+      const T* column = values + ix[i] * xstride + iy[j] * ystride;
+      for (int k = 0; k < 4; ++k) {
+	const T* node = column + 3 * iz[k];
+	const double w = wxy * wz[k];
+	sum[0] += ToDouble(node[0]) * w;
+	sum[1] += ToDouble(node[1]) * w;
+	sum[2] += ToDouble(node[2]) * w;
+      }
+    }
+  }
+  Bfield[0] = fFieldUnit * sum[0];
+  Bfield[1] = fFieldUnit * sum[1];
+  Bfield[2] = fFieldUnit * sum[2];
+}
+
+bool ICESPICEFieldMap::GetVerifyChecksums()
+{
+  return gVerifyChecksums.load(std::memory_order_relaxed);
+}
+
+void ICESPICEFieldMap::SetVerifyChecksums(bool verify)
+{
+  gVerifyChecksums.store(verify, std::memory_order_relaxed);
+}
+
+ICESPICEFieldMap::Kernel ICESPICEFieldMap::GetKernel()
+{
+  return gKernel.load(std::memory_order_relaxed);
+}
+
+ICESPICEFieldMap::Kernel ICESPICEFieldMap::SetKernel(Kernel kernel)
+{
+  if (static_cast<int>(kernel) > static_cast<int>(kBestKernel)) kernel = kBestKernel;
+  gKernel.store(kernel, std::memory_order_relaxed);
+  return kernel;
+}
+
+const char* ICESPICEFieldMap::KernelName(Kernel kernel)
+{
+  switch (kernel) {
+  case Kernel::AVX2:   return "AVX2";
+  case Kernel::AVX512: return "AVX-512";
+  default:             return "scalar";
+  }
+}
+
+void ICESPICEFieldMap::GetFieldValue(double x, double y, double z,
+				     double* Bfield, CellCache& cache) const
+{
+  if (fGeometry != Geometry::Cartesian) {
+    GetFieldValue(x, y, z, Bfield);
+    return;
+  }
+  if (!( x>=fActiveMin[0] && x<=fActiveMax[0] &&
+	 y>=fActiveMin[1] && y<=fActiveMax[1] &&
+	 z>=fActiveMin[2] && z<=fActiveMax[2] )) {
+    Bfield[0] = 0.0;
+    Bfield[1] = 0.0;
+    Bfield[2] = 0.0;
+    return;
+  }
+
+  // Same cell and local coordinates as GetGridValue
+  const double xcell = (x - minx) * invdx;
+  const double ycell = (y - miny) * invdy;
+  const double zcell = (z - minz) * invdz;
+  const int xindex = std::min(static_cast<int>(xcell), nx - 2);
+  const int yindex = std::min(static_cast<int>(ycell), ny - 2);
+  const int zindex = std::min(static_cast<int>(zcell), nz - 2);
+  const std::size_t cell = (static_cast<std::size_t>(xindex) * ny + yindex) * nz + zindex;
+
+  if (cell == cache.cell && cache.map == fId) {
+    ++cache.hits;
+  } else {
+    switch (fStorage) {
+    case Storage::Float:
+      GatherCell(static_cast<const float*>(fValues), cell, cache.corners);
+      break;
+    case Storage::Half:
+      GatherCell(static_cast<const Half*>(fValues), cell, cache.corners);
+      break;
+    case Storage::BFloat16:
+      GatherCell(static_cast<const BFloat16*>(fValues), cell, cache.corners);
+      break;
+    default:
+      GatherCell(static_cast<const double*>(fValues), cell, cache.corners);
+    }
+    cache.map = fId;
+    cache.cell = cell;
+    ++cache.misses;
+  }
+
+  const double xlocal = xcell - xindex;
+  const double ylocal = ycell - yindex;
+  const double zlocal = zcell - zindex;
+  const double wxy[4] = { (1-xlocal) * (1-ylocal), (1-xlocal) * ylocal,
+			     xlocal  * (1-ylocal),    xlocal  * ylocal };
+  const double wz[2]  = { 1-zlocal, zlocal };
+  // The corners form a 2x2x2 grid: neighbours along y are 6 values
+  // apart and along x 12
+  Trilinear(&cache.corners[0][0], 6, 12, wxy, wz, Bfield);
+}
+
+template <typename T>
+void ICESPICEFieldMap::GatherCell(const T* values, std::size_t node,
+				  double (*corners)[3]) const
+{
+  const std::size_t ystride = 3 * static_cast<std::size_t>(nz);
+  const std::size_t xstride = ystride * ny;
+  const T* c000 = values + 3 * node;
+  for (int corner = 0; corner < 8; ++corner) {
+    const T* c = c000 + (corner >> 2) * xstride + ((corner >> 1) & 1) * ystride
+      + 3 * (corner & 1);
+    for (int component = 0; component < 3; ++component) {
+      corners[corner][component] = fFieldUnit * ToDouble(c[component]);
+    }
+  }
+}
+
+void ICESPICEFieldMap::GetFieldValues(std::size_t n, const double* points,
+				      double* Bfield) const
+{
+  if (fGeometry != Geometry::Cartesian) {
+    for (std::size_t i = 0; i < n; ++i) {
+      GetFieldValue(points[3*i], points[3*i + 1], points[3*i + 2], Bfield + 3*i);
+    }
+    return;
+  }
+
+  switch (fStorage) {
+  case Storage::Float:
+    GetGridValues(static_cast<const float*>(fValues), n, points, Bfield);
+    break;
+  case Storage::Half:
+    GetGridValues(static_cast<const Half*>(fValues), n, points, Bfield);
+    break;
+  case Storage::BFloat16:
+    GetGridValues(static_cast<const BFloat16*>(fValues), n, points, Bfield);
+    break;
+  default:
+    GetGridValues(static_cast<const double*>(fValues), n, points, Bfield);
+  }
+}
+
+template <typename T>
+void ICESPICEFieldMap::GetGridValues(const T* values, std::size_t n,
+				     const double* points, double* Bfield) const
+{
+  // The points go in blocks: first the cell and weights of every point of
+  // the block, with the four z rows of each cell prefetched, then the
+  // blend of each point. The blend is that of GetGridValue, so the values
+  // are the same as one lookup at a time.
+  const std::size_t block = 16;
+  const std::size_t ystride = 3 * static_cast<std::size_t>(nz);
+  const std::size_t xstride = ystride * ny;
+  const T* c000[block];
+  double wxy[block][4], wz[block][2];
+
+  for (std::size_t first = 0; first < n; first += block) {
+    const std::size_t count = std::min(block, n - first);
+
+    for (std::size_t i = 0; i < count; ++i) {
+      const double x = points[3*(first + i)];
+      const double y = points[3*(first + i) + 1];
+      const double z = points[3*(first + i) + 2];
+      if (!( x>=fActiveMin[0] && x<=fActiveMax[0] &&
+	     y>=fActiveMin[1] && y<=fActiveMax[1] &&
+	     z>=fActiveMin[2] && z<=fActiveMax[2] )) {
+	c000[i] = nullptr;
+	continue;
+      }
+
+      const double xcell = (x - minx) * invdx;
+      const double ycell = (y - miny) * invdy;
+      const double zcell = (z - minz) * invdz;
+      const int xindex = std::min(static_cast<int>(xcell), nx - 2);
+      const int yindex = std::min(static_cast<int>(ycell), ny - 2);
+      const int zindex = std::min(static_cast<int>(zcell), nz - 2);
+      const double xlocal = xcell - xindex;
+      const double ylocal = ycell - yindex;
+      const double zlocal = zcell - zindex;
+
+      c000[i] = values + xindex * xstride + yindex * ystride + 3 * zindex;
+      wxy[i][0] = (1-xlocal) * (1-ylocal);
+      wxy[i][1] = (1-xlocal) * ylocal;
+      wxy[i][2] = xlocal * (1-ylocal);
+      wxy[i][3] = xlocal * ylocal;
+      wz[i][0] = 1-zlocal;
+      wz[i][1] = zlocal;
+
+      // Each row holds the two z corners, six values that may straddle
+      // two cache lines
+      for (const T* row : { c000[i], c000[i] + ystride, c000[i] + xstride,
+			    c000[i] + xstride + ystride }) {
+	Prefetch(row);
+	Prefetch(row + 5);
+      }
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+      double* B = Bfield + 3*(first + i);
+      if (!c000[i]) {
+	B[0] = 0.0;
+	B[1] = 0.0;
+	B[2] = 0.0;
+	continue;
+      }
+      Trilinear(c000[i], ystride, xstride, wxy[i], wz[i], B);
+      B[0] *= fFieldUnit;
+      B[1] *= fFieldUnit;
+      B[2] *= fFieldUnit;
+    }
+  }
+}
@@ -0,0 +1,390 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldSetup.cc           *
+//    *                                   *
+//    *************************************
+//
+//
+
+#include "ICESPICEFieldSetup.hh"
+#include "ICESPICEFieldManager.hh"
+#include "ICESPICETabulatedField3D.hh"
+#include "ICESPICEAdaptiveField3D.hh"
+#include "ICESPICEMagnetField.hh"
+#include "ICESPICECombinedField.hh"
+#include "ICESPICEStepperFactory.hh"
+
+#include "G4SystemOfUnits.hh"
+#include "G4GenericMessenger.hh"
+
+#include <algorithm>
+#include <cfloat>
+
+ICESPICEFieldSetup::ICESPICEFieldSetup(const char* gridFile, const char* adaptiveFile,
+				       const char* magnetFile, G4double zOffset,
+				       const G4String& model)
+  :fGridFile(gridFile),fAdaptiveFile(adaptiveFile),fMagnetFile(magnetFile),
+   fZoffset(zOffset),fModel("grid"),fInterpolation("linear"),fCellCache(false),
+   fExtraFile("none"),fScale(1.),fExtraScale(1.),
+   fGridField(nullptr),fAdaptiveField(nullptr),fMagnetField(nullptr),
+   fExtraField(nullptr),fCombinedField(new ICESPICECombinedField),
+   fFieldManager(nullptr),fChordFinder(nullptr),fEquation(nullptr),fStepper(nullptr),
+   fStepperName("Default"),fMinStep(1.0e-2*mm),fDeltaChord(0.25*mm),fMessenger(nullptr)
+{
+  SetModel(model);
+  DefineCommands();
+}
+
+ICESPICEFieldSetup::~ICESPICEFieldSetup()
+{
+  delete fMessenger;
+  delete fFieldManager;
+  delete fChordFinder;
+  delete fStepper;
+  delete fEquation;
+  delete fGridField;
+  delete fAdaptiveField;
+  delete fMagnetField;
+  delete fExtraField;
+  delete fCombinedField;
+}
+
+G4MagneticField* ICESPICEFieldSetup::GetModelField() const
+{
+  if (fModel == "magnets") return fMagnetField;
+  if (fModel == "adaptive") return fAdaptiveField;
+  return fGridField;
+}
+
+G4MagneticField* ICESPICEFieldSetup::GetField() const
+{
+  if (fCombinedField->IsPlain()) return GetModelField();
+  return fCombinedField;
+}
+
+void ICESPICEFieldSetup::SetModel(const G4String& name)
+{
+  if (name == "magnets") {
+    if (fMagnetField == nullptr)
+      fMagnetField = new ICESPICEMagnetField(fMagnetFile.c_str(), fZoffset);
+  }
+  else if (name == "adaptive") {
+    if (fAdaptiveField == nullptr)
+      fAdaptiveField = new ICESPICEAdaptiveField3D(fAdaptiveFile.c_str(), fZoffset);
+  }
+  else {
+    if (fGridField == nullptr) {
+      fGridField = new ICESPICETabulatedField3D(fGridFile.c_str(), fZoffset);
+      SetInterpolation(fInterpolation);
+      SetCellCache(fCellCache);
+    }
+  }
+  fModel = name == "magnets" || name == "adaptive" ? name : G4String("grid");
+  UpdateField();
+}
+
+void ICESPICEFieldSetup::SetScale(G4double val)
+{
+  fScale = val;
+  UpdateField();
+}
+
+void ICESPICEFieldSetup::SetExtraGrid(const G4String& filename)
+{
+  if (filename == fExtraFile) return;
+  delete fExtraField;
+  fExtraField = nullptr;
+  fExtraFile = filename;
+  if (filename != "none") {
+    fExtraField = new ICESPICETabulatedField3D(filename.c_str(), fZoffset);
+    SetInterpolation(fInterpolation);
+    SetCellCache(fCellCache);
+  }
+  UpdateField();
+}
+
+void ICESPICEFieldSetup::SetExtraScale(G4double val)
+{
+  fExtraScale = val;
+  UpdateField();
+}
+
+void ICESPICEFieldSetup::SetUniformField(G4ThreeVector val)
+{
+  fUniform = val;
+  UpdateField();
+}
+
+void ICESPICEFieldSetup::UpdateField()
+{
+  G4ThreeVector lower, upper;
+  G4bool hasField;
+  if (fModel == "magnets")
+    hasField = fMagnetField->GetActiveBox(lower, upper);
+  else if (fModel == "adaptive")
+    hasField = fAdaptiveField->GetActiveBox(lower, upper);
+  else
+    hasField = fGridField->GetActiveBox(lower, upper);
+  hasField = hasField && fScale != 0.;
+
+  // The box has to hold the field of every part
+  G4ThreeVector extraLower, extraUpper;
+  if (fExtraField && fExtraScale != 0.
+      && fExtraField->GetActiveBox(extraLower, extraUpper)) {
+    if (hasField) {
+      for (G4int axis = 0; axis < 3; ++axis) {
+	lower[axis] = std::min(lower[axis], extraLower[axis]);
+	upper[axis] = std::max(upper[axis], extraUpper[axis]);
+      }
+    }
+    else {
+      lower = extraLower;
+      upper = extraUpper;
+    }
+    hasField = true;
+  }
+  if (fUniform != G4ThreeVector()) {
+    lower.set(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+    upper.set(DBL_MAX, DBL_MAX, DBL_MAX);
+    hasField = true;
+  }
+
+  fCombinedField->SetField(GetModelField());
+  fCombinedField->SetScale(fScale);
+  fCombinedField->SetExtraField(fExtraField, fExtraScale);
+  fCombinedField->SetUniformField(fUniform);
+
+  if (fFieldManager == nullptr)
+    fFieldManager = new ICESPICEFieldManager(GetField(), hasField, lower, upper);
+  else
+    fFieldManager->SetField(GetField(), hasField, lower, upper);
+  // The equation of motion is built around the field
+  UpdateChordFinder();
+}
+
+G4bool ICESPICEFieldSetup::UpdateChordFinder()
+{
+  G4EquationOfMotion* equation = nullptr;
+  G4MagIntegratorStepper* stepper = nullptr;
+  G4ChordFinder* chordFinder;
+  if (!fCombinedField->IsPlain())
+    chordFinder = ICESPICEStepperFactory::Create(fStepperName, fCombinedField, fMinStep,
+						 equation, stepper);
+  else if (fModel == "magnets")
+    chordFinder = ICESPICEStepperFactory::Create(fStepperName, fMagnetField, fMinStep,
+						 equation, stepper);
+  else if (fModel == "adaptive")
+    chordFinder = ICESPICEStepperFactory::Create(fStepperName, fAdaptiveField, fMinStep,
+						 equation, stepper);
+  else
+    chordFinder = ICESPICEStepperFactory::Create(fStepperName, fGridField, fMinStep,
+						 equation, stepper);
+
+  if (chordFinder == nullptr) {
+    G4ExceptionDescription ed;
+    ed << "Unknown stepper " << fStepperName << ", keeping the previous one.";
+    G4Exception("ICESPICEFieldSetup::UpdateChordFinder()", "pugmag009",
+		JustWarning, ed);
+    return false;
+  }
+
+  chordFinder->SetDeltaChord(fDeltaChord);
+  fFieldManager->SetChordFinder(chordFinder);
+
+  delete fChordFinder;
+  delete fStepper;
+  delete fEquation;
+  fChordFinder = chordFinder;
+  fStepper = stepper;
+  fEquation = equation;
+  return true;
+}
+
+void ICESPICEFieldSetup::SetStepper(const G4String& name)
+{
+  G4String previous = fStepperName;
+  fStepperName = name;
+  if (!UpdateChordFinder()) fStepperName = previous;
+}
+
+void ICESPICEFieldSetup::SetMinStep(G4double val)
+{
+  fMinStep = val;
+  UpdateChordFinder();
+}
+
+void ICESPICEFieldSetup::SetDeltaChord(G4double val)
+{
+  fDeltaChord = val;
+  fChordFinder->SetDeltaChord(val);
+}
+
+void ICESPICEFieldSetup::SetDeltaOneStep(G4double val)
+{
+  fFieldManager->SetDeltaOneStep(val);
+}
+
+void ICESPICEFieldSetup::SetDeltaIntersection(G4double val)
+{
+  fFieldManager->SetDeltaIntersection(val);
+}
+
+void ICESPICEFieldSetup::SetEpsilonMin(G4double val)
+{
+  fFieldManager->SetMinimumEpsilonStep(val);
+}
+
+void ICESPICEFieldSetup::SetEpsilonMax(G4double val)
+{
+  fFieldManager->SetMaximumEpsilonStep(val);
+}
+
+void ICESPICEFieldSetup::SetInterpolation(const G4String& name)
+{
+  fInterpolation = name;
+  ICESPICEFieldMap::Interpolation interpolation = name == "cubic"
+    ? ICESPICEFieldMap::Interpolation::Cubic : ICESPICEFieldMap::Interpolation::Linear;
+  if (fGridField) fGridField->SetInterpolation(interpolation);
+  if (fExtraField) fExtraField->SetInterpolation(interpolation);
+}
+
+void ICESPICEFieldSetup::SetCellCache(G4bool val)
+{
+  fCellCache = val;
+  if (fGridField) fGridField->SetCellCache(val);
+  if (fExtraField) fExtraField->SetCellCache(val);
+}
+
+void ICESPICEFieldSetup::SetStraightLineOutsideField(G4bool val)
+{
+  fFieldManager->SetStraightLineOutsideField(val);
+}
+
+void ICESPICEFieldSetup::Print() const
+{
+  G4cout << " ---> Field from the " << fModel << ", stepper " << fStepperName
+	 << ", min step " << fMinStep/mm << " mm"
+	 << ", delta chord " << fChordFinder->GetDeltaChord()/mm << " mm"
+	 << ", delta one step " << fFieldManager->GetDeltaOneStep()/mm << " mm"
+	 << ", delta intersection " << fFieldManager->GetDeltaIntersection()/mm << " mm"
+	 << ", epsilon " << fFieldManager->GetMinimumEpsilonStep()
+	 << " - " << fFieldManager->GetMaximumEpsilonStep() << G4endl;
+  if (!fCombinedField->IsPlain()) {
+    G4cout << " ---> Field scaled by " << fScale;
+    if (fExtraField)
+      G4cout << ", plus " << fExtraFile << " scaled by " << fExtraScale;
+    if (fUniform != G4ThreeVector())
+      G4cout << ", plus a uniform " << fUniform/gauss << " G";
+    G4cout << G4endl;
+  }
+}
+
+void ICESPICEFieldSetup::DefineCommands()
+{
+  fMessenger = new G4GenericMessenger(this, "/ICESPICE/Field/", "Field control");
+
+  fMessenger->DeclareMethod("Model", &ICESPICEFieldSetup::SetModel,
+    "Field from the grid, the adaptive grid or the analytic model of the magnets.")
+    .SetParameterName("model", false)
+    .SetCandidates("grid adaptive magnets");
+
+  fMessenger->DeclareMethod("Scale", &ICESPICEFieldSetup::SetScale,
+    "Factor on the field of the model.")
+    .SetParameterName("scale", false);
+
+  fMessenger->DeclareMethod("AddGrid", &ICESPICEFieldSetup::SetExtraGrid,
+    "Field map added to the field of the model, none to remove it.")
+    .SetParameterName("filename", false);
+
+  fMessenger->DeclareMethod("AddGridScale", &ICESPICEFieldSetup::SetExtraScale,
+    "Factor on the added field map.")
+    .SetParameterName("scale", false);
+
+  fMessenger->DeclareMethodWithUnit("UniformField", "gauss",
+    &ICESPICEFieldSetup::SetUniformField,
+    "Uniform field added everywhere to the field of the model.")
+    .SetParameterName("Bx", "By", "Bz", false);
+
+  fMessenger->DeclareMethod("Stepper", &ICESPICEFieldSetup::SetStepper,
+    "Integration stepper for tracks in the field.")
+    .SetParameterName("stepper", false)
+    .SetCandidates(ICESPICEStepperFactory::Names());
+
+  fMessenger->DeclareMethodWithUnit("MinStep", "mm", &ICESPICEFieldSetup::SetMinStep,
+    "Smallest step the integration driver takes.")
+    .SetParameterName("minStep", false)
+    .SetRange("minStep>0.");
+
+  fMessenger->DeclareMethodWithUnit("DeltaChord", "mm", &ICESPICEFieldSetup::SetDeltaChord,
+    "Largest distance between a curved track and its chords.")
+    .SetParameterName("deltaChord", false)
+    .SetRange("deltaChord>0.");
+
+  fMessenger->DeclareMethodWithUnit("DeltaOneStep", "mm", &ICESPICEFieldSetup::SetDeltaOneStep,
+    "Accuracy of the end point of an integration step.")
+    .SetParameterName("deltaOneStep", false)
+    .SetRange("deltaOneStep>0.");
+
+  fMessenger->DeclareMethodWithUnit("DeltaIntersection", "mm",
+    &ICESPICEFieldSetup::SetDeltaIntersection,
+    "Accuracy of the intersection of a curved track with a boundary.")
+    .SetParameterName("deltaIntersection", false)
+    .SetRange("deltaIntersection>0.");
+
+  fMessenger->DeclareMethod("EpsMin", &ICESPICEFieldSetup::SetEpsilonMin,
+    "Smallest relative accuracy of a step.")
+    .SetParameterName("epsMin", false)
+    .SetRange("epsMin>0. && epsMin<1.");
+
+  fMessenger->DeclareMethod("EpsMax", &ICESPICEFieldSetup::SetEpsilonMax,
+    "Largest relative accuracy of a step.")
+    .SetParameterName("epsMax", false)
+    .SetRange("epsMax>0. && epsMax<1.");
+
+  fMessenger->DeclareMethod("StraightLineOutsideField",
+    &ICESPICEFieldSetup::SetStraightLineOutsideField,
+    "Take straight steps for tracks that do not head into the field region.")
+    .SetParameterName("straight", true)
+    .SetDefaultValue("true");
+
+  fMessenger->DeclareMethod("Interpolation", &ICESPICEFieldSetup::SetInterpolation,
+    "Interpolation of the field grid between its nodes.")
+    .SetParameterName("interpolation", false)
+    .SetCandidates("linear cubic");
+
+  fMessenger->DeclareMethod("CellCache", &ICESPICEFieldSetup::SetCellCache,
+    "Reuse the corners of the last grid cell for linear lookups in the same cell.")
+    .SetParameterName("cellCache", true)
+    .SetDefaultValue("true");
+
+  fMessenger->DeclareMethod("Print", &ICESPICEFieldSetup::Print,
+    "Print the stepper and the accuracy parameters.");
+}
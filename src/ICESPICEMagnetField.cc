@@ -0,0 +1,290 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//    *************************************
+//    *                                   *
+//    *    ICESPICEMagnetField.cc          *
+//    *                                   *
+//    *************************************
+//
+//
+
+#include "ICESPICEMagnetField.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4PhysicalConstants.hh"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+  // Margin of the default region around the magnets
+  const double kMargin = 50.*mm;
+
+  // ln(a + r) with r = sqrt(a^2 + rest2), written for a < 0 so that it
+  // does not cancel; returned as the argument of the logarithm
+  inline double LogArgument(double a, double r, double rest2)
+  {
+    return a >= 0. ? a + r : rest2 / (r - a);
+  }
+}
+
+ICESPICEMagnetField::ICESPICEMagnetField(const char* filename, double zOffset)
+  :fMagnets(5),fRadius(3.5*mm),fRemanence(1.32*tesla, 0., 0.),fZoffset(zOffset)
+{
+  // The 1" x 1" x 1/8" plates of ICESPICEDetectorConstruction
+  // (cad_files/1x1x1_8in_square_magnet.PLY), standing on a corner
+  fHalfSize[0] = 0.0625*2.54*cm;
+  fHalfSize[1] = fHalfSize[2] = 0.5*2.54*cm;
+  SetRemanence(fRemanence);
+  Place();
+
+  const double outer = fRadius + 2.*std::sqrt(2.)*fHalfSize[1] + kMargin;
+  const double height = std::sqrt(2.)*fHalfSize[1] + kMargin;
+  fLower[0] = fLower[1] = -outer;
+  fUpper[0] = fUpper[1] = outer;
+  fLower[2] = -height;
+  fUpper[2] = height;
+
+  Read(filename);
+
+  G4cout << " ---> Using magnet model " << filename << ": " << fMagnets
+	 << " magnets at " << fRadius/mm << " mm, remanence "
+	 << fRemanence/tesla << " T" << G4endl;
+}
+
+void ICESPICEMagnetField::Read(const char* filename)
+{
+  if (filename[0] == '\0') return;
+  std::ifstream file(filename);
+  if (!file) {
+    G4cout << " ---> No magnet parameters in " << filename
+	   << ", using the nominal magnets" << G4endl;
+    return;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream in(line);
+    std::string key;
+    if (!(in >> key)) continue;
+    double v[3] = { 0., 0., 0. };
+    int n = 0;
+    while (n < 3 && in >> v[n]) ++n;
+
+    if (key == "magnets" && n == 1) fMagnets = int(v[0]);
+    else if (key == "radius" && n == 1) fRadius = v[0]*mm;
+    else if (key == "halfSize" && n == 3) for (int i = 0; i < 3; ++i) fHalfSize[i] = v[i]*mm;
+    else if (key == "remanence" && n == 3) fRemanence.set(v[0]*tesla, v[1]*tesla, v[2]*tesla);
+    else if (key == "lower" && n == 3) for (int i = 0; i < 3; ++i) fLower[i] = v[i]*mm;
+    else if (key == "upper" && n == 3) for (int i = 0; i < 3; ++i) fUpper[i] = v[i]*mm;
+    else {
+      G4ExceptionDescription ed;
+      ed << "Ignoring line \"" << line << "\" of " << filename << std::endl;
+      G4Exception("ICESPICEMagnetField::Read","pugmag010",JustWarning,ed);
+    }
+  }
+  SetRemanence(fRemanence);
+  Place();
+}
+
+void ICESPICEMagnetField::Write(const char* filename, const char* comment) const
+{
+  std::ofstream file(filename);
+  file.precision(10);
+  file << "# ICESPICE magnet model: " << comment << "\n"
+       << "# lengths in mm, remanence in tesla along the plate normal, the\n"
+       << "# radial direction and the axis\n"
+       << "magnets " << fMagnets << "\n"
+       << "radius " << fRadius/mm << "\n"
+       << "halfSize " << fHalfSize[0]/mm << " " << fHalfSize[1]/mm << " "
+       << fHalfSize[2]/mm << "\n"
+       << "remanence " << fRemanence.x()/tesla << " " << fRemanence.y()/tesla << " "
+       << fRemanence.z()/tesla << "\n"
+       << "lower " << fLower[0]/mm << " " << fLower[1]/mm << " " << fLower[2]/mm << "\n"
+       << "upper " << fUpper[0]/mm << " " << fUpper[1]/mm << " " << fUpper[2]/mm << "\n";
+  if (!file) {
+    G4ExceptionDescription ed;
+    ed << "Could not write magnet parameters to " << filename << std::endl;
+    G4Exception("ICESPICEMagnetField::Write","pugmag011",FatalException,ed);
+  }
+}
+
+void ICESPICEMagnetField::SetRemanence(const G4ThreeVector& val)
+{
+  // The square faces of a plate stand on a corner: its sides run at 45
+  // degrees between the radial direction and the axis.
+  fRemanence = val;
+  const double s = 1. / std::sqrt(2.);
+  fBoxRemanence[0] = val.x();
+  fBoxRemanence[1] = s * (val.y() + val.z());
+  fBoxRemanence[2] = s * (val.z() - val.y());
+}
+
+void ICESPICEMagnetField::SetPlacementRadius(double val)
+{
+  fRadius = val;
+  Place();
+}
+
+void ICESPICEMagnetField::SetBox(const double* lower, const double* upper)
+{
+  for (int i = 0; i < 3; ++i) {
+    fLower[i] = lower[i];
+    fUpper[i] = upper[i];
+  }
+}
+
+void ICESPICEMagnetField::Place()
+{
+  // As placed by ICESPICEDetectorConstruction: magnet i has its inner
+  // corner at radius fRadius and angle i 2pi/N from the y axis, and
+  // extends radially outwards from there.
+  fPlaced.resize(fMagnets);
+  const double s = 1. / std::sqrt(2.);
+  for (int i = 0; i < fMagnets; ++i) {
+    const double angle = i * twopi / fMagnets;
+    const double radial[3] = { std::sin(angle), std::cos(angle), 0. };
+    const double normal[3] = { std::cos(angle), -std::sin(angle), 0. };
+    Magnet& m = fPlaced[i];
+    const double centre = fRadius + std::sqrt(2.) * fHalfSize[1];
+    for (int c = 0; c < 3; ++c) {
+      const double axial = c == 2 ? 1. : 0.;
+      m.centre[c] = centre * radial[c];
+      m.axes[0][c] = normal[c];
+      m.axes[1][c] = s * (radial[c] + axial);
+      m.axes[2][c] = s * (axial - radial[c]);
+    }
+  }
+}
+
+bool ICESPICEMagnetField::IsNearMagnet(const double* point, double margin) const
+{
+  for (const Magnet& m : fPlaced) {
+    const double d[3] = { point[0] - m.centre[0], point[1] - m.centre[1],
+			  point[2] - m.centre[2] };
+    bool near = true;
+    for (int i = 0; i < 3 && near; ++i) {
+      const double q = m.axes[i][0] * d[0] + m.axes[i][1] * d[1] + m.axes[i][2] * d[2];
+      near = std::fabs(q) < fHalfSize[i] + margin;
+    }
+    if (near) return true;
+  }
+  return false;
+}
+
+G4bool ICESPICEMagnetField::GetActiveBox(G4ThreeVector& lower,
+					 G4ThreeVector& upper) const
+{
+  if (fMagnets == 0 || fRemanence.mag2() == 0.) return false;
+  lower.set(fLower[0], fLower[1], fLower[2] - fZoffset);
+  upper.set(fUpper[0], fUpper[1], fUpper[2] - fZoffset);
+  return true;
+}
+
+void ICESPICEMagnetField::GetFieldValue(const double point[4],
+					double *Bfield ) const
+{
+  const double p[3] = { point[0], point[1], point[2] + fZoffset };
+  Bfield[0] = Bfield[1] = Bfield[2] = 0.;
+  for (int c = 0; c < 3; ++c) {
+    if (!(p[c] >= fLower[c] && p[c] <= fUpper[c])) return;
+  }
+
+  for (const Magnet& m : fPlaced) {
+    const double d[3] = { p[0] - m.centre[0], p[1] - m.centre[1], p[2] - m.centre[2] };
+    double q[3], b[3];
+    for (int i = 0; i < 3; ++i)
+      q[i] = m.axes[i][0] * d[0] + m.axes[i][1] * d[1] + m.axes[i][2] * d[2];
+    BoxField(q, fHalfSize, fBoxRemanence, b);
+    for (int c = 0; c < 3; ++c)
+      Bfield[c] += m.axes[0][c] * b[0] + m.axes[1][c] * b[1] + m.axes[2][c] * b[2];
+  }
+}
+
+void ICESPICEMagnetField::BoxField(const double* p, const double* half,
+				   const double* Br, double* Bfield)
+{
+  // The field of the magnetic surface charges Br.n / mu0 on the six
+  // faces, summed over the eight corners with the sign of the corner
+  // (Engel-Herbert and Hesjedal, J. Appl. Phys. 97, 074504 (2005)). The
+  // logarithms of the corners are multiplied together first, so each
+  // component takes one logarithm.
+  double x[8], y[8], z[8], r[8];
+  double logs[3][2] = { { 1., 1. }, { 1., 1. }, { 1., 1. } };
+  for (int corner = 0; corner < 8; ++corner) {
+    const int ix = corner & 1, iy = (corner >> 1) & 1, iz = corner >> 2;
+    x[corner] = p[0] - (ix ? half[0] : -half[0]);
+    y[corner] = p[1] - (iy ? half[1] : -half[1]);
+    z[corner] = p[2] - (iz ? half[2] : -half[2]);
+    const double x2 = x[corner]*x[corner], y2 = y[corner]*y[corner], z2 = z[corner]*z[corner];
+    r[corner] = std::sqrt(x2 + y2 + z2);
+    const int k = (ix ^ iy ^ iz) ? 0 : 1;  // corner sign + or -
+    logs[0][k] *= LogArgument(x[corner], r[corner], y2 + z2);
+    logs[1][k] *= LogArgument(y[corner], r[corner], x2 + z2);
+    logs[2][k] *= LogArgument(z[corner], r[corner], x2 + y2);
+  }
+
+  // The arctangents of the two corners on a line along the axis are
+  // subtracted with one atan2: their difference is within (-pi, pi).
+  double angles[3] = { 0., 0., 0. };
+  for (int axis = 0; axis < 3; ++axis) {
+    if (Br[axis] == 0.) continue;
+    const int step = 1 << axis;
+    const double* u = axis == 0 ? x : axis == 1 ? y : z;
+    const double* v = axis == 0 ? y : x;
+    const double* w = axis == 2 ? y : z;
+    for (int lower = 0; lower < 8; ++lower) {
+      if (lower & step) continue;
+      const int upper = lower | step;
+      // atan(vw / (u r)) at upper minus the same at lower
+      const double vw = v[lower] * w[lower];
+      const double ur0 = u[lower] * r[lower], ur1 = u[upper] * r[upper];
+      double num = vw * (ur0 - ur1), den = ur0 * ur1 + vw * vw;
+      if (u[lower] * u[upper] < 0.) { num = -num; den = -den; }
+      // Sign of the upper corner, that of the other two axes
+      const int sign = ((upper ^ (upper >> 1) ^ (upper >> 2)) & 1) ? 1 : -1;
+      angles[axis] += sign * std::atan2(num, den);
+    }
+  }
+  const double lx = std::log(logs[0][0] / logs[0][1]);
+  const double ly = std::log(logs[1][0] / logs[1][1]);
+  const double lz = std::log(logs[2][0] / logs[2][1]);
+
+  const double f = 1. / (4. * pi);
+  Bfield[0] = f * (Br[0] * angles[0] - Br[1] * lz - Br[2] * ly);
+  Bfield[1] = f * (Br[1] * angles[1] - Br[0] * lz - Br[2] * lx);
+  Bfield[2] = f * (Br[2] * angles[2] - Br[0] * ly - Br[1] * lx);
+
+  // Inside the magnet B = mu0 (H + M)
+  if (std::fabs(p[0]) < half[0] && std::fabs(p[1]) < half[1] && std::fabs(p[2]) < half[2]) {
+    for (int c = 0; c < 3; ++c) Bfield[c] += Br[c];
+  }
+}
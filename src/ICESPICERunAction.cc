@@ -35,10 +35,14 @@
 //
 
 #include "ICESPICERunAction.hh"
+#ifdef ICESPICE_FIELD_STATS
+#include "ICESPICETabulatedField3D.hh"
+#endif
 
 #include "G4Run.hh"
 #include "G4UnitsTable.hh"
 #include "G4AnalysisManager.hh"
+#include "G4AccumulableManager.hh"
 #include "Randomize.hh"
 
 #include "G4RunManager.hh"
@@ -47,7 +51,12 @@
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 
 ICESPICERunAction::ICESPICERunAction()
-  : G4UserRunAction()
+  : G4UserRunAction(),
+    fSteps(0)
+#ifdef ICESPICE_FIELD_STATS
+    , fFieldCalls(0), fFieldInside(0), fFieldTimed(0), fFieldNanoseconds(0.),
+      fFieldCellHits(0), fFieldCellMisses(0)
+#endif
   {   
     // set printing event number per each event
     // G4RunManager::GetRunManager()->SetPrintProgress(1);  
@@ -65,6 +74,16 @@ ICESPICERunAction::ICESPICERunAction()
 
     analysisManager->CreateH1("Esil","Edep in silicon", 2000, 0., 2000.0*keV);
 
+    G4AccumulableManager::Instance()->RegisterAccumulable(fSteps);
+#ifdef ICESPICE_FIELD_STATS
+    G4AccumulableManager::Instance()->RegisterAccumulable(fFieldCalls);
+    G4AccumulableManager::Instance()->RegisterAccumulable(fFieldInside);
+    G4AccumulableManager::Instance()->RegisterAccumulable(fFieldTimed);
+    G4AccumulableManager::Instance()->RegisterAccumulable(fFieldNanoseconds);
+    G4AccumulableManager::Instance()->RegisterAccumulable(fFieldCellHits);
+    G4AccumulableManager::Instance()->RegisterAccumulable(fFieldCellMisses);
+#endif
+
     // analysisManager->CreateNtuple("ICESPICE", "Edep");
     // analysisManager->CreateNtupleDColumn("Esil");
     // analysisManager->FinishNtuple();
@@ -86,6 +105,12 @@ void ICESPICERunAction::BeginOfRunAction(const G4Run* aRun)
 
     analysisManager->Reset();
 
+    G4AccumulableManager::Instance()->Reset();
+#ifdef ICESPICE_FIELD_STATS
+    ICESPICETabulatedField3D::ResetStatistics();
+#endif
+    fTimer.Start();
+
   // Open an output file 
   // it can be overwritten in a macro
     analysisManager->OpenFile();
@@ -98,6 +123,57 @@ void ICESPICERunAction::EndOfRunAction(const G4Run* aRun)
   G4AnalysisManager* analysisManager = G4AnalysisManager::Instance();
   analysisManager->Write();
   analysisManager->CloseFile(true);      
+
+  // Workers have finished by the time the master gets here, so its timer
+  // spans the whole run and the rate is that of all threads together.
+  fTimer.Stop();
+#ifdef ICESPICE_FIELD_STATS
+  // The counters are per thread; each thread hands its own to the merge
+  const ICESPICETabulatedField3D::Statistics& stats =
+    ICESPICETabulatedField3D::GetStatistics();
+  fFieldCalls += stats.calls;
+  fFieldInside += stats.inside;
+  fFieldTimed += stats.timed;
+  fFieldNanoseconds += stats.nanoseconds;
+  fFieldCellHits += stats.cellHits;
+  fFieldCellMisses += stats.cellMisses;
+#endif
+  G4AccumulableManager::Instance()->Merge();
+  if (IsMaster() && aRun->GetNumberOfEvent() > 0) {
+    G4double seconds = fTimer.GetRealElapsed();
+    G4cout << "\n ---> " << aRun->GetNumberOfEvent() << " events, "
+	   << fSteps.GetValue() << " steps in " << seconds << " s";
+    if (seconds > 0.) G4cout << ", " << fSteps.GetValue() / seconds << " steps/s";
+    G4cout << G4endl;
+#ifdef ICESPICE_FIELD_STATS
+    PrintFieldStatistics(seconds);
+#endif
+  }
+}
+
+#ifdef ICESPICE_FIELD_STATS
+void ICESPICERunAction::PrintFieldStatistics(G4double seconds)
+{
+  G4long calls = fFieldCalls.GetValue();
+  if (calls == 0) return;
+  G4cout << " ---> Field: " << calls << " evaluations, "
+	 << 100. * fFieldInside.GetValue() / calls << "% inside the active box";
+  if (fFieldTimed.GetValue() > 0) {
+    // Extrapolated from the timed sample to all calls
+    G4double perCall = fFieldNanoseconds.GetValue() / fFieldTimed.GetValue();
+    G4double fieldSeconds = perCall * calls * 1.e-9;
+    G4cout << ", " << perCall << " ns each, " << fieldSeconds << " s in total";
+    G4int threads = G4RunManager::GetRunManager()->GetNumberOfThreads();
+    if (seconds > 0.)
+      G4cout << " (" << 100. * fieldSeconds / (seconds * threads)
+	     << "% of " << threads << " thread(s) over the run)";
+  }
+  G4long cellLookups = fFieldCellHits.GetValue() + fFieldCellMisses.GetValue();
+  if (cellLookups > 0)
+    G4cout << ", " << 100. * fFieldCellHits.GetValue() / cellLookups
+	   << "% of the cell cache lookups in the cached cell";
+  G4cout << G4endl;
 }
+#endif
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
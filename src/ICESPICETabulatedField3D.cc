@@ -36,236 +36,67 @@
 
 #include "ICESPICETabulatedField3D.hh"
 #include "G4SystemOfUnits.hh"
-#include "G4AutoLock.hh"
 
-namespace{
-  G4Mutex myICESPICETabulatedField3DLock = G4MUTEX_INITIALIZER;
-}
+#ifdef ICESPICE_FIELD_STATS
+#include <chrono>
 
-using namespace std;
+G4ThreadLocal ICESPICETabulatedField3D::Statistics
+ICESPICETabulatedField3D::fStatistics = ICESPICETabulatedField3D::Statistics();
+#endif
 
 ICESPICETabulatedField3D::ICESPICETabulatedField3D(const char* filename, 
 						 double zOffset ) 
-  :fZoffset(zOffset),invertX(false),invertY(false),invertZ(false)
+  :fFieldMap(ICESPICEFieldMap::Get(filename)),fZoffset(zOffset),
+   fInterpolation(ICESPICEFieldMap::Interpolation::Linear),fUseCellCache(false)
 {    
- 
-  double lenUnit= meter;
-  double fieldUnit= tesla; 
-  G4cout << "\n-----------------------------------------------------------"
-	 << "\n      Magnetic field"
-	 << "\n-----------------------------------------------------------";
-    
-  G4cout << "\n ---> " "Reading the field grid from " << filename << " ... " << G4endl; 
-
-  //
-  //This is a thread-local class and we have to avoid that all workers open the 
-  //file at the same time
-  G4AutoLock lock(&myICESPICETabulatedField3DLock);
-
-  ifstream file( filename ); // Open the file for reading.
-  
-  if (!file.is_open())
-    {
-      G4ExceptionDescription ed;
-      ed << "Could not open input file " << filename << std::endl;
-      G4Exception("ICESPICETabulatedField3D::ICESPICETabulatedField3D",
-		  "pugmag001",FatalException,ed);
-    }
-
-  // Ignore first blank line
-  char buffer[256];
-  file.getline(buffer,256);
-
-  // Read table dimensions 
-  file >> nx >> ny >> nz; // Note dodgy order
-
-  G4cout << "  [ Number of values x,y,z: " 
-	 << nx << " " << ny << " " << nz << " ] "
-	 << G4endl;
-
-  // Set up storage space for table
-  xField.resize( nx );
-  yField.resize( nx );
-  zField.resize( nx );
-  int ix, iy, iz;
-  for (ix=0; ix<nx; ix++) {
-    xField[ix].resize(ny);
-    yField[ix].resize(ny);
-    zField[ix].resize(ny);
-    for (iy=0; iy<ny; iy++) {
-      xField[ix][iy].resize(nz);
-      yField[ix][iy].resize(nz);
-      zField[ix][iy].resize(nz);
-    }
-  }
-  
-  // Ignore other header information    
-  // The first line whose second character is '0' is considered to
-  // be the last line of the header.
-  do {
-    file.getline(buffer,256);
-  } while ( buffer[1]!='0');
-  
-  // Read in the data
-  double xval,yval,zval,bx,by,bz;
-  double permeability; // Not used in this example.
-
-  int totalDataPoints = nx * ny * nz; // Total number of data points
-  int count = 0; // Counter to track the number of data points read
-  int percentComplete = 0; // To track the completion percentage
-
-  for (ix=0; ix<nx; ix++) {
-    for (iy=0; iy<ny; iy++) {
-      for (iz=0; iz<nz; iz++) {
-        file >> xval >> yval >> zval >> bx >> by >> bz >> permeability;
-        if (!file.good()) {
-            G4cout << "Failed to read data at position: ix=" << ix << ", iy=" << iy << ", iz=" << iz << G4endl;
-            return; // Exit the loop if a read fails
-        }
-
-        // G4cout << "Data read: " << xval << " " << yval << " " << zval << " " << bx << " " << by << " " << bz << " " << permeability << G4endl;
-
-        if ( ix==0 && iy==0 && iz==0 ) {
-          minx = xval * lenUnit;
-          miny = yval * lenUnit;
-          minz = zval * lenUnit;
-        }
-        xField[ix][iy][iz] = bx * fieldUnit;
-        yField[ix][iy][iz] = by * fieldUnit;
-        zField[ix][iy][iz] = bz * fieldUnit;
-
-        // Update progress
-        count++;
-        int newPercentComplete = (100 * count) / totalDataPoints;
-        if (newPercentComplete > percentComplete) {
-          percentComplete = newPercentComplete;
-          G4cout << "Reading progress: " << percentComplete << "% complete" << G4endl;
-        }
-      }
-    }
-  }
-  G4cout << "Reading complete." << G4endl;
-
-  file.close();
-
-  lock.unlock();
-
-  maxx = xval * lenUnit;
-  maxy = yval * lenUnit;
-  maxz = zval * lenUnit;
-
-  G4cout << "\n ---> ... done reading " << G4endl;
-
-  // G4cout << " Read values of field from file " << filename << G4endl; 
-  G4cout << " ---> assumed the order:  x, y, z, Bx, By, Bz "
-	 << "\n ---> Min values x,y,z: " 
-	 << minx/cm << " " << miny/cm << " " << minz/cm << " cm "
-	 << "\n ---> Max values x,y,z: " 
-	 << maxx/cm << " " << maxy/cm << " " << maxz/cm << " cm "
-	 << "\n ---> The field will be offset by " << zOffset/cm << " cm " << G4endl;
-
-  // Should really check that the limits are not the wrong way around.
-  if (maxx < minx) {swap(maxx,minx); invertX = true;} 
-  if (maxy < miny) {swap(maxy,miny); invertY = true;} 
-  if (maxz < minz) {swap(maxz,minz); invertZ = true;} 
-  G4cout << "\nAfter reordering if neccesary"  
-	 << "\n ---> Min values x,y,z: " 
-	 << minx/cm << " " << miny/cm << " " << minz/cm << " cm "
-	 << " \n ---> Max values x,y,z: " 
-	 << maxx/cm << " " << maxy/cm << " " << maxz/cm << " cm ";
-
-  dx = maxx - minx;
-  dy = maxy - miny;
-  dz = maxz - minz;
-  G4cout << "\n ---> Dif values x,y,z (range): " 
-	 << dx/cm << " " << dy/cm << " " << dz/cm << " cm in z "
-	 << "\n-----------------------------------------------------------" << G4endl;
+  G4cout << " ---> Using field grid " << filename 
+	 << ", offset by " << zOffset/cm << " cm " << G4endl;
+#ifdef ICESPICE_FIELD_STATS
+  fHasField = GetActiveBox(fLower, fUpper);
+#endif
 }
 
 void ICESPICETabulatedField3D::GetFieldValue(const double point[4],
 				      double *Bfield ) const
 {
-
-  double x = point[0];
-  double y = point[1];
-  double z = point[2] + fZoffset;
-
-  // Check that the point is within the defined region 
-  if ( x>=minx && x<=maxx &&
-       y>=miny && y<=maxy && 
-       z>=minz && z<=maxz ) {
-    
-    // Position of given point within region, normalized to the range
-    // [0,1]
-    double xfraction = (x - minx) / dx;
-    double yfraction = (y - miny) / dy; 
-    double zfraction = (z - minz) / dz;
-
-    if (invertX) { xfraction = 1 - xfraction;}
-    if (invertY) { yfraction = 1 - yfraction;}
-    if (invertZ) { zfraction = 1 - zfraction;}
-
-    // Need addresses of these to pass to modf below.
-    // modf uses its second argument as an OUTPUT argument.
-    double xdindex, ydindex, zdindex;
-    
-    // Position of the point within the cuboid defined by the
-    // nearest surrounding tabulated points
-    double xlocal = ( std::modf(xfraction*(nx-1), &xdindex));
-    double ylocal = ( std::modf(yfraction*(ny-1), &ydindex));
-    double zlocal = ( std::modf(zfraction*(nz-1), &zdindex));
-    
-    // The indices of the nearest tabulated point whose coordinates
-    // are all less than those of the given point
-    int xindex = static_cast<int>(xdindex);
-    int yindex = static_cast<int>(ydindex);
-    int zindex = static_cast<int>(zdindex);
-    
-
-#ifdef DEBUG_INTERPOLATING_FIELD
-    G4cout << "Local x,y,z: " << xlocal << " " << ylocal << " " << zlocal << G4endl;
-    G4cout << "Index x,y,z: " << xindex << " " << yindex << " " << zindex << G4endl;
-    double valx0z0, mulx0z0, valx1z0, mulx1z0;
-    double valx0z1, mulx0z1, valx1z1, mulx1z1;
-    valx0z0= table[xindex  ][0][zindex];  mulx0z0=  (1-xlocal) * (1-zlocal);
-    valx1z0= table[xindex+1][0][zindex];  mulx1z0=   xlocal    * (1-zlocal);
-    valx0z1= table[xindex  ][0][zindex+1]; mulx0z1= (1-xlocal) * zlocal;
-    valx1z1= table[xindex+1][0][zindex+1]; mulx1z1=  xlocal    * zlocal;
+#ifdef ICESPICE_FIELD_STATS
+  Statistics& stats = fStatistics;
+  const G4bool timed = stats.calls++ % kTimingInterval == 0;
+  if (fHasField &&
+      point[0] >= fLower.x() && point[0] <= fUpper.x() &&
+      point[1] >= fLower.y() && point[1] <= fUpper.y() &&
+      point[2] >= fLower.z() && point[2] <= fUpper.z()) ++stats.inside;
+  std::chrono::steady_clock::time_point start;
+  if (timed) start = std::chrono::steady_clock::now();
+#endif
+  if (fUseCellCache && fInterpolation == ICESPICEFieldMap::Interpolation::Linear) {
+#ifdef ICESPICE_FIELD_STATS
+    const G4long hits = fCellCache.hits, misses = fCellCache.misses;
+#endif
+    fFieldMap->GetFieldValue(point[0], point[1], point[2] + fZoffset, Bfield, fCellCache);
+#ifdef ICESPICE_FIELD_STATS
+    stats.cellHits += fCellCache.hits - hits;
+    stats.cellMisses += fCellCache.misses - misses;
 #endif
-
-        // Full 3-dimensional version
-    Bfield[0] =
-      xField[xindex  ][yindex  ][zindex  ] * (1-xlocal) * (1-ylocal) * (1-zlocal) +
-      xField[xindex  ][yindex  ][zindex+1] * (1-xlocal) * (1-ylocal) *    zlocal  +
-      xField[xindex  ][yindex+1][zindex  ] * (1-xlocal) *    ylocal  * (1-zlocal) +
-      xField[xindex  ][yindex+1][zindex+1] * (1-xlocal) *    ylocal  *    zlocal  +
-      xField[xindex+1][yindex  ][zindex  ] *    xlocal  * (1-ylocal) * (1-zlocal) +
-      xField[xindex+1][yindex  ][zindex+1] *    xlocal  * (1-ylocal) *    zlocal  +
-      xField[xindex+1][yindex+1][zindex  ] *    xlocal  *    ylocal  * (1-zlocal) +
-      xField[xindex+1][yindex+1][zindex+1] *    xlocal  *    ylocal  *    zlocal ;
-    Bfield[1] =
-      yField[xindex  ][yindex  ][zindex  ] * (1-xlocal) * (1-ylocal) * (1-zlocal) +
-      yField[xindex  ][yindex  ][zindex+1] * (1-xlocal) * (1-ylocal) *    zlocal  +
-      yField[xindex  ][yindex+1][zindex  ] * (1-xlocal) *    ylocal  * (1-zlocal) +
-      yField[xindex  ][yindex+1][zindex+1] * (1-xlocal) *    ylocal  *    zlocal  +
-      yField[xindex+1][yindex  ][zindex  ] *    xlocal  * (1-ylocal) * (1-zlocal) +
-      yField[xindex+1][yindex  ][zindex+1] *    xlocal  * (1-ylocal) *    zlocal  +
-      yField[xindex+1][yindex+1][zindex  ] *    xlocal  *    ylocal  * (1-zlocal) +
-      yField[xindex+1][yindex+1][zindex+1] *    xlocal  *    ylocal  *    zlocal ;
-    Bfield[2] =
-      zField[xindex  ][yindex  ][zindex  ] * (1-xlocal) * (1-ylocal) * (1-zlocal) +
-      zField[xindex  ][yindex  ][zindex+1] * (1-xlocal) * (1-ylocal) *    zlocal  +
-      zField[xindex  ][yindex+1][zindex  ] * (1-xlocal) *    ylocal  * (1-zlocal) +
-      zField[xindex  ][yindex+1][zindex+1] * (1-xlocal) *    ylocal  *    zlocal  +
-      zField[xindex+1][yindex  ][zindex  ] *    xlocal  * (1-ylocal) * (1-zlocal) +
-      zField[xindex+1][yindex  ][zindex+1] *    xlocal  * (1-ylocal) *    zlocal  +
-      zField[xindex+1][yindex+1][zindex  ] *    xlocal  *    ylocal  * (1-zlocal) +
-      zField[xindex+1][yindex+1][zindex+1] *    xlocal  *    ylocal  *    zlocal ;
-
   } else {
-    Bfield[0] = 0.0;
-    Bfield[1] = 0.0;
-    Bfield[2] = 0.0;
+    fFieldMap->GetFieldValue(point[0], point[1], point[2] + fZoffset, Bfield,
+			     fInterpolation);
   }
+#ifdef ICESPICE_FIELD_STATS
+  if (timed) {
+    stats.nanoseconds += std::chrono::duration<G4double, std::nano>
+      (std::chrono::steady_clock::now() - start).count();
+    ++stats.timed;
+  }
+#endif
 }
 
+G4bool ICESPICETabulatedField3D::GetActiveBox(G4ThreeVector& lower,
+					      G4ThreeVector& upper) const
+{
+  double lo[3], hi[3];
+  if (!fFieldMap->GetActiveBox(lo, hi)) return false;
+  lower.set(lo[0], lo[1], lo[2] - fZoffset);
+  upper.set(hi[0], hi[1], hi[2] - fZoffset);
+  return true;
+}
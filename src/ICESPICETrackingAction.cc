@@ -43,13 +43,16 @@
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 
-ICESPICETrackingAction::ICESPICETrackingAction()
+ICESPICETrackingAction::ICESPICETrackingAction(ICESPICERunAction* runAction)
+  : fRunAction(runAction)
 { }
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo....
 
-void ICESPICETrackingAction::PostUserTrackingAction(const G4Track*)
+void ICESPICETrackingAction::PostUserTrackingAction(const G4Track* track)
 {   
+  // Counted per track rather than per step to keep the stepping loop lean
+  if (fRunAction) fRunAction->AddSteps(track->GetCurrentStepNumber());
 }
 
 
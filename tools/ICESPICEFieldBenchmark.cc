@@ -0,0 +1,304 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldBenchmark.cc       *
+//    *                                   *
+//    *************************************
+//
+// Comments: Microbenchmark for field map lookups. Times the interpolation
+// on uniformly random points and on points that follow smooth tracks, the
+// way the Runge-Kutta stepper queries the field, all inside the active
+// box so that every lookup reads the table. The old nested-vector
+// layout is rebuilt from the map and timed alongside as a reference, and
+// the interleaved map is timed with each interpolation kernel the CPU
+// supports, one point at a time and in batches of 4 and 16 points. Results
+// are listed one benchmark per line, as Google Benchmark does. The
+// cell_cache lines reuse the corners of the last cell, as
+// ICESPICETabulatedField3D does, and the share of lookups that could is
+// printed at the end. The lookup at the faces of the grid is checked by
+// ICESPICEFieldBoundsTest.
+//
+//   ICESPICEFieldBenchmark <field map> [lookups]
+//
+
+#include "ICESPICEFieldMap.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Point { double x, y, z; };
+
+// Trilinear interpolation on x/y/z component tables of nested vectors,
+// as ICESPICETabulatedField3D used to store the grid.
+class NestedVectorField
+{
+public:
+  explicit NestedVectorField(const ICESPICEFieldMap& map)
+    : nx(map.GetNx()), ny(map.GetNy()), nz(map.GetNz()),
+      minx(map.GetMinX()), miny(map.GetMinY()), minz(map.GetMinZ()),
+      dx(map.GetMaxX() - minx), dy(map.GetMaxY() - miny), dz(map.GetMaxZ() - minz)
+  {
+    for (auto* table : { &xField, &yField, &zField }) {
+      table->assign(nx, std::vector<std::vector<double> >(ny, std::vector<double>(nz)));
+    }
+    for (int ix = 0; ix < nx; ++ix)
+      for (int iy = 0; iy < ny; ++iy)
+        for (int iz = 0; iz < nz; ++iz) {
+          double B[3];
+          map.GetNodeValue(ix, iy, iz, B);
+          xField[ix][iy][iz] = B[0];
+          yField[ix][iy][iz] = B[1];
+          zField[ix][iy][iz] = B[2];
+        }
+  }
+
+  void GetFieldValue(double x, double y, double z, double* B) const
+  {
+    double xd, yd, zd;
+    double xl = std::modf((x - minx) / dx * (nx-1), &xd);
+    double yl = std::modf((y - miny) / dy * (ny-1), &yd);
+    double zl = std::modf((z - minz) / dz * (nz-1), &zd);
+    int i = static_cast<int>(xd), j = static_cast<int>(yd), k = static_cast<int>(zd);
+    const std::vector<std::vector<std::vector<double> > >* tables[3] = { &xField, &yField, &zField };
+    for (int c = 0; c < 3; ++c) {
+      const auto& f = *tables[c];
+      B[c] = f[i  ][j  ][k  ] * (1-xl) * (1-yl) * (1-zl) +
+             f[i  ][j  ][k+1] * (1-xl) * (1-yl) *    zl  +
+             f[i  ][j+1][k  ] * (1-xl) *    yl  * (1-zl) +
+             f[i  ][j+1][k+1] * (1-xl) *    yl  *    zl  +
+             f[i+1][j  ][k  ] *    xl  * (1-yl) * (1-zl) +
+             f[i+1][j  ][k+1] *    xl  * (1-yl) *    zl  +
+             f[i+1][j+1][k  ] *    xl  *    yl  * (1-zl) +
+             f[i+1][j+1][k+1] *    xl  *    yl  *    zl ;
+    }
+  }
+
+private:
+  std::vector<std::vector<std::vector<double> > > xField, yField, zField;
+  int nx, ny, nz;
+  double minx, miny, minz, dx, dy, dz;
+};
+
+// Part of the grid inside the active box of a Cartesian map. The map
+// returns zero outside it without reading the table, while the nested
+// vectors interpolate everywhere, so the points are drawn inside it.
+void SampledBox(const ICESPICEFieldMap& map, double* lower, double* upper)
+{
+  lower[0] = map.GetMinX(); lower[1] = map.GetMinY(); lower[2] = map.GetMinZ();
+  upper[0] = map.GetMaxX(); upper[1] = map.GetMaxY(); upper[2] = map.GetMaxZ();
+  double activeLower[3], activeUpper[3];
+  if (map.GetGeometry() != ICESPICEFieldMap::Geometry::Cartesian
+      || !map.GetActiveBox(activeLower, activeUpper)) return;
+  for (int k = 0; k < 3; ++k) {
+    lower[k] = std::max(lower[k], activeLower[k]);
+    upper[k] = std::min(upper[k], activeUpper[k]);
+  }
+}
+
+// Points drawn uniformly inside the sampled box
+std::vector<Point> RandomPoints(const ICESPICEFieldMap& map, std::size_t n,
+                                std::mt19937_64& engine)
+{
+  double lower[3], upper[3];
+  SampledBox(map, lower, upper);
+  std::uniform_real_distribution<double> ux(lower[0], upper[0]);
+  std::uniform_real_distribution<double> uy(lower[1], upper[1]);
+  std::uniform_real_distribution<double> uz(lower[2], upper[2]);
+  std::vector<Point> points(n);
+  for (auto& p : points) p = { ux(engine), uy(engine), uz(engine) };
+  return points;
+}
+
+// Points along curved tracks with sub-cell steps, inside the sampled box.
+// Each step queries the field four times around the step, as a fourth
+// order stepper does.
+std::vector<Point> TrackPoints(const ICESPICEFieldMap& map, std::size_t n,
+                               std::mt19937_64& engine)
+{
+  double lower[3], upper[3];
+  SampledBox(map, lower, upper);
+  const double cell = (map.GetMaxX() - map.GetMinX()) / (map.GetNx() - 1);
+  const double step = 0.4 * cell;
+  std::uniform_real_distribution<double> unit(0., 1.);
+  std::vector<Point> points;
+  points.reserve(n);
+  while (points.size() < n) {
+    Point p = { lower[0] + (0.1 + 0.8 * unit(engine)) * (upper[0] - lower[0]),
+                lower[1] + (0.1 + 0.8 * unit(engine)) * (upper[1] - lower[1]),
+                upper[2] - std::min(cell, 0.5 * (upper[2] - lower[2])) };
+    double phi = 2. * M_PI * unit(engine);
+    double curvature = (unit(engine) - 0.5) * 0.05 / cell;
+    for (int i = 0; i < 10000 && points.size() < n; ++i) {
+      Point next = { p.x + step * std::cos(phi), p.y + step * std::sin(phi), p.z - 0.5 * step };
+      if (next.x <= lower[0] || next.x >= upper[0] ||
+          next.y <= lower[1] || next.y >= upper[1] ||
+          next.z <= lower[2]) break;
+      for (double f : { 0., 0.5, 0.5, 1. }) {
+        if (points.size() < n)
+          points.push_back({ p.x + f * (next.x - p.x), p.y + f * (next.y - p.y), p.z + f * (next.z - p.z) });
+      }
+      p = next;
+      phi += curvature * step;
+    }
+  }
+  return points;
+}
+
+double Time(const std::vector<Point>& points,
+            const std::function<void(const Point&, double*)>& lookup,
+            double& checksum)
+{
+  auto start = std::chrono::steady_clock::now();
+  double sum = 0.;
+  for (const auto& p : points) {
+    double B[3];
+    lookup(p, B);
+    sum += B[0] + B[1] + B[2];
+  }
+  auto stop = std::chrono::steady_clock::now();
+  checksum = sum;
+  return std::chrono::duration<double, std::nano>(stop - start).count() / points.size();
+}
+
+// Same, handing the points to GetFieldValues a few at a time
+double TimeBatch(const std::vector<Point>& points, const ICESPICEFieldMap& map,
+                 std::size_t batch, double& checksum)
+{
+  static_assert(sizeof(Point) == 3 * sizeof(double), "points must be packed x, y, z");
+  const double* xyz = &points[0].x;
+  std::vector<double> B(3 * batch);
+  auto start = std::chrono::steady_clock::now();
+  double sum = 0.;
+  for (std::size_t first = 0; first < points.size(); first += batch) {
+    const std::size_t n = std::min(batch, points.size() - first);
+    map.GetFieldValues(n, xyz + 3 * first, B.data());
+    for (std::size_t i = 0; i < 3 * n; ++i) sum += B[i];
+  }
+  auto stop = std::chrono::steady_clock::now();
+  checksum = sum;
+  return std::chrono::duration<double, std::nano>(stop - start).count() / points.size();
+}
+
+void Header()
+{
+  std::cout << std::left << std::setw(34) << "Benchmark"
+            << std::right << std::setw(13) << "Time" << std::setw(13) << "Iterations"
+            << std::setw(18) << "Throughput" << "   Checksum\n"
+            << std::string(94, '-') << std::endl;
+}
+
+void Report(const std::string& name, std::size_t lookups, double nsPerLookup, double checksum)
+{
+  std::cout << std::left << std::setw(34) << name
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << nsPerLookup << " ns"
+            << std::setw(13) << lookups
+            << std::setw(11) << 1e3 / nsPerLookup << " M/s"
+            << "   " << std::scientific << std::setprecision(6) << checksum
+            << std::endl;
+}
+
+}
+
+int main(int argc,char** argv) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <field map> [lookups]" << std::endl;
+    return 1;
+  }
+  const std::size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000000;
+
+  ICESPICEFieldMap map(argv[1]);
+  NestedVectorField nested(map);
+
+  std::mt19937_64 engine(12345);
+  const std::vector<Point> random = RandomPoints(map, lookups, engine);
+  const std::vector<Point> track = TrackPoints(map, lookups, engine);
+
+  auto flat = [&map](const Point& p, double* B) { map.GetFieldValue(p.x, p.y, p.z, B); };
+  auto vectors = [&nested](const Point& p, double* B) { nested.GetFieldValue(p.x, p.y, p.z, B); };
+
+  // Kernels the CPU supports, narrowest first
+  const ICESPICEFieldMap::Kernel best = ICESPICEFieldMap::GetKernel();
+  std::vector<ICESPICEFieldMap::Kernel> kernels;
+  for (auto kernel : { ICESPICEFieldMap::Kernel::Scalar, ICESPICEFieldMap::Kernel::AVX2,
+                       ICESPICEFieldMap::Kernel::AVX512 }) {
+    if (static_cast<int>(kernel) <= static_cast<int>(best)) kernels.push_back(kernel);
+  }
+
+  std::cout << "\n" << lookups << " lookups per pattern on a "
+            << map.GetNx() << "x" << map.GetNy() << "x" << map.GetNz() << " grid of "
+            << ICESPICEFieldMap::StorageName(map.GetStorage()) << " values, default kernel "
+            << ICESPICEFieldMap::KernelName(best) << "\n" << std::endl;
+  Header();
+
+  std::map<std::string, double> hitRate;
+  for (const auto& pattern : { std::make_pair("random", &random), std::make_pair("track", &track) }) {
+    const std::string prefix = std::string("BM_Lookup/") + pattern.first + "/";
+    double checksum;
+    double ns = Time(*pattern.second, vectors, checksum);
+    Report(prefix + "nested_vector", lookups, ns, checksum);
+    for (auto kernel : kernels) {
+      ICESPICEFieldMap::SetKernel(kernel);
+      const std::string name = prefix + ICESPICEFieldMap::KernelName(kernel);
+      ns = Time(*pattern.second, flat, checksum);
+      Report(name, lookups, ns, checksum);
+      ns = TimeBatch(*pattern.second, map, 4, checksum);
+      Report(name + "/batch:4", lookups, ns, checksum);
+      ns = TimeBatch(*pattern.second, map, 16, checksum);
+      Report(name + "/batch:16", lookups, ns, checksum);
+      ICESPICEFieldMap::CellCache cache;
+      auto cached = [&map, &cache](const Point& p, double* B) {
+        map.GetFieldValue(p.x, p.y, p.z, B, cache);
+      };
+      ns = Time(*pattern.second, cached, checksum);
+      Report(name + "/cell_cache", lookups, ns, checksum);
+      hitRate[pattern.first] = 100. * cache.hits / std::max<G4long>(1, cache.hits + cache.misses);
+    }
+    ICESPICEFieldMap::SetKernel(best);
+  }
+
+  std::cout << "\nCell cache hits: " << std::fixed << std::setprecision(1)
+            << hitRate["random"] << "% on random points, "
+            << hitRate["track"] << "% along tracks" << std::endl;
+
+  return 0;
+}
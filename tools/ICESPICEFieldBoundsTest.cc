@@ -0,0 +1,188 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldBoundsTest.cc      *
+//    *                                   *
+//    *************************************
+//
+// Comments: Checks the field map lookup at every node on the faces of a
+// Cartesian grid, including the upper faces and corners where the cell
+// index used to run past the table, and just outside them. A small table
+// is written whose field vanishes towards the x faces, so that part of
+// every face lies outside the active box, and it is checked as read and
+// in each of the other value types. Maps given on the command line are
+// checked as well. Built with -fsanitize=address it also catches any
+// read outside the table. Run by ctest; the exit status is 1 if a lookup
+// is wrong.
+//
+//   ICESPICEFieldBoundsTest [field map ...]
+//
+
+#include "ICESPICEFieldMap.hh"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+// Lookups on the faces of the grid must reproduce the node values, with
+// either interpolation, and lookups just beyond them must return zero.
+// Face nodes outside the active box are not looked up in the table, so
+// they must return zero as well, whatever field below kZeroField they hold.
+bool CheckBounds(const ICESPICEFieldMap& map)
+{
+  if (map.GetGeometry() != ICESPICEFieldMap::Geometry::Cartesian) {
+    std::cout << "Bounds check skipped for sector maps" << std::endl;
+    return true;
+  }
+  const int n[3] = { map.GetNx(), map.GetNy(), map.GetNz() };
+  const double lower[3] = { map.GetMinX(), map.GetMinY(), map.GetMinZ() };
+  const double upper[3] = { map.GetMaxX(), map.GetMaxY(), map.GetMaxZ() };
+  auto coordinate = [&](int axis, int i) {
+    if (i == n[axis] - 1) return upper[axis];
+    return lower[axis] + (upper[axis] - lower[axis]) * i / (n[axis] - 1);
+  };
+
+  double largest = 0.;
+  for (int ix = 0; ix < n[0]; ix += std::max(1, n[0] / 16))
+    for (int iy = 0; iy < n[1]; iy += std::max(1, n[1] / 16))
+      for (int iz = 0; iz < n[2]; iz += std::max(1, n[2] / 16)) {
+        double B[3];
+        map.GetNodeValue(ix, iy, iz, B);
+        for (double b : B) largest = std::max(largest, std::fabs(b));
+      }
+  const double tolerance = 1.e-9 * largest + DBL_MIN;
+
+  double activeLower[3], activeUpper[3];
+  const bool active = map.GetActiveBox(activeLower, activeUpper);
+  auto inActiveBox = [&](const double* p) {
+    if (!active) return false;
+    for (int k = 0; k < 3; ++k) {
+      if (p[k] < activeLower[k] || p[k] > activeUpper[k]) return false;
+    }
+    return true;
+  };
+
+  std::size_t checked = 0, failed = 0;
+  for (int face = 0; face < 6; ++face) {
+    const int axis = face / 2;
+    const int fixed = face % 2 ? n[axis] - 1 : 0;
+    const int a = (axis + 1) % 3, b = (axis + 2) % 3;
+    for (int i = 0; i < n[a]; ++i) {
+      for (int j = 0; j < n[b]; ++j) {
+        int index[3];
+        index[axis] = fixed;
+        index[a] = i;
+        index[b] = j;
+        double p[3], expected[3];
+        for (int k = 0; k < 3; ++k) p[k] = coordinate(k, index[k]);
+        map.GetNodeValue(index[0], index[1], index[2], expected);
+        if (!inActiveBox(p)) expected[0] = expected[1] = expected[2] = 0.;
+        for (auto interpolation : { ICESPICEFieldMap::Interpolation::Linear,
+                                    ICESPICEFieldMap::Interpolation::Cubic }) {
+          double B[3];
+          map.GetFieldValue(p[0], p[1], p[2], B, interpolation);
+          ++checked;
+          for (int k = 0; k < 3; ++k) {
+            if (!(std::fabs(B[k] - expected[k]) <= tolerance)) { ++failed; break; }
+          }
+        }
+        // A hair outside the face the point lies on
+        p[axis] = face % 2 ? std::nextafter(upper[axis], DBL_MAX)
+                           : std::nextafter(lower[axis], -DBL_MAX);
+        double B[3];
+        map.GetFieldValue(p[0], p[1], p[2], B);
+        ++checked;
+        if (B[0] != 0. || B[1] != 0. || B[2] != 0.) ++failed;
+      }
+    }
+  }
+  std::cout << "Bounds check: " << checked << " lookups on and beyond the faces, "
+            << failed << " wrong" << std::endl;
+  return failed == 0;
+}
+
+// Writes a table of nx x ny x nz nodes, in m and T, whose field falls
+// far below kZeroField at the x faces and stays above it at the others
+bool WriteTable(const char* filename, int nx, int ny, int nz)
+{
+  std::ofstream file(filename);
+  file << "\n " << nx << " " << ny << " " << nz << "\n"
+       << " 1 X\n 2 Y\n 3 Z\n 4 BX\n 5 BY\n 6 BZ\n 0 [METRE]\n";
+  for (int ix = 0; ix < nx; ++ix) {
+    const double x = -0.04 + 0.08 * ix / (nx - 1);
+    for (int iy = 0; iy < ny; ++iy) {
+      const double y = -0.03 + 0.06 * iy / (ny - 1);
+      for (int iz = 0; iz < nz; ++iz) {
+        const double z = -0.025 + 0.05 * iz / (nz - 1);
+        const double f = 0.1 * std::exp(-(x / 0.006) * (x / 0.006));
+        file << x << " " << y << " " << z << " "
+             << f * (1. + 10. * y) << " " << f * (2. + 10. * z) << " " << 3. * f << "\n";
+      }
+    }
+  }
+  return static_cast<bool>(file);
+}
+
+}
+
+int main(int argc,char** argv) {
+
+  bool passed = true;
+
+  const char* table = "ICESPICEFieldBoundsTest.TABLE";
+  if (!WriteTable(table, 17, 13, 11)) {
+    std::cerr << "Could not write " << table << std::endl;
+    return 1;
+  }
+  {
+    ICESPICEFieldMap map(table);
+    passed = CheckBounds(map) && passed;
+    for (auto storage : { ICESPICEFieldMap::Storage::Float, ICESPICEFieldMap::Storage::Half,
+                          ICESPICEFieldMap::Storage::BFloat16 }) {
+      std::cout << ICESPICEFieldMap::StorageName(storage) << " values: ";
+      ICESPICEFieldMap copy(map, storage);
+      passed = CheckBounds(copy) && passed;
+    }
+  }
+  std::remove(table);
+
+  for (int i = 1; i < argc; ++i) {
+    ICESPICEFieldMap map(argv[i]);
+    passed = CheckBounds(map) && passed;
+  }
+
+  std::cout << (passed ? "Passed" : "FAILED") << std::endl;
+  return passed ? 0 : 1;
+}
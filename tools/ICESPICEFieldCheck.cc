@@ -0,0 +1,414 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldCheck.cc           *
+//    *                                   *
+//    *************************************
+//
+// Comments: Checks a field map before a production campaign, and
+// optionally compares it with another one. The checksum of a binary map
+// is verified when it is read. Over every node of the grid:
+//
+//  - non-finite values, and nodes of exactly zero field next to nodes
+//    with field, which is what the NaN holes of a COMSOL export become
+//    after comsol_to_geant_table.py (fillna(0));
+//  - the distribution of |B|: minimum, percentiles and maximum;
+//  - div B and curl B from central differences at the inner nodes,
+//    relative to the size of the field gradient there. div B must vanish
+//    everywhere; curl B only inside and on the magnets;
+//  - the violation of the N-fold symmetry of the magnets: the field at
+//    each node rotated by 360/N degrees against the interpolated field at
+//    the rotated node;
+//  - with a second map, the difference from its interpolated field at
+//    each node of the first.
+//
+// The nodes are split into slabs of x shared among the threads.
+//
+//   ICESPICEFieldCheck [--threads N] [--symmetry N] <field map> [other map]
+//
+// The exit status is 2 if the map holds non-finite values.
+//
+
+#include "ICESPICEFieldMap.hh"
+#include "G4SystemOfUnits.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Largest and RMS of a residual, with the node of the largest
+struct Residual
+{
+  double max = 0.;
+  double sum2 = 0.;
+  double scale2 = 0.;   // sum of the squared scales the residual is compared with
+  std::size_t n = 0;
+  int where[3] = {-1, -1, -1};
+
+  void Add(double value, double scale, int ix, int iy, int iz)
+  {
+    sum2 += value * value;
+    scale2 += scale * scale;
+    ++n;
+    if (value > max) {
+      max = value;
+      where[0] = ix;
+      where[1] = iy;
+      where[2] = iz;
+    }
+  }
+  void Merge(const Residual& other)
+  {
+    sum2 += other.sum2;
+    scale2 += other.scale2;
+    n += other.n;
+    if (other.max > max) {
+      max = other.max;
+      std::copy(other.where, other.where + 3, where);
+    }
+  }
+  double Rms() const { return n ? std::sqrt(sum2 / n) : 0.; }
+  double Relative() const { return scale2 > 0. ? std::sqrt(sum2 / scale2) : 0.; }
+};
+
+// |B| histogram with 100 logarithmic bins per decade from 1 nT to 100 T,
+// so percentiles are within 2.3%. Bin 0 holds everything below 1 nT.
+const double kHistogramLow = 1.e-9 * tesla;
+const int    kBinsPerDecade = 100;
+const int    kBins = 11 * kBinsPerDecade + 1;
+
+int HistogramBin(double B)
+{
+  if (!(B >= kHistogramLow)) return 0;
+  const int bin = 1 + static_cast<int>(kBinsPerDecade * std::log10(B / kHistogramLow));
+  return std::min(bin, kBins - 1);
+}
+
+double HistogramEdge(int bin)
+{
+  return kHistogramLow * std::pow(10., static_cast<double>(bin) / kBinsPerDecade);
+}
+
+struct Summary
+{
+  std::size_t nodes = 0;
+  std::size_t nonFinite = 0;
+  std::size_t zero = 0;          // nodes of exactly zero field
+  std::size_t zeroNextToField = 0;
+  int firstNonFinite[3] = {-1, -1, -1};
+  double minB = HUGE_VAL;
+  double maxB = 0.;
+  std::vector<std::size_t> histogram = std::vector<std::size_t>(kBins, 0);
+  Residual divergence, curl, symmetry, difference;
+  std::size_t outsideOther = 0;  // nodes outside the other map
+
+  void Merge(const Summary& other)
+  {
+    nodes += other.nodes;
+    if (nonFinite == 0 && other.nonFinite > 0)
+      std::copy(other.firstNonFinite, other.firstNonFinite + 3, firstNonFinite);
+    nonFinite += other.nonFinite;
+    zero += other.zero;
+    zeroNextToField += other.zeroNextToField;
+    minB = std::min(minB, other.minB);
+    maxB = std::max(maxB, other.maxB);
+    for (int i = 0; i < kBins; ++i) histogram[i] += other.histogram[i];
+    divergence.Merge(other.divergence);
+    curl.Merge(other.curl);
+    symmetry.Merge(other.symmetry);
+    difference.Merge(other.difference);
+    outsideOther += other.outsideOther;
+  }
+
+  // Upper edge of the bin holding the given fraction of the nodes
+  double Percentile(double fraction) const
+  {
+    const std::size_t finite = nodes - nonFinite;
+    std::size_t count = 0;
+    for (int i = 0; i < kBins; ++i) {
+      count += histogram[i];
+      if (count >= fraction * finite) return std::min(HistogramEdge(i), maxB);
+    }
+    return maxB;
+  }
+};
+
+class Checker
+{
+public:
+  Checker(const ICESPICEFieldMap& map, const ICESPICEFieldMap* other, int symmetry)
+    : fMap(map), fOther(other), fSymmetry(symmetry),
+      nx(map.GetNx()), ny(map.GetNy()), nz(map.GetNz()),
+      fCartesian(map.GetGeometry() == ICESPICEFieldMap::Geometry::Cartesian)
+  {
+    fLower[0] = map.GetMinX();  fUpper[0] = map.GetMaxX();
+    fLower[1] = map.GetMinY();  fUpper[1] = map.GetMaxY();
+    fLower[2] = map.GetMinZ();  fUpper[2] = map.GetMaxZ();
+    const int n[3] = {nx, ny, nz};
+    for (int axis = 0; axis < 3; ++axis)
+      fSpacing[axis] = (fUpper[axis] - fLower[axis]) / (n[axis] - 1);
+    // Disc around the z axis whose rotations stay inside the grid
+    fDisc = std::min(std::min(fUpper[0], -fLower[0]), std::min(fUpper[1], -fLower[1]));
+  }
+
+  bool IsCartesian() const { return fCartesian; }
+
+  // Checks the nodes of the slabs first to last - 1 along x
+  void Run(int first, int last, Summary& summary) const
+  {
+    const double angle = fSymmetry > 0 ? twopi / fSymmetry : 0.;
+    const double c = std::cos(angle), s = std::sin(angle);
+    for (int ix = first; ix < last; ++ix) {
+      for (int iy = 0; iy < ny; ++iy) {
+        for (int iz = 0; iz < nz; ++iz) {
+          double B[3];
+          fMap.GetNodeValue(ix, iy, iz, B);
+          ++summary.nodes;
+          if (!std::isfinite(B[0]) || !std::isfinite(B[1]) || !std::isfinite(B[2])) {
+            if (summary.nonFinite++ == 0) {
+              summary.firstNonFinite[0] = ix;
+              summary.firstNonFinite[1] = iy;
+              summary.firstNonFinite[2] = iz;
+            }
+            continue;
+          }
+          const double magnitude = std::sqrt(B[0]*B[0] + B[1]*B[1] + B[2]*B[2]);
+          summary.minB = std::min(summary.minB, magnitude);
+          summary.maxB = std::max(summary.maxB, magnitude);
+          ++summary.histogram[HistogramBin(magnitude)];
+          if (magnitude == 0.) {
+            ++summary.zero;
+            if (NextToField(ix, iy, iz)) ++summary.zeroNextToField;
+          }
+
+          if (!fCartesian) continue;
+          const double x = Coordinate(0, ix), y = Coordinate(1, iy), z = Coordinate(2, iz);
+
+          if (ix > 0 && ix < nx - 1 && iy > 0 && iy < ny - 1 && iz > 0 && iz < nz - 1) {
+            // Jacobian dB_i/dx_j from central differences
+            double J[3][3];
+            const int index[3] = {ix, iy, iz};
+            for (int axis = 0; axis < 3; ++axis) {
+              int lo[3] = {ix, iy, iz}, hi[3] = {ix, iy, iz};
+              --lo[axis];
+              ++hi[axis];
+              double Blo[3], Bhi[3];
+              fMap.GetNodeValue(lo[0], lo[1], lo[2], Blo);
+              fMap.GetNodeValue(hi[0], hi[1], hi[2], Bhi);
+              for (int component = 0; component < 3; ++component)
+                J[component][axis] = (Bhi[component] - Blo[component]) / (2. * fSpacing[axis]);
+            }
+            double gradient2 = 0.;
+            for (auto& row : J) for (double d : row) gradient2 += d * d;
+            if (gradient2 > 0.) {
+              const double gradient = std::sqrt(gradient2);
+              const double divergence = J[0][0] + J[1][1] + J[2][2];
+              const double curl[3] = { J[2][1] - J[1][2], J[0][2] - J[2][0], J[1][0] - J[0][1] };
+              summary.divergence.Add(std::fabs(divergence), gradient, index[0], index[1], index[2]);
+              summary.curl.Add(std::sqrt(curl[0]*curl[0] + curl[1]*curl[1] + curl[2]*curl[2]),
+                               gradient, index[0], index[1], index[2]);
+            }
+          }
+
+          if (fSymmetry > 1 && x*x + y*y <= fDisc * fDisc) {
+            // B at the rotated node must be the rotated B
+            double Brotated[3];
+            fMap.GetFieldValue(c*x - s*y, s*x + c*y, z, Brotated);
+            const double expected[3] = { c*B[0] - s*B[1], s*B[0] + c*B[1], B[2] };
+            summary.symmetry.Add(Distance(Brotated, expected), magnitude, ix, iy, iz);
+          }
+
+          if (fOther) {
+            if (x < fOther->GetMinX() || x > fOther->GetMaxX() ||
+                y < fOther->GetMinY() || y > fOther->GetMaxY() ||
+                z < fOther->GetMinZ() || z > fOther->GetMaxZ()) {
+              ++summary.outsideOther;
+            } else {
+              double Bother[3];
+              fOther->GetFieldValue(x, y, z, Bother);
+              summary.difference.Add(Distance(Bother, B), magnitude, ix, iy, iz);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  double Coordinate(int axis, int i) const
+  {
+    const int n[3] = {nx, ny, nz};
+    return i == n[axis] - 1 ? fUpper[axis] : fLower[axis] + fSpacing[axis] * i;
+  }
+
+private:
+  static double Distance(const double* a, const double* b)
+  {
+    const double d[3] = { a[0] - b[0], a[1] - b[1], a[2] - b[2] };
+    return std::sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+  }
+
+  // Whether one of the six neighbours of a node has a non-zero field
+  bool NextToField(int ix, int iy, int iz) const
+  {
+    const int step[6][3] = { {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1} };
+    for (const auto& d : step) {
+      const int jx = ix + d[0], jy = iy + d[1], jz = iz + d[2];
+      if (jx < 0 || jx >= nx || jy < 0 || jy >= ny || jz < 0 || jz >= nz) continue;
+      double B[3];
+      fMap.GetNodeValue(jx, jy, jz, B);
+      if (B[0] != 0. || B[1] != 0. || B[2] != 0.) return true;
+    }
+    return false;
+  }
+
+  const ICESPICEFieldMap& fMap;
+  const ICESPICEFieldMap* fOther;
+  int fSymmetry;
+  int nx, ny, nz;
+  bool fCartesian;
+  double fLower[3], fUpper[3], fSpacing[3];
+  double fDisc;
+};
+
+void PrintResidual(const char* name, const Residual& residual, const Checker& checker,
+                   double unit, const char* unitName)
+{
+  std::cout << std::left << std::setw(12) << name << std::right;
+  if (residual.n == 0) {
+    std::cout << "   not computed" << std::endl;
+    return;
+  }
+  std::cout << std::scientific << std::setprecision(3)
+            << "   max " << residual.max / unit << " " << unitName
+            << ", rms " << residual.Rms() / unit << " " << unitName
+            << ", relative rms " << residual.Relative();
+  if (residual.max > 0.) {
+    std::cout << std::fixed << std::setprecision(2)
+              << "; largest at (" << checker.Coordinate(0, residual.where[0]) / mm << ", "
+              << checker.Coordinate(1, residual.where[1]) / mm << ", "
+              << checker.Coordinate(2, residual.where[2]) / mm << ") mm";
+  }
+  std::cout << std::endl;
+}
+
+}
+
+int main(int argc,char** argv) {
+
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  int symmetry = 5;
+  const char* mapFile = nullptr;
+  const char* otherFile = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = std::max(1, std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "--symmetry") == 0 && i + 1 < argc) symmetry = std::atoi(argv[++i]);
+    else if (!mapFile) mapFile = argv[i];
+    else if (!otherFile) otherFile = argv[i];
+  }
+  if (!mapFile) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--threads N] [--symmetry N] <field map> [other map]" << std::endl;
+    return 1;
+  }
+
+  ICESPICEFieldMap::SetVerifyChecksums(true);
+  ICESPICEFieldMap map(mapFile);
+  std::unique_ptr<ICESPICEFieldMap> other;
+  if (otherFile) other.reset(new ICESPICEFieldMap(otherFile));
+
+  Checker checker(map, other.get(), symmetry);
+  if (!checker.IsCartesian()) {
+    std::cout << "\nSector map: only the values and |B| are checked" << std::endl;
+  }
+
+  // Slabs are handed out one at a time, so threads that reach the slabs
+  // without field do not wait for the others
+  const auto start = std::chrono::steady_clock::now();
+  const int nx = map.GetNx();
+  threads = std::min<unsigned>(threads, nx);
+  std::vector<Summary> summaries(threads);
+  std::atomic<int> nextSlab(0);
+  auto work = [&](Summary& summary) {
+    for (int ix; (ix = nextSlab++) < nx; ) checker.Run(ix, ix + 1, summary);
+  };
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; ++i) workers.emplace_back(work, std::ref(summaries[i]));
+  work(summaries[0]);
+  for (std::thread& worker : workers) worker.join();
+  Summary summary;
+  for (const Summary& s : summaries) summary.Merge(s);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "\n" << summary.nodes << " nodes (" << map.GetNx() << "x" << map.GetNy()
+            << "x" << map.GetNz() << ", " << map.GetValueBytes() / (1024*1024) << " MB) checked in "
+            << std::fixed << std::setprecision(2) << seconds << " s with " << threads
+            << " threads, " << map.GetValueBytes() / (1024.*1024.) / seconds << " MB/s\n" << std::endl;
+
+  std::cout << "Non-finite  " << std::setw(12) << summary.nonFinite << " nodes";
+  if (summary.nonFinite > 0) {
+    std::cout << ", the first at node (" << summary.firstNonFinite[0] << ", "
+              << summary.firstNonFinite[1] << ", " << summary.firstNonFinite[2] << ")";
+  }
+  std::cout << "\nZero field  " << std::setw(12) << summary.zero << " nodes, "
+            << summary.zeroNextToField << " of them next to nodes with field" << std::endl;
+
+  std::cout << std::scientific << std::setprecision(3)
+            << "|B| (T)     min " << summary.minB / tesla;
+  for (double percentile : { 0.01, 0.5, 0.9, 0.99, 0.999 }) {
+    std::cout << ", " << std::fixed << std::setprecision(1) << 100. * percentile << "% "
+              << std::scientific << std::setprecision(3) << summary.Percentile(percentile) / tesla;
+  }
+  std::cout << ", max " << summary.maxB / tesla << "\n" << std::endl;
+
+  PrintResidual("div B", summary.divergence, checker, tesla / m, "T/m");
+  PrintResidual("curl B", summary.curl, checker, tesla / m, "T/m");
+  if (symmetry > 1) {
+    const std::string name = std::to_string(symmetry) + "-fold";
+    PrintResidual(name.c_str(), summary.symmetry, checker, gauss, "G");
+  }
+  if (other) {
+    PrintResidual("difference", summary.difference, checker, gauss, "G");
+    if (summary.outsideOther > 0)
+      std::cout << "            " << summary.outsideOther << " nodes outside " << otherFile
+                << std::endl;
+  }
+
+  return summary.nonFinite > 0 ? 2 : 0;
+}
@@ -0,0 +1,168 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldConvert.cc         *
+//    *                                   *
+//    *************************************
+//
+// Comments: Converts a field table (ICESPICE3D.TABLE) or a COMSOL export
+// into the binary field map read by ICESPICEFieldMap.
+//
+//   ICESPICEFieldConvert [--float|--half|--bfloat16] [--sector N] [--pitch mm]
+//                        ICESPICE3D.TABLE ICESPICE3D.bin
+//   ICESPICEFieldConvert --adaptive gauss [--block cells]
+//                        ICESPICE3D.TABLE ICESPICE3D.amap
+//
+// A COMSOL export (ICESPICEComsolExport) is recognised from its '%'
+// comment lines and streamed into the binary map. With --sector,
+// --adaptive, --half or --bfloat16 it first goes to a temporary map of
+// doubles, which is then converted like a table.
+//
+// --sector N keeps only one 360/N degree sector on an (r, phi, z) grid,
+// using the N-fold symmetry of the magnets. --pitch sets its node spacing;
+// by default it is the x spacing of the input.
+//
+// --adaptive writes an ICESPICEAdaptiveFieldMap instead, which holds each
+// block of cells (8^3 by default, --block) at the coarsest node spacing
+// that stays within the given tolerance of the input.
+//
+// Every map written is read back, checking its header and checksum.
+//
+
+#include "ICESPICEFieldMap.hh"
+#include "ICESPICEAdaptiveFieldMap.hh"
+#include "ICESPICEComsolExport.hh"
+#include "G4SystemOfUnits.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+int main(int argc,char** argv) {
+
+  ICESPICEFieldMap::Storage storage = ICESPICEFieldMap::Storage::Double;
+  int symmetry = 0;
+  double pitch = 0.;
+  double tolerance = -1.;
+  int blockCells = 8;
+  const char* input = nullptr;
+  const char* output = nullptr;
+
+  // Anything not understood stops the tool before it reads or writes a
+  // file: an unknown option, an option without its value, a third path.
+  const char* wrong = nullptr;
+  auto number = [&](int& i) {
+    char* end = nullptr;
+    const double value = i + 1 < argc ? std::strtod(argv[i + 1], &end) : 0.;
+    if (end == nullptr || end == argv[i + 1] || *end != '\0') {
+      wrong = argv[i];
+      return 0.;
+    }
+    ++i;
+    return value;
+  };
+
+  for (int i = 1; i < argc && !wrong; ++i) {
+    if (std::strcmp(argv[i], "--float") == 0) storage = ICESPICEFieldMap::Storage::Float;
+    else if (std::strcmp(argv[i], "--half") == 0) storage = ICESPICEFieldMap::Storage::Half;
+    else if (std::strcmp(argv[i], "--bfloat16") == 0) storage = ICESPICEFieldMap::Storage::BFloat16;
+    else if (std::strcmp(argv[i], "--sector") == 0) symmetry = static_cast<int>(number(i));
+    else if (std::strcmp(argv[i], "--pitch") == 0) pitch = number(i) * mm;
+    else if (std::strcmp(argv[i], "--adaptive") == 0) tolerance = number(i) * gauss;
+    else if (std::strcmp(argv[i], "--block") == 0) blockCells = static_cast<int>(number(i));
+    else if (std::strncmp(argv[i], "--", 2) == 0) wrong = argv[i];
+    else if (!input) input = argv[i];
+    else if (!output) output = argv[i];
+    else wrong = argv[i];
+  }
+
+  if (wrong || !input || !output) {
+    if (wrong) std::cerr << "Unknown argument or missing value: " << wrong << "\n";
+    std::cerr << "Usage: " << argv[0]
+              << " [--float|--half|--bfloat16] [--sector N] [--pitch mm]"
+              << " <ICESPICE3D.TABLE> <output.bin>\n       " << argv[0]
+              << " --adaptive gauss [--block cells] <ICESPICE3D.TABLE> <output.amap>"
+              << std::endl;
+    return 1;
+  }
+
+  ICESPICEFieldMap::SetVerifyChecksums(true);
+
+  G4String table = input;
+  if (ICESPICEComsolExport::IsExport(input)) {
+    if (symmetry == 0 && tolerance < 0. && (storage == ICESPICEFieldMap::Storage::Double
+                                            || storage == ICESPICEFieldMap::Storage::Float)) {
+      ICESPICEComsolExport::Convert(input, output, storage);
+      ICESPICEFieldMap check(output);
+      std::cout << "Wrote " << output << " ("
+                << ICESPICEFieldMap::StorageName(storage) << " values)" << std::endl;
+      return 0;
+    }
+    table = G4String(output) + ".comsol";
+    ICESPICEComsolExport::Convert(input, table.c_str());
+  }
+
+  ICESPICEFieldMap fieldMap(table.c_str());
+  // The temporary map stays mapped until the end
+  if (table != input) std::remove(table.c_str());
+  if (tolerance >= 0.) {
+    ICESPICEAdaptiveFieldMap adaptive(fieldMap, tolerance, blockCells);
+    adaptive.WriteBinary(output);
+
+    // Read the result back and compare it with the input at every node
+    ICESPICEAdaptiveFieldMap check(output);
+    const std::size_t dense = fieldMap.GetValueBytes() * sizeof(float)
+      / ICESPICEFieldMap::ValueSize(fieldMap.GetStorage());
+    std::cout << "Wrote " << output << ": " << check.GetValueBytes() / 1024 << " kB, "
+              << 100. * check.GetValueBytes() / dense << "% of the float grid"
+              << ", largest deviation " << check.GetMaxDeviation(fieldMap) / gauss
+              << " G" << std::endl;
+    return 0;
+  }
+
+  if (symmetry > 0) {
+    if (pitch <= 0.) {
+      pitch = (fieldMap.GetMaxX() - fieldMap.GetMinX()) / (fieldMap.GetNx() - 1);
+    }
+    ICESPICEFieldMap sector(fieldMap, symmetry, pitch);
+    sector.WriteBinary(output, storage);
+  } else {
+    fieldMap.WriteBinary(output, storage);
+  }
+
+  // Read the result back, which checks the header and the checksum
+  ICESPICEFieldMap check(output);
+
+  std::cout << "Wrote " << output << " ("
+            << ICESPICEFieldMap::StorageName(storage) << " values)" << std::endl;
+
+  return 0;
+}
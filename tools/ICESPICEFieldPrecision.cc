@@ -0,0 +1,145 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldPrecision.cc       *
+//    *                                   *
+//    *************************************
+//
+// Comments: Accuracy report for reduced-precision field storage. Every
+// narrower storage type is compared with the double grid, node by node and
+// on random interpolation points. The effect on the Esil spectrum is then
+// checked by running ICESPICE with each binary map and comparing the
+// histograms with compare_esil_histograms() in python_scripts/analysis.py.
+//
+//   ICESPICEFieldPrecision <field map> [points]
+//
+
+#include "ICESPICEFieldMap.hh"
+#include "G4SystemOfUnits.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+namespace {
+
+struct Deviation
+{
+  double max = 0.;
+  double sum2 = 0.;
+  std::size_t n = 0;
+
+  void Add(const double* reference, const double* value)
+  {
+    for (int c = 0; c < 3; ++c) {
+      const double d = value[c] - reference[c];
+      max = std::max(max, std::fabs(d));
+      sum2 += d * d;
+      ++n;
+    }
+  }
+  double Rms() const { return n ? std::sqrt(sum2 / n) : 0.; }
+};
+
+}
+
+int main(int argc,char** argv) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <field map> [points]" << std::endl;
+    return 1;
+  }
+  const std::size_t points = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+
+  ICESPICEFieldMap source(argv[1]);
+  // The reference is always held in double, whatever the file holds
+  ICESPICEFieldMap reference(source, ICESPICEFieldMap::Storage::Double);
+
+  double largest = 0.;
+  for (int ix = 0; ix < reference.GetNx(); ++ix)
+    for (int iy = 0; iy < reference.GetNy(); ++iy)
+      for (int iz = 0; iz < reference.GetNz(); ++iz) {
+        double B[3];
+        reference.GetNodeValue(ix, iy, iz, B);
+        largest = std::max(largest, std::sqrt(B[0]*B[0] + B[1]*B[1] + B[2]*B[2]));
+      }
+
+  std::cout << "\nLargest |B| on the grid: " << largest / gauss << " G"
+            << "\nDeviations from the double grid, in gauss and relative to the largest |B|\n"
+            << std::endl;
+  std::cout << std::left << std::setw(10) << "storage" << std::right
+            << std::setw(10) << "MB"
+            << std::setw(14) << "node max" << std::setw(14) << "node rms"
+            << std::setw(14) << "interp max" << std::setw(14) << "interp rms"
+            << std::setw(12) << "rel max" << std::endl;
+
+  for (auto storage : { ICESPICEFieldMap::Storage::Double, ICESPICEFieldMap::Storage::Float,
+                        ICESPICEFieldMap::Storage::Half, ICESPICEFieldMap::Storage::BFloat16 }) {
+    ICESPICEFieldMap reduced(reference, storage);
+
+    Deviation nodes;
+    for (int ix = 0; ix < reference.GetNx(); ++ix)
+      for (int iy = 0; iy < reference.GetNy(); ++iy)
+        for (int iz = 0; iz < reference.GetNz(); ++iz) {
+          double B[3], Bref[3];
+          reference.GetNodeValue(ix, iy, iz, Bref);
+          reduced.GetNodeValue(ix, iy, iz, B);
+          nodes.Add(Bref, B);
+        }
+
+    // Same seed for every storage type, so all see the same points
+    std::mt19937_64 engine(2024);
+    std::uniform_real_distribution<double> ux(reference.GetMinX(), reference.GetMaxX());
+    std::uniform_real_distribution<double> uy(reference.GetMinY(), reference.GetMaxY());
+    std::uniform_real_distribution<double> uz(reference.GetMinZ(), reference.GetMaxZ());
+    Deviation interpolated;
+    for (std::size_t i = 0; i < points; ++i) {
+      const double x = ux(engine), y = uy(engine), z = uz(engine);
+      double B[3], Bref[3];
+      reference.GetFieldValue(x, y, z, Bref);
+      reduced.GetFieldValue(x, y, z, B);
+      interpolated.Add(Bref, B);
+    }
+
+    std::cout << std::left << std::setw(10) << ICESPICEFieldMap::StorageName(storage)
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << reduced.GetValueBytes() / (1024. * 1024.)
+              << std::scientific << std::setprecision(3)
+              << std::setw(14) << nodes.max / gauss << std::setw(14) << nodes.Rms() / gauss
+              << std::setw(14) << interpolated.max / gauss << std::setw(14) << interpolated.Rms() / gauss
+              << std::setw(12) << std::setprecision(2) << (largest > 0. ? nodes.max / largest : 0.)
+              << std::endl;
+  }
+
+  return 0;
+}
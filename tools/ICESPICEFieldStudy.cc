@@ -0,0 +1,264 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEFieldStudy.cc           *
+//    *                                   *
+//    *************************************
+//
+// Comments: Accuracy against memory for coarser grids. The map is
+// subsampled to every 2nd, 4th, ... node and each coarse grid is
+// interpolated linearly and with cubic splines. Both are compared with
+// trilinear interpolation on the full grid, first as field values at
+// random points, then by focusing: electrons from a point source on the
+// axis at the top of the grid are tracked through the field, and their
+// crossing points on the bottom face are compared with those found with
+// the full grid.
+//
+//   ICESPICEFieldStudy <field map> [stride ...]      (default: 2 4)
+//
+
+#include "ICESPICEFieldMap.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4PhysicalConstants.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+typedef ICESPICEFieldMap::Interpolation Interpolation;
+
+struct Electron { double position[3], direction[3], momentum; };
+
+// Crossing point on the exit plane; lost electrons leave through the
+// sides or loop for longer than the maximum path
+struct Landing { bool landed; double x, y; };
+
+// Region common to two maps
+struct Box { double lower[3], upper[3]; };
+
+Box Overlap(const ICESPICEFieldMap& a, const ICESPICEFieldMap& b)
+{
+  Box box = { { std::max(a.GetMinX(), b.GetMinX()), std::max(a.GetMinY(), b.GetMinY()),
+                std::max(a.GetMinZ(), b.GetMinZ()) },
+              { std::min(a.GetMaxX(), b.GetMaxX()), std::min(a.GetMaxY(), b.GetMaxY()),
+                std::min(a.GetMaxZ(), b.GetMaxZ()) } };
+  return box;
+}
+
+// Electrons of 100 keV to 1.5 MeV, emitted downwards from the axis at the
+// top of box within 40 degrees of the axis
+std::vector<Electron> Source(const Box& box, std::size_t n)
+{
+  std::mt19937_64 engine(2718);
+  std::uniform_real_distribution<double> unit(0., 1.);
+  const double cosMax = std::cos(40.*deg);
+  std::vector<Electron> electrons(n);
+  for (auto& e : electrons) {
+    const double kinetic = (100. + 1400. * unit(engine)) * keV;
+    const double cosTheta = 1. - (1. - cosMax) * unit(engine);
+    const double sinTheta = std::sqrt(1. - cosTheta * cosTheta);
+    const double phi = twopi * unit(engine);
+    e.position[0] = 0.;
+    e.position[1] = 0.;
+    e.position[2] = box.upper[2] - 1.e-6*mm;
+    e.direction[0] = sinTheta * std::cos(phi);
+    e.direction[1] = sinTheta * std::sin(phi);
+    e.direction[2] = -cosTheta;
+    e.momentum = std::sqrt(kinetic * (kinetic + 2. * electron_mass_c2));
+  }
+  return electrons;
+}
+
+// Fourth order Runge-Kutta in path length: dr/ds = u, du/ds = k u x B,
+// with k = q c / p for charge q = -e
+Landing Track(const ICESPICEFieldMap& map, Interpolation interpolation,
+              const Electron& electron, const Box& box)
+{
+  const double h = 0.05*mm;
+  const double maxPath = 1.*m;
+  const double k = -eplus * c_light / electron.momentum;
+
+  auto derivative = [&](const double* y, double* dyds) {
+    double B[3];
+    map.GetFieldValue(y[0], y[1], y[2], B, interpolation);
+    dyds[0] = y[3];
+    dyds[1] = y[4];
+    dyds[2] = y[5];
+    dyds[3] = k * (y[4] * B[2] - y[5] * B[1]);
+    dyds[4] = k * (y[5] * B[0] - y[3] * B[2]);
+    dyds[5] = k * (y[3] * B[1] - y[4] * B[0]);
+  };
+
+  double y[6] = { electron.position[0], electron.position[1], electron.position[2],
+                  electron.direction[0], electron.direction[1], electron.direction[2] };
+  for (double s = 0.; s < maxPath; s += h) {
+    double k1[6], k2[6], k3[6], k4[6], t[6];
+    derivative(y, k1);
+    for (int i = 0; i < 6; ++i) t[i] = y[i] + 0.5 * h * k1[i];
+    derivative(t, k2);
+    for (int i = 0; i < 6; ++i) t[i] = y[i] + 0.5 * h * k2[i];
+    derivative(t, k3);
+    for (int i = 0; i < 6; ++i) t[i] = y[i] + h * k3[i];
+    derivative(t, k4);
+    double next[6];
+    for (int i = 0; i < 6; ++i) next[i] = y[i] + h / 6. * (k1[i] + 2.*k2[i] + 2.*k3[i] + k4[i]);
+
+    if (next[2] <= box.lower[2]) {
+      const double f = (y[2] - box.lower[2]) / (y[2] - next[2]);
+      return { true, y[0] + f * (next[0] - y[0]), y[1] + f * (next[1] - y[1]) };
+    }
+    if (next[0] <= box.lower[0] || next[0] >= box.upper[0] ||
+        next[1] <= box.lower[1] || next[1] >= box.upper[1] ||
+        next[2] >= box.upper[2]) break;
+    std::copy(next, next + 6, y);
+  }
+  return { false, 0., 0. };
+}
+
+std::vector<Landing> Focus(const ICESPICEFieldMap& map, Interpolation interpolation,
+                           const std::vector<Electron>& electrons, const Box& box)
+{
+  std::vector<Landing> landings;
+  landings.reserve(electrons.size());
+  for (const auto& e : electrons) landings.push_back(Track(map, interpolation, e, box));
+  return landings;
+}
+
+std::string Spacing(const ICESPICEFieldMap& map)
+{
+  std::ostringstream label;
+  label << std::fixed << std::setprecision(2)
+        << (map.GetMaxX() - map.GetMinX()) / (map.GetNx() - 1) / mm << " mm";
+  return label.str();
+}
+
+void Compare(const std::string& grid, const char* name,
+             const ICESPICEFieldMap& reference, const ICESPICEFieldMap& map,
+             Interpolation interpolation, const Box& box,
+             const std::vector<Electron>& electrons,
+             const std::vector<Landing>& expected)
+{
+  // Field values at random points of the common region
+  std::mt19937_64 engine(31415);
+  std::uniform_real_distribution<double> ux(box.lower[0], box.upper[0]);
+  std::uniform_real_distribution<double> uy(box.lower[1], box.upper[1]);
+  std::uniform_real_distribution<double> uz(box.lower[2], box.upper[2]);
+  double maxDev = 0., sum2 = 0.;
+  const int points = 200000;
+  for (int i = 0; i < points; ++i) {
+    const double x = ux(engine), y = uy(engine), z = uz(engine);
+    double B0[3], B[3];
+    reference.GetFieldValue(x, y, z, B0);
+    map.GetFieldValue(x, y, z, B, interpolation);
+    for (int c = 0; c < 3; ++c) {
+      const double d = B[c] - B0[c];
+      maxDev = std::max(maxDev, std::fabs(d));
+      sum2 += d * d;
+    }
+  }
+
+  // Focusing on the exit plane
+  const std::vector<Landing> landings = Focus(map, interpolation, electrons, box);
+  double maxShift = 0., sumShift = 0.;
+  int both = 0, changed = 0;
+  for (std::size_t i = 0; i < landings.size(); ++i) {
+    if (landings[i].landed != expected[i].landed) { ++changed; continue; }
+    if (!landings[i].landed) continue;
+    const double shift = std::hypot(landings[i].x - expected[i].x, landings[i].y - expected[i].y);
+    maxShift = std::max(maxShift, shift);
+    sumShift += shift;
+    ++both;
+  }
+
+  std::cout << std::left << std::setw(10) << grid << std::setw(8) << name
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(9) << map.GetValueBytes() / (1024.*1024.)
+            << std::scientific << std::setprecision(3)
+            << std::setw(13) << maxDev / gauss
+            << std::setw(13) << std::sqrt(sum2 / (3. * points)) / gauss
+            << std::setw(13) << (both ? sumShift / both / mm : 0.)
+            << std::setw(13) << maxShift / mm
+            << std::setw(9) << changed << std::defaultfloat << std::endl;
+}
+
+}
+
+int main(int argc,char** argv) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <field map> [stride ...]" << std::endl;
+    return 1;
+  }
+  std::vector<int> strides;
+  for (int i = 2; i < argc; ++i) strides.push_back(std::atoi(argv[i]));
+  if (strides.empty()) strides = { 2, 4 };
+
+  ICESPICEFieldMap map(argv[1]);
+  const std::size_t electrons = 500;
+
+  std::cout << "\nFull grid, trilinear, is the reference. Field deviations at random "
+            << "points;\nfocusing from " << electrons << " electrons tracked from the top "
+            << "of the grid to its bottom face.\n\n"
+            << std::left << std::setw(10) << "grid" << std::setw(8) << "interp"
+            << std::right << std::setw(9) << "MB"
+            << std::setw(13) << "max dB [G]" << std::setw(13) << "rms dB [G]"
+            << std::setw(13) << "mean dr [mm]" << std::setw(13) << "max dr [mm]"
+            << std::setw(9) << "changed" << std::endl;
+
+  {
+    const Box box = Overlap(map, map);
+    const auto source = Source(box, electrons);
+    const auto expected = Focus(map, Interpolation::Linear, source, box);
+    Compare(Spacing(map), "linear", map, map, Interpolation::Linear, box, source, expected);
+    Compare(Spacing(map), "cubic", map, map, Interpolation::Cubic, box, source, expected);
+  }
+
+  for (int stride : strides) {
+    if (stride < 2 || (map.GetNx() - 1) / stride < 3) continue;
+    const ICESPICEFieldMap coarse(map, stride);
+    // Compare on the region both grids cover, tracking the same electrons
+    // through the full grid again if the coarse one is smaller
+    const Box box = Overlap(map, coarse);
+    const auto source = Source(box, electrons);
+    const auto expected = Focus(map, Interpolation::Linear, source, box);
+    Compare(Spacing(coarse), "linear", map, coarse, Interpolation::Linear, box, source, expected);
+    Compare(Spacing(coarse), "cubic", map, coarse, Interpolation::Cubic, box, source, expected);
+  }
+
+  return 0;
+}
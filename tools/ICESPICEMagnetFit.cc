@@ -0,0 +1,243 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEMagnetFit.cc            *
+//    *                                   *
+//    *************************************
+//
+// Comments: Fits the analytic magnet model (ICESPICEMagnetField) to a
+// field map. The field is sampled on a lattice over the active box of the
+// map, two cells away from the surfaces of the magnets where the grid
+// cannot follow the jump of the field. The model is linear in the
+// remanence, which is solved for by least squares for each placement
+// radius tried; the radius is found by golden section search. The
+// parameters are written in the format read by ICESPICEMagnetField, with
+// the active box of the map as the region of the model.
+//
+//   ICESPICEMagnetFit <field map> [parameter file]   (default: ICESPICEMagnets.dat)
+//
+
+#include "ICESPICEFieldMap.hh"
+#include "ICESPICEMagnetField.hh"
+#include "G4SystemOfUnits.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Points where the field is compared, and the field of the map there
+struct Sample { double point[3], B[3]; };
+
+// Residual of the best remanence at the current radius
+struct Fit { double remanence[3], sum2, max; };
+
+std::vector<Sample> Samples(const ICESPICEFieldMap& map, const ICESPICEMagnetField& model,
+                            const double* lower, const double* upper, int n)
+{
+  // Two cells on either side of a surface are smoothed over by the grid
+  const double spacing = std::max((map.GetMaxX() - map.GetMinX()) / (map.GetNx() - 1),
+                                  (map.GetMaxZ() - map.GetMinZ()) / (map.GetNz() - 1));
+  const double margin = std::max(1.*mm, 2. * spacing);
+  std::vector<Sample> samples;
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      for (int k = 0; k < n; ++k) {
+        Sample s;
+        s.point[0] = lower[0] + (i + 0.5) * (upper[0] - lower[0]) / n;
+        s.point[1] = lower[1] + (j + 0.5) * (upper[1] - lower[1]) / n;
+        s.point[2] = lower[2] + (k + 0.5) * (upper[2] - lower[2]) / n;
+        if (model.IsNearMagnet(s.point, margin)) continue;
+        map.GetFieldValue(s.point[0], s.point[1], s.point[2], s.B);
+        samples.push_back(s);
+      }
+    }
+  }
+  return samples;
+}
+
+// Least squares remanence at the radius of model: the field of each
+// component of a unit remanence is one column of the design matrix.
+Fit Solve(ICESPICEMagnetField& model, const std::vector<Sample>& samples)
+{
+  double A[3][3] = {}, b[3] = {};
+  std::vector<double> columns(9 * samples.size());
+  for (int c = 0; c < 3; ++c) {
+    G4ThreeVector unit;
+    unit[c] = tesla;
+    model.SetRemanence(unit);
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+      const double point[4] = { samples[i].point[0], samples[i].point[1],
+                                samples[i].point[2], 0. };
+      model.GetFieldValue(point, &columns[9 * i + 3 * c]);
+    }
+  }
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    const double* F = &columns[9 * i];
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c)
+        for (int d = 0; d < 3; ++d) A[r][c] += F[3 * r + d] * F[3 * c + d];
+      for (int d = 0; d < 3; ++d) b[r] += F[3 * r + d] * samples[i].B[d];
+    }
+  }
+
+  // Cramer's rule on the 3x3 normal equations
+  auto det = [](const double m[3][3]) {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+         - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+         + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  };
+  Fit fit = {};
+  const double D = det(A);
+  for (int c = 0; c < 3; ++c) {
+    double M[3][3];
+    for (int r = 0; r < 3; ++r)
+      for (int k = 0; k < 3; ++k) M[r][k] = k == c ? b[r] : A[r][k];
+    fit.remanence[c] = D != 0. ? det(M) / D : 0.;
+  }
+
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    const double* F = &columns[9 * i];
+    for (int d = 0; d < 3; ++d) {
+      double model = 0.;
+      for (int c = 0; c < 3; ++c) model += fit.remanence[c] * F[3 * c + d];
+      const double r = model - samples[i].B[d];
+      fit.sum2 += r * r;
+      fit.max = std::max(fit.max, std::fabs(r));
+    }
+  }
+  return fit;
+}
+
+double NanosecondsPerCall(const std::vector<Sample>& samples,
+                          const std::function<void(const double*, double*)>& field)
+{
+  double B[3], sum = 0.;
+  const auto start = std::chrono::steady_clock::now();
+  for (const Sample& s : samples) {
+    field(s.point, B);
+    sum += B[0];
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  if (sum == 12345.) std::cout << " ";  // keep the loop
+  return elapsed.count() / samples.size();
+}
+
+}
+
+int main(int argc,char** argv) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <field map> [parameter file]" << std::endl;
+    return 1;
+  }
+  const char* output = argc > 2 ? argv[2] : "ICESPICEMagnets.dat";
+
+  ICESPICEFieldMap map(argv[1]);
+  double lower[3], upper[3];
+  if (!map.GetActiveBox(lower, upper)) {
+    std::cerr << "The field is zero everywhere" << std::endl;
+    return 1;
+  }
+
+  // No parameter file: start from the nominal magnets
+  ICESPICEMagnetField model("", 0.);
+  model.SetBox(lower, upper);
+  const auto samples = Samples(map, model, lower, upper, 40);
+
+  double sumB2 = 0.;
+  for (const Sample& s : samples)
+    sumB2 += s.B[0] * s.B[0] + s.B[1] * s.B[1] + s.B[2] * s.B[2];
+
+  // Golden section search of the placement radius
+  const double golden = 0.5 * (std::sqrt(5.) - 1.);
+  double a = 0., b = 10.*mm;
+  double x1 = b - golden * (b - a), x2 = a + golden * (b - a);
+  model.SetPlacementRadius(x1);
+  double f1 = Solve(model, samples).sum2;
+  model.SetPlacementRadius(x2);
+  double f2 = Solve(model, samples).sum2;
+  while (b - a > 1.e-3*mm) {
+    if (f1 < f2) {
+      b = x2; x2 = x1; f2 = f1;
+      x1 = b - golden * (b - a);
+      model.SetPlacementRadius(x1);
+      f1 = Solve(model, samples).sum2;
+    }
+    else {
+      a = x1; x1 = x2; f1 = f2;
+      x2 = a + golden * (b - a);
+      model.SetPlacementRadius(x2);
+      f2 = Solve(model, samples).sum2;
+    }
+  }
+  model.SetPlacementRadius(0.5 * (a + b));
+  Fit fit = Solve(model, samples);
+  // Components that are zero up to rounding would only cost time
+  const double largest = std::max({ std::fabs(fit.remanence[0]), std::fabs(fit.remanence[1]),
+                                    std::fabs(fit.remanence[2]) });
+  for (double& c : fit.remanence)
+    if (std::fabs(c) < 1.e-9 * largest) c = 0.;
+  model.SetRemanence(G4ThreeVector(fit.remanence[0], fit.remanence[1], fit.remanence[2]) * tesla);
+
+  const std::size_t n = 3 * samples.size();
+  std::cout << std::setprecision(4)
+            << "\nFitted " << samples.size() << " points of " << argv[1] << "\n"
+            << "  placement radius " << model.GetPlacementRadius() / mm << " mm\n"
+            << "  remanence " << fit.remanence[0] << " " << fit.remanence[1] << " "
+            << fit.remanence[2] << " T (plate normal, radial, axial)\n"
+            << "  rms field " << std::sqrt(sumB2 / n) / gauss << " G, rms residual "
+            << std::sqrt(fit.sum2 / n) / gauss << " G ("
+            << 100. * std::sqrt(fit.sum2 / sumB2) << "%), max residual "
+            << fit.max / gauss << " G\n";
+
+  const double gridTime = NanosecondsPerCall(samples, [&](const double* p, double* B) {
+    map.GetFieldValue(p[0], p[1], p[2], B);
+  });
+  const double modelTime = NanosecondsPerCall(samples, [&](const double* p, double* B) {
+    const double point[4] = { p[0], p[1], p[2], 0. };
+    model.GetFieldValue(point, B);
+  });
+  std::cout << "  " << gridTime << " ns per grid lookup (" << map.GetValueBytes() / (1024.*1024.)
+            << " MB), " << modelTime << " ns per model evaluation\n" << std::endl;
+
+  std::string comment = std::string("fitted by ICESPICEMagnetFit to ") + argv[1];
+  model.Write(output, comment.c_str());
+  std::cout << "Wrote " << output << std::endl;
+  return 0;
+}
@@ -0,0 +1,166 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEMeshBenchmark.cc        *
+//    *                                   *
+//    *************************************
+//
+// Comments: Times the reading of CAD meshes by the CADMesh Lexer readers,
+// PLYReader and STLReader, and by CADMesh::File::FastReader, which parses
+// the file in place into points and triangle indices. Each file is read
+// [repeats] times by each reader; the best time of the read alone and of
+// the read followed by the G4TessellatedSolid is printed, with the facet
+// count and the speedup. The read from the mesh cache that ICESPICE uses,
+// written next to the file on the first read, is timed as well. The
+// facets of the two solids are then compared vertex by vertex and the
+// program exits with status 2 if they differ. The Lexer readers only read
+// ASCII files.
+//
+//   ICESPICEMeshBenchmark <PLY or STL file>... [repeats]
+//
+
+#include "CADMesh.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::shared_ptr<CADMesh::File::Reader> LexerReader(CADMesh::File::Type type)
+{
+  if (type == CADMesh::File::STL) return std::make_shared<CADMesh::File::STLReader>();
+  return std::make_shared<CADMesh::File::PLYReader>();
+}
+
+// Best wall time of repeats calls, in milliseconds
+double Time(int repeats, const std::function<void()>& run)
+{
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < repeats; ++i) {
+    auto start = Clock::now();
+    run();
+    best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+  }
+  return best;
+}
+
+G4TessellatedSolid* MakeSolid(const G4String& file, CADMesh::File::Type type,
+                              std::shared_ptr<CADMesh::File::Reader> reader)
+{
+  auto mesh = std::make_shared<CADMesh::TessellatedMesh>(file, type, reader);
+  mesh->SetReverse(false);
+  return mesh->GetTessellatedSolid();
+}
+
+// Largest distance between corresponding vertices, or infinity if the
+// facet counts differ
+double Compare(G4TessellatedSolid* a, G4TessellatedSolid* b)
+{
+  if (a->GetNumberOfFacets() != b->GetNumberOfFacets())
+    return std::numeric_limits<double>::infinity();
+  double largest = 0.;
+  for (G4int i = 0; i < a->GetNumberOfFacets(); ++i) {
+    for (G4int k = 0; k < 3; ++k) {
+      largest = std::max(largest, (a->GetFacet(i)->GetVertex(k) -
+                                   b->GetFacet(i)->GetVertex(k)).mag());
+    }
+  }
+  return largest;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  std::vector<G4String> files;
+  int repeats = 3;
+  for (int i = 1; i < argc; ++i) {
+    char* end = nullptr;
+    long value = std::strtol(argv[i], &end, 10);
+    if (i == argc - 1 && i > 1 && *end == '\0' && value > 0) repeats = int(value);
+    else files.push_back(argv[i]);
+  }
+  if (files.empty()) {
+    std::cerr << "Usage: " << argv[0] << " <PLY or STL file>... [repeats]" << std::endl;
+    return 1;
+  }
+
+  bool same = true;
+  std::cout << std::fixed << std::setprecision(2);
+  for (const auto& file : files) {
+    auto type = CADMesh::File::TypeFromName(file);
+
+    double lexerRead = Time(repeats, [&] { LexerReader(type)->Read(file); });
+    double fastRead = Time(repeats, [&] { CADMesh::File::Fast()->Read(file); });
+
+    // The first read writes the cache and the timed ones read it back
+    CADMesh::File::Cached(CADMesh::File::Fast())->Read(file);
+    double cachedRead = Time(repeats, [&] {
+      CADMesh::File::Cached(CADMesh::File::Fast())->Read(file);
+    });
+
+    G4TessellatedSolid* lexerSolid = nullptr;
+    G4TessellatedSolid* fastSolid = nullptr;
+    double lexerTotal = Time(repeats, [&] {
+      delete lexerSolid;
+      lexerSolid = MakeSolid(file, type, LexerReader(type));
+    });
+    double fastTotal = Time(repeats, [&] {
+      delete fastSolid;
+      fastSolid = MakeSolid(file, type, CADMesh::File::Fast());
+    });
+
+    double deviation = Compare(lexerSolid, fastSolid);
+    same = same && deviation == 0.;
+
+    std::cout << file << "\n"
+              << "  facets " << lexerSolid->GetNumberOfFacets()
+              << (deviation == 0. ? ", identical" : ", DIFFERENT") << "\n"
+              << "  read   Lexer " << std::setw(10) << lexerRead << " ms   FastReader "
+              << std::setw(10) << fastRead << " ms   x" << lexerRead / fastRead << "\n"
+              << "  solid  Lexer " << std::setw(10) << lexerTotal << " ms   FastReader "
+              << std::setw(10) << fastTotal << " ms   x" << lexerTotal / fastTotal << "\n"
+              << "  cached read " << std::setw(10) << cachedRead << " ms" << std::endl;
+
+    delete lexerSolid;
+    delete fastSolid;
+  }
+
+  return same ? 0 : 2;
+}
@@ -0,0 +1,414 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+//
+// Code developed by:
+//  Alex Conley
+//
+//    *************************************
+//    *                                   *
+//    *    ICESPICEStepperBenchmark.cc     *
+//    *                                   *
+//    *************************************
+//
+// Comments: Cost against accuracy of the field integration. Electrons of
+// 100 keV to 2 MeV, with a fixed seed, start on the axis at the top of
+// the active box of the field and head down within 40 degrees of the
+// axis. Each is advanced chord by chord, as G4PropagatorInField does,
+// over a fixed path, with every stepper and accuracy setting. Each chord
+// is a straight segment the navigator checks against the geometry, so
+// chords per track is the number of steps transport in field costs.
+// The end points are compared with those of a high accuracy reference.
+// Settings that no other setting beats in both time and deviation are
+// marked with a *.
+//
+// The chords of the Default stepper at default accuracy are then checked
+// against the CAD solids in ./cad_files (the build directory has them),
+// placed as ICESPICEDetectorConstruction places them, as the navigator
+// checks a step against a volume. This is timed with the tessellated
+// solids and with the G4Box, G4Tubs or G4ExtrudedSolid that replace the
+// meshes recognised as boxes, cylinders or prisms, and chords whose
+// distance to the surface differs by more than the primitive tolerance
+// between the two are counted.
+//
+//   ICESPICEStepperBenchmark <field map> [electrons] [stepper ...]
+//
+
+#include "ICESPICETabulatedField3D.hh"
+#include "ICESPICEStepperFactory.hh"
+#include "G4SystemOfUnits.hh"
+#include "G4PhysicalConstants.hh"
+#include "G4FieldTrack.hh"
+#include "G4ChargeState.hh"
+#include "G4RotationMatrix.hh"
+#include "CADMesh.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// The field, counting its evaluations
+class CountingField : public G4MagneticField
+{
+public:
+  explicit CountingField(const ICESPICETabulatedField3D* field)
+    :fField(field),fCalls(0) {}
+
+  void GetFieldValue(const G4double point[4], G4double* Bfield) const override
+  {
+    ++fCalls;
+    fField->GetFieldValue(point, Bfield);
+  }
+
+  std::size_t GetCalls() const { return fCalls; }
+  void ResetCalls() { fCalls = 0; }
+
+private:
+  const ICESPICETabulatedField3D* fField;
+  mutable std::size_t fCalls;
+};
+
+// Integration parameters, as set with the /ICESPICE/Field/ commands
+struct Accuracy
+{
+  const char* name;
+  G4double deltaChord, deltaOneStep, epsMin, epsMax;
+};
+
+const Accuracy kAccuracies[] = {
+  { "coarse",  1.*mm,    0.1*mm,    5.e-4, 1.e-2 },
+  { "default", 0.25*mm,  0.01*mm,   5.e-5, 1.e-3 },   // Geant4 defaults
+  { "fine",    0.025*mm, 0.001*mm,  5.e-6, 1.e-4 },
+};
+const Accuracy kReference = { "reference", 0.01*mm, 1.e-6*mm, 1.e-9, 1.e-9 };
+const G4double kMinStep = 1.e-2*mm;
+
+struct Electron { G4ThreeVector position, direction; G4double kinetic; };
+
+// Electrons of 100 keV to 2 MeV, emitted downwards from the axis at the
+// top of the box within 40 degrees of the axis
+std::vector<Electron> Source(const G4ThreeVector& lower, const G4ThreeVector& upper,
+			     std::size_t n)
+{
+  std::mt19937_64 engine(2718);
+  std::uniform_real_distribution<double> unit(0., 1.);
+  const double cosMax = std::cos(40.*deg);
+  std::vector<Electron> electrons(n);
+  for (auto& e : electrons) {
+    e.kinetic = (100. + 1900. * unit(engine)) * keV;
+    const double cosTheta = 1. - (1. - cosMax) * unit(engine);
+    const double sinTheta = std::sqrt(1. - cosTheta * cosTheta);
+    const double phi = twopi * unit(engine);
+    e.position.set(0.5 * (lower.x() + upper.x()), 0.5 * (lower.y() + upper.y()), upper.z());
+    e.direction.set(sinTheta * std::cos(phi), sinTheta * std::sin(phi), -cosTheta);
+  }
+  return electrons;
+}
+
+struct Chord { G4ThreeVector start, end; };
+
+struct Result
+{
+  G4String stepper;
+  const char* accuracy;
+  double seconds;
+  double chords, calls;            // per track
+  double meanDeviation, maxDeviation;
+  bool pareto;
+};
+
+// Advances every electron over path, chord by chord, and returns the end
+// points. The step accuracy is set from the path as the propagator sets it
+// from the proposed step, deltaOneStep / step within [epsMin, epsMax].
+std::vector<G4ThreeVector> Propagate(const G4String& stepper, const Accuracy& accuracy,
+				     CountingField& field,
+				     const std::vector<Electron>& electrons,
+				     G4double path, Result* result,
+				     std::vector<Chord>* chords = nullptr)
+{
+  G4EquationOfMotion* equation = nullptr;
+  G4MagIntegratorStepper* integrator = nullptr;
+  G4ChordFinder* chordFinder =
+    ICESPICEStepperFactory::Create(stepper, &field, kMinStep, equation, integrator);
+  std::vector<G4ThreeVector> ends;
+  if (chordFinder == nullptr) {
+    std::cerr << "Unknown stepper " << stepper << std::endl;
+    return ends;
+  }
+  chordFinder->SetDeltaChord(accuracy.deltaChord);
+  G4EquationOfMotion* motion = chordFinder->GetIntegrationDriver()->GetEquationOfMotion();
+  const G4double epsilon =
+    std::min(accuracy.epsMax, std::max(accuracy.epsMin, accuracy.deltaOneStep / path));
+
+  field.ResetCalls();
+  std::size_t chordCount = 0;
+  std::vector<Chord>* chordList = chords;
+  ends.reserve(electrons.size());
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& e : electrons) {
+    const G4double momentum = std::sqrt(e.kinetic * (e.kinetic + 2. * electron_mass_c2));
+    motion->SetChargeMomentumMass(G4ChargeState(-eplus), momentum, electron_mass_c2);
+    G4FieldTrack track(e.position, 0., e.direction, e.kinetic, electron_mass_c2,
+		       -eplus, G4ThreeVector());
+    chordFinder->ResetStepEstimate();
+    chordFinder->OnComputeStep(&track);
+    G4double travelled = 0.;
+    while (travelled < path * (1. - 1.e-12)) {
+      const G4ThreeVector start = track.GetPosition();
+      travelled += chordFinder->AdvanceChordLimited(track, path - travelled, epsilon,
+						    track.GetPosition(), 0.);
+      if (chordList != nullptr) chordList->push_back({ start, track.GetPosition() });
+      ++chordCount;
+    }
+    ends.push_back(track.GetPosition());
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  if (result != nullptr) {
+    result->stepper = stepper;
+    result->accuracy = accuracy.name;
+    result->seconds = elapsed.count();
+    result->chords = double(chordCount) / electrons.size();
+    result->calls = double(field.GetCalls()) / electrons.size();
+  }
+
+  delete chordFinder;
+  delete integrator;
+  delete equation;
+  return ends;
+}
+
+// What the navigator asks of a solid for one chord: whether it starts
+// inside, the safety and, if the chord may reach the surface, the distance
+// along it. Returns the distance the chord can go, at most its length.
+G4double Navigate(const G4VSolid* solid, const G4ThreeVector& start, const G4ThreeVector& end)
+{
+  const G4ThreeVector chord = end - start;
+  const G4double length = chord.mag();
+  if (length == 0.) return 0.;
+  const G4ThreeVector direction = chord / length;
+  if (solid->Inside(start) == kOutside) {
+    if (solid->DistanceToIn(start) >= length) return length;
+    return std::min(length, solid->DistanceToIn(start, direction));
+  }
+  if (solid->DistanceToOut(start) >= length) return length;
+  return std::min(length, solid->DistanceToOut(start, direction));
+}
+
+// Volumes made from CAD files, placed as in ICESPICEDetectorConstruction
+// (the first magnet, and the detector at its default -30 mm)
+struct CADVolume
+{
+  const char* file;
+  G4double rotateY;
+  G4ThreeVector position;
+};
+
+const CADVolume kCADVolumes[] = {
+  { "./cad_files/tantalum_5_slot_attenuator.PLY",     180.*deg, G4ThreeVector() },
+  { "./cad_files/1x1x1_8in_square_magnet.PLY",          0.,      G4ThreeVector(0., 3.5*mm, 0.) },
+  { "./cad_files/pips1000/active_area.PLY",             0.,      G4ThreeVector(0., 0., -30.*mm) },
+  { "./cad_files/pips1000/detector_housing.PLY",        0.,      G4ThreeVector(0., 0., -30.*mm) },
+};
+
+// Seconds to check every chord against solid, repeats times, and the
+// distances found
+double TimeNavigation(const G4VSolid* solid, const std::vector<Chord>& chords,
+		      int repeats, std::vector<G4double>& distances)
+{
+  distances.assign(chords.size(), 0.);
+  const auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeats; ++r) {
+    for (std::size_t i = 0; i < chords.size(); ++i) {
+      distances[i] = Navigate(solid, chords[i].start, chords[i].end);
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void NavigationReport(const std::vector<Chord>& worldChords, std::size_t tracks)
+{
+  const int repeats = 10;
+  std::cout << "\nNavigation along the " << worldChords.size() << " chords of Default at "
+            << "default accuracy, " << repeats << " times\n\n"
+            << std::left << std::setw(46) << "solid" << std::setw(18) << "replaced by"
+            << std::right << std::setw(8) << "facets" << std::setw(14) << "us/track"
+            << std::setw(14) << "replaced" << std::setw(9) << "speedup"
+            << std::setw(8) << "differ" << std::endl;
+
+  double total = 0., totalReplaced = 0.;
+  for (const auto& volume : kCADVolumes) {
+    if (!std::ifstream(volume.file)) {
+      std::cout << std::left << std::setw(46) << volume.file << "not found" << std::endl;
+      continue;
+    }
+
+    // The chords in the frame of the solid: local = rotation (global - position)
+    G4RotationMatrix rotation;
+    rotation.rotateY(volume.rotateY);
+    std::vector<Chord> chords;
+    chords.reserve(worldChords.size());
+    for (const auto& c : worldChords) {
+      chords.push_back({ rotation * (c.start - volume.position),
+                         rotation * (c.end - volume.position) });
+    }
+
+    auto mesh = CADMesh::TessellatedMesh::FromPLY(volume.file);
+    G4TessellatedSolid* tessellated = mesh->GetTessellatedSolid();
+    mesh->SetPrimitives(true);
+    G4VSolid* replaced = mesh->GetSolid();
+    const bool isReplaced = dynamic_cast<G4TessellatedSolid*>(replaced) == nullptr;
+
+    std::vector<G4double> distances, replacedDistances;
+    const double seconds = TimeNavigation(tessellated, chords, repeats, distances);
+    double replacedSeconds = seconds;
+    std::size_t differ = 0;
+    G4String type = "-";
+    if (isReplaced) {
+      replacedSeconds = TimeNavigation(replaced, chords, repeats, replacedDistances);
+      for (std::size_t i = 0; i < chords.size(); ++i) {
+	if (std::abs(distances[i] - replacedDistances[i]) > mesh->GetPrimitiveTolerance()) ++differ;
+      }
+      const G4VSolid* shape = replaced;
+      if (auto displaced = dynamic_cast<const G4DisplacedSolid*>(replaced)) {
+	shape = displaced->GetConstituentMovedSolid();
+      }
+      type = shape->GetEntityType();
+    }
+    total += seconds;
+    totalReplaced += replacedSeconds;
+
+    const double perTrack = 1.e6 / (repeats * tracks);
+    std::cout << std::left << std::setw(46) << volume.file << std::setw(18) << type
+              << std::right << std::setw(8) << tessellated->GetNumberOfFacets()
+              << std::fixed << std::setprecision(2)
+              << std::setw(14) << seconds * perTrack
+              << std::setw(14) << replacedSeconds * perTrack
+              << std::setw(8) << seconds / replacedSeconds << "x"
+              << std::setw(8) << differ << std::defaultfloat << std::endl;
+  }
+
+  if (total > 0.) {
+    std::cout << "\nAll solids: " << std::fixed << std::setprecision(2)
+              << total * 1.e6 / (repeats * tracks) << " us/track tessellated, "
+              << totalReplaced * 1.e6 / (repeats * tracks) << " us/track with primitives ("
+              << total / totalReplaced << "x)" << std::defaultfloat << std::endl;
+  }
+}
+
+}
+
+int main(int argc,char** argv) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <field map> [electrons] [stepper ...]\n"
+              << "Steppers: " << ICESPICEStepperFactory::Names() << std::endl;
+    return 1;
+  }
+  std::size_t n = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+  if (n == 0) n = 200;
+  std::vector<G4String> steppers;
+  for (int i = 3; i < argc; ++i) steppers.push_back(argv[i]);
+  if (steppers.empty()) {
+    std::istringstream names(ICESPICEStepperFactory::Names());
+    for (G4String name; names >> name; ) steppers.push_back(name);
+  }
+
+  ICESPICETabulatedField3D tabulated(argv[1], 0.);
+  G4ThreeVector lower, upper;
+  if (!tabulated.GetActiveBox(lower, upper)) {
+    std::cerr << "The field is zero everywhere" << std::endl;
+    return 1;
+  }
+  CountingField field(&tabulated);
+
+  // Long enough to cross the active box, focused or not
+  const G4double path = 1.5 * (upper.z() - lower.z());
+  const auto electrons = Source(lower, upper, n);
+  const auto reference = Propagate("Default", kReference, field, electrons, path, nullptr);
+
+  std::vector<Result> results;
+  std::vector<Chord> chords;
+  for (const auto& stepper : steppers) {
+    for (const auto& accuracy : kAccuracies) {
+      Result result;
+      const bool keepChords = chords.empty() && stepper == "Default"
+	&& G4String(accuracy.name) == "default";
+      const auto ends = Propagate(stepper, accuracy, field, electrons, path, &result,
+				  keepChords ? &chords : nullptr);
+      if (ends.empty()) break;
+      double sum = 0., max = 0.;
+      for (std::size_t i = 0; i < ends.size(); ++i) {
+	const double d = (ends[i] - reference[i]).mag();
+	sum += d;
+	max = std::max(max, d);
+      }
+      result.meanDeviation = sum / ends.size();
+      result.maxDeviation = max;
+      results.push_back(result);
+    }
+  }
+
+  for (auto& r : results) {
+    r.pareto = std::none_of(results.begin(), results.end(), [&](const Result& o) {
+      return o.seconds <= r.seconds && o.maxDeviation <= r.maxDeviation &&
+	(o.seconds < r.seconds || o.maxDeviation < r.maxDeviation);
+    });
+  }
+
+  std::cout << "\n" << n << " electrons over " << path / mm << " mm, end points compared "
+            << "with Default at eps " << kReference.epsMax << "\n\n"
+            << std::left << std::setw(20) << "stepper" << std::setw(9) << "accuracy"
+            << std::right << std::setw(11) << "us/track" << std::setw(11) << "steps"
+            << std::setw(11) << "B evals" << std::setw(13) << "mean dr [mm]"
+            << std::setw(13) << "max dr [mm]" << std::endl;
+  for (const auto& r : results) {
+    std::cout << std::left << std::setw(20) << r.stepper << std::setw(9) << r.accuracy
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(11) << r.seconds / n * 1.e6
+              << std::setw(11) << r.chords << std::setw(11) << r.calls
+              << std::scientific << std::setprecision(3)
+              << std::setw(13) << r.meanDeviation / mm
+              << std::setw(13) << r.maxDeviation / mm
+              << (r.pareto ? " *" : "") << std::defaultfloat << std::endl;
+  }
+
+  if (chords.empty()) {
+    Propagate("Default", kAccuracies[1], field, electrons, path, nullptr, &chords);
+  }
+  NavigationReport(chords, n);
+
+  return 0;
+}